@@ -0,0 +1,204 @@
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/color.h>
+#include <fmt/format.h>
+#include <unistd.h>
+
+#include <lib/crc32.h>
+#include "code_cache.h"
+
+namespace code_cache {
+
+#define CODE_CACHE_MAGIC    UINT32_C(0x4336344e) /* "N64C" */
+#define CODE_CACHE_VERSION  UINT32_C(2)
+/** Maximum size of a serialized graph. */
+#define CODE_CACHE_GRAPH_MAX    0x40000
+
+/**
+ * @brief Cache file header.
+ * @var header::exe_crc
+ *      CRC32 of the emulator executable, which determines the
+ *      instruction graphs generated for a block and the layout
+ *      of the relocation regions.
+ */
+struct header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t exe_crc;
+    uint32_t nr_regions;
+    uint64_t config;
+};
+
+/** @brief Cache file record, followed by the serialized graph. */
+struct record_header {
+    uint64_t virt_address;
+    uint32_t phys_address;
+    uint32_t mips_len;
+    uint32_t mips_crc;
+    uint32_t graph_len;
+};
+
+struct record {
+    uint64_t virt_address;
+    uint32_t mips_len;
+    uint32_t mips_crc;
+    std::vector<unsigned char> graph;
+};
+
+static std::mutex mutex;
+static std::ofstream file;
+static std::atomic_bool enabled;
+static std::vector<ir_reloc_region_t> regions;
+/** Records indexed by physical address. The container is node based,
+ * references to existing records remain valid on insertion. */
+static std::unordered_multimap<uint32_t, struct record> records;
+
+/** Compute the CRC32 of the running executable. */
+static bool exe_crc32(uint32_t *crc) {
+    std::ifstream exe("/proc/self/exe", std::ios::binary);
+    if (!exe.good()) {
+        return false;
+    }
+    std::vector<unsigned char> contents(
+        (std::istreambuf_iterator<char>(exe)),
+        std::istreambuf_iterator<char>());
+    *crc = calculate_crc32(contents.data(), contents.size());
+    return true;
+}
+
+/** Load the records of an existing cache file.
+ * @param valid_len     Set to the length of the valid file contents.
+ * @return false if the file header does not match \p expected. */
+static bool load(std::string const &path, struct header const &expected,
+                 off_t *valid_len) {
+    std::ifstream is(path, std::ios::binary);
+    struct header header;
+
+    if (!is.read((char *)&header, sizeof(header)) ||
+        memcmp(&header, &expected, sizeof(header)) != 0) {
+        return false;
+    }
+
+    // A truncated trailing record is ignored, and cut from the file
+    // before new records are appended.
+    *valid_len = is.tellg();
+    struct record_header record_header;
+    while (is.read((char *)&record_header, sizeof(record_header))) {
+        if (record_header.graph_len > CODE_CACHE_GRAPH_MAX) {
+            break;
+        }
+        struct record record;
+        record.virt_address = record_header.virt_address;
+        record.mips_len = record_header.mips_len;
+        record.mips_crc = record_header.mips_crc;
+        record.graph.resize(record_header.graph_len);
+        if (!is.read((char *)record.graph.data(), record.graph.size())) {
+            break;
+        }
+        records.emplace(record_header.phys_address, std::move(record));
+        *valid_len = is.tellg();
+    }
+    return true;
+}
+
+bool open(std::string const &directory, uint32_t rom_crc, uint64_t config,
+          ir_reloc_region_t const *regions, unsigned nr_regions) {
+    std::lock_guard<std::mutex> lock(mutex);
+    struct header header = {
+        CODE_CACHE_MAGIC, CODE_CACHE_VERSION, 0, nr_regions, config };
+
+    if (!exe_crc32(&header.exe_crc)) {
+        return false;
+    }
+
+    std::string path = fmt::format("{}/{:08x}.cache", directory, rom_crc);
+    off_t valid_len;
+    records.clear();
+    if (load(path, header, &valid_len) &&
+        truncate(path.c_str(), valid_len) == 0) {
+        file.open(path, std::ios::binary | std::ios::app);
+    } else {
+        records.clear();
+        file.open(path, std::ios::binary | std::ios::trunc);
+        file.write((char const *)&header, sizeof(header));
+    }
+    if (!file.good()) {
+        fmt::print(fmt::fg(fmt::color::tomato),
+            "code cache disabled: failed to open '{}'\n", path);
+        file.close();
+        records.clear();
+        return false;
+    }
+
+    fmt::print(fmt::fg(fmt::color::dark_orange),
+        "code cache: loaded {} blocks from '{}'\n", records.size(), path);
+    code_cache::regions.assign(regions, regions + nr_regions);
+    enabled = true;
+    return true;
+}
+
+ir_graph_t *load_graph(recompiler_backend_t *backend, uint64_t virt_address,
+                       uint32_t phys_address, unsigned char *ptr, size_t len) {
+    struct record const *match = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!enabled) {
+            return NULL;
+        }
+        auto range = records.equal_range(phys_address);
+        for (auto it = range.first; it != range.second; it++) {
+            struct record const &record = it->second;
+            if (record.virt_address == virt_address &&
+                record.mips_len <= len &&
+                record.mips_crc == calculate_crc32(ptr, record.mips_len)) {
+                match = &record;
+                break;
+            }
+        }
+    }
+
+    // Records are never removed once the cache is enabled.
+    if (match == NULL) {
+        return NULL;
+    }
+    return ir_deserialize_graph(backend, regions.data(), regions.size(),
+        match->graph.data(), match->graph.size());
+}
+
+void store_graph(ir_graph_t const *graph, uint64_t virt_address,
+                 uint32_t phys_address, unsigned char *ptr, size_t len) {
+    static thread_local std::vector<unsigned char> buffer(CODE_CACHE_GRAPH_MAX);
+
+    if (!enabled) {
+        return;
+    }
+    size_t graph_len = ir_serialize_graph(graph, regions.data(),
+        regions.size(), buffer.data(), buffer.size());
+    if (graph_len == 0) {
+        return;
+    }
+
+    struct record_header record_header = {
+        virt_address, phys_address, (uint32_t)len,
+        calculate_crc32(ptr, len), (uint32_t)graph_len };
+    struct record record = {
+        virt_address, (uint32_t)len, record_header.mips_crc,
+        std::vector<unsigned char>(buffer.begin(), buffer.begin() + graph_len) };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled) {
+        return;
+    }
+    file.write((char const *)&record_header, sizeof(record_header));
+    file.write((char const *)record.graph.data(), graph_len);
+    file.flush();
+    records.emplace(phys_address, std::move(record));
+}
+
+}; /* namespace code_cache */
@@ -0,0 +1,69 @@
+
+#ifndef _CODE_CACHE_H_INCLUDED_
+#define _CODE_CACHE_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <recompiler/ir.h>
+#include <recompiler/backend.h>
+#include <recompiler/serialize.h>
+
+/**
+ * @brief Persistent cache of recompiled code.
+ *
+ * The cache saves the optimized instruction graphs of recompiled blocks
+ * to a file of the cache directory, named after the CRC32 of the ROM.
+ * Each graph is keyed by the virtual and physical start addresses of the
+ * block, and the CRC32 of the MIPS instruction words it was disassembled
+ * from. When the same game is run again, matching graphs are reloaded
+ * instead of being disassembled and optimized.
+ *
+ * The host pointers embedded in the graphs are relocated against the
+ * regions provided when opening the cache. The cache file is discarded
+ * when it was produced by a different emulator executable.
+ */
+namespace code_cache {
+
+/**
+ * @brief Open the cache file for the selected ROM.
+ * @param directory     Path to the cache directory.
+ * @param rom_crc       CRC32 of the ROM contents.
+ * @param config        Recompiler configuration tag, saved to the cache file
+ *                      header; the cache is discarded if it changes.
+ * @param regions       Relocation regions for the host pointers.
+ * @param nr_regions    Length of \p regions.
+ * @return true if the cache was successfully opened.
+ */
+bool open(std::string const &directory, uint32_t rom_crc, uint64_t config,
+          ir_reloc_region_t const *regions, unsigned nr_regions);
+
+/**
+ * @brief Reload the cached graph for the block starting at the address
+ *  \p virt_address, \p phys_address.
+ *  Safe to call concurrently from multiple recompiler threads.
+ * @param backend       Recompiler backend, cleared by the caller.
+ * @param ptr           Host pointer to the block instructions.
+ * @param len           Maximum length of the block.
+ * @return the rebuilt graph, or NULL if no cached graph matches
+ *  the current instruction words.
+ */
+ir_graph_t *load_graph(recompiler_backend_t *backend, uint64_t virt_address,
+                       uint32_t phys_address, unsigned char *ptr, size_t len);
+
+/**
+ * @brief Save the optimized graph for the block starting at the address
+ *  \p virt_address, \p phys_address.
+ *  Safe to call concurrently from multiple recompiler threads.
+ * @param graph         Optimized instruction graph.
+ * @param ptr           Host pointer to the block instructions.
+ * @param len           Length of the instructions the graph was
+ *                      disassembled from.
+ */
+void store_graph(ir_graph_t const *graph, uint64_t virt_address,
+                 uint32_t phys_address, unsigned char *ptr, size_t len);
+
+}; /* namespace code_cache */
+
+#endif /* _CODE_CACHE_H_INCLUDED_ */
@@ -1,111 +1,285 @@
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <typeinfo>
+#include <vector>
 
 #include <fmt/color.h>
 #include <fmt/format.h>
 
 #include <interpreter.h>
+#include <lib/crc32.h>
 #include <recompiler/ir.h>
 #include <recompiler/backend.h>
 #include <recompiler/code_buffer.h>
+#include <recompiler/config.h>
 #include <recompiler/passes.h>
+#include <recompiler/serialize.h>
 #include <recompiler/target/mips.h>
 #include <recompiler/target/x86_64.h>
+#include <r4300/fastmem.h>
 #include <r4300/state.h>
 
+#include "code_cache.h"
 #include "core.h"
 #include "debugger.h"
+#include "rsp_cache.h"
 #include "trace.h"
 
-#define RECOMPILER_REQUEST_QUEUE_LEN 128
-#define CACHE_PAGE_SHIFT  (14)
-#define CACHE_PAGE_SIZE   (UINT32_C(1) << CACHE_PAGE_SHIFT)
-#define CACHE_PAGE_MASK   (CACHE_PAGE_SIZE - 1)
-#define CACHE_PAGE_COUNT  (0x100)
+#define RECOMPILER_REQUEST_QUEUE_LEN 1024
+#define RECOMPILER_SPECULATION_QUEUE_LEN 256
+/** Maximum number of static successors queued per recompiled block. */
+#define RECOMPILER_SPECULATION_MAX  (8)
+#define RECOMPILER_PRIORITY_LEVELS  (4)
+#define RECOMPILER_PRIORITY_FACTOR  (4)
+#define RECOMPILER_THREAD_MAX   (4)
+#define CACHE_ENTRY_LINKED  (UINT32_C(1) << 31)
+/** Maximum size of the page code buffers, limited by the width
+ * of the offset field of the cache entries. */
+#define CACHE_BUFFER_MAX  (UINT32_C(1) << 29)
+/** Maximum total size of the page code buffers. The links between
+ * recompiled blocks are encoded as 32bit relative offsets. */
+#define CACHE_TOTAL_MAX   (UINT64_C(1) << 31)
+#define CODE_PAGE_SHIFT   (12)
+#define CODE_PAGE_COUNT   (sizeof(R4300::State::dram) >> CODE_PAGE_SHIFT)
+/** Maximum number of cache pages, for the smallest page size. */
+#define CACHE_PAGE_MAX    CODE_PAGE_COUNT
+#define RECOMPILER_LINK_MAX     (0x4000)
+#define RECOMPILER_CHAIN_CYCLES (0x400)
+/** Cycles per recompiler cache epoch, the unit of the last use times. */
+#define RECOMPILER_EPOCH_SHIFT  (20)
+/** Maximum number of cycles run by the RSP thread ahead of the CPU. */
+#define RSP_THREAD_RUN_AHEAD    (UINT64_C(0x10000))
+/** Number of cycles run by the RSP thread between two checks
+ * for pause requests. */
+#define RSP_THREAD_SLICE_CYCLES (0x400)
 
 using namespace R4300;
 
+/** Bounds of the executable image, defined by the linker. */
+extern "C" char __executable_start[];
+extern "C" char _end[];
+
+/**
+ * @brief Recompilation request.
+ * @var recompiler_request::tier
+ *      Optimization tier: 1 for blocks crossing the recompilation
+ *      threshold, 2 for recompiled blocks crossing the hot threshold.
+ * @var recompiler_request::entry
+ *      Tier 2 only: cache entry of the tier 1 binary to replace,
+ *      without the linked bit.
+ * @var recompiler_request::generation
+ *      Tier 2 only: generation of the cache page containing the
+ *      tier 1 binary.
+ * @var recompiler_request::speculative
+ *      Tier 1 only: set for the static successors of recompiled blocks,
+ *      requested before being executed.
+ */
 struct recompiler_request {
     uint64_t virt_address;
     uint32_t phys_address;
     uint32_t end_phys_address;
+    unsigned tier;
+    uint32_t entry;
+    uint32_t generation;
+    bool speculative;
 
     recompiler_request() : virt_address(0), phys_address(0) {}
     recompiler_request(uint64_t virt_address, uint32_t phys_address,
-                       uint32_t end_phys_address) :
+                       uint32_t end_phys_address, unsigned tier = 1,
+                       uint32_t entry = 0, uint32_t generation = 0) :
         virt_address(virt_address),
         phys_address(phys_address),
-        end_phys_address(end_phys_address) {}
+        end_phys_address(end_phys_address),
+        tier(tier), entry(entry), generation(generation),
+        speculative(false) {}
 };
 
-struct recompiler_request_queue {
-    std::mutex mutex;
-    std::condition_variable semaphore;
-    std::atomic_bool notified;
-    std::atomic_uint32_t head;
-    std::atomic_uint32_t tail;
+/**
+ * @brief Bounded multi-producer multi-consumer ring buffer.
+ *
+ * Lock-free ring buffer where each cell carries a sequence number
+ * indicating whether it is ready to be written (sequence == position)
+ * or read (sequence == position + 1) at the current turn.
+ * Producers and consumers reserve positions by advancing the head and
+ * tail indexes with compare and swap.
+ */
+struct recompiler_request_ring {
+    struct cell {
+        std::atomic_uint32_t sequence;
+        struct recompiler_request request;
+    };
+
+    alignas(64) std::atomic_uint32_t head;
+    alignas(64) std::atomic_uint32_t tail;
     uint32_t capacity;
-    struct recompiler_request *buffer;
+    struct cell *buffer;
 
     /** Capacity must be a power of two. */
-    recompiler_request_queue(size_t capacity)
-        : notified(false), head(0), tail(0), capacity(capacity) {
-        buffer = new recompiler_request[capacity];
-        memset(buffer, 0xab, capacity * sizeof(*buffer));
+    recompiler_request_ring(size_t capacity = RECOMPILER_REQUEST_QUEUE_LEN)
+        : head(0), tail(0), capacity(capacity) {
+        buffer = new cell[capacity];
+        for (uint32_t nr = 0; nr < capacity; nr++) {
+            buffer[nr].sequence.store(nr, std::memory_order_relaxed);
+        }
     }
-    ~recompiler_request_queue() {
-        delete buffer;
+    ~recompiler_request_ring() {
+        delete[] buffer;
     }
 
-    bool is_full(void);
-    bool is_empty(void);
     bool enqueue(struct recompiler_request const &request);
-    void dequeue(struct recompiler_request &request);
-    void flush(void);
+    bool try_dequeue(struct recompiler_request &request);
 };
 
-bool recompiler_request_queue::is_full(void) {
-    return (head - tail) == capacity;
+/**
+ * Insert a request at the head of the ring. Never blocks.
+ * @return false if the ring is full.
+ */
+bool recompiler_request_ring::enqueue(struct recompiler_request const &request) {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    struct cell *cell;
+
+    for (;;) {
+        cell = &buffer[head & (capacity - 1)];
+        uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - head);
+        if (diff == 0) {
+            if (this->head.compare_exchange_weak(head, head + 1,
+                    std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            head = this->head.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->request = request;
+    cell->sequence.store(head + 1, std::memory_order_release);
+    return true;
 }
 
-bool recompiler_request_queue::is_empty(void) {
-    return head == tail;
+/**
+ * Remove the request at the tail of the ring. Never blocks.
+ * @return false if the ring is empty.
+ */
+bool recompiler_request_ring::try_dequeue(struct recompiler_request &request) {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    struct cell *cell;
+
+    for (;;) {
+        cell = &buffer[tail & (capacity - 1)];
+        uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - (tail + 1));
+        if (diff == 0) {
+            if (this->tail.compare_exchange_weak(tail, tail + 1,
+                    std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            tail = this->tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    request = cell->request;
+    cell->sequence.store(tail + capacity, std::memory_order_release);
+    return true;
 }
 
-bool recompiler_request_queue::enqueue(struct recompiler_request const &request) {
-    if (is_full()) {
+/**
+ * @brief Request priority queue.
+ *
+ * The queue is made of one lock-free ring per priority level; consumers
+ * serve the highest non-empty level first, and requests of the same level
+ * in FIFO order. The priority of a request is set by the hotness of the
+ * requested block.
+ *
+ * The mutex and condition variable are only used to put idle consumers
+ * to sleep; producers take the mutex only when consumers are waiting.
+ */
+struct recompiler_request_queue {
+    struct recompiler_request_ring levels[RECOMPILER_PRIORITY_LEVELS];
+    alignas(64) std::atomic_uint32_t nr_waiting;
+    std::mutex mutex;
+    std::condition_variable semaphore;
+
+    recompiler_request_queue() : nr_waiting(0) {}
+
+    bool enqueue(struct recompiler_request const &request, unsigned priority);
+    bool try_dequeue(struct recompiler_request &request);
+    bool dequeue(struct recompiler_request &request,
+                 std::atomic_bool const &stopped);
+    void notify_all(void);
+};
+
+/**
+ * Insert a request at the selected priority level. Never blocks.
+ * @return false if the priority level is full.
+ */
+bool recompiler_request_queue::enqueue(struct recompiler_request const &request,
+                                       unsigned priority) {
+    if (!levels[priority].enqueue(request)) {
         return false;
     }
 
-    std::unique_lock<std::mutex> lock(mutex);
-    uint32_t head = this->head.load(std::memory_order_relaxed);
-    buffer[head % capacity] = request;
-    this->head.store(head + 1, std::memory_order_release);
-
-    lock.unlock();
-    if (!notified.exchange(true, std::memory_order_release)) {
+    // Wake up a sleeping consumer. The fence orders the sequence update
+    // before the load of the waiting count, consumers increment the count
+    // before checking the queue again.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (nr_waiting.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
         semaphore.notify_one();
     }
-
     return true;
 }
 
-void recompiler_request_queue::dequeue(struct recompiler_request &request) {
-    std::unique_lock<std::mutex> lock(mutex);
-    semaphore.wait(lock, [this] { return !is_empty(); });
-    notified.store(false, std::memory_order_acquire);
+/**
+ * Remove the oldest request of the highest non-empty priority level.
+ * Never blocks.
+ * @return false if the queue is empty.
+ */
+bool recompiler_request_queue::try_dequeue(struct recompiler_request &request) {
+    for (unsigned nr = RECOMPILER_PRIORITY_LEVELS; nr > 0; nr--) {
+        if (levels[nr - 1].try_dequeue(request)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Remove the request with the highest priority, waiting for a request
+ * to be inserted if the queue is empty.
+ * @return false if \p stopped was set while waiting.
+ */
+bool recompiler_request_queue::dequeue(struct recompiler_request &request,
+                                       std::atomic_bool const &stopped) {
+    if (try_dequeue(request)) {
+        return true;
+    }
 
-    uint32_t tail = this->tail.load(std::memory_order_acquire);
-    request = buffer[tail % capacity];
-    this->tail.store(tail + 1, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(mutex);
+    nr_waiting.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool dequeued = false;
+    semaphore.wait(lock, [&] {
+        dequeued = try_dequeue(request);
+        return dequeued || stopped.load(std::memory_order_acquire); });
+    nr_waiting.fetch_sub(1, std::memory_order_relaxed);
+    return dequeued;
 }
 
-void recompiler_request_queue::flush(void) {
-    uint32_t head = this->head.load(std::memory_order_acquire);
-    this->tail.store(head, std::memory_order_release);
-    notified = false;
+/** Wake up all waiting consumers, to observe the stop condition. */
+void recompiler_request_queue::notify_all(void) {
+    std::lock_guard<std::mutex> lock(mutex);
+    semaphore.notify_all();
 }
 
 /**
@@ -113,11 +287,14 @@ void recompiler_request_queue::flush(void) {
  * associate addresses to recompiled binary code.
  * Each cache entry has the following format:
  *
- *   31             2 1 0
- *  +----------------+-+-+
- *  |    offset      |P|V|
- *  +----------------+-+-+
+ *   31 30          2 1 0
+ *  +--+-------------+-+-+
+ *  |L |   offset    |P|V|
+ *  +--+-------------+-+-+
  *
+ * + *L* linked bit, set when the exit stub of another recompiled block
+ *   was patched to jump directly to the entrypoint. Can only be set
+ *   on valid entries, and is cleared on invalidation.
  * + *offset*: offset from the code buffer start to the
  *   binary code entrypoint.
  * + *P* pending bit, set when a cache query misses, and a
@@ -141,14 +318,112 @@ void recompiler_request_queue::flush(void) {
  *      |                     |                      |
  *  1 1 | miss                | upd ptr 0 1          | upd 0 1 0
  *
+ * The map covers the DRAM range starting at address 0, one entry per word.
+ * The size of the map, the cache page size and the size of the page code
+ * buffers are selected at startup with \ref core::set_recompiler_cache_geometry.
+ *
  * The cache is further organized in pages. The code recompiled from addresses
- * in the same page is stored in a common code buffer, all entries in the page
- * are invalidated when memory needs to be reclaimed.
+ * in the same page is stored in a common code buffer. The binaries of a page
+ * buffer are described by block records, sorted by offset; new binaries are
+ * generated into the largest free range of the buffer. When the buffer is
+ * full, the page is reclaimed by the interpreter thread on request of
+ * a recompiler thread, since the evicted code may be running or linked to
+ * from other blocks. Reclaiming evicts the dead binaries, then the blocks
+ * least recently entered from the interpreter, until enough of the buffer
+ * is free. The entries of evicted blocks are reset and requested again
+ * when executed.
+ *
+ * Requests are served by a pool of recompiler threads. The disassembly and
+ * optimization passes run concurrently; the page buffer mutex serializes
+ * the generation of code into a page buffer and the update of the cache
+ * entry. The reclaim pending flag is only set with the page buffer mutex
+ * held, the page buffer is thus never written while it is reclaimed.
+ *
+ * Links between recompiled blocks are established by the interpreter thread
+ * when a block returns through an unlinked exit stub, and the target block
+ * is found in the cache. All links are recorded to be able to restore
+ * the exit stubs when the target block is invalidated.
+ *
+ * Each entry also counts the number of times the interpreter thread
+ * executed the block, and recompilation is requested only when the count
+ * reaches the recompilation threshold. The priority of the request is
+ * raised while the block remains pending and keeps getting hotter.
+ * Recompiled blocks entered often enough from the interpreter to reach
+ * the hot threshold are recompiled a second time with more expensive
+ * optimizations, and the cache entry is replaced if it has not been
+ * modified in the meantime. The replaced binary remains in the page buffer
+ * until the page is reclaimed, as other blocks may still be linked to it.
+ * Page generations are incremented by each page reclaim, and prevent
+ * replacing an entry whose offset was reused after a page reclaim.
+ *
+ * Blocks entered again right after branching to themselves are checked
+ * for idle loops, which are fast-forwarded to the next scheduled event.
+ * The busy flag caches the blocks found not to be idle loop candidates.
+ *
+ * The last use epoch of an entry is updated each time the recompiled block
+ * is entered from the interpreter thread, and ranks the blocks for eviction.
+ * Epochs are counted in units of 2^RECOMPILER_EPOCH_SHIFT cycles.
+ *
+ * The code bitmap tracks the 4KB pages containing pending or valid entries,
+ * and enables skipping the invalidation of ranges that never held
+ * recompiled code. Pages are marked by the interpreter thread when
+ * requesting a recompilation, and unmarked when all their entries
+ * are invalidated.
  */
 
+struct recompiler_link {
+    unsigned char *rel32;
+    uint32_t phys_address;
+};
+
+/**
+ * @brief Record of a binary stored in a page code buffer.
+ * @var recompiler_block::offset
+ *      Offset of the binary from the start of the page buffer.
+ * @var recompiler_block::length
+ *      Length of the binary.
+ * @var recompiler_block::phys_address
+ *      Start address of the recompiled block.
+ * @var recompiler_block::epoch
+ *      Epoch at which the binary was generated. The block is considered
+ *      used at least until this epoch.
+ */
+struct recompiler_block {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t phys_address;
+    uint32_t epoch;
+};
+
+/**
+ * @brief Recompiler cache.
+ * @var recompiler_cache::range
+ *      Size of the DRAM range covered by the map. Zero until the cache
+ *      is allocated by \ref core::start().
+ * @var recompiler_cache::page_shift
+ *      Log2 of the cache page size.
+ * @var recompiler_cache::page_count
+ *      Number of cache pages and page code buffers.
+ */
 struct recompiler_cache {
-    std::atomic_uint32_t map[0x100000];
+    uint32_t range;
+    uint32_t page_shift;
+    uint32_t page_count;
+    std::unique_ptr<std::atomic_uint32_t[]> map;
+    std::unique_ptr<uint16_t[]> hits;
+    std::unique_ptr<bool[]> hot;
+    std::unique_ptr<bool[]> busy;
+    std::unique_ptr<uint32_t[]> used;
+    uint64_t code[CODE_PAGE_COUNT / 64];
     code_buffer_t *buffers;
+    std::vector<struct recompiler_block> blocks[CACHE_PAGE_MAX];
+    std::atomic_bool reclaim_pending[CACHE_PAGE_MAX];
+    std::atomic_uint32_t generation[CACHE_PAGE_MAX];
+    std::mutex buffer_mutex[CACHE_PAGE_MAX];
+    std::atomic_bool reclaim_requested;
+    std::atomic_uint32_t epoch;
+    struct recompiler_link links[RECOMPILER_LINK_MAX];
+    unsigned nr_links;
 };
 
 namespace core {
@@ -156,12 +431,23 @@ namespace core {
 unsigned long recompiler_cycles;
 unsigned long recompiler_clears;
 unsigned long recompiler_requests;
-
-static struct recompiler_request_queue recompiler_request_queue(
-    RECOMPILER_REQUEST_QUEUE_LEN);
-static recompiler_backend_t   *recompiler_backend;
+unsigned long recompiler_blocks;
+unsigned long recompiler_spills;
+unsigned long recompiler_bytes_saved;
+unsigned long recompiler_promotions;
+unsigned long recompiler_speculations;
+unsigned long idle_skipped_cycles;
+unsigned long recompiler_invalidated_bytes;
+unsigned long recompiler_invalidated_entries;
+
+static struct recompiler_request_queue recompiler_request_queue;
+/** Static successors of recompiled blocks, queued by the recompiler threads
+ * and requested by the interpreter thread when the workers are idle. */
+static struct recompiler_request_ring recompiler_speculation_ring(
+    RECOMPILER_SPECULATION_QUEUE_LEN);
 static struct recompiler_cache recompiler_cache;
-static std::thread            *recompiler_thread;
+static std::thread            *recompiler_threads[RECOMPILER_THREAD_MAX];
+static unsigned                recompiler_nr_threads;
 static std::atomic_bool        recompiler_stopped;
 static std::thread            *interpreter_thread;
 static std::mutex              interpreter_mutex;
@@ -169,6 +455,107 @@ static std::condition_variable interpreter_semaphore;
 static std::atomic_bool        interpreter_halted;
 static std::atomic_bool        interpreter_stopped;
 static std::string             interpreter_halted_reason;
+/** Set when the interpreter can evaluate predecoded blocks. */
+static bool                    interpreter_block_cache_enabled;
+/** Set on the interpreter thread only. */
+static thread_local bool       interpreter_thread_local;
+
+/** RSP thread, NULL when the RSP runs in lockstep with the CPU.
+ * The RSP thread holds the mutex while running; the other threads
+ * request it to yield by incrementing the pause counter. */
+static bool                    rsp_thread_enabled;
+static std::thread            *rsp_thread;
+static std::mutex              rsp_mutex;
+static std::condition_variable rsp_semaphore;
+static std::atomic_uint        rsp_pauses;
+static std::atomic_bool        rsp_waiting;
+static std::atomic_bool        rsp_stopped;
+/** Set by the RSP thread when stopped before an instruction observable
+ * by the CPU, to be executed by the interpreter thread. */
+static std::atomic_bool        rsp_sync_pending;
+/** Cycle count of the RSP thread, owned by the holder of the mutex. */
+static uint64_t                rsp_cycles;
+/** Cycle count the RSP thread can run up to, updated by the interpreter
+ * thread after each block. */
+static std::atomic_uint64_t    rsp_cycles_limit;
+static thread_local unsigned   rsp_lock_depth;
+
+/** Write protected DRAM pages written since the last call to
+ * exec_code_page_writes, waiting for their code to be invalidated. */
+static std::atomic_uint64_t    code_writes_pending[CODE_PAGE_COUNT / 64];
+static std::atomic_bool        code_writes_requested;
+
+/** Directory of the persistent code cache, empty if disabled. */
+static std::string             code_cache_directory;
+
+/** Number of executions of a block before requesting recompilation. */
+static unsigned                recompiler_cache_threshold =
+    RECOMPILER_CACHE_THRESHOLD;
+/** Number of entries into a recompiled block before requesting
+ * recompilation with the hot tier optimizations. */
+static unsigned                recompiler_hot_threshold =
+    RECOMPILER_HOT_THRESHOLD;
+
+/** Geometry of the recompiler cache, applied when the cache is allocated. */
+static uint32_t                recompiler_cache_page_size =
+    RECOMPILER_CACHE_PAGE_SIZE;
+static uint32_t                recompiler_cache_buffer_size =
+    RECOMPILER_CACHE_BUFFER_SIZE;
+static uint32_t                recompiler_cache_range = sizeof(State::dram);
+/** Set when the recompiler cache could not be allocated, the CPU
+ * then runs on the interpreter only. */
+static bool                    recompiler_disabled;
+
+/** Cycle budget for following links between recompiled blocks. */
+static uint64_t                recompiler_cycles_limit;
+/** Patch site of the unlinked exit stub taken by the last block. */
+static unsigned char          *recompiler_exit_link;
+/** Patch site and target address of the exit stub to link at the next
+ * cache query. */
+static unsigned char          *recompiler_pending_link;
+static uint64_t                recompiler_pending_link_address;
+
+/**
+ * @brief Remove the links targeting recompiled blocks in the selected range.
+ *  The exit stubs are restored to return to the interpreter.
+ *  Called from the interpreter thread only.
+ * @param start_phys_address    Start address of the range to unlink.
+ * @param end_phys_address      Exclusive end address of the range to unlink.
+ */
+static
+void unlink_recompiler_blocks(uint32_t start_phys_address,
+                              uint32_t end_phys_address) {
+    for (unsigned nr = 0; nr < recompiler_cache.nr_links;) {
+        struct recompiler_link *link = &recompiler_cache.links[nr];
+        if (link->phys_address >= start_phys_address &&
+            link->phys_address < end_phys_address) {
+            ir_x86_64_patch_link(link->rel32, NULL);
+            *link = recompiler_cache.links[--recompiler_cache.nr_links];
+        } else {
+            nr++;
+        }
+    }
+}
+
+/**
+ * @brief Link an exit stub to the recompiled block for the selected address.
+ *  Called from the interpreter thread only.
+ * @param rel32                 Patch site of the exit stub.
+ * @param phys_address          Address of the target block.
+ * @param binary                Entrypoint of the target block.
+ */
+static
+void link_recompiler_block(unsigned char *rel32, uint32_t phys_address,
+                           code_entry_t binary) {
+    if (recompiler_cache.nr_links >= RECOMPILER_LINK_MAX) {
+        return;
+    }
+
+    recompiler_cache.links[recompiler_cache.nr_links++] =
+        (struct recompiler_link){ rel32, phys_address };
+    recompiler_cache.map[phys_address >> 2].fetch_or(CACHE_ENTRY_LINKED);
+    ir_x86_64_patch_link(rel32, (unsigned char *)binary);
+}
 
 /**
  * @brief Invalidate the recompiler cache entry for the provided address range.
@@ -186,76 +573,486 @@ void invalidate_recompiler_cache(uint64_t start_phys_address,
         core::halt("Watchpoint");
     }
 
+    // Drop the predecoded interpreter blocks.
+    interpreter::cpu::invalidate_block_cache(
+        start_phys_address, end_phys_address);
+
 #if ENABLE_RECOMPILER
-    if (start_phys_address > 0x400000) {
+    // Writes to IMEM change the microcode image executed by the RSP.
+    if (start_phys_address < UINT64_C(0x04002000) &&
+        end_phys_address > UINT64_C(0x04001000)) {
+        rsp_cache::invalidate();
+    }
+
+    if (start_phys_address > recompiler_cache.range) {
         return;
     }
-    if (end_phys_address > 0x400000) {
-        end_phys_address = 0x400000;
+    if (end_phys_address > recompiler_cache.range) {
+        end_phys_address = recompiler_cache.range;
     }
 
+    if (end_phys_address <= start_phys_address) {
+        return;
+    }
+    recompiler_invalidated_bytes += end_phys_address - start_phys_address;
+
     start_phys_address = start_phys_address >> 2;
     end_phys_address = (end_phys_address + 3) >> 2;
+    bool linked = false;
+
+    // Only the pages marked in the code bitmap can contain pending
+    // or valid entries.
+    uint32_t page_shift = CODE_PAGE_SHIFT - 2;
+    uint32_t start_page = start_phys_address >> page_shift;
+    uint32_t end_page = (end_phys_address - 1) >> page_shift;
+    for (uint32_t page = start_page; page <= end_page; page++) {
+        uint64_t bit = UINT64_C(1) << (page % 64);
+        if (!(recompiler_cache.code[page / 64] & bit)) {
+            continue;
+        }
 
-    for (uint32_t index = start_phys_address; index < end_phys_address; index++) {
-        // Not setting P,V = 0,0 because P needs to remain up
-        // to prevent concurrency issues with the recompiler thread.
-        recompiler_cache.map[index].fetch_and(UINT32_C(0xfffffffe));
+        uint32_t page_start = page << page_shift;
+        uint32_t page_end = (page + 1) << page_shift;
+        uint32_t start = std::max<uint32_t>(start_phys_address, page_start);
+        uint32_t end = std::min<uint32_t>(end_phys_address, page_end);
+        for (uint32_t index = start; index < end; index++) {
+            // Not setting P,V = 0,0 because P needs to remain up
+            // to prevent concurrency issues with the recompiler thread.
+            uint32_t entry = recompiler_cache.map[index].fetch_and(
+                ~(CACHE_ENTRY_LINKED | UINT32_C(0x1)));
+            linked |= (entry & CACHE_ENTRY_LINKED) != 0;
+            recompiler_invalidated_entries += entry & 0x1;
+            // The modified code needs to become hot again.
+            recompiler_cache.hits[index] = 0;
+            recompiler_cache.hot[index] = false;
+            recompiler_cache.busy[index] = false;
+        }
+        // No entry in the page remains pending or valid.
+        if (start == page_start && end == page_end) {
+            recompiler_cache.code[page / 64] &= ~bit;
+        }
+    }
+
+    // Restore the exit stubs jumping to the invalidated blocks.
+    // This can happen while running recompiled code, the stubs of the
+    // current block are patched before they are reached.
+    if (linked) {
+        unlink_recompiler_blocks(start_phys_address << 2,
+                                 end_phys_address << 2);
     }
 #endif /* ENABLE_RECOMPILER */
 }
 
 /**
- * @brief Clear a full recompiler cache page.
- *  All cache entries are invalidated, the code buffer is emptied.
- *  Called from the recompiled thread only.
- * @param phys_address          Any physical address inside the page to clear.
+ * @brief Return the largest free range of a page code buffer.
+ * @param blocks        Block records of the page buffer, sorted by offset.
+ * @param evicted       Flags of the block records to count as free,
+ *                      or NULL.
+ * @param capacity      Capacity of the page buffer.
+ * @param start         Set to the offset of the free range.
+ * @return the length of the free range.
+ */
+static
+uint32_t largest_free_range(std::vector<struct recompiler_block> const &blocks,
+                            std::vector<bool> const *evicted,
+                            uint32_t capacity, uint32_t *start) {
+    uint32_t free_start = 0;
+    uint32_t largest_start = 0;
+    uint32_t largest_len = 0;
+
+    for (size_t nr = 0; nr <= blocks.size(); nr++) {
+        if (nr < blocks.size() && evicted != NULL && (*evicted)[nr]) {
+            continue;
+        }
+        uint32_t free_end = nr < blocks.size() ? blocks[nr].offset : capacity;
+        if (free_end - free_start > largest_len) {
+            largest_start = free_start;
+            largest_len = free_end - free_start;
+        }
+        if (nr < blocks.size()) {
+            free_start = blocks[nr].offset + blocks[nr].length;
+        }
+    }
+    *start = largest_start;
+    return largest_len;
+}
+
+/**
+ * @brief Select the range of a page code buffer receiving the next binary.
+ *  The largest free range is selected.
+ *  Called from a recompiler thread only, with the page buffer mutex held.
+ * @param view          Set to a code buffer covering the selected range.
  */
-static inline
-void clear_recompiler_cache_page(uint32_t phys_address) {
-    // Update clear count.
-    recompiler_clears++;
+static
+void reserve_recompiler_buffer(uint32_t page_nr, code_buffer_t *view) {
+    code_buffer_t *buffer = recompiler_cache.buffers + page_nr;
+    uint32_t start;
+    uint32_t len = largest_free_range(recompiler_cache.blocks[page_nr],
+        NULL, buffer->capacity, &start);
+
+    view->ptr = buffer->ptr + start;
+    view->length = 0;
+    view->capacity = len;
+}
+
+/**
+ * @brief Record a binary generated into a page code buffer.
+ *  Called from a recompiler thread only, with the page buffer mutex held.
+ */
+static
+void insert_recompiler_block(uint32_t page_nr, uint32_t offset,
+                             uint32_t length, uint32_t phys_address) {
+    std::vector<struct recompiler_block> &blocks =
+        recompiler_cache.blocks[page_nr];
+    struct recompiler_block block = { offset, length, phys_address,
+        recompiler_cache.epoch.load(std::memory_order_relaxed) };
+    auto pos = std::upper_bound(blocks.begin(), blocks.end(), block,
+        [](struct recompiler_block const &lhs,
+           struct recompiler_block const &rhs) {
+            return lhs.offset < rhs.offset; });
+
+    blocks.insert(pos, block);
+    recompiler_cache.buffers[page_nr].length += length;
+}
+
+/**
+ * @brief Return the epoch of the last use of a recompiled block:
+ *  the last entry from the interpreter thread, or the generation epoch
+ *  if later.
+ */
+static
+uint32_t recompiler_block_last_use(struct recompiler_block const &block) {
+    uint32_t used = recompiler_cache.used[block.phys_address >> 2];
+    return (int32_t)(used - block.epoch) > 0 ? used : block.epoch;
+}
 
-    uint32_t page_nr = phys_address >> CACHE_PAGE_SHIFT;
-    uint32_t page_start = page_nr << CACHE_PAGE_SHIFT;
-    recompiler_cache.buffers[page_nr].length = 0;
-    for (uint32_t index = 0; index < CACHE_PAGE_SIZE; index+=4) {
-        recompiler_cache.map[(page_start + index) >> 2] = 0x0;
+/**
+ * @brief Evict recompiled blocks from a full page code buffer.
+ *  The dead binaries, invalidated or replaced by the hot tier, are evicted
+ *  first, then the least recently used blocks until half of the buffer
+ *  is free, and a quarter of the buffer is available as a single range.
+ *  The cache entries of the evicted blocks are reset, and links into and
+ *  out of the evicted binaries are removed.
+ *  Called from the interpreter thread only, when the page was marked
+ *  with \ref request_reclaim_recompiler_cache_page.
+ */
+static
+void reclaim_recompiler_cache_page(uint32_t page_nr) {
+    code_buffer_t *buffer = recompiler_cache.buffers + page_nr;
+    std::vector<struct recompiler_block> &blocks =
+        recompiler_cache.blocks[page_nr];
+    std::vector<bool> evicted(blocks.size(), false);
+    std::vector<unsigned> live;
+    uint32_t capacity = buffer->capacity;
+    uint32_t free = capacity - buffer->length;
+    uint32_t start;
+
+    for (unsigned nr = 0; nr < blocks.size(); nr++) {
+        uint32_t entry = recompiler_cache.map[blocks[nr].phys_address >> 2];
+        if ((entry & 0x1) &&
+            ((entry & ~CACHE_ENTRY_LINKED) >> 2) == blocks[nr].offset) {
+            live.push_back(nr);
+        } else {
+            evicted[nr] = true;
+            free += blocks[nr].length;
+        }
+    }
+
+    std::sort(live.begin(), live.end(), [&](unsigned lhs, unsigned rhs) {
+        return recompiler_block_last_use(blocks[lhs]) <
+               recompiler_block_last_use(blocks[rhs]); });
+    unsigned nr_live_evicted = 0;
+    while (nr_live_evicted < live.size() && free < capacity / 2) {
+        evicted[live[nr_live_evicted]] = true;
+        free += blocks[live[nr_live_evicted]].length;
+        nr_live_evicted++;
+    }
+    while (nr_live_evicted < live.size() &&
+           largest_free_range(blocks, &evicted, capacity, &start) <
+                capacity / 4) {
+        evicted[live[nr_live_evicted]] = true;
+        nr_live_evicted++;
+    }
+
+    // Reset the entries of the evicted blocks. The execution count is
+    // preserved, hot blocks are requested again on the next query.
+    // Links to the block address are removed even if they target the
+    // binary replacing an evicted binary.
+    std::vector<uint32_t> unlinked;
+    for (unsigned nr = 0; nr < blocks.size(); nr++) {
+        if (!evicted[nr]) {
+            continue;
+        }
+        uint32_t index = blocks[nr].phys_address >> 2;
+        uint32_t entry = recompiler_cache.map[index];
+        if (entry & CACHE_ENTRY_LINKED) {
+            unlinked.push_back(blocks[nr].phys_address);
+        }
+        if ((entry & 0x1) &&
+            ((entry & ~CACHE_ENTRY_LINKED) >> 2) == blocks[nr].offset) {
+            recompiler_cache.map[index] = 0x0;
+            recompiler_cache.hot[index] = false;
+        } else {
+            recompiler_cache.map[index].fetch_and(~CACHE_ENTRY_LINKED);
+        }
+    }
+    std::sort(unlinked.begin(), unlinked.end());
+
+    for (unsigned nr = 0; nr < recompiler_cache.nr_links;) {
+        struct recompiler_link *link = &recompiler_cache.links[nr];
+        bool from_evicted = false;
+        if (link->rel32 >= buffer->ptr &&
+            link->rel32 < buffer->ptr + capacity) {
+            uint32_t offset = link->rel32 - buffer->ptr;
+            auto pos = std::upper_bound(blocks.begin(), blocks.end(), offset,
+                [](uint32_t offset, struct recompiler_block const &block) {
+                    return offset < block.offset; });
+            from_evicted = pos != blocks.begin() &&
+                evicted[pos - blocks.begin() - 1];
+        }
+        bool to_evicted = std::binary_search(
+            unlinked.begin(), unlinked.end(), link->phys_address);
+        if (to_evicted && !from_evicted) {
+            ir_x86_64_patch_link(link->rel32, NULL);
+        }
+        if (to_evicted || from_evicted) {
+            *link = recompiler_cache.links[--recompiler_cache.nr_links];
+        } else {
+            nr++;
+        }
+    }
+
+    // Drop the evicted block records.
+    unsigned kept = 0;
+    for (unsigned nr = 0; nr < blocks.size(); nr++) {
+        if (evicted[nr]) {
+            buffer->length -= blocks[nr].length;
+            recompiler_clears++;
+        } else {
+            blocks[kept++] = blocks[nr];
+        }
+    }
+    blocks.resize(kept);
+
+    recompiler_pending_link = NULL;
+    recompiler_cache.generation[page_nr].fetch_add(
+        1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Request reclaiming memory from a full page code buffer.
+ *  The recompiler threads stop using the page buffer until the
+ *  interpreter thread has reclaimed it.
+ *  Called from a recompiler thread only, with the page buffer mutex held.
+ * @param phys_address          Any physical address inside the page
+ *                              to reclaim.
+ */
+static
+void request_reclaim_recompiler_cache_page(uint32_t phys_address) {
+    uint32_t page_nr = phys_address >> recompiler_cache.page_shift;
+    recompiler_cache.reclaim_pending[page_nr].store(
+        true, std::memory_order_release);
+    recompiler_cache.reclaim_requested.store(
+        true, std::memory_order_release);
+}
+
+/**
+ * @brief Reclaim the recompiler cache pages marked by the recompiler threads.
+ *  Called from the interpreter thread only, outside of recompiled code.
+ */
+static
+void exec_recompiler_cache_reclaims(void) {
+    if (!recompiler_cache.reclaim_requested.exchange(
+            false, std::memory_order_acquire)) {
+        return;
+    }
+    for (uint32_t page_nr = 0; page_nr < recompiler_cache.page_count;
+         page_nr++) {
+        if (recompiler_cache.reclaim_pending[page_nr].load(
+                std::memory_order_acquire)) {
+            reclaim_recompiler_cache_page(page_nr);
+            recompiler_cache.reclaim_pending[page_nr].store(
+                false, std::memory_order_release);
+        }
+    }
+}
+
+/**
+ * @brief Report the write to a write protected DRAM page.
+ *  Called from the fastmem fault handler on the first write to the page,
+ *  after the write protection is removed. The page is only recorded here,
+ *  and its code invalidated by \ref exec_code_page_writes. Writes from the
+ *  interpreter thread can modify the code being executed: the current
+ *  predecoded block and the chain of linked recompiled blocks are
+ *  interrupted to invalidate the page before the next block.
+ * @param phys_address          Start address of the written page.
+ */
+static
+void invalidate_code_page(uint32_t phys_address) {
+    uint32_t page = phys_address >> CODE_PAGE_SHIFT;
+    if (page < CODE_PAGE_COUNT) {
+        code_writes_pending[page / 64].fetch_or(
+            UINT64_C(1) << (page % 64), std::memory_order_release);
+        code_writes_requested.store(true, std::memory_order_release);
+    }
+    if (interpreter_thread_local) {
+        interpreter::cpu::interrupt_block();
+        recompiler_cycles_limit = 0;
+    }
+}
+
+/**
+ * @brief Invalidate the code of the write protected pages written since
+ *  the last call.
+ *  Called from the interpreter thread only, outside of recompiled code.
+ */
+static
+void exec_code_page_writes(void) {
+    if (!code_writes_requested.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+    for (uint32_t nr = 0; nr < CODE_PAGE_COUNT / 64; nr++) {
+        uint64_t pages = code_writes_pending[nr].exchange(
+            0, std::memory_order_acquire);
+        for (; pages != 0; pages &= pages - 1) {
+            uint32_t page = nr * 64 + __builtin_ctzll(pages);
+            invalidate_recompiler_cache(page << CODE_PAGE_SHIFT,
+                (page + 1) << CODE_PAGE_SHIFT);
+        }
+    }
+}
+
+/**
+ * @brief Reset a pending cache entry, to be queried again.
+ *  Valid entries are left unchanged.
+ *  Called from a recompiler thread only.
+ */
+static
+void reset_recompiler_cache_entry(uint32_t index) {
+    uint32_t entry = recompiler_cache.map[index].load(
+        std::memory_order_relaxed);
+    while ((entry & 0x1) == 0 && entry != 0x0 &&
+           !recompiler_cache.map[index].compare_exchange_weak(entry, 0x0)) {
+    }
+}
+
+/**
+ * @brief Queue the static successors of the block recompiled for
+ *  \p request as speculative requests. Only the successors in the same
+ *  cache page are selected; the exit targets are virtual addresses,
+ *  translated relative to the block start when directly mapped, or
+ *  following the block start in the same physical region.
+ * @param graph     Instruction graph of the recompiled block.
+ */
+static
+void queue_recompiler_speculations(struct recompiler_request const *request,
+                                   ir_graph_t const *graph) {
+    uint64_t targets[RECOMPILER_SPECULATION_MAX];
+    unsigned nr_targets = ir_exit_targets(graph, ir_mips_pc_global(),
+        targets, RECOMPILER_SPECULATION_MAX);
+    uint32_t buffer_index = request->phys_address >> recompiler_cache.page_shift;
+    bool unmapped =
+        request->virt_address >= UINT64_C(0xffffffff80000000) &&
+        request->virt_address <  UINT64_C(0xffffffffc0000000);
+
+    for (unsigned nr = 0; nr < nr_targets; nr++) {
+        uint64_t target = targets[nr];
+        uint64_t phys_target;
+        if (unmapped &&
+            ((target ^ request->virt_address) & ~UINT64_C(0x1fffffff)) == 0) {
+            phys_target = target & UINT64_C(0x1fffffff);
+        } else if (target > request->virt_address &&
+                   target - request->virt_address <=
+                       request->end_phys_address - request->phys_address) {
+            phys_target = request->phys_address +
+                (target - request->virt_address);
+        } else {
+            continue;
+        }
+        if ((target & 0x3) != 0 ||
+            phys_target == request->phys_address ||
+            phys_target + 3 > request->end_phys_address ||
+            (phys_target >> recompiler_cache.page_shift) != buffer_index) {
+            continue;
+        }
+
+        struct recompiler_request speculation(target, phys_target,
+            request->end_phys_address);
+        speculation.speculative = true;
+        (void)recompiler_speculation_ring.enqueue(speculation);
     }
 }
 
 static
 void exec_recompiler_request(struct recompiler_backend *backend,
                              struct recompiler_request *request) {
+    // Drop the requests made obsolete since they were queued:
+    // the priority of pending blocks is raised by queueing duplicate
+    // requests, and recompiled blocks may have been modified.
+    uint32_t index = request->phys_address >> 2;
+    uint32_t current = recompiler_cache.map[index].load(
+        std::memory_order_acquire);
+    if (request->tier == 1 && (current & 0x3) != 0x3) {
+        reset_recompiler_cache_entry(index);
+        return;
+    }
+    if (request->tier == 2 && (current & ~CACHE_ENTRY_LINKED) != request->entry) {
+        return;
+    }
+
     // Update request count.
-    recompiler_requests++;
+    __atomic_fetch_add(&recompiler_requests, 1, __ATOMIC_RELAXED);
 
     // Get the pointer to the buffer containing the MIPS assembly to
     // recompiler. The length is computed so as to not cross a cache page
     // boundary: the code must fit inside a cache range.
     uint64_t phys_address = request->phys_address;
-    uint64_t end_phys_address =
-        (phys_address + CACHE_PAGE_SIZE) & ~CACHE_PAGE_MASK;
+    uint64_t page_mask = (UINT64_C(1) << recompiler_cache.page_shift) - 1;
+    uint64_t end_phys_address = (phys_address + page_mask + 1) & ~page_mask;
     if (end_phys_address > request->end_phys_address)
         end_phys_address = request->end_phys_address;
     uint64_t phys_len = end_phys_address - phys_address;
     uint8_t *phys_ptr = state.dram + phys_address;
-    uint32_t buffer_index = phys_address >> CACHE_PAGE_SHIFT;
+    uint32_t buffer_index = phys_address >> recompiler_cache.page_shift;
     code_buffer_t *buffer = recompiler_cache.buffers + buffer_index;
+    code_buffer_t view;
     ir_graph_t *graph;
     code_entry_t binary;
     size_t binary_len;
 
+    // The page is waiting to be reclaimed by the interpreter thread,
+    // drop the request. The cache entry is reset to be queried again.
+    if (recompiler_cache.reclaim_pending[buffer_index].load(
+            std::memory_order_acquire)) {
+        reset_recompiler_cache_entry(index);
+        return;
+    }
+
+    // Reload the optimized graph from the persistent code cache,
+    // or disassemble and optimize the block.
     clear_recompiler_backend(backend);
-    graph = ir_mips_disassemble(
-        backend, request->virt_address, phys_ptr, phys_len);
+    graph = code_cache::load_graph(backend,
+        request->virt_address, phys_address, phys_ptr, phys_len);
 
     if (graph == NULL) {
-        return;
+        clear_recompiler_backend(backend);
+        graph = ir_mips_disassemble(
+            backend, request->virt_address, phys_ptr, phys_len);
+
+        if (graph == NULL) {
+            return;
+        }
+
+        // Optimize generated graph.
+        ir_optimize(backend, graph);
+        code_cache::store_graph(graph, request->virt_address, phys_address,
+            phys_ptr, ir_mips_disassembled_len());
     }
 
-    // Optimize generated graph.
-    ir_optimize(backend, graph);
+    // Apply the expensive optimizations to hot blocks.
+    if (request->tier == 2) {
+        ir_optimize_full(backend, graph);
+    }
 
 #if 0
     // Sanity checks on the optimized intermediate representation.
@@ -265,38 +1062,155 @@ void exec_recompiler_request(struct recompiler_backend *backend,
 #endif
 
     // Re-compile to x86_64.
-    binary = ir_x86_64_assemble(backend, buffer, graph, &binary_len);
+    // The page buffer is shared with the other recompiler threads,
+    // and may have been marked for reclaiming in the meantime.
+    std::lock_guard<std::mutex> lock(
+        recompiler_cache.buffer_mutex[buffer_index]);
+    if (recompiler_cache.reclaim_pending[buffer_index].load(
+            std::memory_order_acquire)) {
+        reset_recompiler_cache_entry(index);
+        return;
+    }
+    if (request->tier == 2 &&
+        recompiler_cache.generation[buffer_index].load(
+            std::memory_order_relaxed) != request->generation) {
+        return;
+    }
+
+    reserve_recompiler_buffer(buffer_index, &view);
+    binary = ir_x86_64_assemble(backend, &view, graph, &binary_len);
+    ir_x86_64_stats_t stats;
+    ir_x86_64_get_stats(&stats);
+    recompiler_blocks = stats.nr_blocks;
+    recompiler_spills = stats.nr_spills;
+    recompiler_bytes_saved = stats.nr_bytes_saved;
     if (binary == NULL) {
-        clear_recompiler_cache_page(phys_address);
-        recompiler_request_queue.flush();
+        // The cache entry is reset to be queried again after the
+        // page is reclaimed. Pending requests for the same page are
+        // dropped when dequeued.
+        request_reclaim_recompiler_cache_page(phys_address);
+        reset_recompiler_cache_entry(index);
         return;
     }
 
     // Update the recompiler cache.
     // Check that the entry was not invalidated while the recompiler
     // was busy completing the request. The recompiled binary is dropped
-    // in this case, and the code buffer rolled back.
+    // in this case, and its range of the code buffer left free.
     // TODO only checking the first address at the moment.
-    uint32_t index = phys_address >> 2;
     uint32_t offset = (unsigned char *)binary - buffer->ptr;
     uint32_t entry = (offset << 2) | 0x1;
-    uint32_t entry_expected = 0x3;
 
-    if (!recompiler_cache.map[index].compare_exchange_weak(
-            entry_expected, entry, std::memory_order_release)) {
-        buffer->length -= binary_len;
-        recompiler_cache.map[index] = 0x0;
+    if (request->tier == 1) {
+        uint32_t entry_expected = 0x3;
+        if (!recompiler_cache.map[index].compare_exchange_strong(
+                entry_expected, entry, std::memory_order_release)) {
+            reset_recompiler_cache_entry(index);
+            return;
+        }
+        insert_recompiler_block(buffer_index, offset, binary_len,
+            phys_address);
+        // The successors of speculative blocks are not requested,
+        // they may never be executed.
+        if (!request->speculative) {
+            queue_recompiler_speculations(request, graph);
+        }
+        return;
+    }
+
+    // The tier 1 entry is replaced preserving the linked bit,
+    // which can be concurrently set by the interpreter thread.
+    uint32_t entry_expected = recompiler_cache.map[index].load(
+        std::memory_order_relaxed);
+    do {
+        if ((entry_expected & ~CACHE_ENTRY_LINKED) != request->entry) {
+            return;
+        }
+    } while (!recompiler_cache.map[index].compare_exchange_weak(
+                entry_expected, entry | (entry_expected & CACHE_ENTRY_LINKED),
+                std::memory_order_release));
+    insert_recompiler_block(buffer_index, offset, binary_len, phys_address);
+    __atomic_fetch_add(&recompiler_promotions, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Run the RSP for the given number of cycles, stopping before the next
+ * instruction observable by the CPU. Called from the RSP thread.
+ * @return true if the execution stopped before such an instruction.
+ */
+static
+bool exec_rsp_until_sync(unsigned long cycles) {
+#if ENABLE_RECOMPILER
+    return rsp_cache::exec_until_sync(cycles);
+#else
+    for (unsigned long nr = 0; nr < cycles; nr++) {
+        if (state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) {
+            return false;
+        }
+        if (R4300::RSP::at_sync_point()) {
+            return true;
+        }
+        R4300::RSP::step();
+    }
+    return false;
+#endif /* ENABLE_RECOMPILER */
+}
+
+/**
+ * Execute the RSP instructions observable by the CPU the RSP thread
+ * stopped at, and extend the run-ahead window of the RSP thread to the
+ * current CPU cycle count. Called from the interpreter thread.
+ */
+static
+void sync_rsp_thread(void) {
+    if (rsp_sync_pending.load(std::memory_order_acquire)) {
+        lock_rsp();
+        while (!(state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) &&
+               R4300::RSP::at_sync_point()) {
+            R4300::RSP::step();
+            rsp_cycles++;
+        }
+        rsp_sync_pending.store(false, std::memory_order_relaxed);
+        unlock_rsp();
+    }
+
+    // Wake up the RSP thread only if it is waiting, and not halted; the
+    // fence orders the store to the cycle limit with the load of the
+    // waiting flag, matching the fence in rsp_routine().
+    rsp_cycles_limit.store(state.cycles + RSP_THREAD_RUN_AHEAD,
+                           std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rsp_waiting.load(std::memory_order_relaxed) &&
+        !(state.hwreg.SP_STATUS_REG & SP_STATUS_HALT)) {
+        std::lock_guard<std::mutex> lock(rsp_mutex);
+        rsp_semaphore.notify_one();
     }
 }
 
 /**
  * Run the RSP interpreter for the given number of cycles.
+ * The recompiled RSP blocks are executed when the recompiler is enabled.
+ * When the RSP runs on its own thread, only the synchronization with
+ * the RSP thread is performed.
  */
 static
 void exec_rsp_interpreter(unsigned long cycles) {
+    if (rsp_thread != NULL) {
+        sync_rsp_thread();
+        return;
+    }
+#if ENABLE_RECOMPILER
+    rsp_cache::exec(cycles);
+#else
+    // The RSP cannot leave the halted state by itself; return early
+    // instead of stepping through the cycles skipped by idle loops.
+    if (state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) {
+        return;
+    }
     for (unsigned long nr = 0; nr < cycles; nr++) {
         R4300::RSP::step();
     }
+#endif /* ENABLE_RECOMPILER */
 }
 
 /**
@@ -345,9 +1259,102 @@ bool exec_cpu_interpreter(int nr_jumps) {
     return false;
 }
 
+/**
+ * @brief Return the priority of the recompilation request for a block
+ *  executed \p hits times. Priorities range from 1 for blocks at the
+ *  recompilation threshold to the highest priority level, raised each
+ *  time the number of executions is multiplied by
+ *  RECOMPILER_PRIORITY_FACTOR. The priority 0 is reserved to
+ *  the hot tier and speculative requests.
+ */
 static
-void exec_interpreter(struct recompiler_request_queue *queue,
-                      struct recompiler_backend *backend) {
+unsigned recompiler_priority(unsigned hits) {
+    unsigned priority = 1;
+    unsigned level = recompiler_cache_threshold * RECOMPILER_PRIORITY_FACTOR;
+    while (priority < RECOMPILER_PRIORITY_LEVELS - 1 && hits >= level) {
+        priority++;
+        level *= RECOMPILER_PRIORITY_FACTOR;
+    }
+    return priority;
+}
+
+/**
+ * @brief Fast-forward the idle loop starting at the current address.
+ *  The current address must be the target of the branch ending the
+ *  previous block, and the start of the same block.
+ * @param phys_end      Inclusive end address of the physical region mapped
+ *                      contiguously with the block start.
+ * @return true if the block is an idle loop candidate, even if the loop
+ *  could not be fast-forwarded this time.
+ */
+static
+bool exec_idle_loop(uint64_t virt_address, uint32_t phys_address,
+                    uint32_t phys_end) {
+    uint32_t index = phys_address >> 2;
+    if (recompiler_cache.busy[index]) {
+        return false;
+    }
+
+    // The instructions are read directly from DRAM, not to add accesses
+    // to the traces of the recording and replaying buses.
+    u32 instrs[IDLE_LOOP_INSTR_MAX];
+    unsigned len = 0;
+    while (len < IDLE_LOOP_INSTR_MAX &&
+           phys_address + 4 * len + 3 <= phys_end &&
+           phys_address + 4 * len + 3 < sizeof(state.dram)) {
+        u8 const *ptr = state.dram + phys_address + 4 * len;
+        instrs[len++] = ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) |
+                        ((u32)ptr[2] << 8)  | (u32)ptr[3];
+    }
+    if (interpreter::cpu::idle_loop_length(virt_address, instrs, len) == 0) {
+        recompiler_cache.busy[index] = true;
+        return false;
+    }
+
+    ulong until;
+    if (interpreter::cpu::idle_loop_until(virt_address, instrs, len, &until)) {
+        idle_skipped_cycles += until - state.cycles;
+        state.cycles = until;
+    }
+    return true;
+}
+
+/**
+ * @brief Request the recompilation of the static successors queued by the
+ *  recompiler threads. The requests are made at the lowest priority and
+ *  only when recompiler threads are idle; the successors are otherwise
+ *  dropped, and requested when reaching the recompilation threshold.
+ *  Called only on the interpreter thread, which owns the pending entries
+ *  and the code page bitmap.
+ */
+static
+void exec_recompiler_speculations(struct recompiler_request_queue *queue) {
+    struct recompiler_request request;
+    while (recompiler_speculation_ring.try_dequeue(request)) {
+        uint32_t index = request.phys_address >> 2;
+        if (queue->nr_waiting.load(std::memory_order_relaxed) == 0 ||
+            request.phys_address >= recompiler_cache.range ||
+            recompiler_cache.map[index].load(
+                std::memory_order_relaxed) != 0x0) {
+            continue;
+        }
+
+        // The entry is marked pending before the request is visible
+        // to the recompiler threads.
+        uint32_t page = request.phys_address >> CODE_PAGE_SHIFT;
+        recompiler_cache.code[page / 64] |= UINT64_C(1) << (page % 64);
+        (void)fastmem::protect(request.phys_address);
+        recompiler_cache.map[index] = 0x3;
+        if (queue->enqueue(request, 0)) {
+            recompiler_speculations++;
+        } else {
+            recompiler_cache.map[index] = 0x0;
+        }
+    }
+}
+
+static
+void exec_interpreter(struct recompiler_request_queue *queue) {
     uint64_t virt_address = state.cpu.nextPc;
     uint64_t phys_address;
     unsigned long cycles = state.cycles;
@@ -360,6 +1367,8 @@ void exec_interpreter(struct recompiler_request_queue *queue,
     static uint64_t virt_end;
     static uint32_t phys_start;
     static uint32_t phys_end;
+    // Start address of the previous block.
+    static uint64_t last_virt_address;
 
     if (virt_address >= virt_start && (virt_address + 3) <= virt_end) {
         phys_address = phys_start + (virt_address - virt_start);
@@ -392,36 +1401,104 @@ void exec_interpreter(struct recompiler_request_queue *queue,
         }
     }
 
+    // Reclaim the cache pages filled by the recompiler threads,
+    // and request the successors of the recompiled blocks.
+    exec_recompiler_cache_reclaims();
+    exec_recompiler_speculations(queue);
+
     // Query the recompiler cache.
     // The virtual address was successfully translated at this point.
     code_entry_t binary = NULL;
     uint32_t entry;
+    uint32_t epoch = (uint32_t)(state.cycles >> RECOMPILER_EPOCH_SHIFT);
+    recompiler_cache.epoch.store(epoch, std::memory_order_relaxed);
 
-    if (phys_address < 0x400000) {
+    if (phys_address < recompiler_cache.range) {
         uint32_t index = phys_address >> 2;
-        uint32_t buffer_index = phys_address >> CACHE_PAGE_SHIFT;
+        uint32_t buffer_index = phys_address >> recompiler_cache.page_shift;
+        unsigned hits = recompiler_cache.hits[index];
+        if (hits < UINT16_MAX) {
+            recompiler_cache.hits[index] = ++hits;
+        }
+
         entry = recompiler_cache.map[index];
         switch (entry & 0x3) {
         case 0x0:
-            recompiler_cache.map[index] =
-                queue->enqueue(recompiler_request(virt_address, phys_address, phys_end)) ?
-                0x3 : 0x0;
+            // The entry is marked pending before the request is visible
+            // to the recompiler threads.
+            if (hits >= recompiler_cache_threshold) {
+                uint32_t page = phys_address >> CODE_PAGE_SHIFT;
+                recompiler_cache.code[page / 64] |= UINT64_C(1) << (page % 64);
+                (void)fastmem::protect(phys_address);
+                recompiler_cache.map[index] = 0x3;
+                if (!queue->enqueue(
+                        recompiler_request(virt_address, phys_address, phys_end),
+                        recompiler_priority(hits))) {
+                    recompiler_cache.map[index] = 0x0;
+                }
+            }
             break;
         case 0x1:
-            binary = (code_entry_t)(
-                recompiler_cache.buffers[buffer_index].ptr + (entry >> 2));
+            binary = (code_entry_t)(recompiler_cache.buffers[buffer_index].ptr +
+                ((entry & ~CACHE_ENTRY_LINKED) >> 2));
+            recompiler_cache.used[index] = epoch;
+            // Request the hot tier recompilation at the lowest priority,
+            // the block already runs recompiled code.
+            if (hits >= recompiler_hot_threshold &&
+                !recompiler_cache.hot[index]) {
+                recompiler_cache.hot[index] = queue->enqueue(
+                    recompiler_request(virt_address, phys_address, phys_end,
+                        2, entry & ~CACHE_ENTRY_LINKED,
+                        recompiler_cache.generation[buffer_index].load(
+                            std::memory_order_relaxed)), 0);
+            }
             break;
         case 0x2:
+            break;
         case 0x3:
+            // Raise the priority of the pending request when the block
+            // reaches the next hotness level. The stale request is
+            // dropped when dequeued.
+            if (recompiler_priority(hits) != recompiler_priority(hits - 1)) {
+                (void)queue->enqueue(
+                    recompiler_request(virt_address, phys_address, phys_end),
+                    recompiler_priority(hits));
+            }
             break;
         }
     }
 
+    // Fast-forward idle loops. Exit stubs looping to idle loops are left
+    // unlinked to return to the interpreter at each iteration.
+    if (virt_address == last_virt_address &&
+        phys_address < recompiler_cache.range &&
+        exec_idle_loop(virt_address, phys_address, phys_end)) {
+        recompiler_pending_link = NULL;
+        cycles = state.cycles;
+    }
+    last_virt_address = virt_address;
+
+    // Link the exit stub taken by the previous block, if the current
+    // address is its target and was found in the cache.
+    if (binary != NULL && recompiler_pending_link != NULL &&
+        recompiler_pending_link_address == virt_address) {
+        link_recompiler_block(recompiler_pending_link, phys_address, binary);
+    }
+    recompiler_pending_link = NULL;
+
     // The recompiler cache did not contain the requested entry point,
     // run the recompiler until the next branching instruction.
     if (binary == NULL) {
         // Run the interpreter until the next branching instruction.
-        (void)exec_cpu_interpreter(1);
+        // Predecoded blocks are evaluated when the bus does not need to
+        // observe instruction fetches; the block is completed with the
+        // fetching interpreter if it stopped before the branch.
+        if (!interpreter_block_cache_enabled ||
+            !interpreter::cpu::eval_block(phys_address, (uint64_t)phys_end + 1)) {
+            (void)exec_cpu_interpreter(1);
+        } else if (state.cpu.nextAction != State::Action::Jump) {
+            (void)exec_cpu_interpreter(0);
+        }
     }
     // The recompiler cache did contain the entry point.
     // Jump to the recompiled code, then patch the state.
@@ -431,9 +1508,27 @@ void exec_interpreter(struct recompiler_request_queue *queue,
         state.cpu.nextAction = State::Continue;
         state.cpu.nextPc = 0;
 
+        // Set the cycle budget for following block links.
+        // Scheduled events and interrupts are only checked when
+        // returning from recompiled code.
+        recompiler_exit_link = NULL;
+        recompiler_cycles_limit =
+            std::min(state.cpu.nextEvent, cycles + RECOMPILER_CHAIN_CYCLES);
+
         // Run generated assembly.
         binary();
 
+        // Save the exit stub to be linked if the block returned through
+        // an unlinked exit. Only the targets in the KSEG0, KSEG1 segments
+        // are linked, since their address translation is fixed.
+        if (recompiler_exit_link != NULL &&
+            state.cpu.nextAction == State::Continue &&
+            state.reg.pc >= UINT64_C(0xffffffff80000000) &&
+            state.reg.pc <  UINT64_C(0xffffffffc0000000)) {
+            recompiler_pending_link = recompiler_exit_link;
+            recompiler_pending_link_address = state.reg.pc;
+        }
+
         // Post-binary state rectification.
         // The nextPc, nextAction need to be corrected after exiting from an
         // exception or interrupt to correctly follow up with interpreter
@@ -457,42 +1552,120 @@ void exec_interpreter(struct recompiler_request_queue *queue,
 void get_recompiler_cache_stats(float *cache_usage,
                                 float *buffer_usage) {
 #if ENABLE_RECOMPILER
+    size_t map_size = recompiler_cache.range >> 2;
     size_t map_taken = 0;
-    for (size_t nr = 0; nr < 0x100000; nr++) {
+    for (size_t nr = 0; nr < map_size; nr++) {
         map_taken += (recompiler_cache.map[nr] & 1);
     }
 
     size_t buffer_taken = 0;
     size_t buffer_capacity = 0;
-    for (size_t nr = 0; nr < CACHE_PAGE_COUNT; nr++) {
+    for (size_t nr = 0; nr < recompiler_cache.page_count; nr++) {
         buffer_taken += recompiler_cache.buffers[nr].length;
         buffer_capacity += recompiler_cache.buffers[nr].capacity;
     }
 
-    *cache_usage = (float)map_taken / 0x100000;
-    *buffer_usage = (float)buffer_taken / buffer_capacity;
+    *cache_usage = map_size == 0 ? 0 : (float)map_taken / map_size;
+    *buffer_usage = buffer_capacity == 0 ? 0 :
+        (float)buffer_taken / buffer_capacity;
 #else
     *cache_usage = 0;
     *buffer_usage = 0;
 #endif /* ENABLE_RECOMPILER */
 }
 
+size_t get_recompiler_fallback_stats(recompiler_fallback *fallbacks,
+                                     size_t max) {
+#if ENABLE_RECOMPILER
+    ir_mips_fallback_stats_t stats[IR_MIPS_FALLBACK_MAX];
+    size_t len = ir_mips_get_fallback_stats(stats,
+        std::min(max, (size_t)IR_MIPS_FALLBACK_MAX));
+    for (size_t nr = 0; nr < len; nr++) {
+        fallbacks[nr].instr = stats[nr].instr;
+        fallbacks[nr].count = stats[nr].count;
+    }
+    return len;
+#else
+    (void)fallbacks;
+    (void)max;
+    return 0;
+#endif /* ENABLE_RECOMPILER */
+}
+
 /**
  * @brief Recompiler thead routine.
  * Loops waiting for recompilation requests issued by the interpreter thread.
  * Requests are added to the cache when completed.
+ * Each recompiler thread owns a separate recompiler backend.
  */
 static
-void recompiler_routine(void) {
+void recompiler_routine(unsigned thread_nr) {
     fmt::print(fmt::fg(fmt::color::dark_orange),
-        "recompiler thread starting\n");
+        "recompiler thread {} starting\n", thread_nr);
 
+    recompiler_backend_t *backend = ir_mips_recompiler_backend();
+    struct recompiler_request request;
+    while (recompiler_request_queue.dequeue(request, recompiler_stopped)) {
+        exec_recompiler_request(backend, &request);
+    }
+
+    free_recompiler_backend(backend);
+
+    fmt::print(fmt::fg(fmt::color::dark_orange),
+        "recompiler thread {} exiting\n", thread_nr);
+}
+
+/** Check whether the RSP thread can run, called with the mutex held. */
+static
+bool rsp_runnable(void) {
+    return rsp_stopped.load(std::memory_order_acquire) ||
+        (rsp_pauses.load(std::memory_order_relaxed) == 0 &&
+         !rsp_sync_pending.load(std::memory_order_relaxed) &&
+         !(state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) &&
+         rsp_cycles < rsp_cycles_limit.load(std::memory_order_relaxed));
+}
+
+/**
+ * @brief RSP thead routine.
+ * Runs the RSP by slices of \ref RSP_THREAD_SLICE_CYCLES cycles while
+ * not halted, paused, or too far ahead of the CPU. The RSP stops before
+ * the instructions observable by the CPU, which are left to the
+ * interpreter thread.
+ */
+static
+void rsp_routine(void) {
+    fmt::print(fmt::fg(fmt::color::dark_orange),
+        "RSP thread starting\n");
+
+    std::unique_lock<std::mutex> lock(rsp_mutex);
+    bool halted = true;
     for (;;) {
-        struct recompiler_request request;
-        recompiler_request_queue.dequeue(request);
-        exec_recompiler_request(
-            recompiler_backend, &request);
+        if (!rsp_runnable()) {
+            rsp_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            rsp_semaphore.wait(lock, rsp_runnable);
+            rsp_waiting.store(false, std::memory_order_relaxed);
+        }
+        if (rsp_stopped.load(std::memory_order_acquire)) {
+            break;
+        }
+        // The cycles elapsed while the RSP was halted are dropped,
+        // as in lockstep mode.
+        if (halted) {
+            halted = false;
+            rsp_cycles = rsp_cycles_limit.load(std::memory_order_relaxed) -
+                RSP_THREAD_RUN_AHEAD;
+        }
+
+        if (exec_rsp_until_sync(RSP_THREAD_SLICE_CYCLES)) {
+            rsp_sync_pending.store(true, std::memory_order_release);
+        }
+        rsp_cycles += RSP_THREAD_SLICE_CYCLES;
+        halted = state.hwreg.SP_STATUS_REG & SP_STATUS_HALT;
     }
+
+    fmt::print(fmt::fg(fmt::color::dark_orange),
+        "RSP thread exiting\n");
 }
 
 /**
@@ -511,6 +1684,7 @@ static
 void interpreter_routine(void) {
     fmt::print(fmt::fg(fmt::color::dark_orange),
         "interpreter thread starting\n");
+    interpreter_thread_local = true;
 
     for (;;) {
         std::unique_lock<std::mutex> lock(interpreter_mutex);
@@ -538,9 +1712,14 @@ void interpreter_routine(void) {
             // at the start of the loop contents.
             cycles = state.cycles;
             check_cpu_events();
+            exec_code_page_writes();
             // trace_point(state.cpu.nextPc, state.cycles);
 #if ENABLE_RECOMPILER
-            exec_interpreter(&recompiler_request_queue, recompiler_backend);
+            if (!recompiler_disabled) {
+                exec_interpreter(&recompiler_request_queue);
+            } else {
+                exec_cpu_interpreter(1);
+            }
 #else
             exec_cpu_interpreter(1);
 #endif /* ENABLE_RECOMPILER */
@@ -552,20 +1731,134 @@ void interpreter_routine(void) {
     }
 }
 
-void start(void) {
 #if ENABLE_RECOMPILER
-    if (recompiler_backend == NULL) {
-        recompiler_backend = ir_mips_recompiler_backend();
+/**
+ * @brief Allocate the recompiler cache with the selected geometry.
+ *  The recompiler is disabled if the code buffers cannot be allocated.
+ * @return false if the recompiler is disabled.
+ */
+static
+bool alloc_recompiler_cache(void) {
+    if (recompiler_disabled) {
+        return false;
     }
+    uint32_t page_shift = __builtin_ctz(recompiler_cache_page_size);
+    uint32_t page_count = recompiler_cache_range >> page_shift;
+    recompiler_cache.buffers = alloc_code_buffer_array(
+        page_count, recompiler_cache_buffer_size);
     if (recompiler_cache.buffers == NULL) {
-        recompiler_cache.buffers =
-            alloc_code_buffer_array(CACHE_PAGE_COUNT, 0x40000);
+        fmt::print(fmt::fg(fmt::color::tomato),
+            "failed to allocate the recompiler cache, "
+            "falling back to the interpreter\n");
+        recompiler_disabled = true;
+        return false;
     }
-    if (recompiler_thread == NULL) {
+
+    size_t map_size = recompiler_cache_range >> 2;
+    recompiler_cache.page_shift = page_shift;
+    recompiler_cache.page_count = page_count;
+    recompiler_cache.map.reset(new std::atomic_uint32_t[map_size]());
+    recompiler_cache.hits.reset(new uint16_t[map_size]());
+    recompiler_cache.hot.reset(new bool[map_size]());
+    recompiler_cache.busy.reset(new bool[map_size]());
+    recompiler_cache.used.reset(new uint32_t[map_size]());
+    recompiler_cache.range = recompiler_cache_range;
+    return true;
+}
+#endif /* ENABLE_RECOMPILER */
+
+void start(void) {
+    // Writes to the DRAM pages holding predecoded or recompiled code
+    // are caught by write protecting the pages, instead of invalidating
+    // the code on every store. This requires the DRAM to be mapped
+    // to the fastmem arena, and a memory bus that does not observe
+    // RAM accesses. The debugger watchpoints are checked on
+    // explicit invalidations only.
+    bool write_protect = !ENABLE_BREAKPOINTS && fastmem::base != NULL &&
+        typeid(*state.bus) == typeid(Memory::Bus);
+    if (write_protect) {
+        fastmem::set_write_routine(invalidate_code_page);
+    }
+    state.bus->invalidateCode = !write_protect;
+
+#if ENABLE_RECOMPILER
+    if (recompiler_cache.buffers == NULL && alloc_recompiler_cache()) {
+        static_assert(sizeof(state.cpu.nextAction) == sizeof(uint32_t),
+            "unexpected size for the type State::Action");
+        ir_x86_64_link_config_t link_config = {
+            ir_mips_pc_global(),
+            (uint64_t const *)&state.cycles,
+            &recompiler_cycles_limit,
+            (uint32_t const *)&state.cpu.nextAction,
+            &recompiler_exit_link,
+        };
+        ir_x86_64_set_link_config(&link_config);
+        ir_mips_set_cycles_limit(&recompiler_cycles_limit);
+
+        // Enable the inline memory fast path only if the memory bus
+        // does not need to observe RAM accesses, as is the case for
+        // trace recording and replay.
+        uint64_t fast_path_size;
+        if (typeid(*state.bus) != typeid(Memory::Bus)) {
+            fast_path_size = 0;
+            ir_mips_set_fast_path(NULL, 0);
+        } else if (fastmem::base != NULL) {
+            fast_path_size = FASTMEM_ARENA_SIZE;
+            ir_mips_set_fast_path(fastmem::base, FASTMEM_ARENA_SIZE);
+            ir_mips_set_write_protect(write_protect);
+            fastmem::set_exit_routine(ir_x86_64_abort);
+        } else {
+            fast_path_size = sizeof(state.dram);
+            ir_mips_set_fast_path(state.dram, sizeof(state.dram));
+        }
+
+        // Open the persistent code cache. The host pointers embedded in
+        // the cached graphs point to the executable image (functions and
+        // machine state) or to the fastmem arena. Bit 0 of the
+        // configuration tag records the write protection of code pages.
+        if (!code_cache_directory.empty()) {
+            ir_reloc_region_t regions[2] = {
+                { (uintptr_t)__executable_start,
+                  (uintptr_t)(_end - __executable_start) },
+                { (uintptr_t)fastmem::base, FASTMEM_ARENA_SIZE },
+            };
+            (void)code_cache::open(code_cache_directory,
+                calculate_crc32(state.rom, state.rom_size),
+                fast_path_size | (write_protect ? 1 : 0),
+                regions, fastmem::base != NULL ? 2 : 1);
+        }
+    }
+    if (recompiler_nr_threads == 0 && !recompiler_disabled) {
+        // Leave one hardware thread for the interpreter,
+        // and another for the GUI.
+        unsigned nr_threads = std::thread::hardware_concurrency();
+        nr_threads = nr_threads > 2 ? nr_threads - 2 : 1;
+        nr_threads = std::min(nr_threads, (unsigned)RECOMPILER_THREAD_MAX);
+
         recompiler_stopped = false;
-        recompiler_thread = new std::thread(recompiler_routine);
+        for (unsigned nr = 0; nr < nr_threads; nr++) {
+            recompiler_threads[nr] = new std::thread(recompiler_routine, nr);
+        }
+        recompiler_nr_threads = nr_threads;
     }
 #endif /* ENABLE_RECOMPILER */
+    // Predecoded blocks bypass the instruction fetches, which are
+    // recorded and replayed by the trace buses.
+    interpreter_block_cache_enabled =
+        typeid(*state.bus) == typeid(Memory::Bus);
+    // The trace buses record and replay the CPU accesses, which must
+    // not depend on the progress of the RSP thread.
+    if (rsp_thread_enabled && rsp_thread == NULL &&
+        typeid(*state.bus) == typeid(Memory::Bus)) {
+        // The CPU accesses to DMEM and IMEM must reach the memory bus,
+        // which pauses the RSP thread.
+        state.swapSpMemory();
+        fastmem::protect_sp_memory();
+        rsp_stopped = false;
+        rsp_sync_pending = false;
+        rsp_cycles_limit = state.cycles + RSP_THREAD_RUN_AHEAD;
+        rsp_thread = new std::thread(rsp_routine);
+    }
     if (interpreter_thread == NULL) {
         interpreter_halted = true;
         interpreter_halted_reason = "reset";
@@ -582,17 +1875,88 @@ void stop(void) {
         delete interpreter_thread;
         interpreter_thread = NULL;
     }
+    if (rsp_thread != NULL) {
+        rsp_stopped.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(rsp_mutex);
+            rsp_semaphore.notify_one();
+        }
+        rsp_thread->join();
+        delete rsp_thread;
+        rsp_thread = NULL;
+    }
 #if ENABLE_RECOMPILER
-    if (recompiler_thread != NULL) {
+    if (recompiler_nr_threads > 0) {
         recompiler_stopped.store(true, std::memory_order_release);
-        recompiler_thread->join();
-        delete recompiler_thread;
-        recompiler_thread = NULL;
+        recompiler_request_queue.notify_all();
+        for (unsigned nr = 0; nr < recompiler_nr_threads; nr++) {
+            recompiler_threads[nr]->join();
+            delete recompiler_threads[nr];
+            recompiler_threads[nr] = NULL;
+        }
+        recompiler_nr_threads = 0;
     }
 #endif /* ENABLE_RECOMPILER */
 }
 
+void set_rsp_thread(bool enabled) {
+    rsp_thread_enabled = enabled;
+}
+
+void lock_rsp(void) {
+    if (rsp_thread != NULL && rsp_lock_depth++ == 0) {
+        rsp_pauses.fetch_add(1, std::memory_order_relaxed);
+        rsp_mutex.lock();
+    }
+}
+
+void unlock_rsp(void) {
+    if (rsp_thread != NULL && --rsp_lock_depth == 0) {
+        rsp_pauses.fetch_sub(1, std::memory_order_relaxed);
+        rsp_semaphore.notify_one();
+        rsp_mutex.unlock();
+    }
+}
+
+void set_code_cache_directory(std::string const &directory) {
+    code_cache_directory = directory;
+}
+
+/** Round up to the size of the code buffers allocated in whole pages. */
+static inline uint64_t page_align(uint64_t size) {
+    uint64_t page_mask = (UINT64_C(1) << CODE_PAGE_SHIFT) - 1;
+    return (size + page_mask) & ~page_mask;
+}
+
+bool set_recompiler_cache_geometry(size_t page_size, size_t buffer_size,
+                                   size_t map_size) {
+    size_t range = map_size == 0 ? sizeof(state.dram) : map_size * 4;
+    if (recompiler_cache.buffers != NULL ||
+        page_size < (UINT32_C(1) << CODE_PAGE_SHIFT) ||
+        (page_size & (page_size - 1)) != 0 ||
+        buffer_size < (UINT32_C(1) << CODE_PAGE_SHIFT) ||
+        buffer_size > CACHE_BUFFER_MAX ||
+        range > sizeof(state.dram) || range % page_size != 0 ||
+        (range / page_size) * page_align(buffer_size) > CACHE_TOTAL_MAX) {
+        return false;
+    }
+    recompiler_cache_page_size = page_size;
+    recompiler_cache_buffer_size = buffer_size;
+    recompiler_cache_range = range;
+    return true;
+}
+
+void set_recompiler_thresholds(unsigned cache_threshold,
+                               unsigned hot_threshold) {
+    // The execution counters saturate at UINT16_MAX.
+    recompiler_cache_threshold =
+        std::max(1u, std::min(cache_threshold, (unsigned)UINT16_MAX));
+    recompiler_hot_threshold =
+        std::max(1u, std::min(hot_threshold, (unsigned)UINT16_MAX));
+}
+
 void reset(void) {
+    rsp_lock lock;
     R4300::state.reset();
     recompiler_cycles = 0;
 }
@@ -601,6 +1965,7 @@ void halt(std::string reason) {
     if (!interpreter_halted) {
         interpreter_halted_reason = reason;
         interpreter_halted.store(true, std::memory_order_release);
+        interpreter::cpu::interrupt_block();
     }
 }
 
@@ -615,6 +1980,7 @@ std::string halted_reason(void) {
 void step(void) {
     if (interpreter_thread != NULL &&
         interpreter_halted.load(std::memory_order_acquire)) {
+        rsp_lock lock;
         R4300::step();
         RSP::step();
     }
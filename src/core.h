@@ -2,6 +2,7 @@
 #ifndef _CORE_H_INCLUDED_
 #define _CORE_H_INCLUDED_
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -9,10 +10,28 @@ namespace core {
 
 /** Number of cycles executed through recompiled code. */
 extern unsigned long recompiler_cycles;
-/** Number of recompiler cache clears. */
+/** Number of recompiled blocks evicted from the code buffers. */
 extern unsigned long recompiler_clears;
 /** Number of handlded recompiler requests (successful or not). */
 extern unsigned long recompiler_requests;
+/** Number of instruction blocks assembled by the recompiler. */
+extern unsigned long recompiler_blocks;
+/** Number of pseudo variables spilled to the stack by the recompiler. */
+extern unsigned long recompiler_spills;
+/** Number of bytes of binary code saved by the short jump encodings and
+ * peephole simplifications of the recompiler. */
+extern unsigned long recompiler_bytes_saved;
+/** Number of recompiled blocks replaced by the hot tier. */
+extern unsigned long recompiler_promotions;
+/** Number of speculative recompilation requests for static successors
+ * of recompiled blocks. */
+extern unsigned long recompiler_speculations;
+/** Number of bytes of memory writes checked for recompiled code. */
+extern unsigned long recompiler_invalidated_bytes;
+/** Number of recompiler cache entries invalidated by memory writes. */
+extern unsigned long recompiler_invalidated_entries;
+/** Number of cycles skipped by fast-forwarding idle loops. */
+extern unsigned long idle_skipped_cycles;
 
 /**
  * @brief Start the interpreter and recompiler in separate threads.
@@ -28,6 +47,67 @@ void start(void);
  */
 void stop(void);
 
+/**
+ * @brief Select the execution of the RSP on a dedicated thread.
+ *  Must be called before \ref core::start(). By default the RSP runs in
+ *  lockstep with the CPU on the interpreter thread, after each CPU block.
+ *  On its own thread, the RSP runs ahead of the CPU by a bounded number
+ *  of cycles, and synchronizes with the CPU only at observable points:
+ *  the CPU accesses to the SP registers, semaphore, DMEM and IMEM,
+ *  and the writes to the DPC registers pause the RSP thread, and the RSP
+ *  instructions accessing the coprocessor 0 (SP and DPC registers)
+ *  or raising MI_INTR_SP are executed by the interpreter thread.
+ */
+void set_rsp_thread(bool enabled);
+
+/**
+ * @brief Pause the RSP thread, and hold it paused until the matching
+ *  call to \ref core::unlock_rsp(). The calls can be nested.
+ *  No effect when the RSP runs in lockstep with the CPU.
+ */
+void lock_rsp(void);
+void unlock_rsp(void);
+
+/** Scoped pause of the RSP thread. */
+struct rsp_lock {
+    rsp_lock() { lock_rsp(); }
+    ~rsp_lock() { unlock_rsp(); }
+};
+
+/**
+ * @brief Select the directory of the persistent recompiler code cache.
+ * The cache is opened by \ref core::start(), for the loaded ROM.
+ */
+void set_code_cache_directory(std::string const &directory);
+
+/**
+ * @brief Select the geometry of the recompiler cache.
+ *  Must be called before \ref core::start() allocates the cache.
+ * @param page_size     Size of the cache pages, a power of two of at
+ *                      least 4KB. The code recompiled from addresses in
+ *                      the same page is stored in a common code buffer.
+ * @param buffer_size   Size of the code buffer allocated for each page.
+ * @param map_size      Number of entries of the direct map, one per word
+ *                      of the DRAM range covered by the cache, or zero
+ *                      to cover the full DRAM. The covered range must be
+ *                      a multiple of the page size. The code buffers
+ *                      of all pages must not exceed 2GB in total.
+ * @return false if the geometry is invalid, or the cache already allocated.
+ */
+bool set_recompiler_cache_geometry(size_t page_size, size_t buffer_size,
+                                   size_t map_size);
+
+/**
+ * @brief Select the recompilation thresholds.
+ * @param cache_threshold   Number of times a block is interpreted before
+ *                          requesting its recompilation.
+ * @param hot_threshold     Number of times a recompiled block is entered
+ *                          from the interpreter before requesting its
+ *                          recompilation with more expensive optimizations.
+ */
+void set_recompiler_thresholds(unsigned cache_threshold,
+                               unsigned hot_threshold);
+
 /** Reset the machine state. */
 void reset(void);
 
@@ -50,6 +130,20 @@ void invalidate_recompiler_cache(uint64_t start_phys_address,
 void get_recompiler_cache_stats(float *cache_usage,
                                 float *buffer_usage);
 
+/** Execution count of an instruction evaluated by the interpreter
+ * from recompiled code. */
+struct recompiler_fallback {
+    uint32_t instr;         /**< Instruction word, with the operand fields
+                                 not used for decoding cleared. */
+    unsigned long count;    /**< Number of executions. */
+};
+
+/** Return the interpreter fallback counters of the recompiled code,
+ * sorted by decreasing count. At most \p max entries are written to
+ * \p fallbacks; the number of entries written is returned. */
+size_t get_recompiler_fallback_stats(recompiler_fallback *fallbacks,
+                                     size_t max);
+
 }; /* namespace core */
 
 #endif /* _CORE_H_INCLUDED_ */
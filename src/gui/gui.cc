@@ -15,6 +15,7 @@
 #include <GLFW/glfw3.h>
 
 #include <core.h>
+#include <assembly/disassembler.h>
 #include <assembly/registers.h>
 #include <debugger.h>
 #include <r4300/state.h>
@@ -39,6 +40,10 @@ static unsigned long startCycles;
 static unsigned long startRecompilerCycles;
 static unsigned long startRecompilerRequests;
 static unsigned long startRecompilerCacheClears;
+static unsigned long startRecompilerBlocks;
+static unsigned long startRecompilerSpills;
+static unsigned long startRecompilerBytesSaved;
+static unsigned long startIdleSkippedCycles;
 static int activeController;
 
 static void glfwErrorCallback(int error, const char* description) {
@@ -53,6 +58,9 @@ static void ShowAnalytics(void) {
     static float recompilerCacheClears[5 * 60] = { 0 };
     static float recompilerCache[5 * 60] = { 0 };
     static float recompilerBuffer[5 * 60] = { 0 };
+    static float recompilerSpills[5 * 60] = { 0 };
+    static float recompilerBytesSaved[5 * 60] = { 0 };
+    static float idleSkippedCycles[5 * 60] = { 0 };
     static unsigned plotOffset = 0;
     unsigned plotLength = 5 * 60;
     unsigned plotUpdateInterval = 200;
@@ -66,6 +74,10 @@ static void ShowAnalytics(void) {
     unsigned long updateRecompilerCycles = core::recompiler_cycles;
     unsigned long updateRecompilerRequests = core::recompiler_requests;
     unsigned long updateRecompilerCacheClears = core::recompiler_clears;
+    unsigned long updateRecompilerBlocks = core::recompiler_blocks;
+    unsigned long updateRecompilerSpills = core::recompiler_spills;
+    unsigned long updateRecompilerBytesSaved = core::recompiler_bytes_saved;
+    unsigned long updateIdleSkippedCycles = core::idle_skipped_cycles;
 
     float elapsedMilliseconds = diffTime.count() * 1000.0;
     float machineMilliseconds = (updateCycles - startCycles) / 93750.0;
@@ -85,6 +97,22 @@ static void ShowAnalytics(void) {
         recompilerCacheClears[plotOffset] =
             updateRecompilerCacheClears - startRecompilerCacheClears;
 
+        recompilerSpills[plotOffset] =
+            (updateRecompilerBlocks == startRecompilerBlocks) ? 0 :
+                (float)(updateRecompilerSpills - startRecompilerSpills) /
+                (updateRecompilerBlocks - startRecompilerBlocks);
+
+        recompilerBytesSaved[plotOffset] =
+            (updateRecompilerBlocks == startRecompilerBlocks) ? 0 :
+                (float)(updateRecompilerBytesSaved -
+                        startRecompilerBytesSaved) /
+                (updateRecompilerBlocks - startRecompilerBlocks);
+
+        idleSkippedCycles[plotOffset] =
+            (updateCycles == startCycles) ? 0 :
+                (updateIdleSkippedCycles - startIdleSkippedCycles) * 100.0 /
+                (updateCycles - startCycles);
+
         core::get_recompiler_cache_stats(
             recompilerCache + plotOffset,
             recompilerBuffer + plotOffset);
@@ -98,6 +126,10 @@ static void ShowAnalytics(void) {
         startRecompilerCycles = updateRecompilerCycles;
         startRecompilerRequests = updateRecompilerRequests;
         startRecompilerCacheClears = updateRecompilerCacheClears;
+        startRecompilerBlocks = updateRecompilerBlocks;
+        startRecompilerSpills = updateRecompilerSpills;
+        startRecompilerBytesSaved = updateRecompilerBytesSaved;
+        startIdleSkippedCycles = updateIdleSkippedCycles;
     }
 
     ImGui::PlotLines("", timeRatio, plotLength, plotOffset,
@@ -107,11 +139,31 @@ static void ShowAnalytics(void) {
     ImGui::PlotLines("", recompilerRequests, plotLength, plotOffset,
         "recompiler requests", 0.0f, 500.0f, plotDimensions);
     ImGui::PlotLines("", recompilerCacheClears, plotLength, plotOffset,
-        "recompiler cache clears", 0.0f, 500.0f, plotDimensions);
+        "recompiler cache evictions", 0.0f, 500.0f, plotDimensions);
     ImGui::PlotLines("", recompilerCache, plotLength, plotOffset,
         "recompiler cache", 0.0f, 100.0f, plotDimensions);
     ImGui::PlotLines("", recompilerBuffer, plotLength, plotOffset,
         "recompiler buffer", 0.0f, 100.0f, plotDimensions);
+    ImGui::PlotLines("", recompilerSpills, plotLength, plotOffset,
+        "recompiler spills per block", 0.0f, 4.0f, plotDimensions);
+    ImGui::PlotLines("", recompilerBytesSaved, plotLength, plotOffset,
+        "recompiler bytes saved per block", 0.0f, 64.0f, plotDimensions);
+    ImGui::PlotLines("", idleSkippedCycles, plotLength, plotOffset,
+        "idle cycles skipped", 0.0f, 100.0f, plotDimensions);
+}
+
+static void ShowRecompilerFallbacks(void) {
+    core::recompiler_fallback fallbacks[32];
+    size_t len = core::get_recompiler_fallback_stats(fallbacks, 32);
+    if (len == 0) {
+        ImGui::Text("No interpreter fallbacks");
+        return;
+    }
+    for (size_t nr = 0; nr < len; nr++) {
+        std::string instr =
+            assembly::cpu::disassemble(0, fallbacks[nr].instr);
+        ImGui::Text("%-24.24s %12lu\n", instr.c_str(), fallbacks[nr].count);
+    }
 }
 
 static void ShowCpuRegisters(void) {
@@ -912,6 +964,7 @@ struct Module {
 
 static Module Modules[] = {
     { "Analytics",      -1,                     ShowAnalytics },
+    { "Recompiler",     -1,                     ShowRecompilerFallbacks },
     { "CPU",            Debugger::CPU,          ShowCpuRegisters },
     { "CPU::COP0",      Debugger::COP0,         ShowCpuCop0Registers },
     { "CPU::COP1",      Debugger::COP1,         ShowCpuCop1Registers },
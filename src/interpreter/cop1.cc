@@ -735,6 +735,17 @@ static void (*COP1_callbacks[64])(u32) = {
     eval_Reserved,  eval_Reserved,  eval_Reserved,  eval_Reserved,
 };
 
+eval_callback_t decode_COP1(u32 instr) {
+    u32 funct = assembly::getFunct(instr);
+    switch (assembly::getFmt(instr)) {
+    case 0x10: return COP1_S_callbacks[funct];
+    case 0x11: return COP1_D_callbacks[funct];
+    case 0x14: return COP1_W_callbacks[funct];
+    case 0x15: return COP1_L_callbacks[funct];
+    default:   return COP1_callbacks[assembly::getFmt(instr)];
+    }
+}
+
 void eval_COP1(u32 instr) {
     if (!state.cp0reg.CU1()) {
         takeException(CoprocessorUnusable, 0, false, false, 1u);
@@ -1329,6 +1329,14 @@ void eval_Instr(u32 instr) {
     if (instr) CPU_callbacks[assembly::getOpcode(instr)](instr);
 }
 
+eval_callback_t decode_Instr(u32 instr) {
+    switch (assembly::getOpcode(instr)) {
+    case 0: return SPECIAL_callbacks[assembly::getFunct(instr)];
+    case 1: return REGIMM_callbacks[assembly::getRt(instr)];
+    default: return CPU_callbacks[assembly::getOpcode(instr)];
+    }
+}
+
 void eval(void) {
     u64 vaddr = state.reg.pc;
     u64 paddr;
@@ -0,0 +1,290 @@
+#include <atomic>
+#include <cstring>
+
+#include <assembly/disassembler.h>
+#include <assembly/opcodes.h>
+#include <r4300/fastmem.h>
+#include <r4300/state.h>
+#include <interpreter.h>
+
+using namespace R4300;
+using namespace n64;
+
+namespace interpreter::cpu {
+
+/** Size of the cached physical memory range (DRAM). */
+#define BLOCK_CACHE_SIZE        UINT64_C(0x400000)
+/** Size of the pages tracking the range of cached code. Blocks never
+ * cross a page boundary. */
+#define BLOCK_PAGE_SHIFT        12
+#define BLOCK_PAGE_SIZE         (UINT64_C(1) << BLOCK_PAGE_SHIFT)
+#define BLOCK_PAGE_COUNT        (BLOCK_CACHE_SIZE >> BLOCK_PAGE_SHIFT)
+/** Maximum number of instructions in a block. */
+#define BLOCK_INSTR_MAX         64
+/** Capacity of the instruction arena. */
+#define BLOCK_ARENA_SIZE        0x40000
+
+/**
+ * @brief Predecoded instruction.
+ * @var block_entry::label
+ *      Dispatch label inside \ref eval_block. The last entry of
+ *      each block points to the block exit.
+ * @var block_entry::handler
+ *      Resolved instruction handler.
+ * @var block_entry::instr
+ *      Instruction word.
+ */
+struct block_entry {
+    void *label;
+    eval_callback_t handler;
+    u32 instr;
+};
+
+/**
+ * @brief Cache of predecoded blocks.
+ * @var block_cache::map
+ *      Offset plus one of the first entry of the block starting at each
+ *      DRAM word in the instruction arena, zero if the block is not cached.
+ * @var block_cache::code_start
+ *      Start offset of the range of cached instructions in each page.
+ * @var block_cache::code_end
+ *      End offset of the range of cached instructions in each page.
+ * @var block_cache::arena
+ *      Instruction arena, filled linearly. Entries are never reclaimed
+ *      individually, the full cache is cleared when the arena is full.
+ */
+struct block_cache {
+    u32 map[BLOCK_CACHE_SIZE >> 2];
+    u16 code_start[BLOCK_PAGE_COUNT];
+    u16 code_end[BLOCK_PAGE_COUNT];
+    struct block_entry arena[BLOCK_ARENA_SIZE];
+    size_t arena_len;
+};
+
+static struct block_cache block_cache;
+static std::atomic_bool block_interrupted;
+
+static void clear_page_code(unsigned page_nr) {
+    block_cache.code_start[page_nr] = BLOCK_PAGE_SIZE;
+    block_cache.code_end[page_nr] = 0;
+}
+
+static void clear_block_cache(void) {
+    memset(block_cache.map, 0, sizeof(block_cache.map));
+    for (unsigned page_nr = 0; page_nr < BLOCK_PAGE_COUNT; page_nr++) {
+        clear_page_code(page_nr);
+    }
+    block_cache.arena_len = 0;
+}
+
+/**
+ * Return true if the instruction \p instr ends the block:
+ * jump and branch instructions, whose delay slot is included in the block,
+ * and exception returns.
+ */
+static bool is_block_end(u32 instr, bool *delay_slot) {
+    *delay_slot = true;
+    switch (assembly::getOpcode(instr)) {
+    case assembly::SPECIAL:
+        return assembly::getFunct(instr) == assembly::JR ||
+               assembly::getFunct(instr) == assembly::JALR;
+    case assembly::REGIMM:
+    case assembly::J:
+    case assembly::JAL:
+    case assembly::BEQ:
+    case assembly::BNE:
+    case assembly::BLEZ:
+    case assembly::BGTZ:
+    case assembly::BEQL:
+    case assembly::BNEL:
+    case assembly::BLEZL:
+    case assembly::BGTZL:
+        return true;
+    case assembly::COP1:
+        return assembly::getRs(instr) == assembly::BCz;
+    case assembly::COP0:
+        *delay_slot = false;
+        return instr == 0x42000018u;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Decode the block starting at the physical address \p phys_address.
+ * Decoding stops after the first jump or branch instruction and its delay
+ * slot, or at the end of the page or of the contiguous physical region.
+ * @return the first entry of the decoded block, or NULL if the block
+ *  could not be fetched.
+ */
+static struct block_entry *decode_block(u64 phys_address, u64 phys_end,
+                                        void *call_label, void *nop_label,
+                                        void *exit_label) {
+    u64 page_end = (phys_address | (BLOCK_PAGE_SIZE - 1)) + 1;
+    unsigned len = 0;
+    bool end = false, delay_slot = false;
+
+    if (phys_end > page_end) {
+        phys_end = page_end;
+    }
+    if (block_cache.arena_len + BLOCK_INSTR_MAX + 1 > BLOCK_ARENA_SIZE) {
+        clear_block_cache();
+    }
+
+    struct block_entry *block = block_cache.arena + block_cache.arena_len;
+    for (u64 addr = phys_address; addr + 4 <= phys_end && len < BLOCK_INSTR_MAX;
+         addr += 4) {
+        u32 instr;
+        if (!state.bus->load_u32(addr, &instr)) {
+            break;
+        }
+        block[len].label = instr == 0 ? nop_label : call_label;
+        block[len].handler = decode_Instr(instr);
+        block[len].instr = instr;
+        len++;
+        if (end) {
+            break;
+        }
+        if (is_block_end(instr, &delay_slot)) {
+            end = true;
+            if (!delay_slot) {
+                break;
+            }
+        }
+    }
+
+    if (len == 0) {
+        return NULL;
+    }
+
+    block[len].label = exit_label;
+    block_cache.arena_len += len + 1;
+    block_cache.map[phys_address >> 2] = (block - block_cache.arena) + 1;
+
+    unsigned page_nr = phys_address >> BLOCK_PAGE_SHIFT;
+    u16 start_offset = phys_address & (BLOCK_PAGE_SIZE - 1);
+    u16 end_offset = start_offset + 4 * len;
+    if (start_offset < block_cache.code_start[page_nr]) {
+        block_cache.code_start[page_nr] = start_offset;
+    }
+    if (end_offset > block_cache.code_end[page_nr]) {
+        block_cache.code_end[page_nr] = end_offset;
+    }
+    // Catch the writes to the block instructions
+    // when write protection is enabled.
+    (void)fastmem::protect(phys_address);
+    return block;
+}
+
+bool eval_block(u64 phys_address, u64 phys_end) {
+#if ENABLE_TRACE || ENABLE_BREAKPOINTS
+    // The block cache bypasses the instruction fetch,
+    // which is instrumented by the debugger.
+    (void)phys_address;
+    (void)phys_end;
+    return false;
+#else
+    static_assert(State::Continue == 0 && State::Delay == 1 &&
+                  State::Jump == 2, "unexpected values for State::Action");
+    static void *const action_labels[] = {
+        &&action_continue, &&action_delay, &&action_jump,
+    };
+
+    if (phys_address >= BLOCK_CACHE_SIZE || (phys_address & 3) != 0) {
+        return false;
+    }
+    if (phys_end > BLOCK_CACHE_SIZE) {
+        phys_end = BLOCK_CACHE_SIZE;
+    }
+
+    struct block_entry *entry;
+    u32 offset = block_cache.map[phys_address >> 2];
+    if (offset != 0) {
+        entry = block_cache.arena + offset - 1;
+    } else {
+        entry = decode_block(phys_address, phys_end,
+            &&instr_call, &&instr_nop, &&block_exit);
+        if (entry == NULL) {
+            return false;
+        }
+    }
+
+    // Take the pending jump to the block start.
+    block_interrupted.store(false, std::memory_order_relaxed);
+    state.reg.pc = state.cpu.nextPc;
+    state.cpu.nextAction = State::Continue;
+    state.cpu.delaySlot = false;
+
+execute:
+    state.cycles++;
+    goto *entry->label;
+
+instr_call:
+    entry->handler(entry->instr);
+instr_nop:
+    entry++;
+    if (block_interrupted.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    goto *action_labels[state.cpu.nextAction];
+
+action_continue:
+    state.reg.pc += 4;
+    state.cpu.delaySlot = false;
+    if (entry->label == &&block_exit) {
+        return true;
+    }
+    goto execute;
+
+action_delay:
+    state.reg.pc += 4;
+    state.cpu.nextAction = State::Jump;
+    state.cpu.delaySlot = true;
+    if (entry->label == &&block_exit) {
+        return true;
+    }
+    goto execute;
+
+action_jump:
+block_exit:
+    return true;
+#endif /* ENABLE_TRACE || ENABLE_BREAKPOINTS */
+}
+
+void invalidate_block_cache(u64 start_phys_address, u64 end_phys_address) {
+    if (start_phys_address >= BLOCK_CACHE_SIZE) {
+        return;
+    }
+    if (end_phys_address > BLOCK_CACHE_SIZE) {
+        end_phys_address = BLOCK_CACHE_SIZE;
+    }
+
+    unsigned start_page = start_phys_address >> BLOCK_PAGE_SHIFT;
+    unsigned end_page = (end_phys_address - 1) >> BLOCK_PAGE_SHIFT;
+    for (unsigned page_nr = start_page; page_nr <= end_page; page_nr++) {
+        u64 page_address = (u64)page_nr << BLOCK_PAGE_SHIFT;
+        u64 code_start = page_address + block_cache.code_start[page_nr];
+        u64 code_end = page_address + block_cache.code_end[page_nr];
+        if (code_start >= end_phys_address || code_end <= start_phys_address) {
+            continue;
+        }
+
+        // Drop all the blocks of the page; the current block is
+        // interrupted in case it was overwritten.
+        memset(&block_cache.map[code_start >> 2], 0,
+               ((code_end - code_start) >> 2) * sizeof(u32));
+        clear_page_code(page_nr);
+        block_interrupted.store(true, std::memory_order_relaxed);
+    }
+}
+
+void interrupt_block(void) {
+    block_interrupted.store(true, std::memory_order_relaxed);
+}
+
+/** Initialize the page code ranges to empty. */
+static struct block_cache_init {
+    block_cache_init() { clear_block_cache(); }
+} block_cache_init;
+
+}; /* namespace interpreter::cpu */
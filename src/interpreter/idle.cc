@@ -0,0 +1,345 @@
+
+#include <assembly/disassembler.h>
+#include <assembly/opcodes.h>
+#include <r4300/cpu.h>
+#include <r4300/hw.h>
+#include <r4300/state.h>
+#include <interpreter.h>
+
+using namespace R4300;
+using namespace n64;
+
+namespace interpreter::cpu {
+
+/** Physical addresses of the device registers an idle loop may poll.
+ * Their values only change on scheduled events, or with the RSP,
+ * which must be halted. */
+const u32 SP_STATUS_REG = UINT32_C(0x04040010);
+const u32 MI_INTR_REG = UINT32_C(0x04300008);
+const u32 VI_CURRENT_REG = UINT32_C(0x04400010);
+const u32 PI_STATUS_REG = UINT32_C(0x04600010);
+const u32 SI_STATUS_REG = UINT32_C(0x04800018);
+
+/**
+ * @brief Decode the registers read and written by the instruction
+ *  \p instr, and check that it is allowed in an idle loop.
+ *  Allowed instructions are the loads, and the arithmetic and logic
+ *  instructions that cannot raise exceptions.
+ * @param branch    Set to true if the instruction is a branch or jump
+ *                  without link.
+ * @return false if the instruction cannot be part of an idle loop.
+ */
+static bool decode_idle_instr(u32 instr, u32 *reads, u32 *writes,
+                              bool *branch) {
+    u32 rs = UINT32_C(1) << assembly::getRs(instr);
+    u32 rt = UINT32_C(1) << assembly::getRt(instr);
+    u32 rd = UINT32_C(1) << assembly::getRd(instr);
+
+    *reads = 0;
+    *writes = 0;
+    *branch = false;
+
+    switch (assembly::getOpcode(instr)) {
+    case assembly::SPECIAL:
+        switch (assembly::getFunct(instr)) {
+        case assembly::SLL:
+        case assembly::SRL:
+        case assembly::SRA:
+        case assembly::DSLL:
+        case assembly::DSRL:
+        case assembly::DSRA:
+        case assembly::DSLL32:
+        case assembly::DSRL32:
+        case assembly::DSRA32:
+            *reads = rt; *writes = rd;
+            return true;
+        case assembly::SLLV:
+        case assembly::SRLV:
+        case assembly::SRAV:
+        case assembly::DSLLV:
+        case assembly::DSRLV:
+        case assembly::DSRAV:
+        case assembly::ADDU:
+        case assembly::SUBU:
+        case assembly::DADDU:
+        case assembly::DSUBU:
+        case assembly::AND:
+        case assembly::OR:
+        case assembly::XOR:
+        case assembly::NOR:
+        case assembly::SLT:
+        case assembly::SLTU:
+            *reads = rs | rt; *writes = rd;
+            return true;
+        case assembly::SYNC:
+            return true;
+        default:
+            return false;
+        }
+
+    case assembly::REGIMM:
+        switch (assembly::getRt(instr)) {
+        case assembly::BLTZ:
+        case assembly::BGEZ:
+        case assembly::BLTZL:
+        case assembly::BGEZL:
+            *reads = rs; *branch = true;
+            return true;
+        default:
+            return false;
+        }
+
+    case assembly::BEQ:
+    case assembly::BNE:
+    case assembly::BEQL:
+    case assembly::BNEL:
+        *reads = rs | rt; *branch = true;
+        return true;
+    case assembly::BLEZ:
+    case assembly::BGTZ:
+    case assembly::BLEZL:
+    case assembly::BGTZL:
+        *reads = rs; *branch = true;
+        return true;
+    case assembly::J:
+        *branch = true;
+        return true;
+
+    case assembly::ADDIU:
+    case assembly::DADDIU:
+    case assembly::SLTI:
+    case assembly::SLTIU:
+    case assembly::ANDI:
+    case assembly::ORI:
+    case assembly::XORI:
+    case assembly::LB:
+    case assembly::LBU:
+    case assembly::LH:
+    case assembly::LHU:
+    case assembly::LW:
+    case assembly::LWU:
+    case assembly::LD:
+        *reads = rs; *writes = rt;
+        return true;
+    case assembly::LUI:
+        *writes = rt;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** Return the target of the branch or jump instruction \p instr
+ * located at the virtual address \p address. */
+static u64 branch_target(u64 address, u32 instr) {
+    if (assembly::getOpcode(instr) == assembly::J) {
+        return ((address + 4) & ~UINT64_C(0x0fffffff)) |
+               ((u64)assembly::getTarget(instr) << 2);
+    }
+    return address + 4 + (u64)((i64)(i16)assembly::getImmediate(instr) << 2);
+}
+
+unsigned idle_loop_length(u64 address, u32 const *instrs, unsigned len) {
+    u32 reads[IDLE_LOOP_INSTR_MAX];
+    u32 writes[IDLE_LOOP_INSTR_MAX];
+    u32 written = 0;
+    unsigned nr;
+    bool branch = false;
+
+    if (len > IDLE_LOOP_INSTR_MAX) {
+        len = IDLE_LOOP_INSTR_MAX;
+    }
+
+    // The loop is the straight line sequence ending with a branch to the
+    // loop start, followed by its delay instruction.
+    for (nr = 0; nr < len && !branch; nr++) {
+        if (!decode_idle_instr(instrs[nr], &reads[nr], &writes[nr], &branch)) {
+            return 0;
+        }
+        written |= writes[nr];
+    }
+    if (!branch || nr >= len ||
+        branch_target(address + 4 * (nr - 1), instrs[nr - 1]) != address ||
+        !decode_idle_instr(instrs[nr], &reads[nr], &writes[nr], &branch) ||
+        branch) {
+        return 0;
+    }
+    written |= writes[nr];
+    nr++;
+
+    // Every iteration must compute the same values: registers read before
+    // being written in the loop cannot be modified by the loop.
+    u32 defined = 1;
+    for (unsigned pos = 0; pos < nr; pos++) {
+        if (reads[pos] & written & ~defined) {
+            return 0;
+        }
+        defined |= writes[pos];
+    }
+    return nr;
+}
+
+/**
+ * @brief Check whether the load from the virtual address \p address
+ *  returns the same value until the next scheduled event.
+ *
+ * DRAM and the SP memories are considered stable while the RSP is halted,
+ * which the caller checks:
+ *  - the SP DMA transfers are started by the RSP, or by the CPU,
+ *    and complete before the RSP halts or the register write returns;
+ *  - the PI DMA transfers write DRAM on their completion event, the SI
+ *    DMA transfers when started by the CPU;
+ *  - the RDP writes only the color and depth images. With the
+ *    asynchronous RDP, these writes are not ordered with the CPU cycle
+ *    count, and fast-forwarding the cycles does not reorder them
+ *    with the CPU accesses.
+ * The other device registers, including the DPC registers, are rejected.
+ * @param vi_current    Set to true if the load reads the VI_CURRENT_REG
+ *                      register, whose value changes with each line.
+ */
+static bool idle_load(u64 address, unsigned bytes, bool *vi_current) {
+    u64 phys_address;
+    if ((address & (bytes - 1)) != 0 ||
+        translate_address(address, &phys_address, false) != Exception::None) {
+        return false;
+    }
+    if (phys_address < UINT64_C(0x800000) ||
+        (phys_address >= UINT64_C(0x04000000) &&
+         phys_address <  UINT64_C(0x04002000))) {
+        return true;
+    }
+    switch (phys_address) {
+    case VI_CURRENT_REG:
+        *vi_current = true;
+        return true;
+    case SP_STATUS_REG:
+    case MI_INTR_REG:
+    case PI_STATUS_REG:
+    case SI_STATUS_REG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool idle_loop_until(u64 address, u32 const *instrs, unsigned len,
+                     ulong *until) {
+    unsigned nr = idle_loop_length(address, instrs, len);
+    if (nr == 0 || !(state.hwreg.SP_STATUS_REG & SP_STATUS_HALT)) {
+        return false;
+    }
+
+    // Evaluate the load addresses. The registers not written by the loop
+    // hold the same values at each iteration; the values of the registers
+    // written by the loop are tracked for simple address computations,
+    // and loaded values are unknown.
+    u64 values[32];
+    u32 known = ~UINT32_C(0);
+    bool vi_current = false;
+
+    for (unsigned reg = 0; reg < 32; reg++) {
+        values[reg] = state.reg.gpr[reg];
+    }
+
+    for (unsigned pos = 0; pos < nr; pos++) {
+        u32 instr = instrs[pos];
+        u32 rs = assembly::getRs(instr);
+        u32 rt = assembly::getRt(instr);
+        u32 rd = assembly::getRd(instr);
+        u64 imm = (u64)(i64)(i16)assembly::getImmediate(instr);
+        bool rs_known = (known >> rs) & 1;
+        bool rt_known = (known >> rt) & 1;
+        unsigned bytes = 0;
+
+        switch (assembly::getOpcode(instr)) {
+        case assembly::SPECIAL:
+            switch (assembly::getFunct(instr)) {
+            case assembly::SLL:
+                values[rd] = (u64)(i64)(i32)(
+                    (u32)values[rt] << assembly::getShamnt(instr));
+                known = rt_known ? known | (1u << rd) : known & ~(1u << rd);
+                break;
+            case assembly::ADDU:
+                values[rd] = (u64)(i64)(i32)(u32)(values[rs] + values[rt]);
+                known = rs_known && rt_known ?
+                    known | (1u << rd) : known & ~(1u << rd);
+                break;
+            case assembly::DADDU:
+                values[rd] = values[rs] + values[rt];
+                known = rs_known && rt_known ?
+                    known | (1u << rd) : known & ~(1u << rd);
+                break;
+            case assembly::OR:
+                values[rd] = values[rs] | values[rt];
+                known = rs_known && rt_known ?
+                    known | (1u << rd) : known & ~(1u << rd);
+                break;
+            case assembly::SYNC:
+                break;
+            default:
+                known &= ~(1u << rd);
+                break;
+            }
+            break;
+
+        case assembly::ADDIU:
+            values[rt] = (u64)(i64)(i32)(u32)(values[rs] + imm);
+            known = rs_known ? known | (1u << rt) : known & ~(1u << rt);
+            break;
+        case assembly::DADDIU:
+            values[rt] = values[rs] + imm;
+            known = rs_known ? known | (1u << rt) : known & ~(1u << rt);
+            break;
+        case assembly::ORI:
+            values[rt] = values[rs] | assembly::getImmediate(instr);
+            known = rs_known ? known | (1u << rt) : known & ~(1u << rt);
+            break;
+        case assembly::LUI:
+            values[rt] = (u64)(i64)(i32)(assembly::getImmediate(instr) << 16);
+            known |= 1u << rt;
+            break;
+        case assembly::SLTI:
+        case assembly::SLTIU:
+        case assembly::ANDI:
+        case assembly::XORI:
+            known &= ~(1u << rt);
+            break;
+
+        case assembly::LB:
+        case assembly::LBU: bytes = 1; break;
+        case assembly::LH:
+        case assembly::LHU: bytes = 2; break;
+        case assembly::LW:
+        case assembly::LWU: bytes = 4; break;
+        case assembly::LD:  bytes = 8; break;
+        default:
+            break;
+        }
+
+        if (bytes != 0) {
+            if (!rs_known || !idle_load(values[rs] + imm, bytes, &vi_current)) {
+                return false;
+            }
+            known &= ~(1u << rt);
+        }
+        // The zero register is never written.
+        values[0] = 0;
+        known |= 1;
+    }
+
+    // The loop is fast-forwarded to the next scheduled event, or
+    // to the next line increment when polling the current VI line.
+    *until = state.cpu.nextEvent;
+    if (vi_current && state.hwreg.vi_CyclesPerLine != 0) {
+        ulong diff = state.cycles - state.hwreg.vi_LastCycleCount;
+        ulong line = state.hwreg.vi_LastCycleCount +
+            (diff / state.hwreg.vi_CyclesPerLine + 1) *
+                state.hwreg.vi_CyclesPerLine;
+        if (line < *until) {
+            *until = line;
+        }
+    }
+    return *until > state.cycles && *until != (ulong)-1;
+}
+
+}; /* namespace interpreter::cpu */
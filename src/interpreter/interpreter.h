@@ -146,6 +146,75 @@ void eval_SPECIAL(u32 instr);
 void eval_REGIMM(u32 instr);
 void eval_Instr(u32 instr);
 
+/** Instruction handler type. */
+typedef void (*eval_callback_t)(u32 instr);
+
+/** Return the handler implementing the instruction \p instr,
+ * skipping the nested dispatch performed by \ref eval_Instr. */
+eval_callback_t decode_Instr(u32 instr);
+
+/**
+ * @brief Run the predecoded block starting at the physical address
+ *  \p phys_address, which must be the translation of the target
+ *  of the pending jump.
+ *
+ * The block is decoded and cached on first execution. Execution stops at the
+ * next jump or exception, leaving the state with action Jump. If the end of
+ * the block is reached, or the block is interrupted, the state is left
+ * with action Continue or Delay instead, and the execution must be
+ * completed with \ref eval.
+ * @param phys_address  Physical address of the block start.
+ * @param phys_end      Exclusive end address of the physical region mapped
+ *                      contiguously with the block start.
+ * @return false if the block cannot be cached, in which case no
+ *  instruction was executed.
+ */
+bool eval_block(u64 phys_address, u64 phys_end);
+
+/** Invalidate the predecoded blocks overlapping the physical address
+ * range \p start_phys_address, \p end_phys_address. */
+void invalidate_block_cache(u64 start_phys_address, u64 end_phys_address);
+
+/** Stop the execution of the current predecoded block after the
+ * current instruction. Can be called from any thread. */
+void interrupt_block(void);
+
+/** Maximum number of instructions in an idle loop. */
+#define IDLE_LOOP_INSTR_MAX     16
+
+/**
+ * @brief Check whether the instructions \p instrs, located at the virtual
+ *  address \p address, start with an idle loop candidate.
+ *
+ * The loop must be a straight line sequence ending with a branch to
+ * its first instruction, and containing only loads and arithmetic
+ * instructions, such that every iteration computes the same values
+ * as long as the loaded memory is not modified.
+ * @param instrs        Instruction words.
+ * @param len           Number of instruction words in \p instrs.
+ * @return the length of the loop including the delay instruction,
+ *  or 0 if the instructions do not form an idle loop.
+ */
+unsigned idle_loop_length(u64 address, u32 const *instrs, unsigned len);
+
+/**
+ * @brief Check whether the idle loop candidate located at the virtual
+ *  address \p address, which must be the current program counter,
+ *  spins until the next scheduled event.
+ *
+ * The loaded addresses are evaluated against the current register values,
+ * and must point to memory or device registers only modified by scheduled
+ * events, while the RSP is halted: DRAM, the SP memories, and the
+ * SP_STATUS, MI_INTR, VI_CURRENT, PI_STATUS and SI_STATUS registers.
+ * The writes of the RDP to DRAM are not ordered with the CPU cycles,
+ * and are ignored.
+ * @param until         Set to the cycle count the loop can be
+ *                      fast-forwarded to.
+ * @return true if the loop can be fast-forwarded.
+ */
+bool idle_loop_until(u64 address, u32 const *instrs, unsigned len,
+                     ulong *until);
+
 void eval_MFC0(u32 instr);
 void eval_DMFC0(u32 instr);
 void eval_MTC0(u32 instr);
@@ -215,6 +284,11 @@ void eval_COP1_W(u32 instr);
 void eval_COP1_L(u32 instr);
 void eval_COP1(u32 instr);
 
+/** Return the handler implementing the COP1 instruction \p instr,
+ * skipping the format and function dispatch performed by
+ * \ref eval_COP1. The coprocessor usability is not checked. */
+eval_callback_t decode_COP1(u32 instr);
+
 /** Helper for branch instructions: update the state to branch to \p btrue
  * or \p bfalse depending on the tested condition \p cond. */
 static inline void branch(bool cond, u64 btrue, u64 bfalse) {
@@ -365,6 +439,42 @@ void eval_VSUBC(u32 instr);
 void eval_VXOR(u32 instr);
 void eval_COP2(u32 instr);
 
+/** Return the handler implementing the COP2 instruction \p instr,
+ * skipping the dispatch performed by \ref eval_COP2. */
+cpu::eval_callback_t decode_COP2(u32 instr);
+
+/** Instruction sets available to the implementations of the
+ * vector instructions. */
+enum class simd_level {
+    scalar,
+    sse2,
+    sse41,
+    avx2,
+};
+
+/** Return the best instruction set supported by the host cpu,
+ * \ref simd_level::scalar if the SIMD implementations are not
+ * compiled in. */
+simd_level detect_simd_level(void);
+
+/** Return the implementation of the vector instruction with the funct
+ * field \p funct for the instruction set \p level, or NULL if the
+ * instruction is not implemented for this instruction set. */
+cpu::eval_callback_t get_simd_callback(simd_level level, u32 funct);
+
+/**
+ * @brief Select the implementations of the vector instructions.
+ *  The instructions missing from the selected instruction set fall back
+ *  to the scalar implementations. The best supported instruction set is
+ *  selected at startup. Blocks recompiled before the change keep
+ *  calling the previous implementations.
+ * @return false if \p level is not supported by the host cpu.
+ */
+bool set_simd_level(simd_level level);
+
+/** Return the instruction set selected by \ref set_simd_level. */
+simd_level get_simd_level(void);
+
 extern u16 RCP_ROM[512];
 extern u16 RSQ_ROM[512];
 
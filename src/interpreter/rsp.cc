@@ -590,7 +590,6 @@ void eval_VABS(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VADD(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -636,7 +635,6 @@ void eval_VADDC(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VAND(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -901,7 +899,6 @@ void eval_VLT(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VMACF(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -926,7 +923,6 @@ void eval_VMACQ(u32 instr) {
     core::halt("VMACQ unsupported");
 }
 
-__attribute__((weak))
 void eval_VMACU(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -947,7 +943,6 @@ void eval_VMACU(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VMADH(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -968,7 +963,6 @@ void eval_VMADH(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VMADL(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -989,7 +983,6 @@ void eval_VMADL(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VMADM(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -1010,7 +1003,6 @@ void eval_VMADM(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VMADN(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -1187,7 +1179,6 @@ void eval_VMULU(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VNAND(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -1249,7 +1240,6 @@ void eval_VNULL(u32 instr) {
     (void)instr;
 }
 
-__attribute__((weak))
 void eval_VNOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -1270,7 +1260,6 @@ void eval_VNOR(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VNXOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -1291,7 +1280,6 @@ void eval_VNXOR(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -1594,7 +1582,6 @@ void eval_VSUBC(u32 instr) {
     state.rspreg.vr[vd] = out;
 }
 
-__attribute__((weak))
 void eval_VXOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -2118,7 +2105,9 @@ void eval_XORI(u32 instr) {
 }
 
 
-static void (*COP2_callbacks[64])(u32) = {
+/** Default implementations of the vector instructions,
+ * indexed by the funct field. */
+static cpu::eval_callback_t const COP2_scalar_callbacks[64] = {
     /* Multiply group */
     eval_VMULF,     eval_VMULU,     eval_VRNDP,     eval_VMULQ,
     eval_VMUDL,     eval_VMUDM,     eval_VMUDN,     eval_VMUDH,
@@ -2143,6 +2132,48 @@ static void (*COP2_callbacks[64])(u32) = {
     eval_Reserved,  eval_Reserved,  eval_Reserved,  eval_VNULL,
 };
 
+/** Implementations of the vector instructions selected by
+ * \ref set_simd_level, indexed by the funct field. */
+static cpu::eval_callback_t COP2_callbacks[64];
+static simd_level COP2_simd_level;
+
+/** Default when the SIMD implementations are not linked in. */
+__attribute__((weak))
+simd_level detect_simd_level(void) {
+    return simd_level::scalar;
+}
+
+/** Default when the SIMD implementations are not linked in. */
+__attribute__((weak))
+cpu::eval_callback_t get_simd_callback(simd_level level, u32 funct) {
+    (void)level;
+    (void)funct;
+    return NULL;
+}
+
+bool set_simd_level(simd_level level) {
+    if (level > detect_simd_level()) {
+        return false;
+    }
+    for (u32 funct = 0; funct < 64; funct++) {
+        cpu::eval_callback_t callback = level == simd_level::scalar ? NULL :
+            get_simd_callback(level, funct);
+        COP2_callbacks[funct] = callback != NULL ? callback :
+            COP2_scalar_callbacks[funct];
+    }
+    COP2_simd_level = level;
+    return true;
+}
+
+simd_level get_simd_level(void) {
+    return COP2_simd_level;
+}
+
+__attribute__((constructor))
+static void init_COP2_callbacks(void) {
+    set_simd_level(detect_simd_level());
+}
+
 void eval_COP2(u32 instr) {
     switch (assembly::getRs(instr)) {
     case assembly::MFCz: eval_MFC2(instr); break;
@@ -2159,6 +2190,21 @@ void eval_COP2(u32 instr) {
     }
 }
 
+cpu::eval_callback_t decode_COP2(u32 instr) {
+    switch (assembly::getRs(instr)) {
+    case assembly::MFCz: return eval_MFC2;
+    case assembly::MTCz: return eval_MTC2;
+    case assembly::CFCz: return eval_CFC2;
+    case assembly::CTCz: return eval_CTC2;
+    default:
+        if ((instr & (1lu << 25)) == 0) {
+            return eval_COP2;
+        } else {
+            return COP2_callbacks[instr & UINT32_C(0x3f)];
+        }
+    }
+}
+
 static void (*SPECIAL_callbacks[64])(u32) = {
     eval_SLL,       eval_Reserved,  eval_SRL,       eval_SRA,
     eval_SLLV,      eval_Reserved,  eval_SRLV,      eval_SRAV,
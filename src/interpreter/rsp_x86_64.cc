@@ -1,9 +1,26 @@
 
 /*
- * This file implements the vector instructions using x86_64 sse2
- * features, overriding the default implementations in rsp.cc
+ * This file implements the vector instructions using x86_64 SIMD
+ * features, replacing the default implementations in rsp.cc
+ *
+ * The file is compiled once for each supported instruction set:
+ * rsp_x86_64_sse41.cc and rsp_x86_64_avx2.cc include it again with
+ * the following macros defined, and the variant in use is selected
+ * at startup by \ref interpreter::rsp::set_simd_level.
+ *  - RSP_X86_64_VARIANT  name of the namespace enclosing the variant
+ *  - RSP_X86_64_TARGET   function attribute enabling the instruction set
+ *  - RSP_X86_64_SSE41    enables the SSSE3 and SSE4.1 code paths
+ *  - RSP_X86_64_DISPATCH defined for the base sse2 variant only,
+ *                        which implements the runtime dispatch
  */
 
+#ifndef RSP_X86_64_VARIANT
+#define RSP_X86_64_VARIANT  sse2
+#define RSP_X86_64_TARGET
+#define RSP_X86_64_SSE41    0
+#define RSP_X86_64_DISPATCH
+#endif
+
 #include <cstring>
 #include <iomanip>
 #include <iostream>
@@ -26,19 +43,63 @@
 using namespace R4300;
 using namespace n64;
 
-namespace interpreter::rsp {
+namespace interpreter::rsp::RSP_X86_64_VARIANT {
 
 /**
  * Helper for loading a vector register into an m128i value.
  */
+RSP_X86_64_TARGET
 static __m128i mm_load_vr(uint32_t vr) {
     return _mm_load_si128((__m128i *)(state.rspreg.vr + vr));
 }
 
+#if RSP_X86_64_SSE41
+/**
+ * Byte shuffle masks implementing the element selection, indexed by the
+ * element specifier.
+ */
+alignas(16) static const u8 select_element_masks[16][16] = {
+    // Vector Operand
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+
+    // Scalar Quarter
+    {  0,  1,  0,  1,  4,  5,  4,  5,  8,  9,  8,  9, 12, 13, 12, 13 },
+    {  2,  3,  2,  3,  6,  7,  6,  7, 10, 11, 10, 11, 14, 15, 14, 15 },
+
+    // Scalar Half
+    {  0,  1,  0,  1,  0,  1,  0,  1,  8,  9,  8,  9,  8,  9,  8,  9 },
+    {  2,  3,  2,  3,  2,  3,  2,  3, 10, 11, 10, 11, 10, 11, 10, 11 },
+    {  4,  5,  4,  5,  4,  5,  4,  5, 12, 13, 12, 13, 12, 13, 12, 13 },
+    {  6,  7,  6,  7,  6,  7,  6,  7, 14, 15, 14, 15, 14, 15, 14, 15 },
+
+    // Scalar Whole
+    {  0,  1,  0,  1,  0,  1,  0,  1,  0,  1,  0,  1,  0,  1,  0,  1 },
+    {  2,  3,  2,  3,  2,  3,  2,  3,  2,  3,  2,  3,  2,  3,  2,  3 },
+    {  4,  5,  4,  5,  4,  5,  4,  5,  4,  5,  4,  5,  4,  5,  4,  5 },
+    {  6,  7,  6,  7,  6,  7,  6,  7,  6,  7,  6,  7,  6,  7,  6,  7 },
+    {  8,  9,  8,  9,  8,  9,  8,  9,  8,  9,  8,  9,  8,  9,  8,  9 },
+    { 10, 11, 10, 11, 10, 11, 10, 11, 10, 11, 10, 11, 10, 11, 10, 11 },
+    { 12, 13, 12, 13, 12, 13, 12, 13, 12, 13, 12, 13, 12, 13, 12, 13 },
+    { 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15 },
+};
+
+/**
+ * Helper for loading a vector register into an m128i value with
+ * proper element selection applied.
+ */
+RSP_X86_64_TARGET
+static __m128i mm_load_vr_elt(uint32_t vr, uint32_t e) {
+    __m128i const res = _mm_load_si128((__m128i *)(state.rspreg.vr + vr));
+    return _mm_shuffle_epi8(res,
+        _mm_load_si128((__m128i const *)select_element_masks[e & 0xfu]));
+}
+#else
 /**
  * Helper for loading a vector register into an m128i value with
  * proper element selection applied.
  */
+RSP_X86_64_TARGET
 static __m128i mm_load_vr_elt(uint32_t vr, uint32_t e) {
     __m128i res;
     switch (e) {
@@ -84,10 +145,12 @@ static __m128i mm_load_vr_elt(uint32_t vr, uint32_t e) {
     }
     return res;
 }
+#endif /* RSP_X86_64_SSE41 */
 
 /**
  * Helper for storing a vector register from an m128i value.
  */
+RSP_X86_64_TARGET
 static void mm_store_vr(uint32_t vr, __m128i val) {
     return _mm_store_si128((__m128i *)(state.rspreg.vr + vr), val);
 }
@@ -96,6 +159,7 @@ static void mm_store_vr(uint32_t vr, __m128i val) {
  * Helper for loading the accumulator into high, middle, and low
  * vector registers.
  */
+RSP_X86_64_TARGET
 static void mm_load_acc(__m128i *acc_hi, __m128i *acc_md, __m128i *acc_lo) {
     *acc_hi = _mm_load_si128((__m128i *)state.rspreg.vacc.hi.h);
     *acc_md = _mm_load_si128((__m128i *)state.rspreg.vacc.md.h);
@@ -106,6 +170,7 @@ static void mm_load_acc(__m128i *acc_hi, __m128i *acc_md, __m128i *acc_lo) {
  * Helper for storing the accumulator from high, middle, and low
  * vector registers.
  */
+RSP_X86_64_TARGET
 static void mm_store_acc(__m128i acc_hi, __m128i acc_md, __m128i acc_lo) {
     _mm_store_si128((__m128i *)state.rspreg.vacc.hi.h, acc_hi);
     _mm_store_si128((__m128i *)state.rspreg.vacc.md.h, acc_md);
@@ -115,6 +180,7 @@ static void mm_store_acc(__m128i acc_hi, __m128i acc_md, __m128i acc_lo) {
 /**
  * Helper for updating the lower word of the accumulator.
  */
+RSP_X86_64_TARGET
 static void mm_store_acc_lo(__m128i acc_lo) {
     _mm_store_si128((__m128i *)state.rspreg.vacc.lo.h, acc_lo);
 }
@@ -123,6 +189,7 @@ static void mm_store_acc_lo(__m128i acc_lo) {
  * Helper for adding eight 48bit values split over high,
  * middle, and low 128bit vectors.
  */
+RSP_X86_64_TARGET
 static void mm_add_epi48(__m128i const a_hi,
                          __m128i const a_md,
                          __m128i const a_lo,
@@ -168,15 +235,21 @@ static void mm_add_epi48(__m128i const a_hi,
  * Cond must contain valid boolean values, i.e. 0000 for false and 1111 for
  * true. Return the result of cond ? a : b for each component.
  */
+RSP_X86_64_TARGET
 static __m128i mm_select_epi16(__m128i const cond,
                                __m128i const a,
                                __m128i const b) {
+#if RSP_X86_64_SSE41
+    return _mm_blendv_epi8(b, a, cond);
+#else
     return _mm_or_si128(_mm_and_si128(cond, a), _mm_andnot_si128(cond, b));
+#endif
 }
 
 /**
  * Helper implementing the binary complement function.
  */
+RSP_X86_64_TARGET
 static __m128i mm_not_si128(__m128i const a) {
     return _mm_xor_si128(a, _mm_set1_epi32(0xffffffff));
 }
@@ -184,6 +257,7 @@ static __m128i mm_not_si128(__m128i const a) {
 /**
  * Helper to perform signed clamp on a two word value.
  */
+RSP_X86_64_TARGET
 static __m128i mm_clamphi_epi48(__m128i const hi, __m128i const md) {
     __m128i const hi_sign = _mm_srai_epi16(hi, 15);
     __m128i const md_sign = _mm_srai_epi16(md, 15);
@@ -195,6 +269,7 @@ static __m128i mm_clamphi_epi48(__m128i const hi, __m128i const md) {
 /**
  * Helper to perform unsigned clamp on a two word value.
  */
+RSP_X86_64_TARGET
 static __m128i mm_clamphi_epu48(__m128i const hi, __m128i const md) {
     __m128i const hi_sign = _mm_srai_epi16(hi, 15);
     __m128i const md_sign = _mm_srai_epi16(md, 15);
@@ -206,6 +281,7 @@ static __m128i mm_clamphi_epu48(__m128i const hi, __m128i const md) {
 /**
  * Helper to perform unsigned clamp on a two word value.
  */
+RSP_X86_64_TARGET
 static __m128i mm_clamplo_epi48(__m128i const hi,
                                 __m128i const md,
                                 __m128i const lo) {
@@ -216,7 +292,153 @@ static __m128i mm_clamplo_epi48(__m128i const hi,
         _mm_xor_si128(hi_sign, _mm_set1_epi16(0xffff)));
 }
 
+/**
+ * Helper implementing the unsigned greater than comparison.
+ */
+RSP_X86_64_TARGET
+static __m128i mm_cmpgt_epu16(__m128i const a, __m128i const b) {
+    __m128i const signbit = _mm_set1_epi16(0x8000);
+    return _mm_cmpgt_epi16(
+        _mm_xor_si128(a, signbit),
+        _mm_xor_si128(b, signbit));
+}
+
+/**
+ * Helper for expanding the eight low bits of a flag register
+ * (VCO, VCC, VCE) to boolean values, one per component.
+ */
+RSP_X86_64_TARGET
+static __m128i mm_load_flags(u16 flags) {
+    __m128i const bits = _mm_set_epi16(
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    return _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(flags), bits), bits);
+}
+
+/**
+ * Helper for packing boolean values to a flag register.
+ * The components of lo and hi are returned as the bits 0-7 and 8-15
+ * respectively.
+ */
+RSP_X86_64_TARGET
+static u16 mm_store_flags(__m128i const lo, __m128i const hi) {
+    return _mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+}
+
+/**
+ * Helper computing the fractional multiplication of VMULF and VMULU:
+ * the signed product is shifted left by one and rounded by adding 0x8000,
+ * and returned as a 48bit value split over high, middle, and low
+ * 128bit vectors.
+ */
+RSP_X86_64_TARGET
+static void mm_mulf_epi16(__m128i const a,
+                          __m128i const b,
+                          __m128i *res_hi_ptr,
+                          __m128i *res_md_ptr,
+                          __m128i *res_lo_ptr) {
 
+    // Compute multiplication, with sign extension.
+    __m128i res_lo = _mm_mullo_epi16(a, b);
+    __m128i res_md = _mm_mulhi_epi16(a, b);
+    __m128i res_hi = _mm_srai_epi16(res_md, 15);
+
+    // Shift the result left by one. The sign extension is unchanged.
+    res_md = _mm_or_si128(
+        _mm_slli_epi16(res_md, 1),
+        _mm_srli_epi16(res_lo, 15));
+    res_lo =
+        _mm_slli_epi16(res_lo, 1);
+
+    // Add 0x8000 to the low word. The carry is 0 for no carry,
+    // -1 otherwise, and propagates to the high word if the middle
+    // word is 0xffff.
+    __m128i const carry_lo = _mm_srai_epi16(res_lo, 15);
+    __m128i const carry_md = _mm_and_si128(
+        _mm_cmpeq_epi16(res_md, _mm_set1_epi16(-1)), carry_lo);
+
+    res_lo = _mm_xor_si128(res_lo, _mm_set1_epi16(0x8000));
+    res_md = _mm_sub_epi16(res_md, carry_lo);
+    res_hi = _mm_sub_epi16(res_hi, carry_md);
+
+    *res_hi_ptr = res_hi;
+    *res_md_ptr = res_md;
+    *res_lo_ptr = res_lo;
+}
+
+RSP_X86_64_TARGET
+void eval_VABS(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Negate the components of b where a is negative, and clear them
+    // where a is zero.
+#if RSP_X86_64_SSE41
+    __m128i const res = _mm_sign_epi16(b, a);
+#else
+    __m128i const neg = _mm_srai_epi16(a, 15);
+    __m128i const zero = _mm_cmpeq_epi16(a, _mm_setzero_si128());
+    __m128i const res = _mm_andnot_si128(zero,
+        _mm_sub_epi16(_mm_xor_si128(b, neg), neg));
+#endif
+
+    // Save result to output register and lower accumulator word.
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+}
+
+RSP_X86_64_TARGET
+void eval_VADD(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs. The carry is 0 for no carry, -1 otherwise.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const carry = mm_load_flags(state.rspreg.vco);
+
+    // The lower accumulator word receives the truncated sum.
+    __m128i const sum = _mm_sub_epi16(_mm_add_epi16(a, b), carry);
+
+    // Add the carry to the lesser operand first: this addition
+    // can only saturate if both operands are INT16_MAX, in which case
+    // the final result is saturated regardless.
+    __m128i const min = _mm_subs_epi16(_mm_min_epi16(a, b), carry);
+    __m128i const res = _mm_adds_epi16(min, _mm_max_epi16(a, b));
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(sum);
+    state.rspreg.vco = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VADDC(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute unsigned sum, the carry is set if the sum wraps around.
+    __m128i const res = _mm_add_epi16(a, b);
+    __m128i const carry = mm_cmpgt_epu16(a, res);
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vco = mm_store_flags(carry, _mm_setzero_si128());
+}
+
+RSP_X86_64_TARGET
 void eval_VAND(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -235,6 +457,200 @@ void eval_VAND(u32 instr) {
     mm_store_acc_lo(res);
 }
 
+RSP_X86_64_TARGET
+void eval_VCH(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const ones = _mm_cmpeq_epi16(zero, zero);
+
+    // Compare a with -b if the signs differ, with b otherwise.
+    __m128i const sign = _mm_srai_epi16(_mm_xor_si128(a, b), 15);
+    __m128i const b_neg = _mm_srai_epi16(b, 15);
+    __m128i const tmp = mm_select_epi16(sign,
+        _mm_add_epi16(a, b), _mm_sub_epi16(a, b));
+
+    __m128i const tmp_le = mm_not_si128(_mm_cmpgt_epi16(tmp, zero));
+    __m128i const tmp_ge = mm_not_si128(_mm_srai_epi16(tmp, 15));
+    __m128i const le = mm_select_epi16(sign, tmp_le, b_neg);
+    __m128i const ge = mm_select_epi16(sign, b_neg, tmp_ge);
+    __m128i const vce = _mm_and_si128(sign, _mm_cmpeq_epi16(tmp, ones));
+    __m128i const neq = mm_not_si128(
+        _mm_or_si128(_mm_cmpeq_epi16(tmp, zero), vce));
+
+    // Clip a to the selected bound.
+    __m128i const res = mm_select_epi16(sign,
+        mm_select_epi16(le, _mm_sub_epi16(zero, b), a),
+        mm_select_epi16(ge, b, a));
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vcc = mm_store_flags(le, ge);
+    state.rspreg.vco = mm_store_flags(sign, neq);
+    state.rspreg.vce = mm_store_flags(vce, zero);
+}
+
+RSP_X86_64_TARGET
+void eval_VCL(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs, and the flags set by the previous VCH instruction.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const sign = mm_load_flags(state.rspreg.vco);
+    __m128i const neq = mm_load_flags(state.rspreg.vco >> 8);
+    __m128i const vce = mm_load_flags(state.rspreg.vce);
+    __m128i le = mm_load_flags(state.rspreg.vcc);
+    __m128i ge = mm_load_flags(state.rspreg.vcc >> 8);
+
+    // Compare a with -b if the signs differed, updating the less than
+    // or equal flag.
+    __m128i const sum = _mm_add_epi16(a, b);
+    __m128i const carry = mm_cmpgt_epu16(a, sum);
+    __m128i const sum_zero = _mm_cmpeq_epi16(sum, zero);
+    __m128i const sum_le = mm_select_epi16(vce,
+        _mm_or_si128(sum_zero, mm_not_si128(carry)),
+        _mm_andnot_si128(carry, sum_zero));
+    le = mm_select_epi16(_mm_andnot_si128(neq, sign), sum_le, le);
+
+    // Compare a with b otherwise, updating the greater than or
+    // equal flag.
+    __m128i const diff_ge = mm_not_si128(mm_cmpgt_epu16(b, a));
+    ge = mm_select_epi16(_mm_or_si128(neq, sign), ge, diff_ge);
+
+    // Clip a to the selected bound.
+    __m128i const res = mm_select_epi16(sign,
+        mm_select_epi16(le, _mm_sub_epi16(zero, b), a),
+        mm_select_epi16(ge, b, a));
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vcc = mm_store_flags(le, ge);
+    state.rspreg.vco = 0;
+    state.rspreg.vce = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VCR(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const ones = _mm_cmpeq_epi16(zero, zero);
+
+    // Compare a with the one's complement of b if the signs differ,
+    // with b otherwise.
+    __m128i const sign = _mm_srai_epi16(_mm_xor_si128(a, b), 15);
+    __m128i const b_neg = _mm_srai_epi16(b, 15);
+    __m128i const tmp = mm_select_epi16(sign,
+        _mm_sub_epi16(_mm_add_epi16(a, b), ones), _mm_sub_epi16(a, b));
+
+    __m128i const tmp_le = mm_not_si128(_mm_cmpgt_epi16(tmp, zero));
+    __m128i const tmp_ge = mm_not_si128(_mm_srai_epi16(tmp, 15));
+    __m128i const le = mm_select_epi16(sign, tmp_le, b_neg);
+    __m128i const ge = mm_select_epi16(sign, b_neg, tmp_ge);
+
+    // Clip a to the selected bound.
+    __m128i const res = mm_select_epi16(sign,
+        mm_select_epi16(le, mm_not_si128(b), a),
+        mm_select_epi16(ge, b, a));
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vcc = mm_store_flags(le, ge);
+    state.rspreg.vco = 0;
+    state.rspreg.vce = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VEQ(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const neq = mm_load_flags(state.rspreg.vco >> 8);
+
+    // Compute the comparison; the result is b in all cases.
+    __m128i const cmp = _mm_andnot_si128(neq, _mm_cmpeq_epi16(a, b));
+
+    mm_store_vr(vd, b);
+    mm_store_acc_lo(b);
+    state.rspreg.vcc = mm_store_flags(cmp, _mm_setzero_si128());
+    state.rspreg.vco = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VGE(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const carry = mm_load_flags(state.rspreg.vco);
+    __m128i const neq = mm_load_flags(state.rspreg.vco >> 8);
+
+    // Compute the comparison, equal operands compare greater
+    // unless both the carry and not equal flags are set.
+    __m128i const eq = _mm_andnot_si128(
+        _mm_and_si128(carry, neq), _mm_cmpeq_epi16(a, b));
+    __m128i const cmp = _mm_or_si128(_mm_cmpgt_epi16(a, b), eq);
+    __m128i const res = mm_select_epi16(cmp, a, b);
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vcc = mm_store_flags(cmp, _mm_setzero_si128());
+    state.rspreg.vco = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VLT(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const carry = mm_load_flags(state.rspreg.vco);
+    __m128i const neq = mm_load_flags(state.rspreg.vco >> 8);
+
+    // Compute the comparison, equal operands compare lesser
+    // if both the carry and not equal flags are set.
+    __m128i const eq = _mm_and_si128(
+        _mm_and_si128(carry, neq), _mm_cmpeq_epi16(a, b));
+    __m128i const cmp = _mm_or_si128(_mm_cmplt_epi16(a, b), eq);
+    __m128i const res = mm_select_epi16(cmp, a, b);
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vcc = mm_store_flags(cmp, _mm_setzero_si128());
+    state.rspreg.vco = 0;
+}
+
+RSP_X86_64_TARGET
 void eval_VMACF(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -276,9 +692,7 @@ void eval_VMACF(u32 instr) {
     mm_store_acc(acc_hi, acc_md, acc_lo);
 }
 
-/** SSE2 implementation not required */
-void eval_VMACQ(u32 instr);
-
+RSP_X86_64_TARGET
 void eval_VMACU(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -320,6 +734,7 @@ void eval_VMACU(u32 instr) {
     mm_store_acc(acc_hi, acc_md, acc_lo);
 }
 
+RSP_X86_64_TARGET
 void eval_VMADH(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -350,6 +765,7 @@ void eval_VMADH(u32 instr) {
     mm_store_acc(acc_hi, acc_md, acc_lo);
 }
 
+RSP_X86_64_TARGET
 void eval_VMADL(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -379,6 +795,7 @@ void eval_VMADL(u32 instr) {
     mm_store_acc(acc_hi, acc_md, acc_lo);
 }
 
+RSP_X86_64_TARGET
 void eval_VMADM(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -411,6 +828,7 @@ void eval_VMADM(u32 instr) {
     mm_store_acc(acc_hi, acc_md, acc_lo);
 }
 
+RSP_X86_64_TARGET
 void eval_VMADN(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -443,9 +861,168 @@ void eval_VMADN(u32 instr) {
     mm_store_acc(acc_hi, acc_md, acc_lo);
 }
 
-/** SSE2 implementation not required */
-void eval_VMOV(u32 instr);
+RSP_X86_64_TARGET
+void eval_VMRG(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const cmp = mm_load_flags(state.rspreg.vcc);
 
+    // Select a or b according to the compare flags.
+    __m128i const res = mm_select_epi16(cmp, a, b);
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vco = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VMUDH(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute multiplication, with sign extension.
+    // The product is written to the high and middle accumulator words.
+    __m128i const acc_lo = _mm_setzero_si128();
+    __m128i const acc_md = _mm_mullo_epi16(a, b);
+    __m128i const acc_hi = _mm_mulhi_epi16(a, b);
+
+    // The result is the middle word of the accumulator,
+    // signed clamped.
+    __m128i const res = mm_clamphi_epi48(acc_hi, acc_md);
+
+    mm_store_vr(vd, res);
+    mm_store_acc(acc_hi, acc_md, acc_lo);
+}
+
+RSP_X86_64_TARGET
+void eval_VMUDL(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute high word of unsigned multiplication.
+    // The product is written to the lower accumulator word, the result
+    // is the lower word of the accumulator, always within range.
+    __m128i const res = _mm_mulhi_epu16(a, b);
+
+    mm_store_vr(vd, res);
+    mm_store_acc(_mm_setzero_si128(), _mm_setzero_si128(), res);
+}
+
+RSP_X86_64_TARGET
+void eval_VMUDM(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute multiplication of signed a with unsigned b,
+    // with sign extension.
+    __m128i const acc_lo = _mm_mullo_epi16(a, b);
+    __m128i acc_md = _mm_mulhi_epi16(a, b);
+    acc_md = _mm_add_epi16(acc_md, _mm_and_si128(a, _mm_srai_epi16(b, 15)));
+    __m128i const acc_hi = _mm_srai_epi16(acc_md, 15);
+
+    // The result is the middle word of the accumulator,
+    // always within the signed range.
+    mm_store_vr(vd, acc_md);
+    mm_store_acc(acc_hi, acc_md, acc_lo);
+}
+
+RSP_X86_64_TARGET
+void eval_VMUDN(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute multiplication of unsigned a with signed b,
+    // with sign extension.
+    __m128i const acc_lo = _mm_mullo_epi16(a, b);
+    __m128i acc_md = _mm_mulhi_epi16(a, b);
+    acc_md = _mm_add_epi16(acc_md, _mm_and_si128(b, _mm_srai_epi16(a, 15)));
+    __m128i const acc_hi = _mm_srai_epi16(acc_md, 15);
+
+    // The result is the lower word of the accumulator,
+    // always within range.
+    mm_store_vr(vd, acc_lo);
+    mm_store_acc(acc_hi, acc_md, acc_lo);
+}
+
+RSP_X86_64_TARGET
+void eval_VMULF(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute multiplication, with sign extension, shifted left
+    // by one and rounded.
+    __m128i acc_hi, acc_md, acc_lo;
+    mm_mulf_epi16(a, b, &acc_hi, &acc_md, &acc_lo);
+
+    // The result is the middle word of the accumulator,
+    // signed clamped.
+    __m128i const res = mm_clamphi_epi48(acc_hi, acc_md);
+
+    mm_store_vr(vd, res);
+    mm_store_acc(acc_hi, acc_md, acc_lo);
+}
+
+RSP_X86_64_TARGET
+void eval_VMULU(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute multiplication, with sign extension, shifted left
+    // by one and rounded.
+    __m128i acc_hi, acc_md, acc_lo;
+    mm_mulf_epi16(a, b, &acc_hi, &acc_md, &acc_lo);
+
+    // The result is the middle word of the accumulator,
+    // unsigned clamped.
+    __m128i const res = mm_clamphi_epu48(acc_hi, acc_md);
+
+    mm_store_vr(vd, res);
+    mm_store_acc(acc_hi, acc_md, acc_lo);
+}
+
+RSP_X86_64_TARGET
 void eval_VNAND(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -466,12 +1043,29 @@ void eval_VNAND(u32 instr) {
     mm_store_acc_lo(res);
 }
 
-/** SSE2 implementation not required */
-void eval_VNOP(u32 instr);
+RSP_X86_64_TARGET
+void eval_VNE(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const neq = mm_load_flags(state.rspreg.vco >> 8);
+
+    // Compute the comparison; the result is a in all cases.
+    __m128i const cmp = _mm_or_si128(neq,
+        mm_not_si128(_mm_cmpeq_epi16(a, b)));
 
-/** SSE2 implementation not required */
-void eval_VNULL(u32 instr);
+    mm_store_vr(vd, a);
+    mm_store_acc_lo(a);
+    state.rspreg.vcc = mm_store_flags(cmp, _mm_setzero_si128());
+    state.rspreg.vco = 0;
+}
 
+RSP_X86_64_TARGET
 void eval_VNOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -492,6 +1086,7 @@ void eval_VNOR(u32 instr) {
     mm_store_acc_lo(res);
 }
 
+RSP_X86_64_TARGET
 void eval_VNXOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -512,6 +1107,7 @@ void eval_VNXOR(u32 instr) {
     mm_store_acc_lo(res);
 }
 
+RSP_X86_64_TARGET
 void eval_VOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -530,6 +1126,83 @@ void eval_VOR(u32 instr) {
     mm_store_acc_lo(res);
 }
 
+RSP_X86_64_TARGET
+void eval_VSAR(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Same behaviour as the default implementation: e=0,1,2 return 0,
+    // e=8,9,10 read the accumulator without modifying it.
+    switch (e) {
+    case 0 ... 2:
+        mm_store_vr(vd, _mm_setzero_si128());
+        break;
+    case 8:
+        mm_store_vr(vd, _mm_load_si128((__m128i *)state.rspreg.vacc.hi.h));
+        break;
+    case 9:
+        mm_store_vr(vd, _mm_load_si128((__m128i *)state.rspreg.vacc.md.h));
+        break;
+    case 10:
+        mm_store_vr(vd, _mm_load_si128((__m128i *)state.rspreg.vacc.lo.h));
+        break;
+    default:
+        break;
+    }
+}
+
+RSP_X86_64_TARGET
+void eval_VSUB(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs. The carry is 0 for no carry, -1 otherwise.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+    __m128i const carry = mm_load_flags(state.rspreg.vco);
+
+    // Add the carry to b, with and without saturation. The lower
+    // accumulator word receives the truncated difference.
+    __m128i const b_carry = _mm_sub_epi16(b, carry);
+    __m128i const b_carry_sat = _mm_subs_epi16(b, carry);
+    __m128i const diff = _mm_sub_epi16(a, b_carry);
+
+    // The saturated addition is off by one when b + carry overflows,
+    // the difference is adjusted accordingly.
+    __m128i const overflow = _mm_cmpgt_epi16(b_carry_sat, b_carry);
+    __m128i const res = _mm_adds_epi16(
+        _mm_subs_epi16(a, b_carry_sat), overflow);
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(diff);
+    state.rspreg.vco = 0;
+}
+
+RSP_X86_64_TARGET
+void eval_VSUBC(u32 instr) {
+    u32 e = assembly::getElement(instr);
+    u32 vt = assembly::getVt(instr);
+    u32 vs = assembly::getVs(instr);
+    u32 vd = assembly::getVd(instr);
+
+    // Load inputs.
+    __m128i const a = mm_load_vr(vs);
+    __m128i const b = mm_load_vr_elt(vt, e);
+
+    // Compute unsigned difference, the carry is set if the difference
+    // is negative, the not equal flag if it is not zero.
+    __m128i const res = _mm_sub_epi16(a, b);
+    __m128i const carry = mm_cmpgt_epu16(b, a);
+    __m128i const neq = mm_not_si128(_mm_cmpeq_epi16(a, b));
+
+    mm_store_vr(vd, res);
+    mm_store_acc_lo(res);
+    state.rspreg.vco = mm_store_flags(carry, neq);
+}
+
+RSP_X86_64_TARGET
 void eval_VXOR(u32 instr) {
     u32 e = assembly::getElement(instr);
     u32 vt = assembly::getVt(instr);
@@ -548,4 +1221,69 @@ void eval_VXOR(u32 instr) {
     mm_store_acc_lo(res);
 }
 
+/**
+ * Vector instructions implemented by this variant, indexed by the funct
+ * field, with the same layout as the COP2 callback table of rsp.cc.
+ * The missing entries are left to the default implementations.
+ */
+extern cpu::eval_callback_t const callbacks[64];
+cpu::eval_callback_t const callbacks[64] = {
+    /* Multiply group */
+    eval_VMULF,     eval_VMULU,     NULL,           NULL,
+    eval_VMUDL,     eval_VMUDM,     eval_VMUDN,     eval_VMUDH,
+    eval_VMACF,     eval_VMACU,     NULL,           NULL,
+    eval_VMADL,     eval_VMADM,     eval_VMADN,     eval_VMADH,
+    /* Add group */
+    eval_VADD,      eval_VSUB,      NULL,           eval_VABS,
+    eval_VADDC,     eval_VSUBC,     NULL,           NULL,
+    NULL,           NULL,           NULL,           NULL,
+    NULL,           eval_VSAR,      NULL,           NULL,
+    /* Select group */
+    eval_VLT,       eval_VEQ,       eval_VNE,       eval_VGE,
+    eval_VCL,       eval_VCH,       eval_VCR,       eval_VMRG,
+    /* Logical group */
+    eval_VAND,      eval_VNAND,     eval_VOR,       eval_VNOR,
+    eval_VXOR,      eval_VNXOR,     NULL,           NULL,
+    /* Divide group */
+    NULL,           NULL,           NULL,           NULL,
+    NULL,           NULL,           NULL,           NULL,
+    /* Invalid group */
+    NULL,           NULL,           NULL,           NULL,
+    NULL,           NULL,           NULL,           NULL,
+};
+
+}; /* namespace interpreter::rsp::RSP_X86_64_VARIANT */
+
+#ifdef RSP_X86_64_DISPATCH
+namespace interpreter::rsp {
+
+namespace sse41 {
+extern cpu::eval_callback_t const callbacks[64];
+}; /* namespace sse41 */
+
+namespace avx2 {
+extern cpu::eval_callback_t const callbacks[64];
+}; /* namespace avx2 */
+
+simd_level detect_simd_level(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return simd_level::avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return simd_level::sse41;
+    }
+    return simd_level::sse2;
+}
+
+cpu::eval_callback_t get_simd_callback(simd_level level, u32 funct) {
+    switch (level) {
+    case simd_level::sse2:  return sse2::callbacks[funct & 0x3fu];
+    case simd_level::sse41: return sse41::callbacks[funct & 0x3fu];
+    case simd_level::avx2:  return avx2::callbacks[funct & 0x3fu];
+    default:                return NULL;
+    }
+}
+
 }; /* namespace interpreter::rsp */
+#endif /* RSP_X86_64_DISPATCH */
@@ -0,0 +1,14 @@
+
+/*
+ * AVX2 variant of the vector instructions implemented in rsp_x86_64.cc,
+ * selected at runtime when supported by the host cpu. The RSP vectors
+ * are 128bit wide: this variant uses the VEX encoded forms of the SSE4.1
+ * code paths, which save the register copies required by the destructive
+ * two operand forms.
+ */
+
+#define RSP_X86_64_VARIANT  avx2
+#define RSP_X86_64_TARGET   __attribute__((target("avx2")))
+#define RSP_X86_64_SSE41    1
+
+#include "rsp_x86_64.cc"
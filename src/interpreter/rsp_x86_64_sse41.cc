@@ -0,0 +1,11 @@
+
+/*
+ * SSE4.1 variant of the vector instructions implemented in rsp_x86_64.cc,
+ * selected at runtime when supported by the host cpu.
+ */
+
+#define RSP_X86_64_VARIANT  sse41
+#define RSP_X86_64_TARGET   __attribute__((target("sse4.1")))
+#define RSP_X86_64_SSE41    1
+
+#include "rsp_x86_64.cc"
@@ -1,11 +1,15 @@
 
 #include <cstring>
+#include <string>
 #include <iostream>
 #include <fstream>
 
 #include <cxxopts.hpp>
 
+#include <r4300/hle.h>
 #include <r4300/state.h>
+#include <recompiler/config.h>
+#include <core.h>
 #include <memory.h>
 #include <trace.h>
 
@@ -18,6 +22,21 @@ int main(int argc, char *argv[])
         ("record",      "Record execution trace", cxxopts::value<std::string>())
         ("replay",      "Replay execution trace", cxxopts::value<std::string>())
         ("recompiler",  "Enable recompiler", cxxopts::value<bool>()->default_value("false"))
+        ("code-cache",  "Persistent recompiler code cache directory", cxxopts::value<std::string>())
+        ("recompiler-threshold", "Number of executions before recompiling a block",
+            cxxopts::value<unsigned>()->default_value(std::to_string(RECOMPILER_CACHE_THRESHOLD)))
+        ("recompiler-hot-threshold", "Number of executions before recompiling a block with expensive optimizations",
+            cxxopts::value<unsigned>()->default_value(std::to_string(RECOMPILER_HOT_THRESHOLD)))
+        ("recompiler-page-size", "Size of the recompiler cache pages",
+            cxxopts::value<size_t>()->default_value(std::to_string(RECOMPILER_CACHE_PAGE_SIZE)))
+        ("recompiler-buffer-size", "Size of the code buffer allocated for each recompiler cache page",
+            cxxopts::value<size_t>()->default_value(std::to_string(RECOMPILER_CACHE_BUFFER_SIZE)))
+        ("recompiler-map-size", "Number of recompiler cache entries, one per DRAM word, 0 to cover the full DRAM",
+            cxxopts::value<size_t>()->default_value("0"))
+        ("rsp-thread",  "Run the RSP on a dedicated thread", cxxopts::value<bool>()->default_value("false"))
+        ("force-lle",   "Run all RSP tasks with the low level emulation", cxxopts::value<bool>()->default_value("false"))
+        ("capture-tasks", "Directory where the audio and graphics tasks executed with the high level emulation are captured",
+            cxxopts::value<std::string>())
         ("b,bios",      "Select PIF boot rom", cxxopts::value<std::string>())
         ("rom",         "ROM file", cxxopts::value<std::string>())
         ("h,help",      "Print usage");
@@ -89,6 +108,27 @@ int main(int argc, char *argv[])
     R4300::state.load(rom_contents);
     rom_contents.close();
 
+    if (result.count("code-cache")) {
+        core::set_code_cache_directory(result["code-cache"].as<std::string>());
+    }
+    if (!core::set_recompiler_cache_geometry(
+            result["recompiler-page-size"].as<size_t>(),
+            result["recompiler-buffer-size"].as<size_t>(),
+            result["recompiler-map-size"].as<size_t>())) {
+        std::cout << "Invalid recompiler cache geometry" << std::endl;
+        std::cout << options.help() << std::endl;
+        exit(1);
+    }
+    core::set_recompiler_thresholds(
+        result["recompiler-threshold"].as<unsigned>(),
+        result["recompiler-hot-threshold"].as<unsigned>());
+    core::set_rsp_thread(result["rsp-thread"].as<bool>());
+    R4300::hle::set_force_lle(result["force-lle"].as<bool>());
+    if (result.count("capture-tasks")) {
+        R4300::hle::set_capture_directory(
+            result["capture-tasks"].as<std::string>());
+    }
+
     startGui();
     return 0;
 }
@@ -108,6 +108,21 @@ void Region::insert(Region *region)
     subregions.insert(it, region);
 }
 
+void Region::remove(u64 addr, u64 size)
+{
+    std::vector<Region *>::iterator it = subregions.begin();
+    while (it != subregions.end()) {
+        Region *sub = *it;
+        if (sub->address >= addr &&
+            sub->address + sub->size <= addr + size) {
+            it = subregions.erase(it);
+            delete sub;
+        } else {
+            it++;
+        }
+    }
+}
+
 class RamRegion : public Region
 {
 public:
@@ -218,6 +233,7 @@ public:
     }
 
 private:
+    friend class Bus;
     Reader read;
     Writer write;
 };
@@ -252,4 +268,94 @@ void Region::insertIOmem(u64 addr, u64 size,
     insert(new IOmemRegion(addr, size, read, write, this));
 }
 
+void Bus::updatePageTable()
+{
+    pages.clear();
+    if (bits > 32) {
+        return;
+    }
+
+    pages.resize((1llu << bits) >> PageShift);
+    for (size_t index = 0; index < pages.size(); index++) {
+        u64 start = (u64)index << PageShift;
+        u64 end = start + PageSize;
+        Page page = { NULL, NULL, NULL, NULL, &root };
+
+        for (Region *sub : root.subregions) {
+            if (start < sub->address || end > sub->address + sub->size)
+                continue;
+            if (sub->ram && sub->block != NULL) {
+                page.load_block = sub->block + (start - sub->address);
+                page.store_block = sub->readonly ? NULL : page.load_block;
+            } else if (sub->device) {
+                IOmemRegion *io = static_cast<IOmemRegion *>(sub);
+                page.read = io->read;
+                page.write = io->write;
+            }
+            page.region = sub;
+            break;
+        }
+        pages[index] = page;
+    }
+}
+
+bool Bus::load(unsigned bytes, u64 addr, u64 *val)
+{
+    Page const *page = lookup(bytes, addr);
+    if (page == NULL) {
+        return root.load(bytes, addr, val);
+    }
+    if (page->load_block != NULL) {
+        u8 *ptr = page->load_block + (addr & (PageSize - 1));
+        switch (bytes) {
+            case 1: *val = *ptr; return true;
+#ifdef TARGET_BIGENDIAN
+            case 2: *val = __builtin_bswap16(*(u16 *)ptr); return true;
+            case 4: *val = __builtin_bswap32(*(u32 *)ptr); return true;
+            case 8: *val = __builtin_bswap64(*(u64 *)ptr); return true;
+#else
+            case 2: *val = *(u16 *)ptr; return true;
+            case 4: *val = *(u32 *)ptr; return true;
+            case 8: *val = *(u64 *)ptr; return true;
+#endif
+        }
+    }
+    if (page->read != NULL) {
+        return page->read(bytes, addr, val);
+    }
+    return page->region->load(bytes, addr, val);
+}
+
+bool Bus::store(unsigned bytes, u64 addr, u64 val)
+{
+    Page const *page = lookup(bytes, addr);
+    if (page == NULL) {
+        return root.store(bytes, addr, val);
+    }
+    if (page->store_block != NULL) {
+        u8 *ptr = page->store_block + (addr & (PageSize - 1));
+        switch (bytes) {
+            case 1: *ptr = val; break;
+#ifdef TARGET_BIGENDIAN
+            case 2: *(u16 *)ptr = __builtin_bswap16(val); break;
+            case 4: *(u32 *)ptr = __builtin_bswap32(val); break;
+            case 8: *(u64 *)ptr = __builtin_bswap64(val); break;
+#else
+            case 2: *(u16 *)ptr = val; break;
+            case 4: *(u32 *)ptr = val; break;
+            case 8: *(u64 *)ptr = val; break;
+#endif
+            default: return page->region->store(bytes, addr, val);
+        }
+        if (invalidateCode) {
+            core::invalidate_recompiler_cache(addr, addr + bytes);
+        }
+        return true;
+    }
+    if (page->write != NULL) {
+        return page->write(bytes, addr, val);
+    }
+    return page->region->store(bytes, addr, val);
+}
+
 };
@@ -36,6 +36,8 @@ public:
 
     void print();
     void insert(Region *region);
+    /** Remove and delete the subregions contained in \p addr, \p size. */
+    void remove(u64 addr, u64 size);
     void insertRam(u64 addr, u64 size, u8 *mem);
     void insertRom(u64 addr, u64 size, u8 *mem);
     void insertIOmem(u64 addr, u64 size,
@@ -46,20 +48,41 @@ protected:
     void adjustEndianness(uint bytes, u64 *value);
 };
 
+/**
+ * @brief Physical memory bus.
+ *
+ * Accesses are dispatched through a flat page table indexed by the address
+ * bits above \ref Bus::PageShift. Pages fully contained in a RAM or ROM
+ * region are accessed directly through the host memory, pages fully
+ * contained in an IO region call the region handlers; other pages
+ * fall back to searching the region tree.
+ * The page table is built by \ref updatePageTable, and must be rebuilt
+ * after inserting new regions.
+ */
 class Bus
 {
 public:
-    Bus(unsigned bits) : root(0, 1llu << bits) {}
+    typedef bool (*Reader)(unsigned bytes, u64 addr, u64 *value);
+    typedef bool (*Writer)(unsigned bytes, u64 addr, u64 value);
+
+    Bus(unsigned bits) :
+        root(0, 1llu << bits), invalidateCode(true), bits(bits) {}
     virtual ~Bus() {}
 
     Region root;
 
-    virtual bool load(unsigned bytes, u64 addr, u64 *val) {
-        return root.load(bytes, addr, val);
-    }
-    virtual bool store(unsigned bytes, u64 addr, u64 val) {
-        return root.store(bytes, addr, val);
-    }
+    /**
+     * Set when RAM stores must explicitly invalidate the recompiled and
+     * predecoded code. Cleared when the pages holding code are write
+     * protected instead, and the writes caught by the fastmem fault handler.
+     */
+    bool invalidateCode;
+
+    /** Rebuild the page table from the regions inserted into \ref root. */
+    void updatePageTable();
+
+    virtual bool load(unsigned bytes, u64 addr, u64 *val);
+    virtual bool store(unsigned bytes, u64 addr, u64 val);
 
     inline bool load_u8(u64 addr, u8 *val) {
         u64 val64; bool res = load(1, addr, &val64);
@@ -89,6 +112,44 @@ public:
     inline bool store_u64(u64 addr, u64 val) {
         return store(8, addr, val);
     }
+
+    static const unsigned PageShift = 16;
+    static const u64 PageSize = 1llu << PageShift;
+
+private:
+    /**
+     * @brief Page table entry.
+     * @var Page::load_block
+     * @brief Host memory of the page for RAM and ROM pages, NULL otherwise.
+     * @var Page::store_block
+     * @brief Host memory of the page for RAM pages, NULL otherwise.
+     * @var Page::read
+     * @brief Read handler for IO pages, NULL otherwise.
+     * @var Page::write
+     * @brief Write handler for IO pages, NULL otherwise.
+     * @var Page::region
+     * @brief Region to defer to when the access cannot be handled with
+     *  the above fields.
+     */
+    struct Page {
+        u8 *load_block;
+        u8 *store_block;
+        Reader read;
+        Writer write;
+        Region *region;
+    };
+
+    unsigned bits;
+    std::vector<Page> pages;
+
+    Page const *lookup(unsigned bytes, u64 addr) const {
+        u64 index = addr >> PageShift;
+        if (index >= pages.size() ||
+            (addr & (PageSize - 1)) + bytes > PageSize) {
+            return NULL;
+        }
+        return &pages[index];
+    }
 };
 
 /**
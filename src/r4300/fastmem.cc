@@ -0,0 +1,411 @@
+#include <atomic>
+#include <cstring>
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <signal.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#define FASTMEM_SUPPORTED 1
+#else
+#define FASTMEM_SUPPORTED 0
+#endif
+
+#include <r4300/cpu.h>
+#include <r4300/fastmem.h>
+#include <r4300/state.h>
+
+namespace R4300 {
+namespace fastmem {
+
+u8 *base;
+
+/** Routine jumped to for exiting recompiled code after an exception
+ * was raised by a forwarded memory access. */
+static void (*exit_routine)(void);
+
+/** Routine called after unprotecting a DRAM page on a write fault. */
+static void (*write_routine)(u32 phys_address);
+
+/** Size of the DRAM pages write protected by \ref protect. */
+#define FASTMEM_PROTECT_SHIFT   12
+#define FASTMEM_PROTECT_SIZE    (UINT64_C(1) << FASTMEM_PROTECT_SHIFT)
+#define FASTMEM_PROTECT_COUNT   (sizeof(State::dram) >> FASTMEM_PROTECT_SHIFT)
+
+/** Offsets of the memory arrays in the shared memory file backing
+ * the fastmem arena. DMEM and IMEM are consecutive, and mapped
+ * together at their physical address. */
+#define FASTMEM_DRAM_OFFSET     UINT64_C(0x0)
+#define FASTMEM_DMEM_OFFSET     UINT64_C(0x400000)
+#define FASTMEM_IMEM_OFFSET     UINT64_C(0x401000)
+#define FASTMEM_ROM_OFFSET      UINT64_C(0x402000)
+#define FASTMEM_FILE_SIZE       UINT64_C(0x10002000)
+
+#if FASTMEM_SUPPORTED
+
+static struct sigaction previous_action;
+
+/** Bitmap of the write protected DRAM pages. */
+static std::atomic_uint64_t protected_pages[FASTMEM_PROTECT_COUNT / 64];
+/** Bitmap of the DRAM pages whose protection is being changed. The bit
+ * of a page is held while updating both its protection bit and its
+ * mapping, so that the two remain consistent. A spin lock is used as the
+ * fault handler cannot block on a mutex. */
+static std::atomic_uint64_t locked_pages[FASTMEM_PROTECT_COUNT / 64];
+
+static void lock_page(u64 page) {
+    u64 bit = UINT64_C(1) << (page % 64);
+    while (locked_pages[page / 64].fetch_or(bit, std::memory_order_acquire)
+           & bit) {
+        __builtin_ia32_pause();
+    }
+}
+
+static void unlock_page(u64 page) {
+    u64 bit = UINT64_C(1) << (page % 64);
+    locked_pages[page / 64].fetch_and(~bit, std::memory_order_release);
+}
+
+/**
+ * Convert between the guest memory representation, used by the
+ * recompiled code, and the bus representation.
+ */
+static u64 swap_value(unsigned bytes, u64 value) {
+#ifdef TARGET_BIGENDIAN
+    switch (bytes) {
+    case 2: return __builtin_bswap16(value);
+    case 4: return __builtin_bswap32(value);
+    case 8: return __builtin_bswap64(value);
+    }
+#endif
+    return value;
+}
+
+/** Map the x86_64 register numbers to the general register
+ * indexes of the signal context. */
+static const int ucontext_register[16] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8,  REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+/**
+ * @brief Decoded memory access instruction.
+ * Only the forms generated by the recompiler for loads and stores
+ * are recognized: MOV r/m, r (88, 89), MOV r, r/m (8A, 8B),
+ * and MOV r/m, imm (C6, C7), with operand size prefixes.
+ */
+struct access {
+    bool load;
+    bool immediate;
+    bool high_byte;     /**< Register operand is one of AH, CH, DH, BH. */
+    unsigned bytes;
+    unsigned reg;
+    u64 imm;
+    unsigned len;       /**< Instruction length in bytes. */
+};
+
+static bool decode_access(u8 const *ptr, struct access *access) {
+    u8 const *start = ptr;
+    bool opsize = false;
+    u8 rex = 0;
+
+    if (*ptr == 0x66) {
+        opsize = true;
+        ptr++;
+    }
+    if ((*ptr & 0xf0) == 0x40) {
+        rex = *ptr++;
+    }
+
+    u8 opcode = *ptr++;
+    unsigned wide_bytes = (rex & 0x8) ? 8 : opsize ? 2 : 4;
+    access->immediate = false;
+    switch (opcode) {
+    case 0x88: access->load = false; access->bytes = 1; break;
+    case 0x89: access->load = false; access->bytes = wide_bytes; break;
+    case 0x8a: access->load = true;  access->bytes = 1; break;
+    case 0x8b: access->load = true;  access->bytes = wide_bytes; break;
+    case 0xc6: access->load = false; access->bytes = 1;
+               access->immediate = true; break;
+    case 0xc7: access->load = false; access->bytes = wide_bytes;
+               access->immediate = true; break;
+    default:   return false;
+    }
+
+    u8 modrm = *ptr++;
+    unsigned mod = modrm >> 6;
+    unsigned rm = modrm & 0x7;
+    access->reg = ((modrm >> 3) & 0x7) | ((rex & 0x4) ? 8 : 0);
+    access->high_byte = access->bytes == 1 && rex == 0 &&
+                        access->reg >= 4 && !access->immediate;
+    if (access->high_byte) {
+        access->reg -= 4;
+    }
+
+    if (mod == 3) {
+        return false;
+    }
+    if (rm == 4) {
+        u8 sib = *ptr++;
+        if (mod == 0 && (sib & 0x7) == 5) {
+            ptr += 4;
+        }
+    }
+    if (mod == 0 && rm == 5) {
+        ptr += 4;
+    }
+    ptr += mod == 1 ? 1 : mod == 2 ? 4 : 0;
+
+    if (access->immediate) {
+        switch (access->bytes) {
+        case 1: access->imm = *ptr; ptr += 1; break;
+        case 2: access->imm = *(u16 const *)ptr; ptr += 2; break;
+        case 4: access->imm = *(u32 const *)ptr; ptr += 4; break;
+        case 8: access->imm = (u64)(i64)*(i32 const *)ptr; ptr += 4; break;
+        }
+    }
+
+    access->len = ptr - start;
+    return true;
+}
+
+/**
+ * Perform the faulting access through the memory bus, with the same
+ * semantics as the slow path memory helpers of the recompiler.
+ * @return true if recompiled execution can continue, false if an
+ *  exception or interrupt was raised.
+ */
+static bool forward_access(mcontext_t *mcontext, u64 addr,
+                           struct access const *access) {
+    greg_t *reg = &mcontext->gregs[ucontext_register[access->reg]];
+    u64 next_pc;
+    bool valid;
+
+    state.cpu.nextAction = state.cpu.delaySlot ? State::Jump : State::Continue;
+    next_pc = state.cpu.nextPc;
+
+    if (access->load) {
+        u64 value;
+        valid = state.bus->load(access->bytes, addr, &value);
+        value = swap_value(access->bytes, value);
+        if (valid) {
+            switch (access->bytes) {
+            case 1:
+                if (access->high_byte) {
+                    *reg = (*reg & ~(greg_t)0xff00) | (greg_t)((u8)value << 8);
+                } else {
+                    *reg = (*reg & ~(greg_t)0xff) | (greg_t)(u8)value;
+                }
+                break;
+            case 2: *reg = (*reg & ~(greg_t)0xffff) | (greg_t)(u16)value; break;
+            case 4: *reg = (greg_t)(u32)value; break;
+            case 8: *reg = (greg_t)value; break;
+            }
+        }
+    } else {
+        u64 value = access->immediate ? access->imm : (u64)*reg;
+        if (access->high_byte) {
+            value >>= 8;
+        }
+        switch (access->bytes) {
+        case 1: value = (u8)value; break;
+        case 2: value = (u16)value; break;
+        case 4: value = (u32)value; break;
+        }
+        valid = state.bus->store(access->bytes, addr,
+                                 swap_value(access->bytes, value));
+    }
+
+    if (!valid) {
+        // The fast path is only taken for KSEG0, KSEG1 addresses,
+        // the segment cannot be recovered from the physical address.
+        takeException(BusError, UINT64_C(0xffffffff80000000) | addr,
+                      false, access->load);
+        return false;
+    }
+    return state.cpu.nextAction != State::Jump ||
+           state.cpu.nextPc == next_pc;
+}
+
+/** Change the protection of the DRAM page at the physical address
+ * \p phys_address, in both the arena and the DRAM array. */
+static void set_protection(u64 phys_address, int prot) {
+    mprotect(base + phys_address, FASTMEM_PROTECT_SIZE, prot);
+    mprotect(state.dram + phys_address, FASTMEM_PROTECT_SIZE, prot);
+}
+
+/**
+ * Unprotect the DRAM page containing the faulting address, accessed either
+ * through the arena or the DRAM array, and report the write.
+ * @return false if the address is not in DRAM.
+ */
+static bool unprotect_fault(u8 *fault_addr) {
+    u64 addr;
+    if (fault_addr >= base && fault_addr < base + sizeof(state.dram)) {
+        addr = fault_addr - base;
+    } else if (fault_addr >= state.dram &&
+               fault_addr < state.dram + sizeof(state.dram)) {
+        addr = fault_addr - state.dram;
+    } else {
+        return false;
+    }
+
+    u64 page = addr >> FASTMEM_PROTECT_SHIFT;
+    u64 bit = UINT64_C(1) << (page % 64);
+    u64 phys_address = page << FASTMEM_PROTECT_SHIFT;
+    lock_page(page);
+    set_protection(phys_address, PROT_READ | PROT_WRITE);
+    bool written = protected_pages[page / 64].fetch_and(~bit) & bit;
+    unlock_page(page);
+    if (written) {
+        write_routine(phys_address);
+    }
+    return true;
+}
+
+static void fault_handler(int sig, siginfo_t *info, void *context) {
+    u8 *fault_addr = (u8 *)info->si_addr;
+    ucontext_t *ucontext = (ucontext_t *)context;
+    mcontext_t *mcontext = &ucontext->uc_mcontext;
+    struct access access;
+
+    // DRAM pages are mapped read-write in both views, and only fault
+    // when write protected. The write is restarted on return.
+    if (write_routine != NULL && info->si_code == SEGV_ACCERR &&
+        unprotect_fault(fault_addr)) {
+        return;
+    }
+
+    if (exit_routine != NULL &&
+        fault_addr >= base && fault_addr < base + FASTMEM_ARENA_SIZE &&
+        decode_access((u8 const *)mcontext->gregs[REG_RIP], &access)) {
+        u64 addr = fault_addr - base;
+        if (forward_access(mcontext, addr, &access)) {
+            mcontext->gregs[REG_RIP] += access.len;
+        } else {
+            mcontext->gregs[REG_RIP] = (greg_t)exit_routine;
+        }
+        return;
+    }
+
+    // Not an access to the arena: restore the previous handler, the
+    // instruction will fault again when the handler returns.
+    sigaction(sig, &previous_action, NULL);
+}
+
+/** Remap the host memory \p ptr onto the shared memory file at the
+ * offset \p offset. */
+static bool remap(int fd, void *ptr, size_t size, off_t offset) {
+    void *res = mmap(ptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED, fd, offset);
+    return res == ptr;
+}
+
+/** Map the shared memory file range \p offset, \p offset + \p size
+ * into the arena at the physical address \p addr. */
+static bool map(int fd, u64 addr, size_t size, off_t offset, int prot) {
+    void *ptr = base + addr;
+    void *res = mmap(ptr, size, prot, MAP_SHARED | MAP_FIXED, fd, offset);
+    return res == ptr;
+}
+
+bool init(State *state) {
+    if (sysconf(_SC_PAGESIZE) != 0x1000) {
+        return false;
+    }
+
+    int fd = memfd_create("fastmem", MFD_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, FASTMEM_FILE_SIZE) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // Reserve the arena, inaccessible by default.
+    void *arena = mmap(NULL, FASTMEM_ARENA_SIZE, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    base = (u8 *)arena;
+
+    if (!map(fd, 0x00000000, sizeof(state->dram),
+             FASTMEM_DRAM_OFFSET, PROT_READ | PROT_WRITE) ||
+        !map(fd, 0x04000000, sizeof(state->dmem) + sizeof(state->imem),
+             FASTMEM_DMEM_OFFSET, PROT_READ | PROT_WRITE) ||
+        !map(fd, 0x10000000, sizeof(state->rom),
+             FASTMEM_ROM_OFFSET, PROT_READ) ||
+        !remap(fd, state->dram, sizeof(state->dram), FASTMEM_DRAM_OFFSET) ||
+        !remap(fd, state->dmem, sizeof(state->dmem), FASTMEM_DMEM_OFFSET) ||
+        !remap(fd, state->imem, sizeof(state->imem), FASTMEM_IMEM_OFFSET) ||
+        !remap(fd, state->rom,  sizeof(state->rom),  FASTMEM_ROM_OFFSET)) {
+        munmap(arena, FASTMEM_ARENA_SIZE);
+        close(fd);
+        base = NULL;
+        return false;
+    }
+
+    // The mappings hold a reference to the file.
+    close(fd);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_action);
+    return true;
+}
+
+bool protect(u32 phys_address) {
+    if (base == NULL || write_routine == NULL ||
+        phys_address >= sizeof(state.dram)) {
+        return false;
+    }
+    u64 page = phys_address >> FASTMEM_PROTECT_SHIFT;
+    u64 bit = UINT64_C(1) << (page % 64);
+    lock_page(page);
+    if (!(protected_pages[page / 64].fetch_or(bit) & bit)) {
+        set_protection(page << FASTMEM_PROTECT_SHIFT, PROT_READ);
+    }
+    unlock_page(page);
+    return true;
+}
+
+void protect_sp_memory(void) {
+    if (base != NULL) {
+        mprotect(base + 0x04000000, sizeof(state.dmem) + sizeof(state.imem),
+                 PROT_NONE);
+    }
+}
+
+#else /* FASTMEM_SUPPORTED */
+
+bool init(State *state) {
+    (void)state;
+    return false;
+}
+
+bool protect(u32 phys_address) {
+    (void)phys_address;
+    return false;
+}
+
+void protect_sp_memory(void) {
+}
+
+#endif /* FASTMEM_SUPPORTED */
+
+void set_exit_routine(void (*routine)(void)) {
+    exit_routine = routine;
+}
+
+void set_write_routine(void (*routine)(u32 phys_address)) {
+    write_routine = routine;
+}
+
+}; /* namespace fastmem */
+}; /* namespace R4300 */
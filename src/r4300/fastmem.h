@@ -0,0 +1,83 @@
+#ifndef _R4300_FASTMEM_H_INCLUDED_
+#define _R4300_FASTMEM_H_INCLUDED_
+
+#include <types.h>
+
+namespace R4300 {
+
+class State;
+
+namespace fastmem {
+
+/** Size of the physical address range covered by the fastmem arena,
+ * i.e. the range addressable through the KSEG0 and KSEG1 segments. */
+#define FASTMEM_ARENA_SIZE  UINT64_C(0x20000000)
+
+/**
+ * @brief Host address of the fastmem arena, or NULL if the arena
+ * could not be created.
+ *
+ * The arena reserves a host virtual region mapping the N64 physical address
+ * space: DRAM, SP DMEM and IMEM are mapped read-write at their physical
+ * offsets, and the cartridge ROM read-only. The pages are shared
+ * with the corresponding arrays of the machine state. All other pages,
+ * including the MMIO register ranges, are left inaccessible: accesses
+ * from recompiled code fault, and are forwarded to the memory bus
+ * by a SIGSEGV handler.
+ */
+extern u8 *base;
+
+/**
+ * @brief Create the fastmem arena.
+ *
+ * The memory arrays of \p state are remapped in place onto the pages
+ * backing the arena, and must not have been written before.
+ * Failure is not fatal, \ref base is left NULL and the memory bus
+ * is used for all accesses.
+ * @return true iff the arena was successfully created.
+ */
+bool init(State *state);
+
+/**
+ * @brief Set the routine used to exit recompiled code when a memory
+ * access forwarded by the fault handler raises an exception or interrupt.
+ *
+ * The routine is jumped to in place of the faulting instruction, and must
+ * unwind the stack frame of the recompiled code. Faulting accesses
+ * are not handled while the routine is NULL.
+ */
+void set_exit_routine(void (*exit_routine)(void));
+
+/**
+ * @brief Set the routine called when a write to a write protected
+ * DRAM page faults.
+ *
+ * The routine is called from the fault handler of the faulting thread
+ * with the physical address of the page, after the page was unprotected,
+ * and the write completes when the fault handler returns. The routine
+ * must be async-signal-safe. Pages are not protected while the routine
+ * is NULL.
+ */
+void set_write_routine(void (*write_routine)(u32 phys_address));
+
+/**
+ * @brief Write protect the 4KB DRAM page containing the physical address
+ * \p phys_address, both in the arena and in the DRAM array of the machine
+ * state. The next write to the page is reported to the write routine.
+ * @return true iff the page is write protected.
+ */
+bool protect(u32 phys_address);
+
+/**
+ * @brief Remove the access to SP DMEM and IMEM through the arena.
+ * Accesses from recompiled code fault and are forwarded to the memory
+ * bus, which lets the bus observe them when the RSP runs on a separate
+ * thread. The DMEM and IMEM arrays of the machine state are not affected.
+ */
+void protect_sp_memory(void);
+
+}; /* namespace fastmem */
+
+}; /* namespace R4300 */
+
+#endif /* _R4300_FASTMEM_H_INCLUDED_ */
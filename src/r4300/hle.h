@@ -0,0 +1,144 @@
+
+#ifndef _R4300_HLE_H_INCLUDED_
+#define _R4300_HLE_H_INCLUDED_
+
+#include <string>
+#include <vector>
+
+#include <types.h>
+
+namespace R4300 {
+namespace hle {
+
+/**
+ * @brief High level emulation of the RSP tasks.
+ *
+ * The tasks started by the CPU are described by an OSTask structure
+ * written to the end of DMEM, before clearing the SP halt bit. The task
+ * microcode is identified by the CRC32 of its text segment, i.e. of the
+ * IMEM contents run by the task, and the tasks of recognized audio and
+ * graphics microcodes are executed natively instead of running the
+ * microcode on the RSP. The task completes immediately: the RSP is
+ * left halted with the task done signal raised, as by the BREAK
+ * instruction ending the microcode.
+ */
+
+/** DMEM address of the OSTask structure. */
+#define OSTASK_ADDRESS          UINT32_C(0xfc0)
+#define OSTASK_TYPE             UINT32_C(0x00)
+#define OSTASK_FLAGS            UINT32_C(0x04)
+#define OSTASK_UCODE_BOOT       UINT32_C(0x08)
+#define OSTASK_UCODE_BOOT_SIZE  UINT32_C(0x0c)
+#define OSTASK_UCODE            UINT32_C(0x10)
+#define OSTASK_UCODE_SIZE       UINT32_C(0x14)
+#define OSTASK_UCODE_DATA       UINT32_C(0x18)
+#define OSTASK_UCODE_DATA_SIZE  UINT32_C(0x1c)
+#define OSTASK_DRAM_STACK       UINT32_C(0x20)
+#define OSTASK_DRAM_STACK_SIZE  UINT32_C(0x24)
+#define OSTASK_OUTPUT_BUFF      UINT32_C(0x28)
+#define OSTASK_OUTPUT_BUFF_SIZE UINT32_C(0x2c)
+#define OSTASK_DATA_PTR         UINT32_C(0x30)
+#define OSTASK_DATA_SIZE        UINT32_C(0x34)
+#define OSTASK_YIELD_DATA_PTR   UINT32_C(0x38)
+#define OSTASK_YIELD_DATA_SIZE  UINT32_C(0x3c)
+
+/** OSTask types. */
+#define M_GFXTASK               UINT32_C(1)
+#define M_AUDTASK               UINT32_C(2)
+
+/** Graphics microcodes supported by the high level emulation. */
+enum gfx_ucode {
+    GFX_UCODE_F3D,
+    GFX_UCODE_F3DEX,
+};
+
+/** Number of audio tasks executed by the high level emulation. */
+extern unsigned long audio_tasks;
+/** Number of graphics tasks executed by the high level emulation. */
+extern unsigned long gfx_tasks;
+
+/** Range of DRAM written by a task. */
+struct dram_range {
+    u32 address;
+    u32 length;
+};
+
+/** Read a word of the OSTask structure in DMEM. */
+u32 load_task_word(u32 offset);
+
+/**
+ * @brief Force the low level emulation of all tasks, for accuracy
+ *  comparisons. The high level emulation is enabled by default.
+ */
+void set_force_lle(bool force);
+
+/**
+ * @brief Select the directory where the audio and graphics tasks
+ *  executed with the high level emulation are captured,
+ *  for comparing the high and low level emulations. The captures hold
+ *  the DRAM, DMEM, IMEM contents and RSP program counter at the start of
+ *  the task. Empty to disable the capture.
+ */
+void set_capture_directory(std::string const &directory);
+
+/**
+ * @brief Start the task described by the OSTask structure in DMEM.
+ *  Called when the CPU clears the SP halt bit.
+ * @return true if the task was executed by the high level emulation,
+ *  false if the RSP should run the task microcode.
+ */
+bool start_task(void);
+
+/**
+ * @brief Check whether the ucode data segment \p data of \p size bytes
+ *  belongs to a supported audio microcode.
+ * @param lut_offset    Receives the offset of the resample filter
+ *                      coefficients in the data segment.
+ */
+bool identify_audio_ucode(u8 const *data, u32 size, u32 *lut_offset);
+
+/**
+ * @brief Execute the command list of the audio task in DMEM.
+ *  The RSP state is not modified. No command is executed if the list
+ *  contains unsupported commands.
+ * @param lut_offset    Offset of the resample filter coefficients
+ *                      in the ucode data segment.
+ * @param outputs       If not NULL, receives the DRAM ranges written
+ *                      with audio samples.
+ * @return true if the command list was executed.
+ */
+bool exec_audio_task(u32 lut_offset, std::vector<dram_range> *outputs);
+
+/**
+ * @brief Check whether the ucode data segment \p data of \p size bytes
+ *  belongs to a supported graphics microcode: Fast3D, F3DEX or F3DLX
+ *  version 1, recognized from the identification string of the data.
+ * @param ucode         Receives the microcode variant.
+ */
+bool identify_gfx_ucode(u8 const *data, u32 size, enum gfx_ucode *ucode);
+
+/** Result of the high level emulation of a graphics task. */
+enum gfx_status {
+    /** The display list was executed. */
+    GFX_TASK_COMPLETE,
+    /** The display list switches to another microcode, and was not
+     *  executed: the task must run on the RSP. */
+    GFX_TASK_SWITCHED,
+    /** The execution reached a microcode switch missed by the display
+     *  list scan; the rest of the display list was dropped. */
+    GFX_TASK_ABORTED,
+};
+
+/**
+ * @brief Execute the display list of the graphics task in DMEM.
+ *  The vertices are transformed, lit and clipped on the host, and the
+ *  generated RDP commands are executed through rdp::interface.
+ *  The RSP state is not modified. The display list is scanned first,
+ *  and not executed if it switches to another microcode.
+ */
+enum gfx_status exec_gfx_task(enum gfx_ucode ucode);
+
+}; /* namespace hle */
+}; /* namespace R4300 */
+
+#endif /* _R4300_HLE_H_INCLUDED_ */
@@ -0,0 +1,824 @@
+
+#include <cstring>
+
+#include <emmintrin.h>
+
+#include <r4300/hle.h>
+#include <r4300/state.h>
+
+#include <core.h>
+#include <debugger.h>
+
+namespace R4300 {
+namespace hle {
+
+/** Flags of the audio commands. */
+#define A_INIT                  0x01
+#define A_LOOP                  0x02
+#define A_LEFT                  0x02
+#define A_VOL                   0x04
+#define A_AUX                   0x08
+
+/** DMEM address of the buffers addressed by the ABI1 commands. */
+#define ABI1_DMEM_BASE          UINT32_C(0x5c0)
+
+/** Number of ADPCM codebook entries: 16 predictors of 16 coefficients. */
+#define ADPCM_TABLE_SIZE        256
+/** Number of resample filter coefficients: 64 phases of 4 taps. */
+#define RESAMPLE_LUT_SIZE       256
+
+#define DMEM_MASK               UINT32_C(0xfff)
+#define DRAM_MASK               ((u32)sizeof(state.dram) - 1)
+
+/**
+ * @brief State of the audio command list interpreter.
+ * @var audio_state::adpcm_coefs
+ *      ADPCM codebook entries expanded for the SIMD residual computation:
+ *      for each predictor, five pairs of interleaved coefficient columns
+ *      for the output samples 0-3 and 4-7.
+ * @var audio_state::outputs
+ *      DRAM ranges written by SAVEBUFF, NULL if not recorded.
+ */
+struct audio_state {
+    u32 segments[16];
+    u32 in;
+    u32 out;
+    u32 count;
+    u32 dry_right;
+    u32 wet_left;
+    u32 wet_right;
+    i16 dry;
+    i16 wet;
+    i16 vol[2];
+    i16 target[2];
+    i32 rate[2];
+    u32 loop;
+    i16 table[ADPCM_TABLE_SIZE];
+    __m128i adpcm_coefs[16][5][2];
+    i16 resample_lut[RESAMPLE_LUT_SIZE];
+    std::vector<dram_range> *outputs;
+};
+
+typedef void (*audio_command_t)(struct audio_state *audio, u32 w1, u32 w2);
+
+static inline u32 align(u32 value, u32 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline i16 clamp_s16(i32 value) {
+    return value < INT16_MIN ? INT16_MIN :
+           value > INT16_MAX ? INT16_MAX : value;
+}
+
+static inline i16 load_s16(u32 addr) {
+    return (i16)((state.dmem[addr & DMEM_MASK] << 8) |
+                 state.dmem[(addr + 1) & DMEM_MASK]);
+}
+
+static inline void store_s16(u32 addr, i16 value) {
+    state.dmem[addr & DMEM_MASK] = (u16)value >> 8;
+    state.dmem[(addr + 1) & DMEM_MASK] = value;
+}
+
+static inline u16 load_dram_u16(u32 address) {
+    return ((u16)state.dram[address & DRAM_MASK] << 8) |
+           state.dram[(address + 1) & DRAM_MASK];
+}
+
+static inline void store_dram_u16(u32 address, u16 value) {
+    state.dram[address & DRAM_MASK] = value >> 8;
+    state.dram[(address + 1) & DRAM_MASK] = value;
+}
+
+static inline u32 load_dram_u32(u32 address) {
+    return ((u32)load_dram_u16(address) << 16) | load_dram_u16(address + 2);
+}
+
+static inline void store_dram_u32(u32 address, u32 value) {
+    store_dram_u16(address, value >> 16);
+    store_dram_u16(address + 2, value);
+}
+
+/** Invalidate the recompiled code for the DRAM range written by a
+ * command, as done for the SP DMA transfers. */
+static inline void invalidate_dram(u32 address, u32 len) {
+    address &= DRAM_MASK;
+    core::invalidate_recompiler_cache(address, (u64)address + len);
+}
+
+/** Check that the DMEM range \p addr, \p addr + \p len does not wrap. */
+static inline bool dmem_contiguous(u32 addr, u32 len) {
+    return (addr & DMEM_MASK) + len <= sizeof(state.dmem);
+}
+
+/**
+ * Check that the SIMD kernels processing 8 samples at a time produce the
+ * same result as the sequential processing for the sample buffers
+ * \p left, \p right: the buffers must be identical, or at least 8 samples
+ * apart.
+ */
+static inline bool simd_compatible(u32 left, u32 right) {
+    u32 delta = left > right ? left - right : right - left;
+    return delta == 0 || delta >= 16;
+}
+
+/** Swap the bytes of the 16-bit lanes, to convert DMEM samples
+ * to host samples. */
+static inline __m128i mm_bswap_epi16(__m128i x) {
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static inline __m128i mm_load_samples(u32 addr) {
+    return mm_bswap_epi16(_mm_loadu_si128(
+        (__m128i const *)&state.dmem[addr & DMEM_MASK]));
+}
+
+static inline void mm_store_samples(u32 addr, __m128i samples) {
+    _mm_storeu_si128((__m128i *)&state.dmem[addr & DMEM_MASK],
+                     mm_bswap_epi16(samples));
+}
+
+/**
+ * Mix the samples \p src into \p dst with the gains \p gain:
+ * dst = clamp(dst + ((src * gain) >> 15)), computed on 32 bits.
+ */
+static inline __m128i mm_mix_epi16(__m128i dst, __m128i src, __m128i gain) {
+    __m128i lo = _mm_mullo_epi16(src, gain);
+    __m128i hi = _mm_mulhi_epi16(src, gain);
+    __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+    __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+    __m128i d0 = _mm_srai_epi32(_mm_unpacklo_epi16(dst, dst), 16);
+    __m128i d1 = _mm_srai_epi32(_mm_unpackhi_epi16(dst, dst), 16);
+    return _mm_packs_epi32(_mm_add_epi32(d0, p0), _mm_add_epi32(d1, p1));
+}
+
+static inline void mix_sample(u32 dst, i16 src, i16 gain) {
+    store_s16(dst, clamp_s16(load_s16(dst) + (((i32)src * gain) >> 15)));
+}
+
+/** Resolve the segmented address \p so. */
+static u32 get_address(struct audio_state *audio, u32 so) {
+    return audio->segments[(so >> 24) & 0xfu] + (so & 0xffffffu);
+}
+
+/**
+ * Expand the ADPCM codebook for the SIMD residual computation.
+ * The residual of the output sample i of a half frame is
+ *      src[i] << 11 + book1[i] * l1 + book2[i] * l2
+ *          + sum(k < i) book2[i - 1 - k] * src[k]
+ * i.e. the product of the input samples src[0..7], l1, l2 with a 10x8
+ * coefficient matrix, whose columns are paired for pmaddwd.
+ */
+static void expand_adpcm_table(struct audio_state *audio) {
+    for (unsigned nr = 0; nr < 16; nr++) {
+        i16 const *book1 = &audio->table[nr * 16];
+        i16 const *book2 = book1 + 8;
+        i16 coefs[10][8];
+        for (unsigned i = 0; i < 8; i++) {
+            for (unsigned k = 0; k < 8; k++) {
+                coefs[k][i] = k == i ? 2048 : k < i ? book2[i - 1 - k] : 0;
+            }
+            coefs[8][i] = book1[i];
+            coefs[9][i] = book2[i];
+        }
+        for (unsigned p = 0; p < 5; p++) {
+            for (unsigned h = 0; h < 2; h++) {
+                i16 const *c0 = &coefs[2 * p][4 * h];
+                i16 const *c1 = &coefs[2 * p + 1][4 * h];
+                audio->adpcm_coefs[nr][p][h] = _mm_setr_epi16(
+                    c0[0], c1[0], c0[1], c1[1], c0[2], c1[2], c0[3], c1[3]);
+            }
+        }
+    }
+}
+
+/** Compute the residuals of a half ADPCM frame, scalar version. */
+static void adpcm_residuals(i16 *dst, i16 const *src, i16 const *book,
+                            i16 l1, i16 l2) {
+    i16 const *book1 = book;
+    i16 const *book2 = book + 8;
+    for (unsigned i = 0; i < 8; i++) {
+        u32 accu = (u32)(i32)src[i] << 11;
+        accu += (i32)book1[i] * l1 + (i32)book2[i] * l2;
+        for (unsigned k = 0; k < i; k++) {
+            accu += (i32)book2[i - 1 - k] * src[k];
+        }
+        dst[i] = clamp_s16((i32)accu >> 11);
+    }
+}
+
+/** Compute the residuals of a half ADPCM frame, SIMD version. */
+static inline __m128i mm_adpcm_residuals(__m128i const coefs[5][2],
+                                         __m128i src, i16 l1, i16 l2) {
+    __m128i pairs[5] = {
+        _mm_shuffle_epi32(src, 0x00),
+        _mm_shuffle_epi32(src, 0x55),
+        _mm_shuffle_epi32(src, 0xaa),
+        _mm_shuffle_epi32(src, 0xff),
+        _mm_set1_epi32((i32)(((u32)(u16)l2 << 16) | (u16)l1)),
+    };
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (unsigned p = 0; p < 5; p++) {
+        lo = _mm_add_epi32(lo, _mm_madd_epi16(pairs[p], coefs[p][0]));
+        hi = _mm_add_epi32(hi, _mm_madd_epi16(pairs[p], coefs[p][1]));
+    }
+    return _mm_packs_epi32(_mm_srai_epi32(lo, 11), _mm_srai_epi32(hi, 11));
+}
+
+/** Decode the 16 samples of an ADPCM frame, scalar version. */
+static void adpcm_predict(i16 *dst, u32 src, unsigned rshift) {
+    for (unsigned i = 0; i < 8; i++) {
+        u8 byte = state.dmem[(src + i) & DMEM_MASK];
+        dst[2 * i]     = (i16)((u16)(byte & 0xf0) << 8) >> rshift;
+        dst[2 * i + 1] = (i16)((u16)(byte & 0x0f) << 12) >> rshift;
+    }
+}
+
+/** Decode the 16 samples of an ADPCM frame, SIMD version. */
+static inline void mm_adpcm_predict(__m128i *lo, __m128i *hi,
+                                    u32 src, unsigned rshift) {
+    __m128i bytes = _mm_loadl_epi64(
+        (__m128i const *)&state.dmem[src & DMEM_MASK]);
+    __m128i words = _mm_unpacklo_epi8(bytes, bytes);
+    __m128i high = _mm_and_si128(words, _mm_set1_epi16((i16)0xf000));
+    __m128i low = _mm_slli_epi16(words, 12);
+    __m128i count = _mm_cvtsi32_si128(rshift);
+    *lo = _mm_sra_epi16(_mm_unpacklo_epi16(high, low), count);
+    *hi = _mm_sra_epi16(_mm_unpackhi_epi16(high, low), count);
+}
+
+/**
+ * Decode \p count bytes of ADPCM samples from \p dmemi to \p dmemo.
+ * The output starts with the last frame of the previous run, saved to
+ * \p last_frame_address, or loaded from \p loop_address when looping.
+ */
+static void adpcm(struct audio_state *audio, bool init, bool loop,
+                  u32 dmemo, u32 dmemi, u32 count,
+                  u32 loop_address, u32 last_frame_address) {
+    alignas(16) i16 last_frame[16];
+    u32 nr_frames = count / 32;
+
+    if (init) {
+        memset(last_frame, 0, sizeof(last_frame));
+    } else {
+        u32 address = loop ? loop_address : last_frame_address;
+        for (unsigned i = 0; i < 16; i++) {
+            last_frame[i] = load_dram_u16(address + 2 * i);
+        }
+    }
+    for (unsigned i = 0; i < 16; i++) {
+        store_s16(dmemo + 2 * i, last_frame[i]);
+    }
+    dmemo += 32;
+
+    if (dmem_contiguous(dmemi, 9 * nr_frames) &&
+        dmem_contiguous(dmemo, count)) {
+        __m128i prev = _mm_load_si128((__m128i const *)&last_frame[8]);
+        for (u32 nr = 0; nr < nr_frames; nr++, dmemi += 9, dmemo += 32) {
+            u8 code = state.dmem[dmemi & DMEM_MASK];
+            unsigned scale = code >> 4;
+            __m128i const (*coefs)[2] = audio->adpcm_coefs[code & 0xf];
+            __m128i src_lo, src_hi;
+            mm_adpcm_predict(&src_lo, &src_hi, dmemi + 1,
+                             scale < 12 ? 12 - scale : 0);
+            __m128i lo = mm_adpcm_residuals(coefs, src_lo,
+                _mm_extract_epi16(prev, 6), _mm_extract_epi16(prev, 7));
+            __m128i hi = mm_adpcm_residuals(coefs, src_hi,
+                _mm_extract_epi16(lo, 6), _mm_extract_epi16(lo, 7));
+            mm_store_samples(dmemo, lo);
+            mm_store_samples(dmemo + 16, hi);
+            prev = hi;
+        }
+        _mm_store_si128((__m128i *)&last_frame[0],
+            mm_load_samples(dmemo - 32));
+        _mm_store_si128((__m128i *)&last_frame[8],
+            mm_load_samples(dmemo - 16));
+    } else {
+        for (u32 nr = 0; nr < nr_frames; nr++, dmemi += 9) {
+            u8 code = state.dmem[dmemi & DMEM_MASK];
+            unsigned scale = code >> 4;
+            i16 const *book = &audio->table[(code & 0xf) * 16];
+            i16 frame[16];
+            adpcm_predict(frame, dmemi + 1, scale < 12 ? 12 - scale : 0);
+            adpcm_residuals(&last_frame[0], &frame[0], book,
+                            last_frame[14], last_frame[15]);
+            adpcm_residuals(&last_frame[8], &frame[8], book,
+                            last_frame[6], last_frame[7]);
+            for (unsigned i = 0; i < 16; i++, dmemo += 2) {
+                store_s16(dmemo, last_frame[i]);
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < 16; i++) {
+        store_dram_u16(last_frame_address + 2 * i, last_frame[i]);
+    }
+    invalidate_dram(last_frame_address, 32);
+}
+
+/**
+ * Resample \p count bytes of samples from \p dmemi to \p dmemo with the
+ * pitch \p pitch in Q16.16 format, using the 4-tap filter of the microcode.
+ * The four samples preceding the input and the pitch accumulator
+ * are saved to \p address.
+ */
+static void resample(struct audio_state *audio, bool init,
+                     u32 dmemo, u32 dmemi, u32 count, u32 pitch,
+                     u32 address) {
+    u32 ipos = ((dmemi & DMEM_MASK) >> 1) - 4;
+    u32 opos = (dmemo & DMEM_MASK) >> 1;
+    u32 pitch_accu;
+    u32 nr_samples = count >> 1;
+
+    if (init) {
+        for (unsigned k = 0; k < 4; k++) {
+            store_s16(2 * (ipos + k), 0);
+        }
+        pitch_accu = 0;
+    } else {
+        for (unsigned k = 0; k < 4; k++) {
+            store_s16(2 * (ipos + k), load_dram_u16(address + 2 * k));
+        }
+        pitch_accu = load_dram_u16(address + 8);
+    }
+
+    // Compute the input positions and filter phases beforehand,
+    // to check the buffer overlaps for the SIMD kernel.
+    u32 positions[RESAMPLE_LUT_SIZE * 8];
+    u32 phases[RESAMPLE_LUT_SIZE * 8];
+    u32 pos = ipos;
+    u32 initial_accu = pitch_accu;
+    bool simd = nr_samples <= RESAMPLE_LUT_SIZE * 8 && (nr_samples % 8) == 0;
+    for (u32 nr = 0; simd && nr < nr_samples; nr++) {
+        positions[nr] = pos;
+        phases[nr] = (pitch_accu & 0xfc00) >> 8;
+        pitch_accu += pitch;
+        pos += pitch_accu >> 16;
+        pitch_accu &= 0xffff;
+    }
+    u32 in_start = 2 * ipos;
+    u32 in_end = 2 * (pos + 4);
+    u32 out_start = 2 * opos;
+    u32 out_end = 2 * (opos + nr_samples);
+    simd = simd && ipos < 0x800 && in_end <= sizeof(state.dmem) &&
+        out_end <= sizeof(state.dmem) &&
+        (out_end <= in_start || out_start >= in_end);
+
+    if (simd) {
+        i16 const *lut = audio->resample_lut;
+        for (u32 nr = 0; nr < nr_samples; nr += 8) {
+            __m128i sums[4];
+            for (unsigned j = 0; j < 4; j++) {
+                u32 a = nr + 2 * j;
+                __m128i in = mm_bswap_epi16(_mm_unpacklo_epi64(
+                    _mm_loadl_epi64((__m128i const *)
+                        &state.dmem[2 * positions[a]]),
+                    _mm_loadl_epi64((__m128i const *)
+                        &state.dmem[2 * positions[a + 1]])));
+                __m128i coefs = _mm_unpacklo_epi64(
+                    _mm_loadl_epi64((__m128i const *)&lut[phases[a]]),
+                    _mm_loadl_epi64((__m128i const *)&lut[phases[a + 1]]));
+                __m128i prod = _mm_madd_epi16(in, coefs);
+                prod = _mm_add_epi32(prod, _mm_srli_epi64(prod, 32));
+                sums[j] = _mm_shuffle_epi32(prod, 0x08);
+            }
+            __m128i lo = _mm_unpacklo_epi64(sums[0], sums[1]);
+            __m128i hi = _mm_unpacklo_epi64(sums[2], sums[3]);
+            mm_store_samples(2 * (opos + nr), _mm_packs_epi32(
+                _mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15)));
+        }
+        ipos = pos;
+    } else {
+        pitch_accu = initial_accu;
+        for (u32 nr = 0; nr < nr_samples; nr++) {
+            i16 const *lut = &audio->resample_lut[(pitch_accu & 0xfc00) >> 8];
+            u32 accu = 0;
+            for (unsigned k = 0; k < 4; k++) {
+                accu += (i32)load_s16(2 * (ipos + k)) * lut[k];
+            }
+            store_s16(2 * (opos + nr), clamp_s16((i32)accu >> 15));
+            pitch_accu += pitch;
+            ipos += pitch_accu >> 16;
+            pitch_accu &= 0xffff;
+        }
+    }
+
+    for (unsigned k = 0; k < 4; k++) {
+        store_dram_u16(address + 2 * k, load_s16(2 * (ipos + k)));
+    }
+    store_dram_u16(address + 8, pitch_accu);
+    invalidate_dram(address, 10);
+}
+
+/**
+ * @brief Volume ramp of the envelope mixer.
+ * The volume follows an exponential sequence towards the target,
+ * interpolated linearly over 8 samples.
+ */
+struct ramp {
+    i32 value;
+    i32 step;
+    i32 target;
+};
+
+static inline i16 ramp_step(struct ramp *ramp) {
+    bool reached;
+    ramp->value = (i32)((u32)ramp->value + (u32)ramp->step);
+    reached = ramp->step <= 0 ?
+        ramp->value <= ramp->target : ramp->value >= ramp->target;
+    if (reached) {
+        ramp->value = ramp->target;
+        ramp->step = 0;
+    }
+    return ramp->value >> 16;
+}
+
+/** Compute the gains clamp((vol * k + 0x4000) >> 15) for 8 samples. */
+static inline __m128i mm_envmix_gains(__m128i vol, i16 k) {
+    __m128i one = _mm_set1_epi16(1);
+    __m128i coef = _mm_set1_epi32((i32)(UINT32_C(0x4000) << 16 | (u16)k));
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(vol, one), coef);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(vol, one), coef);
+    return _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+}
+
+/**
+ * Mix the input samples into the dry left and right buffers, and the
+ * wet left and right buffers if \p aux is set, with the gains of the
+ * left and right volume ramps. The ramp state is saved to \p address
+ * in the layout of the microcode.
+ */
+static void envmixer(struct audio_state *audio, bool init, bool aux,
+                     u32 dmemi, u32 count, u32 address) {
+    u32 buffers[4] = {
+        audio->out, audio->dry_right, audio->wet_left, audio->wet_right };
+    unsigned nr_buffers = aux ? 4 : 2;
+    i16 dry = audio->dry;
+    i16 wet = audio->wet;
+    struct ramp ramps[2];
+    i32 exp_seq[2];
+    i32 exp_rates[2];
+
+    if (init) {
+        for (unsigned lr = 0; lr < 2; lr++) {
+            ramps[lr].value = (i32)((u32)(i32)audio->vol[lr] << 16);
+            ramps[lr].target = (i32)((u32)(i32)audio->target[lr] << 16);
+            exp_rates[lr] = audio->rate[lr];
+            exp_seq[lr] = (i32)((u32)(i32)audio->vol[lr] *
+                                (u32)audio->rate[lr]);
+        }
+    } else {
+        wet = load_dram_u16(address);
+        dry = load_dram_u16(address + 4);
+        for (unsigned lr = 0; lr < 2; lr++) {
+            ramps[lr].target = load_dram_u32(address + 8 + 4 * lr);
+            exp_rates[lr] = load_dram_u32(address + 16 + 4 * lr);
+            exp_seq[lr] = load_dram_u32(address + 24 + 4 * lr);
+            ramps[lr].value = load_dram_u32(address + 32 + 4 * lr);
+        }
+    }
+    for (unsigned lr = 0; lr < 2; lr++) {
+        ramps[lr].step = (i32)((u32)ramps[lr].target - (u32)ramps[lr].value);
+    }
+
+    u32 nr_groups = (count + 15) / 16;
+    bool simd = dmem_contiguous(dmemi, 16 * nr_groups);
+    for (unsigned i = 0; i < nr_buffers; i++) {
+        simd = simd && dmem_contiguous(buffers[i], 16 * nr_groups) &&
+            simd_compatible(buffers[i], dmemi);
+        for (unsigned j = 0; j < i; j++) {
+            simd = simd && simd_compatible(buffers[i], buffers[j]);
+        }
+    }
+
+    for (u32 group = 0; group < nr_groups; group++) {
+        alignas(16) i16 vols[2][8];
+        for (unsigned lr = 0; lr < 2; lr++) {
+            if (ramps[lr].step != 0) {
+                exp_seq[lr] = ((i64)exp_seq[lr] * exp_rates[lr]) >> 16;
+                ramps[lr].step = (i32)((u32)exp_seq[lr] -
+                                       (u32)ramps[lr].value) >> 3;
+            }
+        }
+        for (unsigned x = 0; x < 8; x++) {
+            vols[0][x] = ramp_step(&ramps[0]);
+            vols[1][x] = ramp_step(&ramps[1]);
+        }
+
+        u32 offset = 16 * group;
+        if (simd) {
+            __m128i left = _mm_load_si128((__m128i const *)vols[0]);
+            __m128i right = _mm_load_si128((__m128i const *)vols[1]);
+            __m128i gains[4] = {
+                mm_envmix_gains(left, dry), mm_envmix_gains(right, dry),
+                mm_envmix_gains(left, wet), mm_envmix_gains(right, wet),
+            };
+            __m128i in = mm_load_samples(dmemi + offset);
+            for (unsigned i = 0; i < nr_buffers; i++) {
+                u32 dst = buffers[i] + offset;
+                mm_store_samples(dst,
+                    mm_mix_epi16(mm_load_samples(dst), in, gains[i]));
+            }
+        } else {
+            for (unsigned x = 0; x < 8; x++) {
+                i16 gains[4] = {
+                    clamp_s16(((i32)vols[0][x] * dry + 0x4000) >> 15),
+                    clamp_s16(((i32)vols[1][x] * dry + 0x4000) >> 15),
+                    clamp_s16(((i32)vols[0][x] * wet + 0x4000) >> 15),
+                    clamp_s16(((i32)vols[1][x] * wet + 0x4000) >> 15),
+                };
+                i16 in = load_s16(dmemi + offset + 2 * x);
+                for (unsigned i = 0; i < nr_buffers; i++) {
+                    mix_sample(buffers[i] + offset + 2 * x, in, gains[i]);
+                }
+            }
+        }
+    }
+
+    store_dram_u16(address, wet);
+    store_dram_u16(address + 4, dry);
+    for (unsigned lr = 0; lr < 2; lr++) {
+        store_dram_u32(address + 8 + 4 * lr, ramps[lr].target);
+        store_dram_u32(address + 16 + 4 * lr, exp_rates[lr]);
+        store_dram_u32(address + 24 + 4 * lr, exp_seq[lr]);
+        store_dram_u32(address + 32 + 4 * lr, ramps[lr].value);
+    }
+    invalidate_dram(address, 40);
+}
+
+/** Mix \p count bytes of samples from \p dmemi into \p dmemo
+ * with the gain \p gain. */
+static void mixer(u32 dmemo, u32 dmemi, u32 count, i16 gain) {
+    u32 nr = 0;
+    if (dmem_contiguous(dmemo, count) && dmem_contiguous(dmemi, count) &&
+        simd_compatible(dmemo, dmemi)) {
+        __m128i gains = _mm_set1_epi16(gain);
+        for (; nr + 16 <= count; nr += 16) {
+            mm_store_samples(dmemo + nr, mm_mix_epi16(
+                mm_load_samples(dmemo + nr),
+                mm_load_samples(dmemi + nr), gains));
+        }
+    }
+    for (; nr < count; nr += 2) {
+        mix_sample(dmemo + nr, load_s16(dmemi + nr), gain);
+    }
+}
+
+/** Interleave \p count bytes of the left and right samples
+ * into \p dmemo. */
+static void interleave(u32 dmemo, u32 left, u32 right, u32 count) {
+    u32 nr_samples = (count >> 2) * 2;
+    u32 nr = 0;
+    if (dmem_contiguous(dmemo, 4 * nr_samples) &&
+        dmem_contiguous(left, 2 * nr_samples) &&
+        dmem_contiguous(right, 2 * nr_samples) &&
+        ((dmemo & DMEM_MASK) + 4 * nr_samples <= (left & DMEM_MASK) ||
+         (left & DMEM_MASK) + 2 * nr_samples <= (dmemo & DMEM_MASK)) &&
+        ((dmemo & DMEM_MASK) + 4 * nr_samples <= (right & DMEM_MASK) ||
+         (right & DMEM_MASK) + 2 * nr_samples <= (dmemo & DMEM_MASK))) {
+        // Interleaving does not depend on the byte order.
+        for (; nr + 8 <= nr_samples; nr += 8) {
+            __m128i l = _mm_loadu_si128(
+                (__m128i const *)&state.dmem[(left & DMEM_MASK) + 2 * nr]);
+            __m128i r = _mm_loadu_si128(
+                (__m128i const *)&state.dmem[(right & DMEM_MASK) + 2 * nr]);
+            u8 *dst = &state.dmem[(dmemo & DMEM_MASK) + 4 * nr];
+            _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(l, r));
+        }
+    }
+    for (; nr < nr_samples; nr++) {
+        i16 l = load_s16(left + 2 * nr);
+        i16 r = load_s16(right + 2 * nr);
+        store_s16(dmemo + 4 * nr, l);
+        store_s16(dmemo + 4 * nr + 2, r);
+    }
+}
+
+/** Copy \p count bytes from DRAM to DMEM, with the DMA alignment. */
+static void dma_load(u32 dmem, u32 address, u32 count) {
+    dmem &= ~UINT32_C(3);
+    address &= ~UINT32_C(7);
+    count = align(count, 8);
+    for (u32 nr = 0; nr < count; nr++) {
+        state.dmem[(dmem + nr) & DMEM_MASK] =
+            state.dram[(address + nr) & DRAM_MASK];
+    }
+}
+
+/** Copy \p count bytes from DMEM to DRAM, with the DMA alignment. */
+static void dma_save(struct audio_state *audio,
+                     u32 dmem, u32 address, u32 count) {
+    dmem &= ~UINT32_C(3);
+    address &= ~UINT32_C(7);
+    count = align(count, 8);
+    for (u32 nr = 0; nr < count; nr++) {
+        state.dram[(address + nr) & DRAM_MASK] =
+            state.dmem[(dmem + nr) & DMEM_MASK];
+    }
+    invalidate_dram(address, count);
+    if (audio->outputs != NULL) {
+        audio->outputs->push_back({ address & DRAM_MASK, count });
+    }
+}
+
+static void abi1_SPNOOP(struct audio_state *audio, u32 w1, u32 w2) {
+}
+
+static void abi1_ADPCM(struct audio_state *audio, u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    adpcm(audio, flags & A_INIT, flags & A_LOOP,
+          audio->out, audio->in, align(audio->count, 32),
+          audio->loop, get_address(audio, w2));
+}
+
+static void abi1_CLEARBUFF(struct audio_state *audio, u32 w1, u32 w2) {
+    u32 dmem = ((w1 & 0xffff) + ABI1_DMEM_BASE) & DMEM_MASK;
+    u32 count = align(w2 & 0xffff, 16);
+    if (dmem_contiguous(dmem, count)) {
+        memset(&state.dmem[dmem], 0, count);
+    } else {
+        for (u32 nr = 0; nr < count; nr++) {
+            state.dmem[(dmem + nr) & DMEM_MASK] = 0;
+        }
+    }
+}
+
+static void abi1_ENVMIXER(struct audio_state *audio, u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    envmixer(audio, flags & A_INIT, flags & A_AUX,
+             audio->in, audio->count, get_address(audio, w2));
+}
+
+static void abi1_LOADBUFF(struct audio_state *audio, u32 w1, u32 w2) {
+    if (audio->count != 0) {
+        dma_load(audio->in, get_address(audio, w2), audio->count);
+    }
+}
+
+static void abi1_RESAMPLE(struct audio_state *audio, u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    u32 pitch = (w1 & 0xffff) << 1;
+    resample(audio, flags & A_INIT, audio->out, audio->in,
+             align(audio->count, 16), pitch, get_address(audio, w2));
+}
+
+static void abi1_SAVEBUFF(struct audio_state *audio, u32 w1, u32 w2) {
+    if (audio->count != 0) {
+        dma_save(audio, audio->out, get_address(audio, w2), audio->count);
+    }
+}
+
+static void abi1_SEGMENT(struct audio_state *audio, u32 w1, u32 w2) {
+    audio->segments[(w2 >> 24) & 0xfu] = w2 & 0xffffffu;
+}
+
+static void abi1_SETBUFF(struct audio_state *audio, u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    u32 dmem = ((w1 & 0xffff) + ABI1_DMEM_BASE) & 0xffff;
+    u32 dmemo = ((w2 >> 16) + ABI1_DMEM_BASE) & 0xffff;
+    u32 count = w2 & 0xffff;
+    if (flags & A_AUX) {
+        audio->dry_right = dmem;
+        audio->wet_left = dmemo;
+        audio->wet_right = (count + ABI1_DMEM_BASE) & 0xffff;
+    } else {
+        audio->in = dmem;
+        audio->out = dmemo;
+        audio->count = count;
+    }
+}
+
+static void abi1_SETVOL(struct audio_state *audio, u32 w1, u32 w2) {
+    u8 flags = w1 >> 16;
+    if (flags & A_AUX) {
+        audio->dry = w1;
+        audio->wet = w2;
+    } else {
+        unsigned lr = (flags & A_LEFT) ? 0 : 1;
+        if (flags & A_VOL) {
+            audio->vol[lr] = w1;
+        } else {
+            audio->target[lr] = w1;
+            audio->rate[lr] = w2;
+        }
+    }
+}
+
+static void abi1_DMEMMOVE(struct audio_state *audio, u32 w1, u32 w2) {
+    u32 dmemi = (w1 & 0xffff) + ABI1_DMEM_BASE;
+    u32 dmemo = (w2 >> 16) + ABI1_DMEM_BASE;
+    u32 count = align(w2 & 0xffff, 16);
+    for (u32 nr = 0; nr < count; nr++) {
+        state.dmem[(dmemo + nr) & DMEM_MASK] =
+            state.dmem[(dmemi + nr) & DMEM_MASK];
+    }
+}
+
+static void abi1_LOADADPCM(struct audio_state *audio, u32 w1, u32 w2) {
+    u32 count = align(w1 & 0xffff, 8) >> 1;
+    u32 address = get_address(audio, w2);
+    count = count < ADPCM_TABLE_SIZE ? count : ADPCM_TABLE_SIZE;
+    for (u32 nr = 0; nr < count; nr++) {
+        audio->table[nr] = load_dram_u16(address + 2 * nr);
+    }
+    expand_adpcm_table(audio);
+}
+
+static void abi1_MIXER(struct audio_state *audio, u32 w1, u32 w2) {
+    if (audio->count != 0) {
+        mixer((w2 & 0xffff) + ABI1_DMEM_BASE, (w2 >> 16) + ABI1_DMEM_BASE,
+              align(audio->count, 32), w1);
+    }
+}
+
+static void abi1_INTERLEAVE(struct audio_state *audio, u32 w1, u32 w2) {
+    if (audio->count != 0) {
+        interleave(audio->out, (w2 >> 16) + ABI1_DMEM_BASE,
+                   (w2 & 0xffff) + ABI1_DMEM_BASE, audio->count);
+    }
+}
+
+static void abi1_SETLOOP(struct audio_state *audio, u32 w1, u32 w2) {
+    audio->loop = get_address(audio, w2);
+}
+
+/** Commands of the ABI1 audio microcode. POLEF is not implemented,
+ * the command lists using it are left to the low level emulation. */
+static const audio_command_t abi1_commands[16] = {
+    abi1_SPNOOP,        abi1_ADPCM,         abi1_CLEARBUFF,     abi1_ENVMIXER,
+    abi1_LOADBUFF,      abi1_RESAMPLE,      abi1_SAVEBUFF,      abi1_SEGMENT,
+    abi1_SETBUFF,       abi1_SETVOL,        abi1_DMEMMOVE,      abi1_LOADADPCM,
+    abi1_MIXER,         abi1_INTERLEAVE,    NULL,               abi1_SETLOOP,
+};
+
+/** Words of the data segment of the ABI1 audio microcode, identifying
+ * the microcode: the first word, and two words of its command table. */
+#define ABI1_DATA_WORD_0x00     UINT32_C(0x00000001)
+#define ABI1_DATA_WORD_0x28     UINT32_C(0x1e24138c)
+#define ABI1_DATA_WORD_0x30     UINT32_C(0xf0000f00)
+
+/** First phase of the resample filter of the audio microcodes,
+ * locating the filter coefficients in the data segment. */
+static const u8 resample_lut_row0[8] = {
+    0x0c, 0x39, 0x66, 0xad, 0x0d, 0x46, 0xff, 0xdf,
+};
+
+static u32 load_u32(u8 const *ptr) {
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) |
+           ((u32)ptr[2] << 8)  | (u32)ptr[3];
+}
+
+bool identify_audio_ucode(u8 const *data, u32 size, u32 *lut_offset) {
+    if (size < 0x34 ||
+        load_u32(data + 0x00) != ABI1_DATA_WORD_0x00 ||
+        load_u32(data + 0x28) != ABI1_DATA_WORD_0x28 ||
+        load_u32(data + 0x30) != ABI1_DATA_WORD_0x30) {
+        return false;
+    }
+    for (u32 offset = 0; offset + 2 * RESAMPLE_LUT_SIZE <= size;
+         offset += 2) {
+        if (memcmp(data + offset, resample_lut_row0,
+                   sizeof(resample_lut_row0)) == 0) {
+            *lut_offset = offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool exec_audio_task(u32 lut_offset, std::vector<dram_range> *outputs) {
+    static struct audio_state audio;
+    u32 alist = load_task_word(OSTASK_DATA_PTR) & DRAM_MASK;
+    u32 alist_size = load_task_word(OSTASK_DATA_SIZE) & ~UINT32_C(7);
+    u32 lut = load_task_word(OSTASK_UCODE_DATA) + lut_offset;
+
+    if (alist_size > sizeof(state.dram) - alist) {
+        return false;
+    }
+    for (u32 nr = 0; nr < alist_size; nr += 8) {
+        u32 command = (state.dram[alist + nr] & 0x7fu);
+        if (command >= 16 || abi1_commands[command] == NULL) {
+            debugger::info(Debugger::SP,
+                "unsupported audio command {:02x}, "
+                "task left to the low level emulation", command);
+            return false;
+        }
+    }
+
+    memset(&audio, 0, sizeof(audio));
+    for (unsigned nr = 0; nr < RESAMPLE_LUT_SIZE; nr++) {
+        audio.resample_lut[nr] = load_dram_u16(lut + 2 * nr);
+    }
+    audio.outputs = outputs;
+    for (u32 nr = 0; nr < alist_size; nr += 8) {
+        u32 w1 = load_dram_u32(alist + nr);
+        u32 w2 = load_dram_u32(alist + nr + 4);
+        abi1_commands[(w1 >> 24) & 0x7fu](&audio, w1, w2);
+    }
+    return true;
+}
+
+}; /* namespace hle */
+}; /* namespace R4300 */
@@ -0,0 +1,1293 @@
+
+#include <cmath>
+#include <cstring>
+
+#include <emmintrin.h>
+
+#include <r4300/hle.h>
+#include <r4300/rdp.h>
+#include <r4300/state.h>
+
+#include <core.h>
+#include <debugger.h>
+
+namespace R4300 {
+namespace hle {
+
+/* Display list commands of the Fast3D and F3DEX microcodes. */
+#define G_SPNOOP                0x00
+#define G_MTX                   0x01
+#define G_MOVEMEM               0x03
+#define G_VTX                   0x04
+#define G_DL                    0x06
+#define G_SPRITE2D_BASE         0x09
+#define G_LOAD_UCODE            0xaf    /* F3DEX */
+#define G_BRANCH_Z              0xb0    /* F3DEX */
+#define G_TRI2                  0xb1    /* F3DEX */
+#define G_MODIFYVTX             0xb2    /* F3DEX, G_RDPHALF_CONT in Fast3D */
+#define G_RDPHALF_2             0xb3
+#define G_RDPHALF_1             0xb4
+#define G_LINE3D                0xb5
+#define G_CLEARGEOMETRYMODE     0xb6
+#define G_SETGEOMETRYMODE       0xb7
+#define G_ENDDL                 0xb8
+#define G_SETOTHERMODE_L        0xb9
+#define G_SETOTHERMODE_H        0xba
+#define G_TEXTURE               0xbb
+#define G_MOVEWORD              0xbc
+#define G_POPMTX                0xbd
+#define G_CULLDL                0xbe
+#define G_TRI1                  0xbf
+#define G_NOOP                  0xc0
+#define G_TEXRECT               0xe4
+#define G_TEXRECTFLIP           0xe5
+#define G_RDPSETOTHERMODE       0xef
+#define G_SETTIMG               0xfd
+#define G_SETZIMG               0xfe
+#define G_SETCIMG               0xff
+
+/* Geometry mode flags. */
+#define G_ZBUFFER               UINT32_C(0x00000001)
+#define G_SHADE                 UINT32_C(0x00000004)
+#define G_SHADING_SMOOTH        UINT32_C(0x00000200)
+#define G_CULL_FRONT            UINT32_C(0x00001000)
+#define G_CULL_BACK             UINT32_C(0x00002000)
+#define G_FOG                   UINT32_C(0x00010000)
+#define G_LIGHTING              UINT32_C(0x00020000)
+#define G_TEXTURE_GEN           UINT32_C(0x00040000)
+#define G_TEXTURE_GEN_LINEAR    UINT32_C(0x00080000)
+
+/* G_MTX parameters. */
+#define G_MTX_PROJECTION        0x01
+#define G_MTX_LOAD              0x02
+#define G_MTX_PUSH              0x04
+
+/* G_MOVEMEM indices. */
+#define G_MV_VIEWPORT           0x80
+#define G_MV_LOOKATY            0x82
+#define G_MV_LOOKATX            0x84
+#define G_MV_L0                 0x86
+#define G_MV_L7                 0x94
+#define G_MV_MATRIX_1           0x9e
+#define G_MV_MATRIX_2           0x98
+#define G_MV_MATRIX_3           0x9a
+#define G_MV_MATRIX_4           0x9c
+
+/* G_MOVEWORD indices. */
+#define G_MW_MATRIX             0x00
+#define G_MW_NUMLIGHT           0x02
+#define G_MW_CLIP               0x04
+#define G_MW_SEGMENT            0x06
+#define G_MW_FOG                0x08
+#define G_MW_LIGHTCOL           0x0a
+#define G_MW_POINTS             0x0c
+#define G_MW_PERSPNORM          0x0e
+
+/* Vertex fields modified by G_MODIFYVTX and G_MW_POINTS. */
+#define G_MWO_POINT_RGBA        0x10
+#define G_MWO_POINT_ST          0x14
+#define G_MWO_POINT_XYSCREEN    0x18
+#define G_MWO_POINT_ZSCREEN     0x1c
+
+/* Vertex clip codes: outside of the view volume, and outside of the
+ * guard band beyond which the triangles are clipped. */
+#define CLIP_X_NEG              0x001
+#define CLIP_X_POS              0x002
+#define CLIP_Y_NEG              0x004
+#define CLIP_Y_POS              0x008
+#define CLIP_NEAR               0x010
+#define CLIP_FAR                0x020
+#define GUARD_X_NEG             0x040
+#define GUARD_X_POS             0x080
+#define GUARD_Y_NEG             0x100
+#define GUARD_Y_POS             0x200
+#define CLIP_VIEW               0x03f
+#define CLIP_GUARD              (CLIP_NEAR | 0x3c0)
+
+/** Depth of the display list stack. */
+#define GFX_DL_STACK_SIZE       18
+/** Depth of the modelview matrix stack. */
+#define GFX_MTX_STACK_SIZE      32
+/** Size of the vertex buffer. */
+#define GFX_VERTEX_MAX          32
+/** Number of directional lights. */
+#define GFX_LIGHT_MAX           8
+/** Number of RDP command double words buffered before execution. */
+#define GFX_COMMAND_MAX         0x1000
+/** Number of display list commands executed before the task is aborted. */
+#define GFX_STEP_MAX            (UINT32_C(1) << 22)
+/** Number of conditional branches followed by the display list scan. */
+#define GFX_BRANCH_MAX          64
+/** Maximum number of vertices of a clipped triangle. */
+#define GFX_POLYGON_MAX         16
+
+#define DRAM_MASK               ((u32)sizeof(state.dram) - 1)
+
+/**
+ * @brief Transformed vertex.
+ * @var vertex::clip
+ *      Clip coordinates x, y, z, w.
+ * @var vertex::color
+ *      Shade color r, g, b, a, in the range 0..255.
+ * @var vertex::tex
+ *      Texture coordinates s, t in S10.5 format, scaled.
+ * @var vertex::screen
+ *      Screen coordinates x, y in pixels, z in the range 0..0x7fff,
+ *      and the inverse of w. Valid only if the vertex is not clipped
+ *      by the near plane.
+ */
+struct vertex {
+    __m128 clip;
+    __m128 color;
+    __m128 tex;
+    __m128 screen;
+    unsigned clip_codes;
+};
+
+/** Matrix for row vectors, in floating point format. */
+struct matrix {
+    __m128 row[4];
+};
+
+/** Directional light, with a normalized direction. */
+struct light {
+    __m128 color;
+    __m128 dir;
+};
+
+/**
+ * @brief State of the display list interpreter.
+ * @var gfx_state::mvp_raw
+ *      Combined matrix in the fixed point format of the microcode,
+ *      modified by G_MW_MATRIX and G_MV_MATRIX_x.
+ * @var gfx_state::ucode_switch
+ *      Set when the execution reached a microcode switch.
+ */
+struct gfx_state {
+    enum gfx_ucode ucode;
+    u32 pc;
+    u32 dl_stack[GFX_DL_STACK_SIZE];
+    unsigned dl_depth;
+    u32 segments[16];
+
+    struct matrix modelview[GFX_MTX_STACK_SIZE];
+    unsigned mv_depth;
+    struct matrix projection;
+    struct matrix mvp;
+    u8 mvp_raw[64];
+
+    __m128 vscale;
+    __m128 vtrans;
+    float clip_ratio;
+    struct vertex vertices[GFX_VERTEX_MAX];
+
+    u32 geometry_mode;
+    u32 othermode_h;
+    u32 othermode_l;
+    struct {
+        bool on;
+        unsigned tile;
+        unsigned level;
+        float scale_s;
+        float scale_t;
+    } texture;
+
+    unsigned nr_lights;
+    struct light lights[GFX_LIGHT_MAX + 1];
+    __m128 lookat[2];
+    float fog_multiplier;
+    float fog_offset;
+    u32 rdphalf_1;
+    u32 rdphalf_2;
+
+    u64 commands[GFX_COMMAND_MAX];
+    size_t nr_commands;
+    bool ucode_switch;
+};
+
+static inline u8 load_dram_u8(u32 address) {
+    return state.dram[address & DRAM_MASK];
+}
+
+static inline u16 load_dram_u16(u32 address) {
+    return ((u16)load_dram_u8(address) << 8) | load_dram_u8(address + 1);
+}
+
+static inline u32 load_dram_u32(u32 address) {
+    return ((u32)load_dram_u16(address) << 16) | load_dram_u16(address + 2);
+}
+
+/** Resolve the segmented address \p so. */
+static u32 get_address(struct gfx_state *gfx, u32 so) {
+    return (gfx->segments[(so >> 24) & 0xfu] + (so & 0xffffffu)) & DRAM_MASK;
+}
+
+/** Convert to the S15.16 fixed point format, with saturation. */
+static inline i32 to_s15_16(float value) {
+    float fixed = value * 65536.f;
+    return fixed >= 2147483520.f ? INT32_MAX :
+           fixed <= -2147483648.f ? INT32_MIN : (i32)fixed;
+}
+
+static inline float dot3(__m128 a, __m128 b) {
+    __m128 m = _mm_mul_ps(a, b);
+    __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, 0x55));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(m, m, 0xaa)));
+}
+
+static inline __m128 normalize3(__m128 v) {
+    float len = dot3(v, v);
+    return len > 0.f ? _mm_mul_ps(v, _mm_set1_ps(1.f / sqrtf(len))) : v;
+}
+
+static inline __m128 lerp(__m128 a, __m128 b, __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+/** Multiply the row vector x, y, z, 1 by the matrix \p m. */
+static inline __m128 transform_point(struct matrix const *m,
+                                     float x, float y, float z) {
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(x), m->row[0]),
+                   _mm_mul_ps(_mm_set1_ps(y), m->row[1])),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(z), m->row[2]), m->row[3]));
+}
+
+/** Multiply the row vector x, y, z, 0 by the matrix \p m. */
+static inline __m128 transform_vector(struct matrix const *m,
+                                      float x, float y, float z) {
+    __m128 v = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(x), m->row[0]),
+                   _mm_mul_ps(_mm_set1_ps(y), m->row[1])),
+        _mm_mul_ps(_mm_set1_ps(z), m->row[2]));
+    return _mm_and_ps(v, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+}
+
+/** Compute \p dst = \p a * \p b; \p dst may alias \p a or \p b. */
+static void mul_matrix(struct matrix *dst, struct matrix const *a,
+                       struct matrix const *b) {
+    struct matrix res;
+    for (unsigned i = 0; i < 4; i++) {
+        alignas(16) float row[4];
+        _mm_store_ps(row, a->row[i]);
+        res.row[i] = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), b->row[0]),
+                       _mm_mul_ps(_mm_set1_ps(row[1]), b->row[1])),
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[2]), b->row[2]),
+                       _mm_mul_ps(_mm_set1_ps(row[3]), b->row[3])));
+    }
+    *dst = res;
+}
+
+static void identity_matrix(struct matrix *m) {
+    m->row[0] = _mm_setr_ps(1.f, 0.f, 0.f, 0.f);
+    m->row[1] = _mm_setr_ps(0.f, 1.f, 0.f, 0.f);
+    m->row[2] = _mm_setr_ps(0.f, 0.f, 1.f, 0.f);
+    m->row[3] = _mm_setr_ps(0.f, 0.f, 0.f, 1.f);
+}
+
+/**
+ * Convert a matrix from the fixed point format of the microcode:
+ * the integer parts of the S15.16 elements, followed by the
+ * fractional parts.
+ */
+static void convert_matrix(struct matrix *m, u8 const *raw) {
+    for (unsigned i = 0; i < 4; i++) {
+        alignas(16) float row[4];
+        for (unsigned j = 0; j < 4; j++) {
+            u8 const *hi = raw + 8 * i + 2 * j;
+            u8 const *lo = hi + 32;
+            i32 fixed = (i32)(((u32)hi[0] << 24) | ((u32)hi[1] << 16) |
+                              ((u32)lo[0] << 8) | (u32)lo[1]);
+            row[j] = (float)fixed / 65536.f;
+        }
+        m->row[i] = _mm_load_ps(row);
+    }
+}
+
+static void load_matrix(struct matrix *m, u32 address) {
+    u8 raw[64];
+    for (unsigned nr = 0; nr < sizeof(raw); nr++) {
+        raw[nr] = load_dram_u8(address + nr);
+    }
+    convert_matrix(m, raw);
+}
+
+/** Convert a matrix to the fixed point format of the microcode. */
+static void store_raw_matrix(u8 *raw, struct matrix const *m) {
+    for (unsigned i = 0; i < 4; i++) {
+        alignas(16) float row[4];
+        _mm_store_ps(row, m->row[i]);
+        for (unsigned j = 0; j < 4; j++) {
+            u32 fixed = to_s15_16(row[j]);
+            u8 *hi = raw + 8 * i + 2 * j;
+            u8 *lo = hi + 32;
+            hi[0] = fixed >> 24; hi[1] = fixed >> 16;
+            lo[0] = fixed >> 8;  lo[1] = fixed;
+        }
+    }
+}
+
+static void update_mvp(struct gfx_state *gfx) {
+    mul_matrix(&gfx->mvp, &gfx->modelview[gfx->mv_depth], &gfx->projection);
+    store_raw_matrix(gfx->mvp_raw, &gfx->mvp);
+}
+
+/** Append an RDP command to the command buffer. */
+static void push_command(struct gfx_state *gfx, u64 const *command,
+                         size_t len) {
+    if (gfx->nr_commands + len > GFX_COMMAND_MAX) {
+        rdp::interface->exec_commands(gfx->commands, gfx->nr_commands);
+        gfx->nr_commands = 0;
+    }
+    memcpy(&gfx->commands[gfx->nr_commands], command, len * sizeof(u64));
+    gfx->nr_commands += len;
+}
+
+static void push_command(struct gfx_state *gfx, u32 w0, u32 w1) {
+    u64 command = ((u64)w0 << 32) | w1;
+    push_command(gfx, &command, 1);
+}
+
+static void flush_commands(struct gfx_state *gfx) {
+    if (gfx->nr_commands > 0) {
+        rdp::interface->exec_commands(gfx->commands, gfx->nr_commands);
+        gfx->nr_commands = 0;
+    }
+}
+
+/** Compute the screen coordinates of the vertex \p v. */
+static void project_vertex(struct gfx_state *gfx, struct vertex *v) {
+    alignas(16) float clip[4];
+    _mm_store_ps(clip, v->clip);
+    float inv_w = clip[3] != 0.f ? 1.f / clip[3] : 0.f;
+    __m128 screen = _mm_add_ps(gfx->vtrans,
+        _mm_mul_ps(_mm_mul_ps(v->clip, _mm_set1_ps(inv_w)), gfx->vscale));
+    alignas(16) float values[4];
+    _mm_store_ps(values, screen);
+    values[3] = inv_w;
+    v->screen = _mm_load_ps(values);
+}
+
+static unsigned compute_clip_codes(struct gfx_state *gfx, __m128 clip) {
+    alignas(16) float c[4];
+    _mm_store_ps(c, clip);
+    float guard = gfx->clip_ratio * c[3];
+    unsigned codes = 0;
+    codes |= c[0] < -c[3] ? CLIP_X_NEG : 0;
+    codes |= c[0] >  c[3] ? CLIP_X_POS : 0;
+    codes |= c[1] < -c[3] ? CLIP_Y_NEG : 0;
+    codes |= c[1] >  c[3] ? CLIP_Y_POS : 0;
+    codes |= c[2] < -c[3] ? CLIP_NEAR : 0;
+    codes |= c[2] >  c[3] ? CLIP_FAR : 0;
+    codes |= c[0] < -guard ? GUARD_X_NEG : 0;
+    codes |= c[0] >  guard ? GUARD_X_POS : 0;
+    codes |= c[1] < -guard ? GUARD_Y_NEG : 0;
+    codes |= c[1] >  guard ? GUARD_Y_POS : 0;
+    return codes;
+}
+
+/** Compute the color of a lit vertex from its transformed normal. */
+static __m128 light_vertex(struct gfx_state *gfx, __m128 normal) {
+    __m128 color = gfx->lights[gfx->nr_lights].color;
+    for (unsigned nr = 0; nr < gfx->nr_lights; nr++) {
+        float intensity = dot3(normal, gfx->lights[nr].dir);
+        if (intensity > 0.f) {
+            color = _mm_add_ps(color,
+                _mm_mul_ps(gfx->lights[nr].color, _mm_set1_ps(intensity)));
+        }
+    }
+    return _mm_min_ps(color, _mm_set1_ps(255.f));
+}
+
+/** Load and transform \p count vertices to the vertex buffer. */
+static void load_vertices(struct gfx_state *gfx, u32 address,
+                          unsigned first, unsigned count) {
+    struct matrix const *modelview = &gfx->modelview[gfx->mv_depth];
+    for (unsigned nr = 0; nr < count && first + nr < GFX_VERTEX_MAX;
+         nr++, address += 16) {
+        struct vertex *v = &gfx->vertices[first + nr];
+        float x = (i16)load_dram_u16(address);
+        float y = (i16)load_dram_u16(address + 2);
+        float z = (i16)load_dram_u16(address + 4);
+        float s = (i16)load_dram_u16(address + 8);
+        float t = (i16)load_dram_u16(address + 10);
+        u8 r = load_dram_u8(address + 12);
+        u8 g = load_dram_u8(address + 13);
+        u8 b = load_dram_u8(address + 14);
+        u8 a = load_dram_u8(address + 15);
+
+        v->clip = transform_point(&gfx->mvp, x, y, z);
+        v->clip_codes = compute_clip_codes(gfx, v->clip);
+        project_vertex(gfx, v);
+
+        if (gfx->geometry_mode & G_LIGHTING) {
+            __m128 normal = normalize3(transform_vector(modelview,
+                (i8)r, (i8)g, (i8)b));
+            v->color = light_vertex(gfx, normal);
+            if (gfx->geometry_mode & G_TEXTURE_GEN) {
+                float fx = dot3(normal, gfx->lookat[0]);
+                float fy = dot3(normal, gfx->lookat[1]);
+                if (gfx->geometry_mode & G_TEXTURE_GEN_LINEAR) {
+                    s = acosf(-fx) * 325.94931f * 32.f;
+                    t = acosf(-fy) * 325.94931f * 32.f;
+                } else {
+                    s = (fx + 1.f) * 512.f * 32.f;
+                    t = (fy + 1.f) * 512.f * 32.f;
+                }
+            }
+        } else {
+            v->color = _mm_setr_ps(r, g, b, 0.f);
+        }
+
+        float alpha = a;
+        if (gfx->geometry_mode & G_FOG) {
+            alignas(16) float clip[4];
+            _mm_store_ps(clip, v->clip);
+            float depth = clip[3] != 0.f ? clip[2] / clip[3] : 0.f;
+            alpha = depth * gfx->fog_multiplier + gfx->fog_offset;
+            alpha = alpha < 0.f ? 0.f : alpha > 255.f ? 255.f : alpha;
+        }
+        alignas(16) float color[4];
+        _mm_store_ps(color, v->color);
+        color[3] = alpha;
+        v->color = _mm_load_ps(color);
+        v->tex = _mm_setr_ps(s * gfx->texture.scale_s,
+                             t * gfx->texture.scale_t, 0.f, 0.f);
+    }
+}
+
+/** Modify a field of a transformed vertex. */
+static void modify_vertex(struct gfx_state *gfx, unsigned index,
+                          unsigned where, u32 value) {
+    if (index >= GFX_VERTEX_MAX) {
+        return;
+    }
+    struct vertex *v = &gfx->vertices[index];
+    alignas(16) float clip[4];
+    alignas(16) float screen[4];
+    alignas(16) float vscale[4];
+    alignas(16) float vtrans[4];
+    _mm_store_ps(clip, v->clip);
+    _mm_store_ps(screen, v->screen);
+    _mm_store_ps(vscale, gfx->vscale);
+    _mm_store_ps(vtrans, gfx->vtrans);
+
+    switch (where) {
+    case G_MWO_POINT_RGBA:
+        v->color = _mm_setr_ps(value >> 24, (value >> 16) & 0xff,
+                               (value >> 8) & 0xff, value & 0xff);
+        return;
+    case G_MWO_POINT_ST:
+        v->tex = _mm_setr_ps((i16)(value >> 16), (i16)value, 0.f, 0.f);
+        return;
+    case G_MWO_POINT_XYSCREEN:
+        screen[0] = (float)(i16)(value >> 16) / 4.f;
+        screen[1] = (float)(i16)value / 4.f;
+        break;
+    case G_MWO_POINT_ZSCREEN:
+        screen[2] = (float)value / 65536.f * 32.f;
+        break;
+    default:
+        return;
+    }
+
+    /* Update the clip coordinates to match the new screen coordinates. */
+    for (unsigned i = 0; i < 3; i++) {
+        clip[i] = vscale[i] != 0.f ?
+            (screen[i] - vtrans[i]) / vscale[i] * clip[3] : clip[i];
+    }
+    v->clip = _mm_load_ps(clip);
+    v->screen = _mm_load_ps(screen);
+    v->clip_codes = compute_clip_codes(gfx, v->clip);
+}
+
+static inline u64 pack_int(i32 a, i32 b, i32 c, i32 d) {
+    return ((u64)((u32)a >> 16) << 48) | ((u64)((u32)b >> 16) << 32) |
+           ((u64)((u32)c >> 16) << 16) | (u64)((u32)d >> 16);
+}
+
+static inline u64 pack_frac(i32 a, i32 b, i32 c, i32 d) {
+    return ((u64)(u16)a << 48) | ((u64)(u16)b << 32) |
+           ((u64)(u16)c << 16) | (u64)(u16)d;
+}
+
+/**
+ * Compute the RDP triangle coefficients for the vertices \p v1, \p v2,
+ * \p v3, with screen coordinates inside of the guard band,
+ * and emit the triangle command. The shade color is taken from \p flat
+ * if not NULL.
+ */
+static void emit_triangle(struct gfx_state *gfx, struct vertex const *v1,
+                          struct vertex const *v2, struct vertex const *v3,
+                          struct vertex const *flat) {
+    bool shade = gfx->geometry_mode & G_SHADE;
+    bool texture = gfx->texture.on;
+    bool zbuffer = gfx->geometry_mode & G_ZBUFFER;
+
+    /* Sort the vertices by increasing y. */
+    alignas(16) float p[3][4];
+    struct vertex const *v[3] = { v1, v2, v3 };
+    _mm_store_ps(p[0], v1->screen);
+    _mm_store_ps(p[1], v2->screen);
+    _mm_store_ps(p[2], v3->screen);
+    unsigned i1 = 0, i2 = 1, i3 = 2, tmp;
+    if (p[i2][1] < p[i1][1]) { tmp = i1; i1 = i2; i2 = tmp; }
+    if (p[i3][1] < p[i2][1]) { tmp = i2; i2 = i3; i3 = tmp; }
+    if (p[i2][1] < p[i1][1]) { tmp = i1; i1 = i2; i2 = tmp; }
+
+    float x1 = p[i1][0], y1 = p[i1][1];
+    float x2 = p[i2][0], y2 = p[i2][1];
+    float x3 = p[i3][0], y3 = p[i3][1];
+    i32 y1f = (i32)floorf(y1 * 4.f);
+    i32 y2f = (i32)floorf(y2 * 4.f);
+    i32 y3f = (i32)ceilf(y3 * 4.f);
+    if (y1f == y3f) {
+        return;
+    }
+
+    float hx = x3 - x1, hy = y3 - y1;
+    float mx = x2 - x1, my = y2 - y1;
+    float lx = x3 - x2, ly = y3 - y2;
+    float nz = hx * my - hy * mx;
+    if (fabsf(nz) < 1e-6f) {
+        return;
+    }
+    float attr_factor = -1.f / nz;
+    bool lft = nz < 0.f;
+    float ish = hy != 0.f ? hx / hy : 0.f;
+    float ism = my != 0.f ? mx / my : 0.f;
+    float isl = ly != 0.f ? lx / ly : 0.f;
+    float fy = floorf(y1) - y1;
+
+    u64 command[22];
+    unsigned len = 0;
+    u64 opcode = 0x08 | (shade ? 0x4 : 0) | (texture ? 0x2 : 0) |
+                 (zbuffer ? 0x1 : 0);
+    command[len++] = (opcode << 56) | ((u64)lft << 55) |
+        ((u64)(gfx->texture.level & 0x7) << 51) |
+        ((u64)(gfx->texture.tile & 0x7) << 48) |
+        ((u64)(y3f & 0x3fff) << 32) | ((u64)(y2f & 0x3fff) << 16) |
+        (u64)(y1f & 0x3fff);
+    command[len++] = ((u64)(u32)to_s15_16(x2) << 32) |
+                     (u32)to_s15_16(isl);
+    command[len++] = ((u64)(u32)to_s15_16(x1 + fy * ish) << 32) |
+                     (u32)to_s15_16(ish);
+    command[len++] = ((u64)(u32)to_s15_16(x1 + fy * ism) << 32) |
+                     (u32)to_s15_16(ism);
+
+    /* Compute the attribute gradients for four attributes at once:
+     *      dAdx = (hy * mA - my * hA) * attr_factor
+     *      dAdy = (mx * hA - hx * mA) * attr_factor
+     *      dAde = dAdy + dAdx * ish
+     * and the attribute values at the start of the major edge. */
+    __m128 factor = _mm_set1_ps(attr_factor);
+    __m128 shy = _mm_set1_ps(hy), smy = _mm_set1_ps(my);
+    __m128 shx = _mm_set1_ps(hx), smx = _mm_set1_ps(mx);
+    __m128 sish = _mm_set1_ps(ish), sfy = _mm_set1_ps(fy);
+    auto gradients = [&](__m128 a1, __m128 a2, __m128 a3, i32 out[4][4]) {
+        __m128 ma = _mm_sub_ps(a2, a1);
+        __m128 ha = _mm_sub_ps(a3, a1);
+        __m128 dadx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(shy, ma),
+                                            _mm_mul_ps(smy, ha)), factor);
+        __m128 dady = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(smx, ha),
+                                            _mm_mul_ps(shx, ma)), factor);
+        __m128 dade = _mm_add_ps(dady, _mm_mul_ps(dadx, sish));
+        __m128 a = _mm_add_ps(a1, _mm_mul_ps(sfy, dade));
+        __m128 values[4] = { a, dadx, dade, dady };
+        for (unsigned i = 0; i < 4; i++) {
+            alignas(16) float f[4];
+            _mm_store_ps(f, values[i]);
+            for (unsigned j = 0; j < 4; j++) {
+                out[i][j] = to_s15_16(f[j]);
+            }
+        }
+    };
+
+    if (shade) {
+        i32 c[4][4];
+        if (flat != NULL) {
+            gradients(flat->color, flat->color, flat->color, c);
+        } else {
+            gradients(v[i1]->color, v[i2]->color, v[i3]->color, c);
+        }
+        command[len++] = pack_int(c[0][0], c[0][1], c[0][2], c[0][3]);
+        command[len++] = pack_int(c[1][0], c[1][1], c[1][2], c[1][3]);
+        command[len++] = pack_frac(c[0][0], c[0][1], c[0][2], c[0][3]);
+        command[len++] = pack_frac(c[1][0], c[1][1], c[1][2], c[1][3]);
+        command[len++] = pack_int(c[2][0], c[2][1], c[2][2], c[2][3]);
+        command[len++] = pack_int(c[3][0], c[3][1], c[3][2], c[3][3]);
+        command[len++] = pack_frac(c[2][0], c[2][1], c[2][2], c[2][3]);
+        command[len++] = pack_frac(c[3][0], c[3][1], c[3][2], c[3][3]);
+    }
+
+    if (texture || zbuffer) {
+        /* Texture coordinates are divided by w for the perspective
+         * correction; the inverse w is normalized to the maximum 0x7fff. */
+        float w1 = p[i1][3], w2 = p[i2][3], w3 = p[i3][3];
+        float wmax = fmaxf(w1, fmaxf(w2, w3));
+        float wnorm = wmax > 0.f ? 1.f / wmax : 0.f;
+        __m128 attrs[3];
+        for (unsigned i = 0; i < 3; i++) {
+            unsigned k = i == 0 ? i1 : i == 1 ? i2 : i3;
+            alignas(16) float tex[4];
+            _mm_store_ps(tex, v[k]->tex);
+            float w = p[k][3] * wnorm;
+            attrs[i] = _mm_setr_ps(tex[0] * w, tex[1] * w, w * 32767.f,
+                                   p[k][2]);
+        }
+        i32 c[4][4];
+        gradients(attrs[0], attrs[1], attrs[2], c);
+        if (texture) {
+            command[len++] = pack_int(c[0][0], c[0][1], c[0][2], 0);
+            command[len++] = pack_int(c[1][0], c[1][1], c[1][2], 0);
+            command[len++] = pack_frac(c[0][0], c[0][1], c[0][2], 0);
+            command[len++] = pack_frac(c[1][0], c[1][1], c[1][2], 0);
+            command[len++] = pack_int(c[2][0], c[2][1], c[2][2], 0);
+            command[len++] = pack_int(c[3][0], c[3][1], c[3][2], 0);
+            command[len++] = pack_frac(c[2][0], c[2][1], c[2][2], 0);
+            command[len++] = pack_frac(c[3][0], c[3][1], c[3][2], 0);
+        }
+        if (zbuffer) {
+            command[len++] = ((u64)(u32)c[0][3] << 32) | (u32)c[1][3];
+            command[len++] = ((u64)(u32)c[2][3] << 32) | (u32)c[3][3];
+        }
+    }
+
+    push_command(gfx, command, len);
+}
+
+/** Clip the polygon \p in of \p count vertices against the plane
+ * \p plane, in clip coordinates. */
+static unsigned clip_polygon(struct vertex *out, struct vertex const *in,
+                             unsigned count, __m128 plane) {
+    unsigned nr_out = 0;
+    for (unsigned nr = 0; nr < count; nr++) {
+        struct vertex const *a = &in[nr];
+        struct vertex const *b = &in[(nr + 1) % count];
+        float da = dot3(a->clip, plane) + _mm_cvtss_f32(
+            _mm_mul_ss(_mm_shuffle_ps(a->clip, a->clip, 0xff),
+                       _mm_shuffle_ps(plane, plane, 0xff)));
+        float db = dot3(b->clip, plane) + _mm_cvtss_f32(
+            _mm_mul_ss(_mm_shuffle_ps(b->clip, b->clip, 0xff),
+                       _mm_shuffle_ps(plane, plane, 0xff)));
+        if (da >= 0.f) {
+            out[nr_out++] = *a;
+        }
+        if ((da >= 0.f) != (db >= 0.f) && nr_out < GFX_POLYGON_MAX) {
+            __m128 t = _mm_set1_ps(da / (da - db));
+            struct vertex *v = &out[nr_out++];
+            v->clip = lerp(a->clip, b->clip, t);
+            v->color = lerp(a->color, b->color, t);
+            v->tex = lerp(a->tex, b->tex, t);
+            v->clip_codes = 0;
+        }
+        if (nr_out >= GFX_POLYGON_MAX) {
+            break;
+        }
+    }
+    return nr_out;
+}
+
+/** Process the triangle with the vertex indices \p i1, \p i2, \p i3:
+ * culling, clipping, and emission of the RDP triangles. */
+static void draw_triangle(struct gfx_state *gfx, unsigned i1, unsigned i2,
+                          unsigned i3, unsigned flat_index) {
+    if (i1 >= GFX_VERTEX_MAX || i2 >= GFX_VERTEX_MAX ||
+        i3 >= GFX_VERTEX_MAX) {
+        return;
+    }
+    struct vertex const *v1 = &gfx->vertices[i1];
+    struct vertex const *v2 = &gfx->vertices[i2];
+    struct vertex const *v3 = &gfx->vertices[i3];
+    struct vertex const *flat = (gfx->geometry_mode & G_SHADING_SMOOTH) ?
+        NULL : &gfx->vertices[flat_index];
+
+    /* Reject the triangles entirely outside of a plane of the view
+     * volume. */
+    if (v1->clip_codes & v2->clip_codes & v3->clip_codes & CLIP_VIEW) {
+        return;
+    }
+
+    struct vertex polygon[2][GFX_POLYGON_MAX];
+    unsigned count = 3;
+    unsigned cur = 0;
+    polygon[0][0] = *v1;
+    polygon[0][1] = *v2;
+    polygon[0][2] = *v3;
+
+    unsigned codes = v1->clip_codes | v2->clip_codes | v3->clip_codes;
+    if (codes & CLIP_GUARD) {
+        float g = gfx->clip_ratio;
+        __m128 const planes[5] = {
+            _mm_setr_ps(0.f, 0.f, 1.f, 1.f),      /* z + w >= 0 */
+            _mm_setr_ps(1.f, 0.f, 0.f, g),        /* x + g w >= 0 */
+            _mm_setr_ps(-1.f, 0.f, 0.f, g),       /* -x + g w >= 0 */
+            _mm_setr_ps(0.f, 1.f, 0.f, g),        /* y + g w >= 0 */
+            _mm_setr_ps(0.f, -1.f, 0.f, g),       /* -y + g w >= 0 */
+        };
+        unsigned const plane_codes[5] = {
+            CLIP_NEAR, GUARD_X_NEG, GUARD_X_POS, GUARD_Y_NEG, GUARD_Y_POS,
+        };
+        for (unsigned nr = 0; nr < 5 && count >= 3; nr++) {
+            if (codes & plane_codes[nr]) {
+                count = clip_polygon(polygon[cur ^ 1], polygon[cur],
+                                     count, planes[nr]);
+                cur ^= 1;
+            }
+        }
+        for (unsigned nr = 0; nr < count; nr++) {
+            project_vertex(gfx, &polygon[cur][nr]);
+        }
+    }
+    if (count < 3) {
+        return;
+    }
+
+    /* Front faces are counter-clockwise in clip space, hence have a
+     * negative area in screen space, where the y axis points down. */
+    float area = 0.f;
+    for (unsigned nr = 0; nr < count; nr++) {
+        alignas(16) float a[4], b[4];
+        _mm_store_ps(a, polygon[cur][nr].screen);
+        _mm_store_ps(b, polygon[cur][(nr + 1) % count].screen);
+        area += a[0] * b[1] - b[0] * a[1];
+    }
+    if (((gfx->geometry_mode & G_CULL_BACK) && area >= 0.f) ||
+        ((gfx->geometry_mode & G_CULL_FRONT) && area <= 0.f)) {
+        return;
+    }
+
+    for (unsigned nr = 1; nr + 1 < count; nr++) {
+        emit_triangle(gfx, &polygon[cur][0], &polygon[cur][nr],
+                      &polygon[cur][nr + 1], flat);
+    }
+}
+
+static void exec_MTX(struct gfx_state *gfx, u32 w0, u32 w1) {
+    unsigned params = (w0 >> 16) & 0xff;
+    struct matrix m;
+    load_matrix(&m, get_address(gfx, w1));
+
+    if (params & G_MTX_PROJECTION) {
+        if (params & G_MTX_LOAD) {
+            gfx->projection = m;
+        } else {
+            mul_matrix(&gfx->projection, &m, &gfx->projection);
+        }
+    } else {
+        if ((params & G_MTX_PUSH) && gfx->mv_depth + 1 < GFX_MTX_STACK_SIZE) {
+            gfx->modelview[gfx->mv_depth + 1] = gfx->modelview[gfx->mv_depth];
+            gfx->mv_depth++;
+        }
+        struct matrix *modelview = &gfx->modelview[gfx->mv_depth];
+        if (params & G_MTX_LOAD) {
+            *modelview = m;
+        } else {
+            mul_matrix(modelview, &m, modelview);
+        }
+    }
+    update_mvp(gfx);
+}
+
+static void load_light(struct light *light, u32 address) {
+    light->color = _mm_setr_ps(load_dram_u8(address),
+        load_dram_u8(address + 1), load_dram_u8(address + 2), 0.f);
+    light->dir = normalize3(_mm_setr_ps((i8)load_dram_u8(address + 8),
+        (i8)load_dram_u8(address + 9), (i8)load_dram_u8(address + 10), 0.f));
+}
+
+static void exec_MOVEMEM(struct gfx_state *gfx, u32 w0, u32 w1) {
+    unsigned index = (w0 >> 16) & 0xff;
+    u32 address = get_address(gfx, w1);
+
+    switch (index) {
+    case G_MV_VIEWPORT: {
+        float scale[4], trans[4];
+        for (unsigned i = 0; i < 4; i++) {
+            scale[i] = (i16)load_dram_u16(address + 2 * i);
+            trans[i] = (i16)load_dram_u16(address + 8 + 2 * i);
+        }
+        /* x and y are in S13.2 format; the depth range 0..0x3ff
+         * is extended to the 15 bit range of the depth buffer. */
+        gfx->vscale = _mm_setr_ps(scale[0] / 4.f, -scale[1] / 4.f,
+                                  scale[2] * 32.f, 0.f);
+        gfx->vtrans = _mm_setr_ps(trans[0] / 4.f, trans[1] / 4.f,
+                                  trans[2] * 32.f, 0.f);
+        break;
+    }
+    case G_MV_LOOKATY:
+        gfx->lookat[1] = normalize3(_mm_setr_ps(
+            (i8)load_dram_u8(address + 8), (i8)load_dram_u8(address + 9),
+            (i8)load_dram_u8(address + 10), 0.f));
+        break;
+    case G_MV_LOOKATX:
+        gfx->lookat[0] = normalize3(_mm_setr_ps(
+            (i8)load_dram_u8(address + 8), (i8)load_dram_u8(address + 9),
+            (i8)load_dram_u8(address + 10), 0.f));
+        break;
+    case G_MV_MATRIX_1:
+    case G_MV_MATRIX_2:
+    case G_MV_MATRIX_3:
+    case G_MV_MATRIX_4: {
+        unsigned offset = index == G_MV_MATRIX_1 ? 0 :
+                          index == G_MV_MATRIX_2 ? 16 :
+                          index == G_MV_MATRIX_3 ? 32 : 48;
+        for (unsigned nr = 0; nr < 16; nr++) {
+            gfx->mvp_raw[offset + nr] = load_dram_u8(address + nr);
+        }
+        convert_matrix(&gfx->mvp, gfx->mvp_raw);
+        break;
+    }
+    default:
+        if (index >= G_MV_L0 && index <= G_MV_L7 && !(index & 1)) {
+            load_light(&gfx->lights[(index - G_MV_L0) / 2], address);
+        } else {
+            debugger::info(Debugger::SP,
+                "gfx: unsupported movemem index {:02x}", index);
+        }
+        break;
+    }
+}
+
+static void exec_MOVEWORD(struct gfx_state *gfx, u32 w0, u32 w1) {
+    unsigned index = w0 & 0xff;
+    unsigned offset = (w0 >> 8) & 0xffff;
+
+    switch (index) {
+    case G_MW_MATRIX:
+        if (offset + 4 <= sizeof(gfx->mvp_raw)) {
+            gfx->mvp_raw[offset]     = w1 >> 24;
+            gfx->mvp_raw[offset + 1] = w1 >> 16;
+            gfx->mvp_raw[offset + 2] = w1 >> 8;
+            gfx->mvp_raw[offset + 3] = w1;
+            convert_matrix(&gfx->mvp, gfx->mvp_raw);
+        }
+        break;
+    case G_MW_NUMLIGHT: {
+        /* The value is (nr_lights + 1) * 32, with bit 31 set. */
+        unsigned nr_lights = ((w1 & 0x7fffffff) / 32);
+        nr_lights = nr_lights > 0 ? nr_lights - 1 : 0;
+        gfx->nr_lights = nr_lights > GFX_LIGHT_MAX ? GFX_LIGHT_MAX : nr_lights;
+        break;
+    }
+    case G_MW_CLIP:
+        if (offset == 0x04 && (i16)w1 > 0) {
+            gfx->clip_ratio = (i16)w1;
+        }
+        break;
+    case G_MW_SEGMENT:
+        gfx->segments[(offset >> 2) & 0xf] = w1 & 0xffffff;
+        break;
+    case G_MW_FOG:
+        gfx->fog_multiplier = (i16)(w1 >> 16);
+        gfx->fog_offset = (i16)w1;
+        break;
+    case G_MW_LIGHTCOL:
+        /* Only the first word of the light color is used. */
+        if ((offset & 0x7) == 0 && offset / 32 <= GFX_LIGHT_MAX) {
+            gfx->lights[offset / 32].color = _mm_setr_ps(
+                w1 >> 24, (w1 >> 16) & 0xff, (w1 >> 8) & 0xff, 0.f);
+        }
+        break;
+    case G_MW_POINTS:
+        modify_vertex(gfx, offset / 40, offset % 40, w1);
+        break;
+    case G_MW_PERSPNORM:
+        break;
+    default:
+        debugger::info(Debugger::SP,
+            "gfx: unsupported moveword index {:02x}", index);
+        break;
+    }
+}
+
+static void exec_TEXTURE(struct gfx_state *gfx, u32 w0, u32 w1) {
+    gfx->texture.on = (w0 & 0xff) != 0;
+    gfx->texture.tile = (w0 >> 8) & 0x7;
+    gfx->texture.level = (w0 >> 11) & 0x7;
+    gfx->texture.scale_s = (float)(w1 >> 16) / 65536.f;
+    gfx->texture.scale_t = (float)(w1 & 0xffff) / 65536.f;
+}
+
+static void exec_SETOTHERMODE(struct gfx_state *gfx, u32 w0, u32 w1) {
+    unsigned shift = (w0 >> 8) & 0xff;
+    unsigned len = w0 & 0xff;
+    u32 mask = (u32)(((UINT64_C(1) << len) - 1) << shift);
+    u32 *othermode = (w0 >> 24) == G_SETOTHERMODE_H ?
+        &gfx->othermode_h : &gfx->othermode_l;
+    *othermode = (*othermode & ~mask) | (w1 & mask);
+    push_command(gfx, (G_RDPSETOTHERMODE << 24) | (gfx->othermode_h & 0xffffff),
+                 gfx->othermode_l);
+}
+
+/** Emit the texture rectangle command, completed by the two following
+ * display list commands. */
+static void exec_TEXRECT(struct gfx_state *gfx, u32 w0, u32 w1) {
+    u32 half_1 = load_dram_u32(gfx->pc + 4);
+    u32 half_2 = load_dram_u32(gfx->pc + 12);
+    gfx->pc += 16;
+    u64 command[2] = {
+        ((u64)w0 << 32) | w1,
+        ((u64)half_1 << 32) | half_2,
+    };
+    push_command(gfx, command, 2);
+}
+
+/** Check whether the vertices \p first to \p last are all outside of the
+ * same plane of the view volume. */
+static bool cull_vertices(struct gfx_state *gfx, unsigned first,
+                          unsigned last) {
+    unsigned codes = CLIP_VIEW;
+    for (unsigned nr = first; nr <= last && nr < GFX_VERTEX_MAX; nr++) {
+        codes &= gfx->vertices[nr].clip_codes;
+    }
+    return first <= last && codes != 0;
+}
+
+/**
+ * Execute a display list command.
+ * @return false at the end of the display list.
+ */
+static bool exec_command(struct gfx_state *gfx, u32 w0, u32 w1) {
+    bool f3dex = gfx->ucode == GFX_UCODE_F3DEX;
+    u8 cmd = w0 >> 24;
+
+    switch (cmd) {
+    case G_SPNOOP:
+    case G_NOOP:
+        break;
+    case G_MTX:
+        exec_MTX(gfx, w0, w1);
+        break;
+    case G_MOVEMEM:
+        exec_MOVEMEM(gfx, w0, w1);
+        break;
+    case G_VTX:
+        if (f3dex) {
+            load_vertices(gfx, get_address(gfx, w1),
+                          ((w0 >> 16) & 0xff) / 2, (w0 >> 10) & 0x3f);
+        } else {
+            load_vertices(gfx, get_address(gfx, w1),
+                          (w0 >> 16) & 0xf, ((w0 >> 20) & 0xf) + 1);
+        }
+        break;
+    case G_DL:
+        if (((w0 >> 16) & 0xff) == 0) {
+            if (gfx->dl_depth >= GFX_DL_STACK_SIZE) {
+                debugger::warn(Debugger::SP, "gfx: display list overflow");
+                return false;
+            }
+            gfx->dl_stack[gfx->dl_depth++] = gfx->pc;
+        }
+        gfx->pc = get_address(gfx, w1);
+        break;
+    case G_ENDDL:
+        if (gfx->dl_depth == 0) {
+            return false;
+        }
+        gfx->pc = gfx->dl_stack[--gfx->dl_depth];
+        break;
+    case G_TRI1:
+        if (f3dex) {
+            draw_triangle(gfx, ((w1 >> 16) & 0xff) / 2,
+                ((w1 >> 8) & 0xff) / 2, (w1 & 0xff) / 2,
+                ((w1 >> 16) & 0xff) / 2);
+        } else {
+            unsigned v[3] = { ((w1 >> 16) & 0xff) / 10,
+                ((w1 >> 8) & 0xff) / 10, (w1 & 0xff) / 10 };
+            draw_triangle(gfx, v[0], v[1], v[2], v[(w1 >> 24) % 3]);
+        }
+        break;
+    case G_TRI2:
+        if (!f3dex) {
+            goto unsupported;
+        }
+        draw_triangle(gfx, ((w0 >> 16) & 0xff) / 2,
+            ((w0 >> 8) & 0xff) / 2, (w0 & 0xff) / 2,
+            ((w0 >> 16) & 0xff) / 2);
+        draw_triangle(gfx, ((w1 >> 16) & 0xff) / 2,
+            ((w1 >> 8) & 0xff) / 2, (w1 & 0xff) / 2,
+            ((w1 >> 16) & 0xff) / 2);
+        break;
+    case G_LINE3D:
+        /* F3DEX encodes quadrangles with the line command; lines are
+         * distinguished by null upper bytes. Lines are not rendered. */
+        if (f3dex && ((w1 >> 24) != 0 || (w0 & 0xffffff) != 0)) {
+            unsigned v0 = (w1 >> 24) / 2, v1 = ((w1 >> 16) & 0xff) / 2;
+            unsigned v2 = ((w1 >> 8) & 0xff) / 2, v3 = (w1 & 0xff) / 2;
+            draw_triangle(gfx, v0, v1, v2, v0);
+            draw_triangle(gfx, v0, v2, v3, v0);
+        } else {
+            debugger::info(Debugger::SP, "gfx: line not rendered");
+        }
+        break;
+    case G_CULLDL:
+        if (f3dex ? cull_vertices(gfx, (w0 & 0xffff) / 2, (w1 & 0xffff) / 2)
+                  : cull_vertices(gfx, (w0 & 0xffff) / 40,
+                                  (w1 & 0xffff) / 40 - 1)) {
+            if (gfx->dl_depth == 0) {
+                return false;
+            }
+            gfx->pc = gfx->dl_stack[--gfx->dl_depth];
+        }
+        break;
+    case G_BRANCH_Z: {
+        if (!f3dex) {
+            goto unsupported;
+        }
+        unsigned index = (w0 & 0xfff) / 2;
+        if (index < GFX_VERTEX_MAX) {
+            alignas(16) float screen[4];
+            _mm_store_ps(screen, gfx->vertices[index].screen);
+            /* The depth is compared in the S15.16 format of the viewport,
+             * before its extension to the depth buffer range. */
+            double depth = (double)screen[2] / 32. * 65536.;
+            if (screen[3] <= 0.f || depth <= (double)(i32)w1) {
+                gfx->pc = get_address(gfx, gfx->rdphalf_1);
+            }
+        }
+        break;
+    }
+    case G_MODIFYVTX:
+        /* G_RDPHALF_CONT in Fast3D. */
+        if (f3dex) {
+            modify_vertex(gfx, (w0 & 0xffff) / 2, (w0 >> 16) & 0xff, w1);
+        }
+        break;
+    case G_RDPHALF_1:
+        gfx->rdphalf_1 = w1;
+        break;
+    case G_RDPHALF_2:
+        gfx->rdphalf_2 = w1;
+        break;
+    case G_SETGEOMETRYMODE:
+        gfx->geometry_mode |= w1;
+        break;
+    case G_CLEARGEOMETRYMODE:
+        gfx->geometry_mode &= ~w1;
+        break;
+    case G_SETOTHERMODE_L:
+    case G_SETOTHERMODE_H:
+        exec_SETOTHERMODE(gfx, w0, w1);
+        break;
+    case G_TEXTURE:
+        exec_TEXTURE(gfx, w0, w1);
+        break;
+    case G_MOVEWORD:
+        exec_MOVEWORD(gfx, w0, w1);
+        break;
+    case G_POPMTX:
+        if (gfx->mv_depth > 0) {
+            gfx->mv_depth--;
+            update_mvp(gfx);
+        }
+        break;
+    case G_TEXRECT:
+    case G_TEXRECTFLIP:
+        exec_TEXRECT(gfx, w0, w1);
+        break;
+    case G_RDPSETOTHERMODE:
+        gfx->othermode_h = w0 & 0xffffff;
+        gfx->othermode_l = w1;
+        push_command(gfx, w0, w1);
+        break;
+    case G_SETTIMG:
+    case G_SETZIMG:
+    case G_SETCIMG:
+        push_command(gfx, w0, get_address(gfx, w1));
+        break;
+    case G_LOAD_UCODE:
+        if (!f3dex) {
+            goto unsupported;
+        }
+        debugger::warn(Debugger::SP,
+            "gfx: unexpected microcode switch, display list aborted");
+        gfx->ucode_switch = true;
+        return false;
+
+    default:
+        /* Other RDP commands are forwarded unchanged; the triangle
+         * commands cannot be inserted in the display lists. */
+        if (cmd >= 0xe6) {
+            push_command(gfx, w0, w1);
+            break;
+        }
+    unsupported:
+        debugger::info(Debugger::SP,
+            "gfx: unsupported command {:08x} {:08x}", w0, w1);
+        break;
+    }
+    return true;
+}
+
+static void reset_gfx_state(struct gfx_state *gfx, enum gfx_ucode ucode) {
+    gfx->ucode = ucode;
+    gfx->pc = 0;
+    gfx->dl_depth = 0;
+    memset(gfx->segments, 0, sizeof(gfx->segments));
+    gfx->mv_depth = 0;
+    identity_matrix(&gfx->modelview[0]);
+    identity_matrix(&gfx->projection);
+    update_mvp(gfx);
+    gfx->vscale = _mm_setr_ps(160.f, -120.f, 511.f * 32.f, 0.f);
+    gfx->vtrans = _mm_setr_ps(160.f, 120.f, 511.f * 32.f, 0.f);
+    gfx->clip_ratio = 2.f;
+    memset(gfx->vertices, 0, sizeof(gfx->vertices));
+    gfx->geometry_mode = 0;
+    gfx->othermode_h = 0;
+    gfx->othermode_l = 0;
+    gfx->texture.on = false;
+    gfx->texture.tile = 0;
+    gfx->texture.level = 0;
+    gfx->texture.scale_s = 1.f;
+    gfx->texture.scale_t = 1.f;
+    gfx->nr_lights = 0;
+    memset(gfx->lights, 0, sizeof(gfx->lights));
+    gfx->lookat[0] = _mm_setr_ps(1.f, 0.f, 0.f, 0.f);
+    gfx->lookat[1] = _mm_setr_ps(0.f, 1.f, 0.f, 0.f);
+    gfx->fog_multiplier = 0.f;
+    gfx->fog_offset = 0.f;
+    gfx->rdphalf_1 = 0;
+    gfx->rdphalf_2 = 0;
+    gfx->nr_commands = 0;
+    gfx->ucode_switch = false;
+}
+
+/**
+ * Scan the display list starting at \p pc for microcode switches, which
+ * are not supported by the high level emulation. The display list calls
+ * are followed, and both paths of the conditional branches; culled
+ * display lists are scanned as if not culled.
+ * @return true if the display list can reach a microcode switch.
+ */
+static bool scan_ucode_switch(u32 pc) {
+    u32 segments[16] = { 0 };
+    u32 dl_stack[GFX_DL_STACK_SIZE];
+    unsigned dl_depth = 0;
+    u32 branches[GFX_BRANCH_MAX];
+    unsigned nr_branches = 0;
+    u32 rdphalf_1 = 0;
+
+    for (u32 steps = 0; steps < GFX_STEP_MAX; steps++) {
+        u32 w0 = load_dram_u32(pc);
+        u32 w1 = load_dram_u32(pc + 4);
+        pc = (pc + 8) & DRAM_MASK;
+
+        switch (w0 >> 24) {
+        case G_LOAD_UCODE:
+            return true;
+        case G_DL:
+            if (((w0 >> 16) & 0xff) == 0) {
+                if (dl_depth >= GFX_DL_STACK_SIZE) {
+                    return false;
+                }
+                dl_stack[dl_depth++] = pc;
+            }
+            pc = (segments[(w1 >> 24) & 0xf] + (w1 & 0xffffff)) & DRAM_MASK;
+            break;
+        case G_ENDDL:
+            /* The branches are scanned until the end of the display list
+             * they jump to, the continuation is shared with the path
+             * not taking the branch. */
+            if (dl_depth > 0) {
+                pc = dl_stack[--dl_depth];
+            } else if (nr_branches > 0) {
+                pc = branches[--nr_branches];
+            } else {
+                return false;
+            }
+            break;
+        case G_BRANCH_Z:
+            if (nr_branches < GFX_BRANCH_MAX) {
+                branches[nr_branches++] = (segments[(rdphalf_1 >> 24) & 0xf] +
+                    (rdphalf_1 & 0xffffff)) & DRAM_MASK;
+            }
+            break;
+        case G_RDPHALF_1:
+            rdphalf_1 = w1;
+            break;
+        case G_MOVEWORD:
+            if ((w0 & 0xff) == G_MW_SEGMENT) {
+                segments[(w0 >> 10) & 0xf] = w1 & 0xffffff;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+/** Identification strings of the data segment of the graphics
+ * microcodes. */
+static const char f3d_signature[] = "RSP SW Version: 2.0";
+static const char gfx_signature[] = "RSP Gfx ucode ";
+
+static bool match_string(u8 const *data, u32 size, u32 offset,
+                         char const *str, size_t len) {
+    return offset + len <= size && memcmp(data + offset, str, len) == 0;
+}
+
+bool identify_gfx_ucode(u8 const *data, u32 size, enum gfx_ucode *ucode) {
+    for (u32 offset = 0; offset < size; offset++) {
+        if (match_string(data, size, offset, f3d_signature,
+                         sizeof(f3d_signature) - 1)) {
+            *ucode = GFX_UCODE_F3D;
+            return true;
+        }
+        if (!match_string(data, size, offset, gfx_signature,
+                          sizeof(gfx_signature) - 1)) {
+            continue;
+        }
+
+        /* The version 1 of the F3DEX, F3DLX and F3DLP microcodes share
+         * the same display list encoding. The signature is formatted as:
+         * "RSP Gfx ucode F3DEX       fifo 1.23 Yoshitaka Yasumoto ..." */
+        u32 pos = offset + sizeof(gfx_signature) - 1;
+        if (!match_string(data, size, pos, "F3DEX", 5) &&
+            !match_string(data, size, pos, "F3DLX", 5) &&
+            !match_string(data, size, pos, "F3DLP", 5)) {
+            return false;
+        }
+        while (pos < size && data[pos] != ' ') pos++;
+        while (pos < size && data[pos] == ' ') pos++;
+        while (pos < size && data[pos] != ' ') pos++;
+        while (pos < size && data[pos] == ' ') pos++;
+        if (match_string(data, size, pos, "1.", 2)) {
+            *ucode = GFX_UCODE_F3DEX;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+enum gfx_status exec_gfx_task(enum gfx_ucode ucode) {
+    static struct gfx_state gfx;
+    u32 pc = load_task_word(OSTASK_DATA_PTR) & DRAM_MASK;
+    if (ucode == GFX_UCODE_F3DEX && scan_ucode_switch(pc)) {
+        return GFX_TASK_SWITCHED;
+    }
+
+    reset_gfx_state(&gfx, ucode);
+    gfx.pc = pc;
+
+    u32 steps = 0;
+    for (; steps < GFX_STEP_MAX; steps++) {
+        u32 w0 = load_dram_u32(gfx.pc);
+        u32 w1 = load_dram_u32(gfx.pc + 4);
+        gfx.pc = (gfx.pc + 8) & DRAM_MASK;
+        if (!exec_command(&gfx, w0, w1)) {
+            break;
+        }
+    }
+    if (steps == GFX_STEP_MAX) {
+        debugger::warn(Debugger::SP, "gfx: display list not terminated");
+    }
+    flush_commands(&gfx);
+    return gfx.ucode_switch ? GFX_TASK_ABORTED : GFX_TASK_COMPLETE;
+}
+
+}; /* namespace hle */
+}; /* namespace R4300 */
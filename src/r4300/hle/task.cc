@@ -0,0 +1,198 @@
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fmt/format.h>
+
+#include <lib/crc32.h>
+#include <r4300/hle.h>
+#include <r4300/hw.h>
+#include <r4300/state.h>
+
+#include <debugger.h>
+
+namespace R4300 {
+namespace hle {
+
+/** Number of microcodes whose identification is retained. */
+#define HLE_UCODE_MAX           16
+/** Number of tasks captured per run. */
+#define HLE_CAPTURE_MAX         16
+/** Maximum size of the text and data segments of a microcode. */
+#define HLE_UCODE_SIZE_MAX      UINT32_C(0x1000)
+
+/** Kind of the microcodes, selecting the high level emulation. */
+enum ucode_kind {
+    UCODE_LLE,
+    UCODE_AUDIO,
+    UCODE_GFX,
+};
+
+/**
+ * @brief Identified microcode.
+ * @var ucode::crc
+ *      CRC32 of the microcode text segment.
+ * @var ucode::kind
+ *      High level emulation executing the microcode tasks.
+ * @var ucode::lut_offset
+ *      Offset of the resample filter coefficients in the data segment,
+ *      for audio microcodes.
+ * @var ucode::gfx
+ *      Variant of the graphics microcodes.
+ */
+struct ucode {
+    bool valid;
+    u32 crc;
+    enum ucode_kind kind;
+    u32 lut_offset;
+    enum gfx_ucode gfx;
+};
+
+unsigned long audio_tasks;
+unsigned long gfx_tasks;
+
+static struct ucode ucodes[HLE_UCODE_MAX];
+static unsigned next_ucode;
+static bool force_lle;
+static std::string capture_directory;
+static unsigned nr_captures;
+
+void set_force_lle(bool force) {
+    force_lle = force;
+}
+
+void set_capture_directory(std::string const &directory) {
+    capture_directory = directory;
+}
+
+u32 load_task_word(u32 offset) {
+    u8 const *ptr = &state.dmem[OSTASK_ADDRESS + offset];
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) |
+           ((u32)ptr[2] << 8)  | (u32)ptr[3];
+}
+
+/** Check that the range \p address, \p address + \p size is in DRAM. */
+static bool check_dram_range(u32 address, u32 size) {
+    return address < sizeof(state.dram) &&
+           size <= sizeof(state.dram) - address;
+}
+
+/**
+ * Identify the microcode from the CRC32 of its text segment.
+ * The identification of microcodes not seen before is made from the
+ * contents of their data segment, and retained for the following tasks.
+ */
+static struct ucode *identify_ucode(u32 type, u32 text, u32 text_size,
+                                    u32 data, u32 data_size) {
+    u32 crc = calculate_crc32(state.dram + text, text_size);
+    for (struct ucode &ucode : ucodes) {
+        if (ucode.valid && ucode.crc == crc) {
+            return &ucode;
+        }
+    }
+
+    struct ucode *ucode = &ucodes[next_ucode];
+    next_ucode = (next_ucode + 1) % HLE_UCODE_MAX;
+    ucode->valid = true;
+    ucode->crc = crc;
+    ucode->kind = UCODE_LLE;
+    if (type == M_AUDTASK &&
+        identify_audio_ucode(state.dram + data, data_size,
+                             &ucode->lut_offset)) {
+        ucode->kind = UCODE_AUDIO;
+    }
+    if (type == M_GFXTASK &&
+        identify_gfx_ucode(state.dram + data, data_size, &ucode->gfx)) {
+        ucode->kind = UCODE_GFX;
+    }
+    debugger::info(Debugger::SP,
+        "microcode crc32={:08x} executed with the {} level emulation",
+        crc, ucode->kind != UCODE_LLE ? "high" : "low");
+    return ucode;
+}
+
+/** Save the machine state at the start of the task, for the comparison
+ * of the high and low level emulations. The capture file is named after
+ * the task kind \p prefix and microcode \p crc. */
+static void capture_task(char const *prefix, u32 crc) {
+    if (capture_directory.empty() || nr_captures >= HLE_CAPTURE_MAX) {
+        return;
+    }
+    std::string filename = fmt::format("{}/{}_{:08x}_{}.task",
+        capture_directory, prefix, crc, nr_captures++);
+    FILE *fd = fopen(filename.c_str(), "wb");
+    if (fd == NULL) {
+        debugger::warn(Debugger::SP,
+            "cannot create the task capture '{}'", filename);
+        return;
+    }
+    u32 pc = state.rsp.nextAction == State::Action::Jump ?
+        state.rsp.nextPc : state.rspreg.pc + 4;
+    fwrite(state.dram, 1, sizeof(state.dram), fd);
+    fwrite(state.dmem, 1, sizeof(state.dmem), fd);
+    fwrite(state.imem, 1, sizeof(state.imem), fd);
+    fwrite(&pc, 1, sizeof(pc), fd);
+    fclose(fd);
+}
+
+bool start_task(void) {
+    u32 type = load_task_word(OSTASK_TYPE);
+    if (force_lle || (type != M_AUDTASK && type != M_GFXTASK)) {
+        return false;
+    }
+
+    u32 text = load_task_word(OSTASK_UCODE);
+    u32 text_size = std::min(load_task_word(OSTASK_UCODE_SIZE),
+                             HLE_UCODE_SIZE_MAX);
+    u32 data = load_task_word(OSTASK_UCODE_DATA);
+    u32 data_size = std::min(load_task_word(OSTASK_UCODE_DATA_SIZE),
+                             HLE_UCODE_SIZE_MAX);
+    if (!check_dram_range(text, text_size) ||
+        !check_dram_range(data, data_size)) {
+        return false;
+    }
+
+    struct ucode *ucode =
+        identify_ucode(type, text, text_size, data, data_size);
+    switch (ucode->kind) {
+    case UCODE_AUDIO:
+        capture_task("audio", ucode->crc);
+        if (!exec_audio_task(ucode->lut_offset, NULL)) {
+            return false;
+        }
+        audio_tasks++;
+        break;
+    case UCODE_GFX:
+        capture_task("gfx", ucode->crc);
+        switch (exec_gfx_task(ucode->gfx)) {
+        case GFX_TASK_SWITCHED:
+            return false;
+        case GFX_TASK_ABORTED:
+            // The task cannot be restarted once its commands were sent
+            // to the RDP; the following tasks run on the RSP.
+            debugger::warn(Debugger::SP,
+                "microcode crc32={:08x} switched to the low level emulation",
+                ucode->crc);
+            ucode->kind = UCODE_LLE;
+            break;
+        default:
+            break;
+        }
+        gfx_tasks++;
+        break;
+    default:
+        return false;
+    }
+
+    // Signal 2 is the task done signal of libultra.
+    state.hwreg.SP_STATUS_REG |=
+        SP_STATUS_SIGNAL2 | SP_STATUS_BROKE | SP_STATUS_HALT;
+    if (state.hwreg.SP_STATUS_REG & SP_STATUS_INTR_BREAK) {
+        set_MI_INTR_REG(MI_INTR_SP);
+    }
+    return true;
+}
+
+}; /* namespace hle */
+}; /* namespace R4300 */
@@ -120,6 +120,8 @@ void write_SP_RD_LEN_REG(u32 value);
 void write_SP_WR_LEN_REG(u32 value);
 void write_SP_STATUS_REG(u32 value);
 u32 read_SP_SEMAPHORE_REG();
+bool read_SP_MEM(uint bytes, u64 addr, u64 *value);
+bool write_SP_MEM(uint bytes, u64 addr, u64 value);
 bool read_SP_REG(uint bytes, u64 addr, u64 *value);
 bool write_SP_REG(uint bytes, u64 addr, u64 value);
 
@@ -84,6 +84,9 @@ bool write_DPC_REG(uint bytes, u64 addr, u64 value)
     if (bytes != 4)
         return false;
 
+    // The RDP reads commands from DMEM when the XBUS source is selected.
+    core::rsp_lock lock;
+
     switch (addr) {
     case DPC_START_REG:     rdp::interface->write_DPC_START_REG(value); break;
     case DPC_END_REG:       rdp::interface->write_DPC_END_REG(value); break;
@@ -3,6 +3,7 @@
 #include <iomanip>
 #include <cstring>
 
+#include <r4300/hle.h>
 #include <r4300/rdp.h>
 #include <r4300/hw.h>
 #include <r4300/state.h>
@@ -121,6 +122,11 @@ void write_SP_RD_LEN_REG(u32 value) {
         }
         // Perform the slice copy.
         memcpy(&dst_ptr[dst], &state.dram[src], len);
+        // Writes to IMEM replace the RSP microcode.
+        if (dst_ptr == state.imem) {
+            core::invalidate_recompiler_cache(
+                UINT64_C(0x04001000) + dst, UINT64_C(0x04001000) + dst + len);
+        }
     }
 }
 
@@ -176,6 +182,7 @@ void write_SP_WR_LEN_REG(u32 value) {
  */
 void write_SP_STATUS_REG(u32 value) {
     debugger::info(Debugger::SP, "SP_STATUS_REG <- {:08x}", value);
+    bool halted = state.hwreg.SP_STATUS_REG & SP_STATUS_HALT;
     if (value & SP_STATUS_CLR_HALT) {
         state.hwreg.SP_STATUS_REG &= ~SP_STATUS_HALT;
     }
@@ -252,6 +259,11 @@ void write_SP_STATUS_REG(u32 value) {
     if (value & SP_STATUS_SET_SIGNAL7) {
         state.hwreg.SP_STATUS_REG |= SP_STATUS_SIGNAL7;
     }
+    // The task is started when the halt bit is cleared, after the signals
+    // have been updated: recognized tasks complete immediately.
+    if (halted && !(state.hwreg.SP_STATUS_REG & SP_STATUS_HALT)) {
+        hle::start_task();
+    }
 }
 
 /**
@@ -266,11 +278,61 @@ u32 read_SP_SEMAPHORE_REG() {
     return value;
 }
 
+/**
+ * @brief Return the host address of the byte at the physical address
+ *  \p addr in DMEM or IMEM.
+ */
+static u8 *sp_mem_ptr(u64 addr) {
+    u8 *mem = (addr & SP_MEM_ADDR_IMEM) ? state.imem : state.dmem;
+    return mem + (addr & SP_MEM_ADDR_MASK);
+}
+
+/**
+ * @brief Read from DMEM or IMEM.
+ *  The RSP thread is paused during the access.
+ */
+bool read_SP_MEM(uint bytes, u64 addr, u64 *value)
+{
+    core::rsp_lock lock;
+    u8 *ptr = sp_mem_ptr(addr);
+    switch (bytes) {
+    case 1: *value = *ptr; break;
+    case 2: *value = __builtin_bswap16(*(u16 *)ptr); break;
+    case 4: *value = __builtin_bswap32(*(u32 *)ptr); break;
+    case 8: *value = __builtin_bswap64(*(u64 *)ptr); break;
+    default: return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Write to DMEM or IMEM.
+ *  The RSP thread is paused during the access; writes to IMEM invalidate
+ *  the recompiled RSP code.
+ */
+bool write_SP_MEM(uint bytes, u64 addr, u64 value)
+{
+    core::rsp_lock lock;
+    u8 *ptr = sp_mem_ptr(addr);
+    switch (bytes) {
+    case 1: *ptr = value; break;
+    case 2: *(u16 *)ptr = __builtin_bswap16(value); break;
+    case 4: *(u32 *)ptr = __builtin_bswap32(value); break;
+    case 8: *(u64 *)ptr = __builtin_bswap64(value); break;
+    default: return false;
+    }
+    core::invalidate_recompiler_cache(addr, addr + bytes);
+    return true;
+}
+
 bool read_SP_REG(uint bytes, u64 addr, u64 *value)
 {
     if (bytes != 4)
         return false;
 
+    // The registers and semaphore are shared with the RSP thread.
+    core::rsp_lock lock;
+
     switch (addr) {
     case SP_MEM_ADDR_REG:
         debugger::info(Debugger::SP, "SP_MEM_ADDR_REG -> {:08x}",
@@ -332,6 +394,10 @@ bool write_SP_REG(uint bytes, u64 addr, u64 value)
     if (bytes != 4)
         return false;
 
+    // The registers, DMA transfers and RSP program counter
+    // are shared with the RSP thread.
+    core::rsp_lock lock;
+
     switch (addr) {
     case SP_MEM_ADDR_REG:
         debugger::info(Debugger::SP, "SP_MEM_ADDR_REG <- {:08x}", value);
@@ -2935,6 +2935,32 @@ static void execute_DPC_command(void) {
     state.hwreg.dpc_CommandBufferLen = 0;
 }
 
+/**
+ * @brief Execute RDP commands from a host buffer.
+ * The buffer must hold complete commands; execution stops at the first
+ * unknown command.
+ */
+static void exec_commands(u64 const *commands, size_t len) {
+    size_t nr = 0;
+    while (nr < len && !core::halted()) {
+        u64 dword = commands[nr];
+        u64 opcode = (dword >> 56) & UINT64_C(0x3f);
+        unsigned nr_dwords = RDPCommands[opcode].nrDoubleWords;
+
+        if (RDPCommands[opcode].command == NULL || nr + nr_dwords > len) {
+            debugger::warn(Debugger::RDP, "invalid host command 0x{:02x} [{:016x}]",
+                opcode, dword);
+            core::halt("RDP invalid host command");
+            return;
+        }
+
+        debugger::info(Debugger::RDP, "[{:016x}] {}",
+            dword, RDPCommands[opcode].name);
+        RDPCommands[opcode].command(dword, commands + nr + 1);
+        nr += nr_dwords;
+    }
+}
+
 /**
  * @brief Execute DPC commands.
  * Commands are read from the DPC_CURRENT_REG until the DPC_END_REG excluded,
@@ -3075,6 +3101,10 @@ public:
         return state.hwreg.dpc_Current;
     }
 
+    virtual void exec_commands(u64 const *commands, size_t len) {
+        R4300::rdp::exec_commands(commands, len);
+    }
+
     virtual void stop() {
     }
 };
@@ -3083,6 +3113,7 @@ public:
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <vector>
 
 class DPCommandAsyncInterface : public DPCommandInterface {
 public:
@@ -3136,9 +3167,25 @@ public:
         return _dpc_current.load(std::memory_order_acquire);
     }
 
+    /* The host commands are queued for the RDP thread once the pending
+     * DPC transfers are complete, to preserve the command order. */
+    virtual void exec_commands(u64 const *commands, size_t len) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this] {
+            uint32_t status = _dpc_status.load(std::memory_order_acquire);
+            return _stopped || core::halted() ||
+                (!DPC_hasNext() && (status & DPC_STATUS_END_VALID) == 0);
+        });
+        _host_commands.insert(_host_commands.end(), commands, commands + len);
+
+        lock.unlock();
+        _semaphore.notify_one();
+    }
+
     virtual void stop() {
         _stopped.store(true, std::memory_order_release);
         _semaphore.notify_one();
+        _idle.notify_all();
     }
 
 private:
@@ -3154,13 +3201,24 @@ private:
                 return _stopped ||
                     (status & DPC_STATUS_END_VALID) ||
                     (status & DPC_STATUS_START_VALID) ||
-                    DPC_hasNext();
+                    DPC_hasNext() ||
+                    !_host_commands.empty();
             });
 
             if (_stopped) {
                 return;
             }
 
+            /* Host commands are queued only when the DPC transfers are
+             * complete: execute them before starting the next transfer. */
+            if (!_host_commands.empty()) {
+                std::vector<u64> commands;
+                commands.swap(_host_commands);
+                lock.unlock();
+                R4300::rdp::exec_commands(commands.data(), commands.size());
+                continue;
+            }
+
             uint32_t status = _dpc_status.load(std::memory_order_acquire);
 
             /* Conditions for starting a new transfer :
@@ -3210,6 +3268,7 @@ private:
                 _dpc_status |= DPC_STATUS_CBUF_READY;
             }
             lock.unlock();
+            _idle.notify_all();
         }
     }
 
@@ -3222,6 +3281,11 @@ private:
     std::thread *_thread;
     std::mutex _mutex;
     std::condition_variable _semaphore;
+
+    /* Commands queued by exec_commands, and signal of the completion
+     * of the DPC transfers. */
+    std::vector<u64> _host_commands;
+    std::condition_variable _idle;
 };
 
 DPCommandInterface *interface =
@@ -315,6 +315,16 @@ public:
 
     virtual uint32_t read_DPC_STATUS_REG() = 0;
     virtual uint32_t read_DPC_CURRENT_REG() = 0;
+
+    /**
+     * @brief Execute RDP commands generated by the host, bypassing the
+     *  DPC command buffer. Used by the high level emulation of the
+     *  graphics tasks. The commands are executed after the commands
+     *  already loaded with the DPC registers.
+     * @param commands      Sequence of complete RDP commands.
+     * @param len           Number of double words in \p commands.
+     */
+    virtual void exec_commands(u64 const *commands, size_t len) = 0;
 };
 
 extern DPCommandInterface *interface;
@@ -34,4 +34,25 @@ void step()
     }
 }
 
+/**
+ * @brief Check whether the next instruction accesses the RSP coprocessor 0
+ *  or halts the RSP. These instructions access the SP and DP interface
+ *  registers, and raise MI interrupts.
+ */
+bool at_sync_point()
+{
+    u64 addr = state.rsp.nextAction == State::Action::Jump ?
+        state.rsp.nextPc : state.rspreg.pc + 4;
+    u32 instr = __builtin_bswap32(*(u32 *)&state.imem[addr & UINT64_C(0xffc)]);
+
+    switch (instr >> 26) {
+    case 0x00: /* SPECIAL */
+        return (instr & 0x3fu) == 0x0d; /* BREAK */
+    case 0x10: /* COP0 */
+        return true;
+    default:
+        return false;
+    }
+}
+
 }; /* namespace R4300::RSP */
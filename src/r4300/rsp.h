@@ -89,6 +89,13 @@ struct rspreg {
 namespace RSP {
 /** @brief Move the RSP one step, if not halted. */
 void step();
+
+/**
+ * @brief Return true if the next instruction is observable by the CPU:
+ *  COP0 register moves, and BREAK. The instruction is executed by the
+ *  interpreter thread when the RSP runs on a separate thread.
+ */
+bool at_sync_point();
 }; /* namespace RSP */
 
 };
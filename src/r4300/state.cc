@@ -5,6 +5,7 @@
 
 #include <core.h>
 #include <memory.h>
+#include <r4300/fastmem.h>
 #include <r4300/hw.h>
 #include <r4300/state.h>
 
@@ -47,6 +48,9 @@ static bool WI(unsigned bytes, u64 addr, u64 val) {
 State::State() : bus(NULL) {
     // Create the physical memory address space for this machine
     // importing the rom bytes for the select file.
+    // The memory arrays are first remapped to the fastmem arena,
+    // when it is available.
+    fastmem::init(this);
     swapMemoryBus(new Memory::Bus(32));
 
     // Plug a controller in slot 0.
@@ -71,7 +75,8 @@ int State::load(std::istream &rom_contents) {
     // Clear the ROM memory and copy the file.
     memset(rom, 0, sizeof(rom));
     rom_contents.read((char *)rom, sizeof(rom));
-    return rom_contents.gcount() > 0 ? 0 : -1;
+    rom_size = rom_contents.gcount();
+    return rom_size > 0 ? 0 : -1;
 }
 
 void State::swapMemoryBus(Memory::Bus *bus) {
@@ -96,10 +101,17 @@ void State::swapMemoryBus(Memory::Bus *bus) {
     bus->root.insertRom(  0x1fc00000llu, 0x7c0,      pifrom);
     bus->root.insertIOmem(0x1fc007c0llu, 0x40,       read_PIF_RAM,  write_PIF_RAM);
     bus->root.insertIOmem(0x1fd00000llu, 0x60300000lu, read_CART_1_3, write_CART_1_3);
+    bus->updatePageTable();
     if (this->bus) delete this->bus;
     this->bus = bus;
 }
 
+void State::swapSpMemory() {
+    bus->root.remove(     0x04000000llu, 0x2000);
+    bus->root.insertIOmem(0x04000000llu, 0x2000,   read_SP_MEM,    write_SP_MEM); /* SP DMEM, IMEM */
+    bus->updatePageTable();
+}
+
 void State::reset() {
     // Clear the machine state.
     memset(dram, 0, sizeof(dram));
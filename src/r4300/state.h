@@ -29,15 +29,18 @@ public:
     struct hwreg hwreg;
     struct tlbEntry tlb[tlbEntryCount]; /**< Translation look-aside buffer */
 
-    alignas(u64) u8 dram[0x400000];
-                 u8 dram_bit9[0x80000];
+    /* DRAM, DMEM, IMEM and ROM are page aligned to be remapped
+     * to the fastmem arena. */
+    alignas(0x1000) u8 dram[0x400000];
+                    u8 dram_bit9[0x80000];
 
-    alignas(u64) u8 dmem[0x1000];
-    alignas(u64) u8 imem[0x1000];
+    alignas(0x1000) u8 dmem[0x1000];
+    alignas(0x1000) u8 imem[0x1000];
     alignas(u64) u8 tmem[0x1000];
     alignas(u64) u8 pifram[0x40];
     alignas(u64) u8 pifrom[0x7c0];
-    alignas(u64) u8 rom[0xfc00000];
+    alignas(0x1000) u8 rom[0xfc00000];
+    size_t rom_size;            /**< Size of the loaded ROM contents. */
 
     Memory::Bus *bus;
     ulong cycles;
@@ -72,6 +75,10 @@ public:
     void unplugController(unsigned channel);
 
     void swapMemoryBus(Memory::Bus *bus);
+    /** Replace the DMEM and IMEM ranges of the memory bus with IO regions
+     * calling \ref read_SP_MEM and \ref write_SP_MEM, which pause the RSP
+     * thread during CPU accesses. */
+    void swapSpMemory();
     void scheduleEvent(ulong timeout, void (*callback)());
     void cancelEvent(void (*callback)());
     void cancelAllEvents();
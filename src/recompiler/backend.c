@@ -330,6 +330,22 @@ void ir_append_br(ir_instr_cont_t *cont,
     target_true->next = &block_true->entry;
 }
 
+/**
+ * @brief Append an unconditional branch to an existing block.
+ * @details The branch is represented as a `br` instruction with a constant
+ *  condition. Used to join control flow paths: \p target must be
+ *  allocated after the blocks branching to it, unless no variable
+ *  defined before the branch is used in \p target, as is the case for
+ *  the back edges of loops.
+ * @param cont      Pointer to the continuation context, must not be NULL.
+ * @param target    Pointer to the target block. Must not be NULL.
+ */
+void ir_append_jmp(ir_instr_cont_t *cont,
+                   ir_block_t *target) {
+    ir_append_instr(cont,
+        ir_make_br(ir_make_const_int(ir_make_i1(), 0), target, target));
+}
+
 /**
  * @brief Append a `call` instruction.
  * @details The variadic parameters are all input values of type
@@ -222,6 +222,8 @@ void       ir_append_br(ir_instr_cont_t *cont,
                         ir_value_t cond,
                         ir_instr_cont_t *target_false,
                         ir_instr_cont_t *target_true);
+void       ir_append_jmp(ir_instr_cont_t *cont,
+                         ir_block_t *target);
 ir_value_t ir_append_call(ir_instr_cont_t *cont,
                           ir_type_t type,
                           void (*func)(),
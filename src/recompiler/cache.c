@@ -146,7 +146,7 @@ int update_recompiler_cache(recompiler_cache_t *cache,
                             code_entry_t binary,
                             size_t binary_len) {
     uint64_t page_nr = address >> cache->page_shift;
-    if (page_nr > cache->page_count) {
+    if (page_nr >= cache->page_count) {
         return -1;
     }
 
@@ -213,7 +213,7 @@ code_entry_t query_recompiler_cache(recompiler_cache_t *cache,
                                     code_buffer_t **emitter,
                                     size_t *binary_len) {
     uint64_t page_nr = address >> cache->page_shift;
-    if (page_nr > cache->page_count) {
+    if (page_nr >= cache->page_count) {
         *emitter = NULL;
         return NULL;
     }
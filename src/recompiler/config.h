@@ -20,11 +20,30 @@
 /** Maximum length of recompiler error messages. */
 #define RECOMPILER_ERROR_MAX_LEN        256
 
-/** Defines whether the disassembly stops at branch instructions or not. */
-#define RECOMPILER_DISAS_BRANCH_ENABLE  0
-
-/** Defines the number of times a branch needs to be taken before
- * requesting recompilation. */
-#define RECOMPILER_CACHE_THRESHOLD      1
+/** Defines whether the disassembly stops at branch instructions or
+ * follows the branch targets inside the disassembled memory region. */
+#define RECOMPILER_DISAS_BRANCH_ENABLE  1
+
+/** Defines the default number of times a block needs to be executed
+ * before requesting recompilation. */
+#define RECOMPILER_CACHE_THRESHOLD      16
+
+/** Defines the default number of times a recompiled block needs to be
+ * entered from the interpreter before requesting recompilation with the
+ * hot tier optimizations. */
+#define RECOMPILER_HOT_THRESHOLD        1024
+
+/** Defines the default size of the recompiler cache pages. The code
+ * recompiled from addresses in the same page is stored in a common
+ * code buffer. */
+#define RECOMPILER_CACHE_PAGE_SIZE      0x4000
+
+/** Defines the default size of the code buffer allocated for each
+ * recompiler cache page. */
+#define RECOMPILER_CACHE_BUFFER_SIZE    0x40000
+
+/** Maximum number of iterations of the optimization pass
+ * for hot blocks. */
+#define RECOMPILER_OPTIMIZE_ITERATIONS_MAX  4
 
 #endif /* _RECOMPILER_CONFIG_H_INCLUDED_ */
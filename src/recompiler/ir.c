@@ -6,7 +6,7 @@
 #include <recompiler/ir.h>
 
 bool ir_is_void_instr(ir_instr_t const *instr) {
-    _Static_assert(IR_ZEXT == 26,
+    _Static_assert(IR_ZEXT == 27,
         "IR instruction set changed, code may need to be updated");
     return (instr->kind == IR_CALL && instr->type.width == 0) ||
            instr->kind == IR_EXIT ||
@@ -74,6 +74,7 @@ static int print_unop(char *buf, size_t len, ir_instr_t const *instr) {
     char const *op = "?";
     switch (instr->kind) {
     case IR_NOT:  op = "not"; break;
+    case IR_BSWAP: op = "bswap"; break;
     default: break;
     }
 
@@ -197,7 +198,7 @@ static int print_cvt(char *buf, size_t len, ir_instr_t const *instr) {
     return written;
 }
 
-_Static_assert(IR_ZEXT == 26,
+_Static_assert(IR_ZEXT == 27,
     "IR instruction set changed, code may need to be updated");
 
 static const int (*print_callbacks[])(char *, size_t, ir_instr_t const *) = {
@@ -207,6 +208,7 @@ static const int (*print_callbacks[])(char *, size_t, ir_instr_t const *) = {
     [IR_CALL]   = print_call,
     [IR_ALLOC]  = print_alloc,
     [IR_NOT]    = print_unop,
+    [IR_BSWAP]  = print_unop,
     [IR_ADD]    = print_binop,
     [IR_SUB]    = print_binop,
     [IR_MUL]    = print_binop,
@@ -285,7 +287,7 @@ static void iter_cvt(ir_instr_t const *instr, ir_value_iterator_t iter, void *ar
     iter(arg, &instr->cvt.value);
 }
 
-_Static_assert(IR_ZEXT == 26,
+_Static_assert(IR_ZEXT == 27,
     "IR instruction set changed, code may need to be updated");
 
 static const void (*iter_callbacks[])(ir_instr_t const *instr,
@@ -297,6 +299,7 @@ static const void (*iter_callbacks[])(ir_instr_t const *instr,
     [IR_CALL]   = iter_call,
     [IR_ALLOC]  = iter_none,
     [IR_NOT]    = iter_unop,
+    [IR_BSWAP]  = iter_unop,
     [IR_ADD]    = iter_binop,
     [IR_SUB]    = iter_binop,
     [IR_MUL]    = iter_binop,
@@ -323,3 +326,30 @@ static const void (*iter_callbacks[])(ir_instr_t const *instr,
 void ir_iter_values(ir_instr_t const *instr, ir_value_iterator_t iter, void *arg) {
     iter_callbacks[instr->kind](instr, iter, arg);
 }
+
+unsigned ir_exit_targets(ir_graph_t const *graph, ir_global_t global,
+                         uint64_t *targets, unsigned max) {
+    unsigned nr_targets = 0;
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        ir_instr_t const *instr = graph->blocks[label].entry;
+        bool known = false;
+        uint64_t target = 0;
+        for (; instr != NULL; instr = instr->next) {
+            if (instr->kind == IR_WRITE && instr->write.global == global) {
+                known = instr->write.value.kind == IR_CONST;
+                target = instr->write.value.const_.int_;
+            } else if (instr->kind == IR_CALL) {
+                known = false;
+            } else if (instr->kind == IR_EXIT && known) {
+                unsigned nr = 0;
+                while (nr < nr_targets && targets[nr] != target) {
+                    nr++;
+                }
+                if (nr == nr_targets && nr_targets < max) {
+                    targets[nr_targets++] = target;
+                }
+            }
+        }
+    }
+    return nr_targets;
+}
@@ -122,6 +122,10 @@ typedef union ir_const {
  *      Value representation as immediate.
  * @var ir_value::var
  *      Value representation as variable.
+ * @var ir_value::host_ptr
+ *      Set for constants holding a host pointer, or derived from one
+ *      by constant folding. The pointers are relocated when
+ *      the graph is serialized.
  */
 typedef struct ir_value {
     ir_value_kind_t     kind;
@@ -130,6 +134,7 @@ typedef struct ir_value {
     ir_const_t          const_;
     ir_var_t            var;
     };
+    bool                host_ptr;
 } ir_value_t;
 
 /**
@@ -152,6 +157,18 @@ static inline ir_value_t ir_make_const_int(ir_type_t type, uintmax_t int_) {
     return ir_make_const(type, (ir_const_t){ .int_ = int_ });
 }
 
+/**
+ * @brief Create a host pointer value representation.
+ * @param ptr       Host pointer value definition.
+ * @return          The created value representation.
+ */
+static inline ir_value_t ir_make_const_ptr(void const *ptr) {
+    ir_value_t value = ir_make_const(ir_make_iptr(),
+        (ir_const_t){ .ptr = (uintptr_t)ptr });
+    value.host_ptr = true;
+    return value;
+}
+
 /**
  * @brief Create an integer value representation.
  * @param n         Value type bitwidth.
@@ -222,6 +239,7 @@ typedef enum ir_instr_kind {
     IR_ALLOC,
     /* Unary operations. */
     IR_NOT,
+    IR_BSWAP,
     /* Binary operations. */
     IR_ADD,
     IR_SUB,
@@ -789,6 +807,22 @@ typedef void (*ir_value_iterator_t)(void *arg, ir_value_t const *value);
  */
 void ir_iter_values(ir_instr_t const *instr, ir_value_iterator_t iter, void *arg);
 
+/**
+ * @brief Collect the static exit targets of an instruction graph.
+ * @details The target of a block terminated by
+ * \ref ir_instr_kind::IR_EXIT is the constant value last written to the
+ * selected global in the block. Blocks writing a variable value, or calling
+ * a function after the last write, have no static target.
+ * @param graph     Pointer to the instruction graph.
+ * @param global    Global register holding the exit target,
+ *                  usually the program counter.
+ * @param targets   Pointer to the output target array.
+ * @param max       Length of the output target array.
+ * @return          Number of distinct targets written to \p targets.
+ */
+unsigned ir_exit_targets(ir_graph_t const *graph, ir_global_t global,
+                         uint64_t *targets, unsigned max);
+
 #ifdef __cplusplus
 }; /* extern "C" */
 #endif /* __cplusplus */
@@ -29,6 +29,60 @@ bool ir_typecheck(recompiler_backend_t *backend,
 void ir_optimize(recompiler_backend_t *backend,
                  ir_graph_t *graph);
 
+/**
+ * Optimize an instruction graph with the more expensive pipeline
+ * reserved to hot blocks.
+ * @param backend   Pointer to the recompiler backend.
+ * @param block     Pointer to the graph to optimize.
+ */
+void ir_optimize_full(recompiler_backend_t *backend,
+                      ir_graph_t *graph);
+
+/** Optimization passes of the instruction graph. */
+typedef enum ir_optimize_pass {
+    /** Block local constant folding, see \ref ir_optimize. */
+    IR_OPTIMIZE_LOCAL,
+    /** Forwarding of global variable values across blocks. */
+    IR_OPTIMIZE_SSA,
+    /** Sparse conditional constant propagation. */
+    IR_OPTIMIZE_SCCP,
+    /** Common subexpression elimination. */
+    IR_OPTIMIZE_CSE,
+    /** Redundant sign and zero extension removal. */
+    IR_OPTIMIZE_EXT,
+    /** Dead code elimination. */
+    IR_OPTIMIZE_DCE,
+    /** Dead global variable store elimination. */
+    IR_OPTIMIZE_DSE,
+    IR_OPTIMIZE_PASS_COUNT,
+} ir_optimize_pass_t;
+
+/** Instruction counts measured before and after each optimization pass,
+ * accumulated over all optimized graphs. */
+typedef struct ir_optimize_stats {
+    unsigned long nr_runs[IR_OPTIMIZE_PASS_COUNT];
+    unsigned long nr_instrs_before[IR_OPTIMIZE_PASS_COUNT];
+    unsigned long nr_instrs_after[IR_OPTIMIZE_PASS_COUNT];
+} ir_optimize_stats_t;
+
+/**
+ * Run one optimization pass on an instruction graph, and record
+ * the instruction counts before and after the pass.
+ * @param backend   Pointer to the recompiler backend.
+ * @param graph     Pointer to the graph to optimize.
+ * @param pass      Selected optimization pass.
+ * @return          Number of instructions after the pass.
+ */
+unsigned ir_optimize_pass(recompiler_backend_t *backend,
+                          ir_graph_t *graph,
+                          ir_optimize_pass_t pass);
+
+/** Return the short name of an optimization pass. */
+char const *ir_optimize_pass_name(ir_optimize_pass_t pass);
+
+/** Copy the accumulated statistics of the optimization passes. */
+void ir_optimize_get_stats(ir_optimize_stats_t *stats);
+
 /**
  * @brief Execute the generated instruction graph.
  * The initial state is assumed to have been previously loaded
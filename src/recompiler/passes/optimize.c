@@ -11,14 +11,37 @@ typedef struct ir_var_context {
     ir_value_t value;
 } ir_var_context_t;
 
+/**
+ * Global variable cache. \ref value holds the current value of the global
+ * when \ref set is true. \ref write points to the last write to the global
+ * not yet committed to memory: the write instruction is unlinked from the
+ * instruction block and inserted back at the next commit point.
+ */
 typedef struct ir_global_context {
     ir_value_t value;
     bool set;
+    ir_instr_t *write;
 } ir_global_context_t;
 
-static ir_var_context_t      ir_var_context[RECOMPILER_VAR_MAX];
-static unsigned              ir_cur_var;
-static ir_global_context_t   ir_global_context[RECOMPILER_GLOBAL_MAX];
+/**
+ * Snapshot of the global variable cache at the end of a block,
+ * inherited by its successors.
+ */
+typedef struct ir_block_context {
+    ir_value_t globals[RECOMPILER_GLOBAL_MAX];
+    bool set[RECOMPILER_GLOBAL_MAX];
+    unsigned nr_predecessors;
+    ir_block_t const *predecessor;
+} ir_block_context_t;
+
+/* The optimizer context is private to each recompiler thread. */
+static _Thread_local ir_var_context_t      ir_var_context[RECOMPILER_VAR_MAX];
+static _Thread_local bool                  ir_var_alloc[RECOMPILER_VAR_MAX];
+static _Thread_local unsigned              ir_cur_var;
+static _Thread_local ir_global_context_t   ir_global_context[RECOMPILER_GLOBAL_MAX];
+static _Thread_local ir_block_context_t    ir_block_context[RECOMPILER_BLOCK_MAX];
+/* Insertion point of the block being optimized. */
+static _Thread_local ir_instr_t          **ir_prev_instr;
 
 static inline uintmax_t make_mask(unsigned width) {
     return width >= CHAR_BIT * sizeof(uintmax_t) ?
@@ -41,20 +64,60 @@ static ir_value_t convert_value(ir_value_t value) {
     }
 }
 
+/** Create the constant result of a folded instruction. The result is
+ * tagged as a host pointer when derived from exactly one host pointer
+ * operand, e.g. the sum of a host pointer and an offset. */
+static ir_value_t make_const(ir_type_t type, uintmax_t int_, bool host_ptr) {
+    ir_value_t value = ir_make_const_int(type, int_);
+    value.host_ptr = host_ptr;
+    return value;
+}
+
 static void const_res(ir_instr_t *instr, ir_value_t value) {
     ir_var_context[instr->res].value = value;
 }
 
 static void remap_res(ir_instr_t *instr) {
     ir_var_context[instr->res].value = ir_make_var(instr->type, ir_cur_var);
+    ir_var_alloc[ir_cur_var] = false;
     instr->res = ir_cur_var;
     ir_cur_var++;
 }
 
+static bool equal_values(ir_value_t left, ir_value_t right) {
+    if (left.kind != right.kind ||
+        left.type.width != right.type.width) {
+        return false;
+    }
+    switch (left.kind) {
+    case IR_CONST:  return left.const_.int_ == right.const_.int_ &&
+                           left.host_ptr == right.host_ptr;
+    case IR_VAR:    return left.var == right.var;
+    default:        return false;
+    }
+}
+
+/**
+ * Insert the pending global writes at the current insertion point,
+ * ahead of the instruction being optimized. Must be called before any
+ * instruction that can exit the block or observe the global variables.
+ */
+static void commit_globals(void) {
+    for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+        ir_instr_t *write = ir_global_context[nr].write;
+        if (write != NULL) {
+            *ir_prev_instr = write;
+            ir_prev_instr = &write->next;
+            ir_global_context[nr].write = NULL;
+        }
+    }
+}
+
 static bool optimize_exit(recompiler_backend_t *backend,
                           ir_instr_t *instr) {
     (void)backend;
     (void)instr;
+    commit_globals();
     return false;
 }
 
@@ -63,12 +126,14 @@ static bool optimize_assert(recompiler_backend_t *backend,
     ir_value_t cond = convert_value(instr->assert_.cond);
     if (cond.kind == IR_CONST && cond.const_.int_ == 0) {
         *instr = ir_make_exit();
+        commit_globals();
         return false;
     }
     if (cond.kind == IR_CONST && cond.const_.int_ != 0) {
         return true;
     }
     instr->assert_.cond = cond;
+    commit_globals();
     return false;
 }
 
@@ -77,6 +142,7 @@ static bool optimize_br(recompiler_backend_t *backend,
     // TODO the br instruction should be replaced by a jmp when the
     // branch condition is constant.
     instr->br.cond = convert_value(instr->br.cond);
+    commit_globals();
     return false;
 }
 
@@ -88,7 +154,10 @@ static bool optimize_call(recompiler_backend_t *backend,
     if (instr->type.width > 0) {
         remap_res(instr);
     }
+    // The called function can read or modify any global variable:
+    // commit pending writes and forget the cached values.
     // TODO depends on call flags.
+    commit_globals();
     memset(ir_global_context, 0, sizeof(ir_global_context));
     return false;
 }
@@ -96,6 +165,7 @@ static bool optimize_call(recompiler_backend_t *backend,
 static bool optimize_alloc(recompiler_backend_t *backend,
                            ir_instr_t *instr) {
     remap_res(instr);
+    ir_var_alloc[instr->res] = true;
     return false;
 }
 
@@ -105,7 +175,24 @@ static bool optimize_not(recompiler_backend_t *backend,
     if (value.kind == IR_CONST) {
         uintmax_t mask = make_mask(value.type.width);
         uintmax_t res = ~value.const_.int_ & mask;
-        const_res(instr, ir_make_const_int(value.type, res));
+        const_res(instr, make_const(value.type, res, value.host_ptr));
+        return true;
+    } else {
+        instr->unop.value = value;
+        remap_res(instr);
+        return false;
+    }
+}
+
+static bool optimize_bswap(recompiler_backend_t *backend,
+                           ir_instr_t *instr) {
+    ir_value_t value = convert_value(instr->unop.value);
+    if (value.kind == IR_CONST) {
+        uintmax_t res = 0;
+        for (unsigned nr = 0; nr < value.type.width; nr += 8) {
+            res = (res << 8) | ((value.const_.int_ >> nr) & 0xff);
+        }
+        const_res(instr, make_const(value.type, res, value.host_ptr));
         return true;
     } else {
         instr->unop.value = value;
@@ -144,7 +231,8 @@ static bool optimize_binop(recompiler_backend_t *backend,
         }
         default: return false;
         }
-        const_res(instr, ir_make_const_int(left.type, res & mask));
+        const_res(instr, make_const(left.type, res & mask,
+            left.host_ptr != right.host_ptr));
         return true;
     }
 
@@ -227,7 +315,8 @@ static bool optimize_binop_signed(recompiler_backend_t *backend,
         case IR_SREM:   res = vleft % vright; break;
         default: return false;
         }
-        const_res(instr, ir_make_const_int(left.type, (uintmax_t)res & mask));
+        const_res(instr, make_const(left.type, (uintmax_t)res & mask,
+            left.host_ptr != right.host_ptr));
         return true;
     } else {
         instr->binop.left = left;
@@ -273,9 +362,20 @@ static bool optimize_icmp(recompiler_backend_t *backend,
     }
 }
 
+/**
+ * Return true if the host memory address can alias a global variable,
+ * i.e. it is not the address of a stack allocated variable.
+ */
+static bool may_alias_globals(ir_value_t address) {
+    return address.kind != IR_VAR || !ir_var_alloc[address.var];
+}
+
 static bool optimize_load(recompiler_backend_t *backend,
                           ir_instr_t *instr) {
     instr->load.address = convert_value(instr->load.address);
+    if (may_alias_globals(instr->load.address)) {
+        commit_globals();
+    }
     remap_res(instr);
     return false;
 }
@@ -284,6 +384,10 @@ static bool optimize_store(recompiler_backend_t *backend,
                            ir_instr_t *instr) {
     instr->store.address = convert_value(instr->store.address);
     instr->store.value = convert_value(instr->store.value);
+    if (may_alias_globals(instr->store.address)) {
+        commit_globals();
+        memset(ir_global_context, 0, sizeof(ir_global_context));
+    }
     return false;
 }
 
@@ -303,13 +407,22 @@ static bool optimize_read(recompiler_backend_t *backend,
 
 static bool optimize_write(recompiler_backend_t *backend,
                            ir_instr_t *instr) {
-    // TODO only the last write to a global should be kept,
-    // (except when global values must be committed,
-    // e.g. before a function call).
-    instr->write.value = convert_value(instr->write.value);
-    ir_global_context[instr->write.global].set = true;
-    ir_global_context[instr->write.global].value = instr->write.value;
-    return false;
+    // Only the last write to a global is kept, the write is delayed
+    // until the next commit point (exit, branch, assert, call).
+    ir_global_context_t *global = ir_global_context + instr->write.global;
+    ir_value_t value = convert_value(instr->write.value);
+
+    // Writing back the value loaded from memory is a no-op.
+    if (global->set && global->write == NULL &&
+        equal_values(global->value, value)) {
+        return true;
+    }
+
+    instr->write.value = value;
+    global->set = true;
+    global->value = value;
+    global->write = instr;
+    return true;
 }
 
 static bool optimize_trunc(recompiler_backend_t *backend,
@@ -318,7 +431,7 @@ static bool optimize_trunc(recompiler_backend_t *backend,
     if (value.kind == IR_CONST) {
         uintmax_t mask = make_mask(instr->type.width);
         uintmax_t res = value.const_.int_ & mask;
-        const_res(instr, ir_make_const_int(instr->type, res));
+        const_res(instr, make_const(instr->type, res, value.host_ptr));
         return true;
     } else {
         instr->cvt.value = value;
@@ -333,7 +446,7 @@ static bool optimize_sext(recompiler_backend_t *backend,
     if (value.kind == IR_CONST) {
         uintmax_t res =
             sign_extend(value.type.width, instr->type.width, value.const_.int_);
-        const_res(instr, ir_make_const_int(instr->type, res));
+        const_res(instr, make_const(instr->type, res, value.host_ptr));
         return true;
     } else {
         instr->cvt.value = value;
@@ -346,7 +459,8 @@ static bool optimize_zext(recompiler_backend_t *backend,
                           ir_instr_t *instr) {
     ir_value_t value = convert_value(instr->cvt.value);
     if (value.kind == IR_CONST) {
-        const_res(instr, ir_make_const_int(instr->type, value.const_.int_));
+        const_res(instr, make_const(instr->type, value.const_.int_,
+            value.host_ptr));
         return true;
     } else {
         instr->cvt.value = value;
@@ -365,6 +479,7 @@ static const bool (*optimize_callbacks[])(recompiler_backend_t *backend,
     [IR_CALL]   = optimize_call,
     [IR_ALLOC]  = optimize_alloc,
     [IR_NOT]    = optimize_not,
+    [IR_BSWAP]  = optimize_bswap,
     [IR_ADD]    = optimize_binop,
     [IR_SUB]    = optimize_binop,
     [IR_MUL]    = optimize_binop,
@@ -388,7 +503,7 @@ static const bool (*optimize_callbacks[])(recompiler_backend_t *backend,
     [IR_ZEXT]   = optimize_zext,
 };
 
-_Static_assert(IR_ZEXT == 26,
+_Static_assert(IR_ZEXT == 27,
     "IR instruction set changed, code may need to be updated");
 
 /**
@@ -408,17 +523,67 @@ static bool optimize_instr(recompiler_backend_t *backend,
  */
 static void optimize_block(recompiler_backend_t *backend,
                            ir_block_t *block) {
+    ir_block_context_t *context = ir_block_context + block->label;
     ir_instr_t *instr = block->entry;
     ir_instr_t *next_instr;
-    ir_instr_t **prev_instr = &block->entry;
 
+    ir_prev_instr = &block->entry;
     memset(ir_global_context, 0, sizeof(ir_global_context));
 
+    // Blocks with a unique predecessor inherit the global values
+    // known at the end of the predecessor, which dominates the block.
+    if (context->nr_predecessors == 1 &&
+        context->predecessor->label < block->label) {
+        for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+            ir_global_context[nr].set = context->set[nr];
+            ir_global_context[nr].value = context->globals[nr];
+        }
+    }
+
     for (; instr != NULL; instr = next_instr) {
         next_instr = instr->next;
         if (!optimize_instr(backend, instr)) {
-            *prev_instr = instr;
-            prev_instr = &instr->next;
+            *ir_prev_instr = instr;
+            ir_prev_instr = &instr->next;
+        }
+        if (instr->kind == IR_BR) {
+            // Save the global values for the successor blocks.
+            for (unsigned t = 0; t < 2; t++) {
+                ir_block_context_t *succ =
+                    ir_block_context + instr->br.target[t]->label;
+                for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+                    succ->set[nr] = ir_global_context[nr].set;
+                    succ->globals[nr] = ir_global_context[nr].value;
+                }
+            }
+        }
+    }
+
+    // Blocks are terminated by exit or br instructions,
+    // all writes are already committed.
+    commit_globals();
+}
+
+/**
+ * Count the predecessors of each block.
+ */
+static void count_predecessors(ir_graph_t *graph) {
+    for (unsigned nr = 0; nr < graph->nr_blocks; nr++) {
+        ir_block_context[nr].nr_predecessors = 0;
+        ir_block_context[nr].predecessor = NULL;
+    }
+    for (unsigned nr = 0; nr < graph->nr_blocks; nr++) {
+        ir_block_t const *block = graph->blocks + nr;
+        ir_instr_t const *instr = block->entry;
+        for (; instr != NULL; instr = instr->next) {
+            if (instr->kind != IR_BR) {
+                continue;
+            }
+            for (unsigned t = 0; t < 2; t++) {
+                unsigned label = instr->br.target[t]->label;
+                ir_block_context[label].nr_predecessors++;
+                ir_block_context[label].predecessor = block;
+            }
         }
     }
 }
@@ -431,7 +596,52 @@ static void optimize_block(recompiler_backend_t *backend,
 void ir_optimize(recompiler_backend_t *backend,
                  ir_graph_t *graph) {
     ir_cur_var = 0;
+    count_predecessors(graph);
     for (unsigned nr = 0; nr < graph->nr_blocks; nr++) {
         optimize_block(backend, &graph->blocks[nr]);
     }
 }
+
+/**
+ * Count the instructions of an instruction graph.
+ */
+static unsigned count_instrs(ir_graph_t const *graph) {
+    unsigned nr_instrs = 0;
+    for (unsigned nr = 0; nr < graph->nr_blocks; nr++) {
+        ir_instr_t const *instr = graph->blocks[nr].entry;
+        for (; instr != NULL; instr = instr->next) {
+            nr_instrs++;
+        }
+    }
+    return nr_instrs;
+}
+
+/**
+ * Optimize an instruction graph with the more expensive pipeline reserved
+ * to hot blocks. The local optimization pass is repeated until the graph
+ * size no longer decreases, then the graph-wide passes propagate values
+ * across blocks and remove the redundant instructions. A last local pass
+ * folds the values exposed by the graph-wide passes.
+ * @param backend   Pointer to the recompiler backend.
+ * @param block     Pointer to the graph to optimize.
+ */
+void ir_optimize_full(recompiler_backend_t *backend,
+                      ir_graph_t *graph) {
+    unsigned nr_instrs = count_instrs(graph);
+    for (unsigned nr = 0; nr < RECOMPILER_OPTIMIZE_ITERATIONS_MAX; nr++) {
+        unsigned new_nr_instrs =
+            ir_optimize_pass(backend, graph, IR_OPTIMIZE_LOCAL);
+        if (new_nr_instrs >= nr_instrs) {
+            break;
+        }
+        nr_instrs = new_nr_instrs;
+    }
+
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_SSA);
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_SCCP);
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_EXT);
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_CSE);
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_DSE);
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_DCE);
+    ir_optimize_pass(backend, graph, IR_OPTIMIZE_LOCAL);
+}
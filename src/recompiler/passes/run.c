@@ -173,6 +173,17 @@ static bool run_not(recompiler_backend_t *backend,
     return true;
 }
 
+static bool run_bswap(recompiler_backend_t *backend,
+                      ir_instr_t const *instr) {
+    uintmax_t value = eval_value(instr->unop.value).int_;
+    uintmax_t res = 0;
+    for (unsigned nr = 0; nr < instr->type.width; nr += 8) {
+        res = (res << 8) | ((value >> nr) & 0xff);
+    }
+    ir_var_values[instr->res] = (ir_const_t){ res };
+    return true;
+}
+
 static bool run_binop(recompiler_backend_t *backend,
                       ir_instr_t const *instr) {
     unsigned width = instr->type.width;
@@ -369,6 +380,7 @@ static const bool (*run_callbacks[])(recompiler_backend_t *backend,
     [IR_CALL]   = run_call,
     [IR_ALLOC]  = run_alloc,
     [IR_NOT]    = run_not,
+    [IR_BSWAP]  = run_bswap,
     [IR_ADD]    = run_binop,
     [IR_SUB]    = run_binop,
     [IR_MUL]    = run_binop,
@@ -392,7 +404,7 @@ static const bool (*run_callbacks[])(recompiler_backend_t *backend,
     [IR_ZEXT]   = run_zext,
 };
 
-_Static_assert(IR_ZEXT == 26,
+_Static_assert(IR_ZEXT == 27,
     "IR instruction set changed, code may need to be updated");
 
 static bool run_instr(recompiler_backend_t *backend,
@@ -0,0 +1,1241 @@
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <recompiler/config.h>
+#include <recompiler/passes.h>
+
+/*
+ * Graph-wide optimization passes.
+ *
+ * The pseudo variables are in SSA form, but the guest registers are held
+ * by global variables, read and written by each instruction block.
+ * The passes below track the values of the global variables across blocks:
+ * a read is replaced by the SSA value reaching it when the same value
+ * reaches the read on every path. The instruction set has no phi
+ * instruction, merge points with different incoming values keep the read.
+ *
+ * Pseudo variables may be used outside the block defining them.
+ * The register allocator computes the liveness intervals in block label
+ * order, a use is only introduced when every path from the definition
+ * to the use stays inside the label interval of the two blocks.
+ */
+
+#define BLOCK_SET_WORDS     ((RECOMPILER_BLOCK_MAX + 63) / 64)
+#define GLOBAL_SET_WORDS    ((RECOMPILER_GLOBAL_MAX + 63) / 64)
+
+typedef struct ir_block_set {
+    uint64_t bits[BLOCK_SET_WORDS];
+} ir_block_set_t;
+
+typedef struct ir_global_set {
+    uint64_t bits[GLOBAL_SET_WORDS];
+} ir_global_set_t;
+
+/**
+ * Lattice of the values of pseudo variables and global variables.
+ * \ref IR_LATTICE_VALUE holds a constant, or a pseudo variable holding
+ * the same value.
+ */
+typedef enum ir_lattice_kind {
+    IR_LATTICE_TOP,
+    IR_LATTICE_VALUE,
+    IR_LATTICE_BOTTOM,
+} ir_lattice_kind_t;
+
+typedef struct ir_lattice {
+    ir_lattice_kind_t kind;
+    ir_value_t value;
+} ir_lattice_t;
+
+typedef struct ir_block_context {
+    ir_block_t *succ[2];
+    unsigned nr_succs;
+    ir_block_set_t preds;
+    /* Blocks dominating this block, including itself. */
+    ir_block_set_t dom;
+    /* Blocks reachable from this block, and reaching this block,
+     * in one or more steps. */
+    ir_block_set_t reach_from;
+    ir_block_set_t reach_to;
+    bool reachable;
+    bool executable[2];
+    ir_global_set_t live_in;
+} ir_block_context_t;
+
+typedef struct ir_var_context {
+    ir_instr_t *def;
+    unsigned block;
+    bool alloc;
+    bool substituted;
+    ir_value_t subst;
+    unsigned nr_uses;
+    ir_block_set_t uses;
+    ir_lattice_t lattice;
+} ir_var_context_t;
+
+/* The pass context is private to each recompiler thread. */
+static _Thread_local ir_block_context_t ir_block_context[RECOMPILER_BLOCK_MAX];
+static _Thread_local ir_var_context_t   ir_var_context[RECOMPILER_VAR_MAX];
+static _Thread_local ir_lattice_t       ir_block_out[RECOMPILER_BLOCK_MAX]
+                                                    [RECOMPILER_GLOBAL_MAX];
+static _Thread_local ir_lattice_t       ir_global_state[RECOMPILER_GLOBAL_MAX];
+static _Thread_local ir_instr_t        *ir_block_instrs[RECOMPILER_INSTR_MAX];
+
+/* Available expressions of the CSE pass, chained by hash bucket. */
+#define CSE_BUCKETS 256
+typedef struct ir_cse_entry {
+    ir_instr_t const *instr;
+    unsigned block;
+    int next;
+} ir_cse_entry_t;
+
+static _Thread_local ir_cse_entry_t     ir_cse_entries[RECOMPILER_INSTR_MAX];
+static _Thread_local int                ir_cse_buckets[CSE_BUCKETS];
+
+static ir_optimize_stats_t ir_stats;
+
+static inline bool set_test(uint64_t const *bits, unsigned nr) {
+    return (bits[nr / 64] >> (nr % 64)) & 1;
+}
+
+static inline void set_add(uint64_t *bits, unsigned nr) {
+    bits[nr / 64] |= UINT64_C(1) << (nr % 64);
+}
+
+static inline void set_remove(uint64_t *bits, unsigned nr) {
+    bits[nr / 64] &= ~(UINT64_C(1) << (nr % 64));
+}
+
+static inline uintmax_t make_mask(unsigned width) {
+    return width >= CHAR_BIT * sizeof(uintmax_t) ?
+        UINTMAX_C(-1) : (UINTMAX_C(1) << width) - 1;
+}
+
+static inline uintmax_t sign_extend(unsigned in_width, unsigned out_width,
+                                    uintmax_t value) {
+    uintmax_t sign_bit = UINTMAX_C(1) << (in_width - 1);
+    uintmax_t sign_ext = make_mask(out_width) & ~make_mask(in_width);
+    return value & sign_bit ? value | sign_ext : value;
+}
+
+static bool equal_values(ir_value_t left, ir_value_t right) {
+    if (left.kind != right.kind ||
+        left.type.width != right.type.width) {
+        return false;
+    }
+    switch (left.kind) {
+    case IR_CONST:  return left.const_.int_ == right.const_.int_ &&
+                           left.host_ptr == right.host_ptr;
+    case IR_VAR:    return left.var == right.var;
+    default:        return false;
+    }
+}
+
+static bool equal_lattices(ir_lattice_t const *left, ir_lattice_t const *right) {
+    return left->kind == right->kind &&
+        (left->kind != IR_LATTICE_VALUE ||
+         equal_values(left->value, right->value));
+}
+
+static void meet_lattice(ir_lattice_t *left, ir_lattice_t const *right) {
+    if (left->kind == IR_LATTICE_TOP) {
+        *left = *right;
+    } else if (right->kind != IR_LATTICE_TOP && !equal_lattices(left, right)) {
+        left->kind = IR_LATTICE_BOTTOM;
+    }
+}
+
+/**
+ * Return true if the instruction computes its result from its operands
+ * only, without side effects.
+ */
+static bool is_pure_instr(ir_instr_t const *instr) {
+    _Static_assert(IR_ZEXT == 27,
+        "IR instruction set changed, code may need to be updated");
+    return (instr->kind >= IR_NOT && instr->kind <= IR_ICMP) ||
+           instr->kind == IR_TRUNC ||
+           instr->kind == IR_SEXT ||
+           instr->kind == IR_ZEXT;
+}
+
+/**
+ * Return true if the host memory address can alias a global variable,
+ * i.e. it is not the address of a stack allocated variable.
+ */
+static bool may_alias_globals(ir_value_t address) {
+    return address.kind != IR_VAR || !ir_var_context[address.var].alloc;
+}
+
+/**
+ * Call \p map on each input value of the instruction, allowing
+ * the values to be replaced.
+ */
+static void map_values(ir_instr_t *instr,
+                       void (*map)(void *arg, ir_value_t *value), void *arg) {
+    switch (instr->kind) {
+    case IR_ASSERT: map(arg, &instr->assert_.cond); break;
+    case IR_BR:     map(arg, &instr->br.cond); break;
+    case IR_CALL:
+        for (unsigned nr = 0; nr < instr->call.nr_params; nr++) {
+            map(arg, &instr->call.params[nr]);
+        }
+        break;
+    case IR_NOT:
+    case IR_BSWAP:  map(arg, &instr->unop.value); break;
+    case IR_ICMP:
+        map(arg, &instr->icmp.left);
+        map(arg, &instr->icmp.right);
+        break;
+    case IR_LOAD:   map(arg, &instr->load.address); break;
+    case IR_STORE:
+        map(arg, &instr->store.address);
+        map(arg, &instr->store.value);
+        break;
+    case IR_WRITE:  map(arg, &instr->write.value); break;
+    case IR_TRUNC:
+    case IR_SEXT:
+    case IR_ZEXT:   map(arg, &instr->cvt.value); break;
+    default:
+        if (instr->kind >= IR_ADD && instr->kind <= IR_XOR) {
+            map(arg, &instr->binop.left);
+            map(arg, &instr->binop.right);
+        }
+        break;
+    }
+}
+
+static unsigned count_instrs(ir_graph_t const *graph) {
+    unsigned nr_instrs = 0;
+    for (unsigned nr = 0; nr < graph->nr_blocks; nr++) {
+        ir_instr_t const *instr = graph->blocks[nr].entry;
+        for (; instr != NULL; instr = instr->next) {
+            nr_instrs++;
+        }
+    }
+    return nr_instrs;
+}
+
+static void record_use(void *arg, ir_value_t *value) {
+    if (value->kind == IR_VAR) {
+        ir_var_context_t *var = ir_var_context + value->var;
+        var->nr_uses++;
+        set_add(var->uses.bits, *(unsigned *)arg);
+    }
+}
+
+/**
+ * Collect the successors, predecessors, reachability and dominators
+ * of the graph blocks, and the definitions and uses of the pseudo
+ * variables.
+ */
+static void analyze_graph(ir_graph_t *graph) {
+    unsigned nr_blocks = graph->nr_blocks;
+
+    memset(ir_var_context, 0, sizeof(ir_var_context));
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        ir_block_context_t *block = ir_block_context + label;
+        memset(block, 0, sizeof(*block));
+        for (ir_instr_t *instr = graph->blocks[label].entry; instr != NULL;
+             instr = instr->next) {
+            map_values(instr, record_use, &label);
+            if (!ir_is_void_instr(instr)) {
+                ir_var_context[instr->res].def = instr;
+                ir_var_context[instr->res].block = label;
+                ir_var_context[instr->res].alloc = instr->kind == IR_ALLOC;
+            }
+            if (instr->kind == IR_BR) {
+                block->succ[0] = instr->br.target[0];
+                block->succ[1] = instr->br.target[1];
+                block->nr_succs = instr->br.target[0] == instr->br.target[1] ||
+                    instr->br.cond.kind == IR_CONST ? 1 : 2;
+                if (instr->br.cond.kind == IR_CONST) {
+                    block->succ[0] =
+                        instr->br.target[instr->br.cond.const_.int_ != 0];
+                }
+            }
+        }
+    }
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        ir_block_context_t *block = ir_block_context + label;
+        for (unsigned nr = 0; nr < block->nr_succs; nr++) {
+            unsigned succ = block->succ[nr]->label;
+            set_add(ir_block_context[succ].preds.bits, label);
+            set_add(block->reach_from.bits, succ);
+        }
+    }
+
+    // Transitive closure of the successor relation.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned label = 0; label < nr_blocks; label++) {
+            ir_block_context_t *block = ir_block_context + label;
+            for (unsigned succ = 0; succ < nr_blocks; succ++) {
+                if (!set_test(block->reach_from.bits, succ)) {
+                    continue;
+                }
+                for (unsigned w = 0; w < BLOCK_SET_WORDS; w++) {
+                    uint64_t bits = block->reach_from.bits[w] |
+                        ir_block_context[succ].reach_from.bits[w];
+                    changed |= bits != block->reach_from.bits[w];
+                    block->reach_from.bits[w] = bits;
+                }
+            }
+        }
+    }
+    ir_block_context[0].reachable = true;
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        ir_block_context_t *block = ir_block_context + label;
+        if (set_test(ir_block_context[0].reach_from.bits, label)) {
+            block->reachable = true;
+        }
+        for (unsigned pred = 0; pred < nr_blocks; pred++) {
+            if (set_test(ir_block_context[pred].reach_from.bits, label)) {
+                set_add(block->reach_to.bits, pred);
+            }
+        }
+    }
+
+    // Iterative dominator sets. Unreachable blocks are dominated
+    // by all blocks.
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        memset(&ir_block_context[label].dom, label == 0 ? 0 : 0xff,
+               sizeof(ir_block_set_t));
+    }
+    set_add(ir_block_context[0].dom.bits, 0);
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned label = 1; label < nr_blocks; label++) {
+            ir_block_context_t *block = ir_block_context + label;
+            ir_block_set_t dom;
+            memset(&dom, 0xff, sizeof(dom));
+            for (unsigned pred = 0; pred < nr_blocks; pred++) {
+                if (!set_test(block->preds.bits, pred) ||
+                    !ir_block_context[pred].reachable) {
+                    continue;
+                }
+                for (unsigned w = 0; w < BLOCK_SET_WORDS; w++) {
+                    dom.bits[w] &= ir_block_context[pred].dom.bits[w];
+                }
+            }
+            set_add(dom.bits, label);
+            if (memcmp(&dom, &block->dom, sizeof(dom)) != 0) {
+                block->dom = dom;
+                changed = true;
+            }
+        }
+    }
+}
+
+/**
+ * Return true if a pseudo variable defined in the block \p def can be
+ * used in the block \p use: the definition dominates the use, and every
+ * path from the definition to the use only crosses blocks with labels
+ * between the two block labels.
+ */
+static bool is_scope_safe(unsigned def, unsigned use) {
+    if (def == use) {
+        return true;
+    }
+    if (def > use || !set_test(ir_block_context[use].dom.bits, def)) {
+        return false;
+    }
+    for (unsigned label = 0; label < RECOMPILER_BLOCK_MAX; label++) {
+        bool from = label == def ||
+            set_test(ir_block_context[def].reach_from.bits, label);
+        bool to = label == use ||
+            set_test(ir_block_context[use].reach_to.bits, label);
+        if (from && to && (label < def || label > use)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Return true if the uses of the pseudo variable \p var can be replaced
+ * by the value \p value.
+ */
+static bool can_substitute(ir_var_t var, ir_value_t value) {
+    if (value.kind != IR_VAR) {
+        return true;
+    }
+    ir_var_context_t const *from = ir_var_context + var;
+    ir_var_context_t const *to = ir_var_context + value.var;
+    if (to->def == NULL || to->alloc || from->alloc) {
+        return false;
+    }
+    if (!is_scope_safe(to->block, from->block)) {
+        return false;
+    }
+    for (unsigned label = 0; label < RECOMPILER_BLOCK_MAX; label++) {
+        if (set_test(from->uses.bits, label) &&
+            !is_scope_safe(to->block, label)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Replace the uses of the pseudo variable \p var by \p value.
+ * The substitution is applied to the graph by \ref apply_substitutions.
+ */
+static void substitute(ir_var_t var, ir_value_t value) {
+    ir_var_context_t *from = ir_var_context + var;
+    from->substituted = true;
+    from->subst = value;
+    if (value.kind == IR_VAR) {
+        ir_var_context_t *to = ir_var_context + value.var;
+        to->nr_uses += from->nr_uses;
+        for (unsigned w = 0; w < BLOCK_SET_WORDS; w++) {
+            to->uses.bits[w] |= from->uses.bits[w];
+        }
+    }
+}
+
+static ir_value_t resolve_value(ir_value_t value) {
+    while (value.kind == IR_VAR && ir_var_context[value.var].substituted) {
+        value = ir_var_context[value.var].subst;
+    }
+    return value;
+}
+
+static void resolve_value_cb(void *arg, ir_value_t *value) {
+    (void)arg;
+    *value = resolve_value(*value);
+}
+
+static void apply_substitutions(ir_graph_t *graph) {
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        ir_instr_t *instr = graph->blocks[label].entry;
+        for (; instr != NULL; instr = instr->next) {
+            map_values(instr, resolve_value_cb, NULL);
+        }
+    }
+}
+
+/**
+ * Evaluate a pure instruction with constant operands.
+ * @return false if the instruction cannot be evaluated.
+ */
+static bool eval_instr(ir_instr_t const *instr, uintmax_t const *operands,
+                       unsigned width, uintmax_t *res) {
+    uintmax_t left = operands[0];
+    uintmax_t right = operands[1];
+    uintmax_t mask = make_mask(width);
+    intmax_t sleft = (intmax_t)sign_extend(width, 64, left);
+    intmax_t sright = (intmax_t)sign_extend(width, 64, right);
+
+    switch (instr->kind) {
+    case IR_NOT:    *res = ~left; break;
+    case IR_BSWAP:
+        *res = 0;
+        for (unsigned nr = 0; nr < width; nr += 8) {
+            *res = (*res << 8) | ((left >> nr) & 0xff);
+        }
+        break;
+    case IR_ADD:    *res = left + right; break;
+    case IR_SUB:    *res = left - right; break;
+    case IR_MUL:    *res = left * right; break;
+    case IR_UDIV:   if (right == 0) return false; *res = left / right; break;
+    case IR_UREM:   if (right == 0) return false; *res = left % right; break;
+    // The signed division overflow is left to the generated code.
+    case IR_SDIV:
+        if (sright == 0 || sright == -1) return false;
+        *res = (uintmax_t)(sleft / sright);
+        break;
+    case IR_SREM:
+        if (sright == 0 || sright == -1) return false;
+        *res = (uintmax_t)(sleft % sright);
+        break;
+    case IR_SLL:    if (right >= width) return false; *res = left << right; break;
+    case IR_SRL:    if (right >= width) return false; *res = left >> right; break;
+    case IR_SRA:    if (right >= width) return false;
+                    *res = (uintmax_t)(sleft >> right); break;
+    case IR_AND:    *res = left & right; break;
+    case IR_OR:     *res = left | right; break;
+    case IR_XOR:    *res = left ^ right; break;
+    case IR_ICMP:
+        switch (instr->icmp.op) {
+        case IR_EQ:  *res = left == right; break;
+        case IR_NE:  *res = left != right; break;
+        case IR_UGT: *res = left > right; break;
+        case IR_UGE: *res = left >= right; break;
+        case IR_ULT: *res = left < right; break;
+        case IR_ULE: *res = left <= right; break;
+        case IR_SGT: *res = sleft > sright; break;
+        case IR_SGE: *res = sleft >= sright; break;
+        case IR_SLT: *res = sleft < sright; break;
+        case IR_SLE: *res = sleft <= sright; break;
+        default: return false;
+        }
+        return true;
+    case IR_TRUNC:
+    case IR_ZEXT:   *res = left; break;
+    case IR_SEXT:   *res = sign_extend(width, instr->type.width, left);
+                    return true;
+    default:
+        return false;
+    }
+    *res &= instr->kind == IR_TRUNC ? make_mask(instr->type.width) : mask;
+    return true;
+}
+
+/**
+ * Return the lattice element of an input value.
+ * Pseudo variables with unknown values stand for themselves.
+ */
+static ir_lattice_t value_lattice(ir_value_t value) {
+    ir_lattice_t lattice = { IR_LATTICE_VALUE, value };
+    if (value.kind == IR_VAR) {
+        ir_lattice_t const *var = &ir_var_context[value.var].lattice;
+        if (var->kind != IR_LATTICE_BOTTOM) {
+            lattice = *var;
+        }
+    }
+    return lattice;
+}
+
+/** Evaluate the lattice element of the result of a pure instruction. */
+static ir_lattice_t eval_lattice(ir_instr_t const *instr) {
+    ir_value_t values[2];
+    uintmax_t operands[2] = { 0, 0 };
+    unsigned nr_values = 1;
+    unsigned width;
+    bool host_ptr = false;
+    ir_lattice_t res = { IR_LATTICE_BOTTOM, };
+
+    switch (instr->kind) {
+    case IR_NOT:
+    case IR_BSWAP: values[0] = instr->unop.value; break;
+    case IR_ICMP:
+        values[0] = instr->icmp.left;
+        values[1] = instr->icmp.right;
+        nr_values = 2;
+        break;
+    case IR_TRUNC:
+    case IR_SEXT:
+    case IR_ZEXT:  values[0] = instr->cvt.value; break;
+    default:
+        values[0] = instr->binop.left;
+        values[1] = instr->binop.right;
+        nr_values = 2;
+        break;
+    }
+    width = values[0].type.width;
+    for (unsigned nr = 0; nr < nr_values; nr++) {
+        ir_lattice_t operand = value_lattice(values[nr]);
+        if (operand.kind == IR_LATTICE_TOP) {
+            res.kind = IR_LATTICE_TOP;
+            return res;
+        }
+        if (operand.value.kind != IR_CONST) {
+            return res;
+        }
+        operands[nr] = operand.value.const_.int_;
+        host_ptr ^= operand.value.host_ptr;
+    }
+    uintmax_t value;
+    if (eval_instr(instr, operands, width, &value)) {
+        // The result derived from exactly one host pointer operand
+        // remains a host pointer, unless it is a comparison.
+        res.kind = IR_LATTICE_VALUE;
+        res.value = ir_make_const_int(instr->type, value);
+        res.value.host_ptr = host_ptr && instr->kind != IR_ICMP;
+    }
+    return res;
+}
+
+/** Update the lattice element of a pseudo variable, return true if
+ * the element was lowered. */
+static bool update_var_lattice(ir_var_t var, ir_lattice_t const *lattice) {
+    ir_lattice_t *current = &ir_var_context[var].lattice;
+    ir_lattice_t old = *current;
+    if (old.kind == IR_LATTICE_TOP) {
+        *current = *lattice;
+    } else {
+        meet_lattice(current, lattice);
+    }
+    return !equal_lattices(&old, current);
+}
+
+/** Compute the global values at the entry of the block \p label. */
+static void block_entry_state(ir_graph_t const *graph, unsigned label) {
+    for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+        ir_global_state[nr].kind =
+            label == 0 ? IR_LATTICE_BOTTOM : IR_LATTICE_TOP;
+    }
+    for (unsigned pred = 0; pred < graph->nr_blocks; pred++) {
+        ir_block_context_t const *block = ir_block_context + pred;
+        if (!set_test(ir_block_context[label].preds.bits, pred) ||
+            !block->reachable ||
+            !((block->executable[0] && block->succ[0]->label == label) ||
+              (block->executable[1] && block->succ[1]->label == label))) {
+            continue;
+        }
+        for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+            meet_lattice(&ir_global_state[nr], &ir_block_out[pred][nr]);
+        }
+    }
+}
+
+/**
+ * Apply the transfer function of one instruction to the global values.
+ * @param conditional   Evaluate the pure instructions.
+ * @return true if the lattice element of the result was lowered.
+ */
+static bool transfer_instr(ir_instr_t const *instr, bool conditional) {
+    ir_lattice_t res = { IR_LATTICE_BOTTOM, };
+
+    switch (instr->kind) {
+    case IR_READ: {
+        ir_lattice_t *global = ir_global_state + instr->read.global;
+        if (global->kind == IR_LATTICE_VALUE) {
+            res = value_lattice(global->value);
+        } else {
+            res.kind = global->kind;
+        }
+        if (global->kind == IR_LATTICE_BOTTOM) {
+            global->kind = IR_LATTICE_VALUE;
+            global->value = ir_make_var(instr->type, instr->res);
+        }
+        break;
+    }
+    case IR_WRITE:
+        ir_global_state[instr->write.global] =
+            value_lattice(instr->write.value);
+        return false;
+    case IR_CALL:
+        for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+            ir_global_state[nr].kind = IR_LATTICE_BOTTOM;
+        }
+        break;
+    case IR_STORE:
+        if (may_alias_globals(instr->store.address)) {
+            for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+                ir_global_state[nr].kind = IR_LATTICE_BOTTOM;
+            }
+        }
+        return false;
+    default:
+        if (conditional && is_pure_instr(instr)) {
+            res = eval_lattice(instr);
+        }
+        break;
+    }
+
+    if (ir_is_void_instr(instr)) {
+        return false;
+    }
+    return update_var_lattice(instr->res, &res);
+}
+
+/**
+ * Mark the executable successors of a block terminated by \p instr.
+ * @return true if a successor was newly marked executable.
+ */
+static bool transfer_br(unsigned label,
+                        ir_instr_t const *instr, bool conditional) {
+    ir_block_context_t *block = ir_block_context + label;
+    bool executable[2] = { true, true };
+    bool changed = false;
+
+    if (instr->kind != IR_BR) {
+        return false;
+    }
+    if (instr->br.target[0] != instr->br.target[1]) {
+        ir_lattice_t cond = { IR_LATTICE_VALUE, instr->br.cond };
+        if (conditional) {
+            cond = value_lattice(instr->br.cond);
+        }
+        if (cond.kind == IR_LATTICE_TOP) {
+            executable[0] = executable[1] = false;
+        } else if (cond.kind == IR_LATTICE_VALUE &&
+                   cond.value.kind == IR_CONST) {
+            executable[cond.value.const_.int_ == 0] = false;
+        }
+    }
+
+    // The block successors are recorded from the original branch targets
+    // here, since constant branches are folded by the pass itself.
+    block->succ[0] = instr->br.target[0];
+    block->succ[1] = instr->br.target[1];
+    for (unsigned nr = 0; nr < 2; nr++) {
+        if (executable[nr] && !block->executable[nr]) {
+            block->executable[nr] = true;
+            ir_block_context[block->succ[nr]->label].reachable = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Propagate the values of the global variables and pseudo variables
+ * through the graph, until a fixed point is reached.
+ * @param conditional
+ *      Evaluate the pure instructions, and only follow the executable
+ *      branch edges. Otherwise, all blocks reachable from the graph entry
+ *      are assumed executable.
+ * @return false if no fixed point was reached.
+ */
+static bool propagate_values(ir_graph_t *graph, bool conditional) {
+    unsigned nr_blocks = graph->nr_blocks;
+    bool changed = true;
+
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        ir_block_context_t *block = ir_block_context + label;
+        for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+            ir_block_out[label][nr].kind = IR_LATTICE_TOP;
+        }
+        block->reachable = label == 0;
+        block->executable[0] = block->executable[1] = false;
+    }
+    for (unsigned var = 0; var < RECOMPILER_VAR_MAX; var++) {
+        ir_var_context[var].lattice.kind = ir_var_context[var].def == NULL ?
+            IR_LATTICE_BOTTOM : IR_LATTICE_TOP;
+    }
+
+    for (unsigned iter = 0; changed; iter++) {
+        if (iter > 4 * nr_blocks + 16) {
+            return false;
+        }
+        changed = false;
+        for (unsigned label = 0; label < nr_blocks; label++) {
+            if (!ir_block_context[label].reachable) {
+                continue;
+            }
+            block_entry_state(graph, label);
+            ir_instr_t *instr = graph->blocks[label].entry;
+            for (; instr != NULL; instr = instr->next) {
+                changed |= transfer_instr(instr, conditional);
+                changed |= transfer_br(label, instr, conditional);
+            }
+            for (unsigned nr = 0; nr < RECOMPILER_GLOBAL_MAX; nr++) {
+                if (!equal_lattices(&ir_block_out[label][nr],
+                                    &ir_global_state[nr])) {
+                    ir_block_out[label][nr] = ir_global_state[nr];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Remove the instruction following \p prev from its block.
+ * Returns the next instruction.
+ */
+static ir_instr_t *unlink_instr(ir_instr_t **prev, ir_instr_t *instr) {
+    *prev = instr->next;
+    return instr->next;
+}
+
+/**
+ * Rewrite the graph with the values computed by \ref propagate_values:
+ * pseudo variables with a known value are replaced, constant branches are
+ * folded and unreachable blocks reduced to an exit instruction.
+ */
+static void rewrite_values(ir_graph_t *graph, bool conditional) {
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        ir_block_t *block = graph->blocks + label;
+        if (!ir_block_context[label].reachable) {
+            if (conditional && block->entry != NULL) {
+                *block->entry = ir_make_exit();
+            }
+            continue;
+        }
+
+        ir_instr_t **prev = &block->entry;
+        ir_instr_t *instr = block->entry;
+        while (instr != NULL) {
+            ir_lattice_t const *res = ir_is_void_instr(instr) ? NULL :
+                &ir_var_context[instr->res].lattice;
+            if (res != NULL && res->kind == IR_LATTICE_VALUE &&
+                (is_pure_instr(instr) || instr->kind == IR_READ)) {
+                ir_value_t value = resolve_value(res->value);
+                if (can_substitute(instr->res, value)) {
+                    substitute(instr->res, value);
+                    instr = unlink_instr(prev, instr);
+                    continue;
+                }
+            }
+            if (conditional && instr->kind == IR_ASSERT) {
+                ir_lattice_t cond = value_lattice(instr->assert_.cond);
+                if (cond.kind == IR_LATTICE_VALUE &&
+                    cond.value.kind == IR_CONST &&
+                    cond.value.const_.int_ != 0) {
+                    instr = unlink_instr(prev, instr);
+                    continue;
+                }
+            }
+            if (conditional && instr->kind == IR_BR &&
+                instr->br.cond.kind != IR_CONST &&
+                ir_block_context[label].executable[0] !=
+                ir_block_context[label].executable[1]) {
+                instr->br.cond = ir_make_const_int(ir_make_i1(),
+                    ir_block_context[label].executable[1]);
+            }
+            prev = &instr->next;
+            instr = instr->next;
+        }
+    }
+    apply_substitutions(graph);
+}
+
+/**
+ * SSA construction: replace the reads of global variables by the value
+ * reaching the read, when the same value reaches it on every path.
+ */
+static void ssa_pass(recompiler_backend_t *backend, ir_graph_t *graph) {
+    (void)backend;
+    analyze_graph(graph);
+    if (propagate_values(graph, false)) {
+        rewrite_values(graph, false);
+    }
+}
+
+/**
+ * Sparse conditional constant propagation. Constant values are propagated
+ * through the pseudo variables and global variables, following only the
+ * branch edges that can be taken.
+ */
+static void sccp_pass(recompiler_backend_t *backend, ir_graph_t *graph) {
+    (void)backend;
+    analyze_graph(graph);
+    if (propagate_values(graph, true)) {
+        rewrite_values(graph, true);
+    }
+}
+
+static bool is_commutative(ir_instr_t const *instr) {
+    switch (instr->kind) {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+        return true;
+    case IR_ICMP:
+        return instr->icmp.op == IR_EQ || instr->icmp.op == IR_NE;
+    default:
+        return false;
+    }
+}
+
+/** Return the operands of a pure instruction. */
+static unsigned instr_operands(ir_instr_t const *instr, ir_value_t *values) {
+    switch (instr->kind) {
+    case IR_NOT:
+    case IR_BSWAP:
+        values[0] = instr->unop.value;
+        return 1;
+    case IR_TRUNC:
+    case IR_SEXT:
+    case IR_ZEXT:
+        values[0] = instr->cvt.value;
+        return 1;
+    case IR_ICMP:
+        values[0] = instr->icmp.left;
+        values[1] = instr->icmp.right;
+        return 2;
+    default:
+        values[0] = instr->binop.left;
+        values[1] = instr->binop.right;
+        return 2;
+    }
+}
+
+static unsigned hash_value(ir_value_t value) {
+    return value.kind == IR_VAR ? value.var * 31u :
+        (unsigned)(value.const_.int_ ^ (value.const_.int_ >> 32)) * 17u + 7u;
+}
+
+static unsigned hash_expr(ir_instr_t const *instr) {
+    ir_value_t values[2];
+    unsigned nr_values = instr_operands(instr, values);
+    unsigned hash = instr->kind * 131u + instr->type.width;
+    // The operand hashes are combined with a commutative operation.
+    for (unsigned nr = 0; nr < nr_values; nr++) {
+        hash += hash_value(values[nr]);
+    }
+    return hash % CSE_BUCKETS;
+}
+
+static bool equal_exprs(ir_instr_t const *left, ir_instr_t const *right) {
+    ir_value_t lvalues[2], rvalues[2];
+    if (left->kind != right->kind ||
+        left->type.width != right->type.width ||
+        (left->kind == IR_ICMP && left->icmp.op != right->icmp.op)) {
+        return false;
+    }
+    unsigned nr_values = instr_operands(left, lvalues);
+    instr_operands(right, rvalues);
+    if (equal_values(lvalues[0], rvalues[0]) &&
+        (nr_values == 1 || equal_values(lvalues[1], rvalues[1]))) {
+        return true;
+    }
+    return nr_values == 2 && is_commutative(left) &&
+        equal_values(lvalues[0], rvalues[1]) &&
+        equal_values(lvalues[1], rvalues[0]);
+}
+
+/**
+ * Common subexpression elimination. Pure instructions are replaced by an
+ * identical instruction of the same block or of a dominating block.
+ */
+static void cse_pass(recompiler_backend_t *backend, ir_graph_t *graph) {
+    unsigned nr_entries = 0;
+    (void)backend;
+
+    analyze_graph(graph);
+    for (unsigned nr = 0; nr < CSE_BUCKETS; nr++) {
+        ir_cse_buckets[nr] = -1;
+    }
+
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        if (!ir_block_context[label].reachable) {
+            continue;
+        }
+        ir_instr_t **prev = &graph->blocks[label].entry;
+        ir_instr_t *instr = *prev;
+        while (instr != NULL) {
+            if (!is_pure_instr(instr)) {
+                prev = &instr->next;
+                instr = instr->next;
+                continue;
+            }
+
+            map_values(instr, resolve_value_cb, NULL);
+            unsigned bucket = hash_expr(instr);
+            bool replaced = false;
+            for (int nr = ir_cse_buckets[bucket]; nr >= 0;
+                 nr = ir_cse_entries[nr].next) {
+                ir_cse_entry_t const *entry = ir_cse_entries + nr;
+                ir_value_t value = ir_make_var(entry->instr->type,
+                                               entry->instr->res);
+                if (equal_exprs(entry->instr, instr) &&
+                    can_substitute(instr->res, value)) {
+                    substitute(instr->res, value);
+                    replaced = true;
+                    break;
+                }
+            }
+            if (replaced) {
+                instr = unlink_instr(prev, instr);
+                continue;
+            }
+            if (nr_entries < RECOMPILER_INSTR_MAX) {
+                ir_cse_entries[nr_entries] = (ir_cse_entry_t){
+                    instr, label, ir_cse_buckets[bucket] };
+                ir_cse_buckets[bucket] = nr_entries++;
+            }
+            prev = &instr->next;
+            instr = instr->next;
+        }
+    }
+    apply_substitutions(graph);
+}
+
+/**
+ * Return the instruction defining the input value, if it is a pseudo
+ * variable defined by an instruction of kind \p kind.
+ */
+static ir_instr_t *def_instr(ir_value_t value, ir_instr_kind_t kind) {
+    if (value.kind != IR_VAR) {
+        return NULL;
+    }
+    ir_instr_t *def = ir_var_context[value.var].def;
+    return def != NULL && def->kind == kind ? def : NULL;
+}
+
+static ir_instr_t *def_ext(ir_value_t value) {
+    ir_instr_t *def = def_instr(value, IR_SEXT);
+    return def != NULL ? def : def_instr(value, IR_ZEXT);
+}
+
+/**
+ * Replace the operand of the conversion \p instr by \p value,
+ * converted with the instruction kind \p kind.
+ * @return false if the value cannot be used in the block \p label.
+ */
+static bool rewrite_cvt(ir_instr_t *instr, unsigned label,
+                        ir_instr_kind_t kind, ir_value_t value) {
+    if (value.kind == IR_VAR) {
+        ir_var_context_t *var = ir_var_context + value.var;
+        if (!is_scope_safe(var->block, label)) {
+            return false;
+        }
+        var->nr_uses++;
+        set_add(var->uses.bits, label);
+    }
+    instr->kind = kind;
+    instr->cvt.value = value;
+    return true;
+}
+
+/**
+ * Redundant extension removal. The 32-bit MIPS instructions truncate
+ * their 64-bit register operands and sign extend their result,
+ * chains of conversions are simplified:
+ *  - trunc (sext|zext x)  -> x, or the narrower conversion of x
+ *  - trunc (trunc x)      -> trunc x
+ *  - sext (sext x), sext (zext x), zext (zext x) -> single extension of x
+ *  - sext (trunc (sext x)) -> sext x, when the truncation keeps x
+ */
+static void ext_pass(recompiler_backend_t *backend, ir_graph_t *graph) {
+    (void)backend;
+    analyze_graph(graph);
+
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        if (!ir_block_context[label].reachable) {
+            continue;
+        }
+        ir_instr_t **prev = &graph->blocks[label].entry;
+        ir_instr_t *instr = *prev;
+        while (instr != NULL) {
+            if (instr->kind != IR_TRUNC &&
+                instr->kind != IR_SEXT &&
+                instr->kind != IR_ZEXT) {
+                prev = &instr->next;
+                instr = instr->next;
+                continue;
+            }
+
+            map_values(instr, resolve_value_cb, NULL);
+            unsigned width = instr->type.width;
+            ir_instr_t *ext = def_ext(instr->cvt.value);
+            ir_instr_t *trunc = def_instr(instr->cvt.value, IR_TRUNC);
+            ir_value_t value;
+            bool removed = false;
+
+            if (instr->kind == IR_TRUNC && ext != NULL) {
+                value = ext->cvt.value;
+                if (value.type.width == width) {
+                    if (can_substitute(instr->res, value)) {
+                        substitute(instr->res, value);
+                        removed = true;
+                    }
+                } else {
+                    (void)rewrite_cvt(instr, label,
+                        value.type.width < width ? ext->kind : IR_TRUNC,
+                        value);
+                }
+            } else if (instr->kind == IR_TRUNC && trunc != NULL) {
+                (void)rewrite_cvt(instr, label, IR_TRUNC, trunc->cvt.value);
+            } else if (ext != NULL &&
+                       (instr->kind == ext->kind || ext->kind == IR_ZEXT)) {
+                (void)rewrite_cvt(instr, label, ext->kind, ext->cvt.value);
+            } else if (trunc != NULL) {
+                ir_value_t wide = trunc->cvt.value;
+                ir_instr_t *inner = def_instr(wide, instr->kind);
+                if (inner != NULL && wide.type.width == width &&
+                    inner->cvt.value.type.width <=
+                        trunc->type.width &&
+                    can_substitute(instr->res, wide)) {
+                    substitute(instr->res, wide);
+                    removed = true;
+                }
+            }
+
+            if (removed) {
+                instr = unlink_instr(prev, instr);
+            } else {
+                prev = &instr->next;
+                instr = instr->next;
+            }
+        }
+    }
+    apply_substitutions(graph);
+}
+
+static void count_use(void *arg, ir_value_t *value) {
+    if (value->kind == IR_VAR) {
+        ir_var_context[value->var].nr_uses += *(int *)arg;
+    }
+}
+
+/**
+ * Dead code elimination. Instructions without side effects whose result
+ * is never used are removed, until no more instructions can be removed.
+ */
+static void dce_pass(recompiler_backend_t *backend, ir_graph_t *graph) {
+    int incr = 1, decr = -1;
+    bool changed = true;
+    (void)backend;
+
+    for (unsigned var = 0; var < RECOMPILER_VAR_MAX; var++) {
+        ir_var_context[var].nr_uses = 0;
+    }
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        ir_instr_t *instr = graph->blocks[label].entry;
+        for (; instr != NULL; instr = instr->next) {
+            map_values(instr, count_use, &incr);
+        }
+    }
+
+    while (changed) {
+        changed = false;
+        for (unsigned label = graph->nr_blocks; label > 0; label--) {
+            ir_instr_t **prev = &graph->blocks[label - 1].entry;
+            ir_instr_t *instr = *prev;
+            while (instr != NULL) {
+                if ((is_pure_instr(instr) ||
+                     instr->kind == IR_READ ||
+                     instr->kind == IR_ALLOC) &&
+                    ir_var_context[instr->res].nr_uses == 0) {
+                    map_values(instr, count_use, &decr);
+                    instr = unlink_instr(prev, instr);
+                    changed = true;
+                } else {
+                    prev = &instr->next;
+                    instr = instr->next;
+                }
+            }
+        }
+    }
+}
+
+static inline void global_set_all(ir_global_set_t *set) {
+    memset(set, 0xff, sizeof(*set));
+}
+
+/**
+ * Compute the global variables live at the entry of each block,
+ * in one backward iteration over the graph.
+ * @param rewrite   Remove the writes to dead global variables.
+ * @return true if the live sets were updated.
+ */
+static bool propagate_live_globals(ir_graph_t *graph, bool rewrite) {
+    bool changed = false;
+
+    for (unsigned label = graph->nr_blocks; label > 0; label--) {
+        ir_block_context_t *block = ir_block_context + label - 1;
+        ir_instr_t *instr = graph->blocks[label - 1].entry;
+        unsigned nr_instrs = 0;
+        ir_global_set_t live = { 0 };
+
+        for (; instr != NULL; instr = instr->next) {
+            ir_block_instrs[nr_instrs++] = instr;
+        }
+        for (unsigned nr = 0; nr < block->nr_succs; nr++) {
+            ir_global_set_t const *succ =
+                &ir_block_context[block->succ[nr]->label].live_in;
+            for (unsigned w = 0; w < GLOBAL_SET_WORDS; w++) {
+                live.bits[w] |= succ->bits[w];
+            }
+        }
+
+        for (unsigned nr = nr_instrs; nr > 0; nr--) {
+            instr = ir_block_instrs[nr - 1];
+            switch (instr->kind) {
+            case IR_EXIT:
+            case IR_ASSERT:
+            case IR_CALL:
+                global_set_all(&live);
+                break;
+            case IR_LOAD:
+                if (may_alias_globals(instr->load.address)) {
+                    global_set_all(&live);
+                }
+                break;
+            case IR_STORE:
+                if (may_alias_globals(instr->store.address)) {
+                    global_set_all(&live);
+                }
+                break;
+            case IR_READ:
+                set_add(live.bits, instr->read.global);
+                break;
+            case IR_WRITE:
+                if (rewrite && !set_test(live.bits, instr->write.global)) {
+                    ir_instr_t **prev = nr > 1 ?
+                        &ir_block_instrs[nr - 2]->next :
+                        &graph->blocks[label - 1].entry;
+                    *prev = instr->next;
+                }
+                set_remove(live.bits, instr->write.global);
+                break;
+            default:
+                break;
+            }
+        }
+        if (memcmp(&live, &block->live_in, sizeof(live)) != 0) {
+            block->live_in = live;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Dead store elimination. Writes to global variables overwritten before
+ * being read on every path are removed. The global variables are observed
+ * by exit and assert instructions, calls, and memory accesses that can
+ * alias the global variables.
+ */
+static void dse_pass(recompiler_backend_t *backend, ir_graph_t *graph) {
+    (void)backend;
+    analyze_graph(graph);
+    while (propagate_live_globals(graph, false)) {
+    }
+    (void)propagate_live_globals(graph, true);
+}
+
+/* Optimization passes, indexed by \ref ir_optimize_pass_t. */
+static void (*const ir_optimize_passes[IR_OPTIMIZE_PASS_COUNT])(
+    recompiler_backend_t *backend, ir_graph_t *graph) = {
+    [IR_OPTIMIZE_LOCAL] = ir_optimize,
+    [IR_OPTIMIZE_SSA]   = ssa_pass,
+    [IR_OPTIMIZE_SCCP]  = sccp_pass,
+    [IR_OPTIMIZE_CSE]   = cse_pass,
+    [IR_OPTIMIZE_EXT]   = ext_pass,
+    [IR_OPTIMIZE_DCE]   = dce_pass,
+    [IR_OPTIMIZE_DSE]   = dse_pass,
+};
+
+static char const *ir_optimize_pass_names[IR_OPTIMIZE_PASS_COUNT] = {
+    [IR_OPTIMIZE_LOCAL] = "local",
+    [IR_OPTIMIZE_SSA]   = "ssa",
+    [IR_OPTIMIZE_SCCP]  = "sccp",
+    [IR_OPTIMIZE_CSE]   = "cse",
+    [IR_OPTIMIZE_EXT]   = "ext",
+    [IR_OPTIMIZE_DCE]   = "dce",
+    [IR_OPTIMIZE_DSE]   = "dse",
+};
+
+unsigned ir_optimize_pass(recompiler_backend_t *backend, ir_graph_t *graph,
+                          ir_optimize_pass_t pass) {
+    unsigned nr_instrs_before = count_instrs(graph);
+    ir_optimize_passes[pass](backend, graph);
+    unsigned nr_instrs_after = count_instrs(graph);
+
+    __atomic_fetch_add(&ir_stats.nr_runs[pass], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ir_stats.nr_instrs_before[pass], nr_instrs_before,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ir_stats.nr_instrs_after[pass], nr_instrs_after,
+                       __ATOMIC_RELAXED);
+    return nr_instrs_after;
+}
+
+char const *ir_optimize_pass_name(ir_optimize_pass_t pass) {
+    return ir_optimize_pass_names[pass];
+}
+
+void ir_optimize_get_stats(ir_optimize_stats_t *stats) {
+    for (unsigned nr = 0; nr < IR_OPTIMIZE_PASS_COUNT; nr++) {
+        stats->nr_runs[nr] =
+            __atomic_load_n(&ir_stats.nr_runs[nr], __ATOMIC_RELAXED);
+        stats->nr_instrs_before[nr] =
+            __atomic_load_n(&ir_stats.nr_instrs_before[nr], __ATOMIC_RELAXED);
+        stats->nr_instrs_after[nr] =
+            __atomic_load_n(&ir_stats.nr_instrs_after[nr], __ATOMIC_RELAXED);
+    }
+}
@@ -290,6 +290,7 @@ static const bool (*typecheck_callbacks[])(recompiler_backend_t *backend,
     [IR_CALL]   = typecheck_call,
     [IR_ALLOC]  = typecheck_alloc,
     [IR_NOT]    = typecheck_unop,
+    [IR_BSWAP]  = typecheck_unop,
     [IR_ADD]    = typecheck_binop,
     [IR_SUB]    = typecheck_binop,
     [IR_MUL]    = typecheck_binop,
@@ -313,7 +314,7 @@ static const bool (*typecheck_callbacks[])(recompiler_backend_t *backend,
     [IR_ZEXT]   = typecheck_cvt,
 };
 
-_Static_assert(IR_ZEXT == 26,
+_Static_assert(IR_ZEXT == 27,
     "IR instruction set changed, code may need to be updated");
 
 static bool typecheck_instr(recompiler_backend_t *backend,
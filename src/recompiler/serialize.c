@@ -0,0 +1,419 @@
+
+#include <string.h>
+
+#include <recompiler/backend.h>
+#include <recompiler/ir.h>
+#include <recompiler/serialize.h>
+
+/**
+ * The graph is serialized as a sequence of fixed size fields in host
+ * byte order:
+ *
+ *  graph   := nr_blocks:u32 nr_vars:u32 block*
+ *  block   := nr_instrs:u32 instr*
+ *  instr   := kind:u8 type:u8 res:u32 <operands>
+ *  value   := kind:u8 type:u8 (var:u32 | const)
+ *  const   := region:u8 int:u64
+ *
+ * Block references are serialized as block indexes. The region index of
+ * constants is 0 for integer values, or the index plus one of the
+ * relocation region containing the pointer for values tagged as host
+ * pointers. Call targets are always relocated.
+ */
+
+typedef struct ir_writer {
+    unsigned char *ptr;
+    size_t len;
+    size_t offset;
+    bool overflow;
+    bool unrelocated;
+    ir_reloc_region_t const *regions;
+    unsigned nr_regions;
+} ir_writer_t;
+
+typedef struct ir_reader {
+    recompiler_backend_t *backend;
+    unsigned char const *ptr;
+    size_t len;
+    size_t offset;
+    ir_reloc_region_t const *regions;
+    unsigned nr_regions;
+} ir_reader_t;
+
+static void write_bytes(ir_writer_t *writer, void const *ptr, size_t len) {
+    if (writer->overflow || writer->offset + len > writer->len) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->ptr + writer->offset, ptr, len);
+    writer->offset += len;
+}
+
+static void write_u8(ir_writer_t *writer, uint8_t val) {
+    write_bytes(writer, &val, sizeof(val));
+}
+
+static void write_u32(ir_writer_t *writer, uint32_t val) {
+    write_bytes(writer, &val, sizeof(val));
+}
+
+static void write_u64(ir_writer_t *writer, uint64_t val) {
+    write_bytes(writer, &val, sizeof(val));
+}
+
+/** Write a host pointer, relative to the relocation region containing it.
+ * @return false if the pointer is not inside any relocation region,
+ *  in which case the graph cannot be serialized. */
+static bool write_ptr(ir_writer_t *writer, uintptr_t ptr) {
+    for (unsigned nr = 0; nr < writer->nr_regions; nr++) {
+        ir_reloc_region_t const *region = &writer->regions[nr];
+        if (ptr >= region->start && ptr - region->start < region->size) {
+            write_u8(writer, nr + 1);
+            write_u64(writer, ptr - region->start);
+            return true;
+        }
+    }
+    writer->unrelocated = true;
+    return false;
+}
+
+static void write_value(ir_writer_t *writer, ir_value_t const *value) {
+    write_u8(writer, value->kind);
+    write_u8(writer, value->type.width);
+    if (value->kind == IR_VAR) {
+        write_u32(writer, value->var);
+    } else if (value->host_ptr) {
+        // Pointers truncated or extended by constant folding
+        // cannot be relocated.
+        if (value->type.width != ir_make_iptr().width) {
+            writer->unrelocated = true;
+        }
+        (void)write_ptr(writer, value->const_.ptr);
+    } else {
+        write_u8(writer, 0);
+        write_u64(writer, value->const_.int_);
+    }
+}
+
+static bool write_instr(ir_writer_t *writer, ir_graph_t const *graph,
+                        ir_instr_t const *instr) {
+    write_u8(writer, instr->kind);
+    write_u8(writer, instr->type.width);
+    write_u32(writer, instr->res);
+
+    switch (instr->kind) {
+    case IR_EXIT:
+        break;
+    case IR_ASSERT:
+        write_value(writer, &instr->assert_.cond);
+        break;
+    case IR_BR:
+        write_u32(writer, instr->br.target[0] - graph->blocks);
+        write_u32(writer, instr->br.target[1] - graph->blocks);
+        write_value(writer, &instr->br.cond);
+        break;
+    case IR_CALL:
+        if (!write_ptr(writer, (uintptr_t)instr->call.func)) {
+            return false;
+        }
+        write_u32(writer, instr->call.nr_params);
+        for (unsigned nr = 0; nr < instr->call.nr_params; nr++) {
+            write_value(writer, &instr->call.params[nr]);
+        }
+        break;
+    case IR_ALLOC:
+        write_u8(writer, instr->alloc.type.width);
+        break;
+    case IR_NOT:
+    case IR_BSWAP:
+        write_value(writer, &instr->unop.value);
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_UDIV:
+    case IR_SDIV:
+    case IR_UREM:
+    case IR_SREM:
+    case IR_SLL:
+    case IR_SRL:
+    case IR_SRA:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+        write_value(writer, &instr->binop.left);
+        write_value(writer, &instr->binop.right);
+        break;
+    case IR_ICMP:
+        write_u8(writer, instr->icmp.op);
+        write_value(writer, &instr->icmp.left);
+        write_value(writer, &instr->icmp.right);
+        break;
+    case IR_LOAD:
+        write_value(writer, &instr->load.address);
+        break;
+    case IR_STORE:
+        write_value(writer, &instr->store.address);
+        write_value(writer, &instr->store.value);
+        break;
+    case IR_READ:
+        write_u32(writer, instr->read.global);
+        break;
+    case IR_WRITE:
+        write_u32(writer, instr->write.global);
+        write_value(writer, &instr->write.value);
+        break;
+    case IR_TRUNC:
+    case IR_SEXT:
+    case IR_ZEXT:
+        write_value(writer, &instr->cvt.value);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+size_t ir_serialize_graph(ir_graph_t const *graph,
+                          ir_reloc_region_t const *regions,
+                          unsigned nr_regions,
+                          unsigned char *buf, size_t len) {
+    ir_writer_t writer = { buf, len, 0, false, false, regions, nr_regions };
+
+    write_u32(&writer, graph->nr_blocks);
+    write_u32(&writer, graph->nr_vars);
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        ir_block_t const *block = &graph->blocks[label];
+        unsigned nr_instrs = 0;
+        for (ir_instr_t const *instr = block->entry; instr != NULL;
+             instr = instr->next) {
+            nr_instrs++;
+        }
+        write_u32(&writer, nr_instrs);
+        for (ir_instr_t const *instr = block->entry; instr != NULL;
+             instr = instr->next) {
+            if (!write_instr(&writer, graph, instr)) {
+                return 0;
+            }
+        }
+    }
+    return writer.overflow || writer.unrelocated ? 0 : writer.offset;
+}
+
+__attribute__((noreturn))
+static void fail_reader(ir_reader_t *reader, char const *reason) {
+    raise_recompiler_error(reader->backend, "serialize", "%s", reason);
+    fail_recompiler_backend(reader->backend);
+}
+
+static void read_bytes(ir_reader_t *reader, void *ptr, size_t len) {
+    if (reader->offset + len > reader->len) {
+        fail_reader(reader, "truncated graph");
+    }
+    memcpy(ptr, reader->ptr + reader->offset, len);
+    reader->offset += len;
+}
+
+static uint8_t read_u8(ir_reader_t *reader) {
+    uint8_t val;
+    read_bytes(reader, &val, sizeof(val));
+    return val;
+}
+
+static uint32_t read_u32(ir_reader_t *reader) {
+    uint32_t val;
+    read_bytes(reader, &val, sizeof(val));
+    return val;
+}
+
+static uint64_t read_u64(ir_reader_t *reader) {
+    uint64_t val;
+    read_bytes(reader, &val, sizeof(val));
+    return val;
+}
+
+/** Read a host pointer written by \ref write_ptr, or an integer constant.
+ * @param host_ptr      Set if the value was relocated. */
+static uintptr_t read_ptr(ir_reader_t *reader, bool *host_ptr) {
+    unsigned region = read_u8(reader);
+    uint64_t offset = read_u64(reader);
+    *host_ptr = region != 0;
+    if (region == 0) {
+        return offset;
+    }
+    if (region > reader->nr_regions ||
+        offset >= reader->regions[region - 1].size) {
+        fail_reader(reader, "invalid relocation");
+    }
+    return reader->regions[region - 1].start + offset;
+}
+
+static ir_value_t read_value(ir_reader_t *reader) {
+    ir_value_t value = { 0 };
+    value.kind = read_u8(reader);
+    value.type = ir_make_iN(read_u8(reader));
+    if (value.kind == IR_VAR) {
+        value.var = read_u32(reader);
+        if (value.var >= reader->backend->cur_var) {
+            fail_reader(reader, "invalid variable");
+        }
+    } else if (value.kind == IR_CONST) {
+        value.const_.int_ = read_ptr(reader, &value.host_ptr);
+        if (value.host_ptr && value.type.width != ir_make_iptr().width) {
+            fail_reader(reader, "invalid relocation");
+        }
+    } else {
+        fail_reader(reader, "invalid value kind");
+    }
+    return value;
+}
+
+static ir_block_t *read_block_ref(ir_reader_t *reader, unsigned nr_blocks) {
+    uint32_t index = read_u32(reader);
+    if (index >= nr_blocks) {
+        fail_reader(reader, "invalid block index");
+    }
+    return &reader->backend->blocks[index];
+}
+
+static ir_value_t *read_params(ir_reader_t *reader, unsigned nr_params) {
+    recompiler_backend_t *backend = reader->backend;
+    if (nr_params == 0) {
+        return NULL;
+    }
+    if (backend->cur_param + nr_params > backend->nr_params) {
+        fail_reader(reader, "out of ir parameter memory");
+    }
+    ir_value_t *params = &backend->params[backend->cur_param];
+    backend->cur_param += nr_params;
+    for (unsigned nr = 0; nr < nr_params; nr++) {
+        params[nr] = read_value(reader);
+    }
+    return params;
+}
+
+static void read_instr(ir_reader_t *reader, ir_instr_t *instr,
+                       unsigned nr_blocks) {
+    memset(instr, 0, sizeof(*instr));
+    instr->kind = read_u8(reader);
+    instr->type = ir_make_iN(read_u8(reader));
+    instr->res = read_u32(reader);
+
+    switch (instr->kind) {
+    case IR_EXIT:
+        break;
+    case IR_ASSERT:
+        instr->assert_.cond = read_value(reader);
+        break;
+    case IR_BR:
+        instr->br.target[0] = read_block_ref(reader, nr_blocks);
+        instr->br.target[1] = read_block_ref(reader, nr_blocks);
+        instr->br.cond = read_value(reader);
+        break;
+    case IR_CALL: {
+        bool host_ptr;
+        instr->call.func = (ir_func_t)read_ptr(reader, &host_ptr);
+        if (!host_ptr) {
+            fail_reader(reader, "invalid relocation");
+        }
+        instr->call.nr_params = read_u32(reader);
+        instr->call.params = read_params(reader, instr->call.nr_params);
+        break;
+    }
+    case IR_ALLOC:
+        instr->alloc.type = ir_make_iN(read_u8(reader));
+        break;
+    case IR_NOT:
+    case IR_BSWAP:
+        instr->unop.value = read_value(reader);
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_UDIV:
+    case IR_SDIV:
+    case IR_UREM:
+    case IR_SREM:
+    case IR_SLL:
+    case IR_SRL:
+    case IR_SRA:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+        instr->binop.left = read_value(reader);
+        instr->binop.right = read_value(reader);
+        break;
+    case IR_ICMP:
+        instr->icmp.op = read_u8(reader);
+        instr->icmp.left = read_value(reader);
+        instr->icmp.right = read_value(reader);
+        break;
+    case IR_LOAD:
+        instr->load.address = read_value(reader);
+        break;
+    case IR_STORE:
+        instr->store.address = read_value(reader);
+        instr->store.value = read_value(reader);
+        break;
+    case IR_READ:
+        instr->read.global = read_u32(reader);
+        break;
+    case IR_WRITE:
+        instr->write.global = read_u32(reader);
+        instr->write.value = read_value(reader);
+        break;
+    case IR_TRUNC:
+    case IR_SEXT:
+    case IR_ZEXT:
+        instr->cvt.value = read_value(reader);
+        break;
+    default:
+        fail_reader(reader, "invalid instruction kind");
+    }
+
+    if (instr->res >= reader->backend->cur_var && !ir_is_void_instr(instr)) {
+        fail_reader(reader, "invalid result variable");
+    }
+    if ((instr->kind == IR_READ || instr->kind == IR_WRITE) &&
+        instr->read.global >= reader->backend->nr_globals) {
+        fail_reader(reader, "invalid global variable");
+    }
+}
+
+ir_graph_t *ir_deserialize_graph(recompiler_backend_t *backend,
+                                 ir_reloc_region_t const *regions,
+                                 unsigned nr_regions,
+                                 unsigned char const *buf, size_t len) {
+    ir_reader_t reader = { backend, buf, len, 0, regions, nr_regions };
+
+    /* Catch recompiler allocation errors. */
+    if (catch_recompiler_error(backend) < 0) {
+        return NULL;
+    }
+
+    unsigned nr_blocks = read_u32(&reader);
+    backend->cur_var = read_u32(&reader);
+    if (nr_blocks == 0 || nr_blocks > backend->nr_blocks) {
+        fail_reader(&reader, "invalid block count");
+    }
+
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        (void)ir_alloc_block(backend);
+    }
+    for (unsigned label = 0; label < nr_blocks; label++) {
+        ir_instr_t **next = &backend->blocks[label].entry;
+        unsigned nr_instrs = read_u32(&reader);
+        for (unsigned nr = 0; nr < nr_instrs; nr++) {
+            ir_instr_t *instr = ir_alloc_instr(backend);
+            read_instr(&reader, instr, nr_blocks);
+            *next = instr;
+            next = &instr->next;
+        }
+        *next = NULL;
+    }
+
+    if (reader.offset != reader.len) {
+        fail_reader(&reader, "trailing data");
+    }
+    return ir_make_graph(backend);
+}
@@ -0,0 +1,74 @@
+
+#ifndef _RECOMPILER_SERIALIZE_H_INCLUDED_
+#define _RECOMPILER_SERIALIZE_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <recompiler/ir.h>
+#include <recompiler/backend.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @struct ir_reloc_region
+ * @brief Host memory region used to relocate the host pointers embedded
+ *  in serialized instruction graphs.
+ * @details Host pointers (call targets and constants tagged with
+ * \ref ir_value::host_ptr) are serialized as the index of the region
+ * containing them and the offset from the region start. The regions are
+ * resolved against the region table passed at deserialization, enabling
+ * graphs to be reloaded in a different process instance.
+ *
+ * @var ir_reloc_region::start
+ *      Host address of the region start.
+ * @var ir_reloc_region::size
+ *      Size of the region in bytes.
+ */
+typedef struct ir_reloc_region {
+    uintptr_t           start;
+    uintptr_t           size;
+} ir_reloc_region_t;
+
+/**
+ * @brief Serialize an instruction graph to the buffer \p buf.
+ * @param graph         Pointer to the serialized graph.
+ * @param regions       Pointer to the array of relocation regions.
+ * @param nr_regions    Length of \p regions.
+ * @param buf           Pointer to the output buffer.
+ * @param len           Length of the output buffer.
+ * @return
+ *      The number of bytes written, or 0 if the buffer is too small, or
+ *      a host pointer of the graph is outside the relocation regions.
+ */
+size_t ir_serialize_graph(ir_graph_t const *graph,
+                          ir_reloc_region_t const *regions,
+                          unsigned nr_regions,
+                          unsigned char *buf, size_t len);
+
+/**
+ * @brief Rebuild an instruction graph serialized with
+ *  \ref ir_serialize_graph.
+ * @details The graph is allocated from \p backend,
+ * which must have been cleared beforehand.
+ * @param backend       Pointer to the recompiler backend.
+ * @param regions       Pointer to the array of relocation regions.
+ * @param nr_regions    Length of \p regions.
+ * @param buf           Pointer to the serialized graph.
+ * @param len           Length of the serialized graph.
+ * @return
+ *      Pointer to the rebuilt graph, or NULL if the input is malformed
+ *      or exceeds the backend capacity.
+ */
+ir_graph_t *ir_deserialize_graph(recompiler_backend_t *backend,
+                                 ir_reloc_region_t const *regions,
+                                 unsigned nr_regions,
+                                 unsigned char const *buf, size_t len);
+
+#ifdef __cplusplus
+}; /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* _RECOMPILER_SERIALIZE_H_INCLUDED_ */
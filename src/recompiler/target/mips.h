@@ -14,6 +14,43 @@ extern "C" {
  */
 recompiler_backend_t *ir_mips_recompiler_backend(void);
 
+/**
+ * @brief Return the identifier of the global variable holding the
+ *  program counter in the MIPS recompiler backend.
+ */
+ir_global_t ir_mips_pc_global(void);
+
+/**
+ * @brief Configure the inline memory access fast path.
+ *
+ * When enabled, aligned loads and stores through the KSEG0 and KSEG1
+ * segments are performed inline at the host address \p base + physical
+ * address, for physical addresses lower than \p size; other accesses
+ * call the memory bus helpers. The fast path is disabled by default.
+ * @param base      Host address of the physical memory, or NULL to disable
+ *                  the fast path.
+ * @param size      Size of the physical memory range, must be a power of two
+ *                  not greater than 0x20000000.
+ */
+void ir_mips_set_fast_path(void *base, uint64_t size);
+
+/**
+ * @brief Select whether the stores on the inline memory fast path
+ * invalidate the recompiled code. The invalidation can be omitted when
+ * the memory pages holding code are write protected. Stores invalidate
+ * the recompiled code by default.
+ */
+void ir_mips_set_write_protect(bool enable);
+
+/**
+ * @brief Configure the cycle limit checked on the back edges of the loops
+ *  formed inside a graph. The recompiled code exits when the cycle counter
+ *  reaches the value pointed to by \p cycles_limit.
+ * @param cycles_limit  Host address of the cycle limit, or NULL to
+ *                      disable following backward branches.
+ */
+void ir_mips_set_cycles_limit(uint64_t const *cycles_limit);
+
 /**
  * @brief Disassemble a memory segment, producing IR bytecode.
  *
@@ -24,11 +61,52 @@ recompiler_backend_t *ir_mips_recompiler_backend(void);
  * The disassembly stops under the following conditions:
  * - the target address falls outside the delimited memory region,
  * - the target instruction is one of : JR, JALR, ERET, i.e. instructions
- *   with variable, context dependant target addresses.
+ *   with variable, context dependant target addresses,
+ * - the graph resources are exhausted.
+ *
+ * When RECOMPILER_DISAS_BRANCH_ENABLE is set, the disassembly follows
+ * the targets of branch and jump instructions inside the memory region,
+ * forming a superblock; other targets generate side exits. Backward
+ * branches check the cycle limit configured with
+ * \ref ir_mips_set_cycles_limit and are not followed if none is set.
  */
 ir_graph_t *ir_mips_disassemble(recompiler_backend_t *backend,
                                 uint64_t address, unsigned char *ptr, size_t len);
 
+/**
+ * @brief Return the length of the memory segment read by the last call to
+ *  \ref ir_mips_disassemble from the calling thread.
+ * The instruction graph is fully determined by the contents of this
+ * segment, the start address, and the fast path configuration.
+ */
+size_t ir_mips_disassembled_len(void);
+
+/** Maximum number of instruction classes tracked by the interpreter
+ * fallback counters. */
+#define IR_MIPS_FALLBACK_MAX    256
+
+/** Execution count of an instruction class evaluated by the stand-in
+ * interpreter from recompiled code. */
+typedef struct ir_mips_fallback_stats {
+    uint32_t instr;     /**< Instruction word, with the operand fields
+                             not used to decode the instruction cleared. */
+    uint64_t count;     /**< Number of executions. */
+} ir_mips_fallback_stats_t;
+
+/**
+ * @brief Return the interpreter fallback counters.
+ *
+ * The recompiled code increments a counter each time an instruction
+ * without native lowering is passed to the stand-in interpreter.
+ * Instructions are grouped by opcode; the COP0 moves are further
+ * separated by register.
+ * @param stats     Receives the counters, sorted by decreasing count.
+ * @param max       Maximum number of entries written to \p stats.
+ * @return the number of entries written to \p stats.
+ */
+size_t ir_mips_get_fallback_stats(ir_mips_fallback_stats_t *stats,
+                                  size_t max);
+
 #ifdef __cplusplus
 }; /* extern "C" */
 #endif /* __cplusplus */
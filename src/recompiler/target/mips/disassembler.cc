@@ -1,4 +1,7 @@
 
+#include <cstring>
+
+#include <core.h>
 #include <interpreter.h>
 #include <assembly/registers.h>
 #include <r4300/state.h>
@@ -135,6 +138,11 @@ _define_virt_store_uN(16);
 _define_virt_store_uN(32);
 _define_virt_store_uN(64);
 
+/* Invalidate the recompiled code after a store on the memory fast path. */
+extern "C" void invalidate_phys_mem(uint64_t phys_addr, uint32_t bytes) {
+    core::invalidate_recompiler_cache(phys_addr, phys_addr + bytes);
+}
+
 static inline uint32_t mips_get_rs(uint32_t instr) {
     return (instr >> 21) & 0x1flu;
 }
@@ -169,13 +177,134 @@ static inline uint32_t mips_get_target(uint32_t instr) {
     return instr & 0x3fffffflu;
 }
 
+/** Offset of the KSEG0 segment, added to the virtual address to get the
+ * offset from the start of the segment. */
+#define FAST_PATH_OFFSET        UINT64_C(0x80000000)
+/** Mask for the bit differentiating KSEG0 and KSEG1. */
+#define FAST_PATH_KSEG1         UINT64_C(0x20000000)
+
+/** Host address of the physical memory accessed from the inline
+ * fast path, NULL if the fast path is disabled. */
+static void *ir_fast_path_base;
+/** Size of the physical memory range accessed from the inline fast path. */
+static uint64_t ir_fast_path_size;
+/** Set when writes to pages holding code are caught by write protection. */
+static bool ir_fast_path_write_protect;
+
+/** Whether the inline fast path can be generated for the
+ * disassembled region. */
+static thread_local bool ir_disas_fast_path;
+
+void ir_mips_set_fast_path(void *base, uint64_t size) {
+    ir_fast_path_base = base;
+    ir_fast_path_size = size;
+}
+
+void ir_mips_set_write_protect(bool enable) {
+    ir_fast_path_write_protect = enable;
+}
+
+/**
+ * Check whether the memory fast path can be generated at this point.
+ * The block and instruction budgets must allow for the additional
+ * control flow required by the fast path, with some margin left
+ * for the remaining code.
+ */
+static inline bool ir_mips_check_fast_path(ir_instr_cont_t *c) {
+    recompiler_backend_t *backend = c->backend;
+    return ir_disas_fast_path &&
+        backend->cur_block + 8 <= backend->nr_blocks &&
+        backend->cur_instr + 64 <= backend->nr_instrs;
+}
+
+/**
+ * Generate the test for the memory fast path: the access must be aligned,
+ * and the virtual address must map to the fast path memory range through
+ * either the KSEG0 or KSEG1 segment.
+ * @param addr          Virtual memory address.
+ * @param width         Memory access width.
+ * @param phys_addr     Receives the physical address, valid only for
+ *                      the fast path.
+ * @return              Value of the slow path condition, false if the
+ *                      fast path can be taken.
+ */
+static inline ir_value_t ir_mips_append_fast_path_check(ir_instr_cont_t *c,
+                                                        ir_value_t addr,
+                                                        unsigned width,
+                                                        ir_value_t *phys_addr) {
+    uint64_t mask = (~(ir_fast_path_size - 1) & ~FAST_PATH_KSEG1) |
+                    (width / 8 - 1);
+    ir_value_t offset = ir_append_binop(c, IR_ADD, addr,
+        ir_make_const_i64(FAST_PATH_OFFSET));
+    *phys_addr = ir_append_binop(c, IR_AND, offset,
+        ir_make_const_i64(ir_fast_path_size - 1));
+    return ir_append_icmp(c, IR_NE,
+        ir_append_binop(c, IR_AND, offset, ir_make_const_i64(mask)),
+        ir_make_const_i64(0));
+}
+
+/**
+ * Generate the host pointer for the fast path access at the
+ * physical address \p phys_addr.
+ */
+static inline ir_value_t ir_mips_append_fast_path_ptr(ir_instr_cont_t *c,
+                                                      ir_value_t phys_addr) {
+    return ir_append_binop(c, IR_ADD,
+        ir_make_const_ptr(ir_fast_path_base),
+        phys_addr);
+}
+
+/**
+ * Convert between the guest memory and host byte orders.
+ */
+static inline ir_value_t ir_mips_append_fast_path_swap(ir_instr_cont_t *c,
+                                                       ir_value_t value) {
+#ifdef TARGET_BIGENDIAN
+    if (value.type.width > 8) {
+        return ir_append_unop(c, IR_BSWAP, value);
+    }
+#endif
+    return value;
+}
+
+/**
+ * Generate a memory load. When enabled, the load is performed inline for
+ * aligned accesses through KSEG0 or KSEG1, and falls back to calling
+ * \p load_func otherwise. Both paths write the loaded value to the same
+ * stack allocated variable, read in the join block. The fast path is
+ * the false branch, assembled inline.
+ * The continuation \p c is updated to point to the join block.
+ */
 static inline
 ir_value_t ir_mips_append_load(ir_instr_cont_t *c, unsigned width,
                                ir_func_t load_func, ir_value_t addr) {
     ir_value_t value_ptr = ir_append_alloc(c, ir_make_iN(width));
-    ir_value_t exn = ir_append_call(c, ir_make_iN(1),
+
+    if (!ir_mips_check_fast_path(c)) {
+        ir_value_t exn = ir_append_call(c, ir_make_iN(1),
+            load_func, 2, addr, value_ptr);
+        ir_append_assert(c, exn);
+        return ir_append_load(c, ir_make_iN(width), value_ptr);
+    }
+
+    ir_instr_cont_t fast_path, slow_path;
+    ir_value_t phys_addr;
+    ir_value_t cond = ir_mips_append_fast_path_check(c, addr, width, &phys_addr);
+    ir_append_br(c, cond, &fast_path, &slow_path);
+    ir_block_t *join = ir_alloc_block(c->backend);
+
+    ir_value_t value = ir_append_load(&fast_path, ir_make_iN(width),
+        ir_mips_append_fast_path_ptr(&fast_path, phys_addr));
+    value = ir_mips_append_fast_path_swap(&fast_path, value);
+    ir_append_store(&fast_path, ir_make_iN(width), value_ptr, value);
+    ir_append_jmp(&fast_path, join);
+
+    ir_value_t exn = ir_append_call(&slow_path, ir_make_iN(1),
         load_func, 2, addr, value_ptr);
-    ir_append_assert(c, exn);
+    ir_append_assert(&slow_path, exn);
+    ir_append_jmp(&slow_path, join);
+
+    *c = (ir_instr_cont_t){ c->backend, join, &join->entry };
     return ir_append_load(c, ir_make_iN(width), value_ptr);
 }
 
@@ -199,13 +328,47 @@ ir_value_t ir_mips_append_load_i64(ir_instr_cont_t *c, ir_value_t addr) {
     return ir_mips_append_load(c, 64, (ir_func_t)virt_load_u64, addr);
 }
 
+/**
+ * Generate a memory store. When enabled, the store is performed inline for
+ * aligned accesses through KSEG0 or KSEG1, and falls back to calling
+ * \p store_func otherwise. The fast path still invalidates the
+ * recompiler cache for the written range, unless the pages holding
+ * code are write protected.
+ * The continuation \p c is updated to point to the join block.
+ */
 static inline
 void ir_mips_append_store(ir_instr_cont_t *c, unsigned width,
                           ir_func_t store_func, ir_value_t addr,
                           ir_value_t value) {
-    ir_value_t exn = ir_append_call(c, ir_make_iN(1),
+    if (!ir_mips_check_fast_path(c)) {
+        ir_value_t exn = ir_append_call(c, ir_make_iN(1),
+            store_func, 2, addr, value);
+        ir_append_assert(c, exn);
+        return;
+    }
+
+    ir_instr_cont_t fast_path, slow_path;
+    ir_value_t phys_addr;
+    ir_value_t cond = ir_mips_append_fast_path_check(c, addr, width, &phys_addr);
+    ir_append_br(c, cond, &fast_path, &slow_path);
+    ir_block_t *join = ir_alloc_block(c->backend);
+
+    ir_append_store(&fast_path, ir_make_iN(width),
+        ir_mips_append_fast_path_ptr(&fast_path, phys_addr),
+        ir_mips_append_fast_path_swap(&fast_path, value));
+    if (!ir_fast_path_write_protect) {
+        ir_append_call(&fast_path, ir_make_iN(0),
+            (ir_func_t)invalidate_phys_mem, 2, phys_addr,
+            ir_make_const_i32(width / 8));
+    }
+    ir_append_jmp(&fast_path, join);
+
+    ir_value_t exn = ir_append_call(&slow_path, ir_make_iN(1),
         store_func, 2, addr, value);
-    ir_append_assert(c, exn);
+    ir_append_assert(&slow_path, exn);
+    ir_append_jmp(&slow_path, join);
+
+    *c = (ir_instr_cont_t){ c->backend, join, &join->entry };
 }
 
 static inline
@@ -249,14 +412,23 @@ static inline void ir_mips_append_write(ir_instr_cont_t *c,
 }
 
 /** Number of cycle increments applied so far. */
-static unsigned ir_disas_cycles;
+static thread_local unsigned ir_disas_cycles;
 /** Whether the current instruction is in a delay slot. */
-static bool ir_disas_delay_slot;
+static thread_local bool ir_disas_delay_slot;
 /** Program address of last branch target. The valid
  * is valid uniquely when ir_disas_delay_slot is set. */
-static ir_value_t ir_disas_branch_target;
+static thread_local ir_value_t ir_disas_branch_target;
 /** Whether the COP1 coprocessor guard was generated or not. */
-static bool ir_cop1_guard_generated;
+static thread_local bool ir_cop1_guard_generated;
+/** Whether the delay slot state was committed by the delay
+ * instruction of the current branch. */
+static thread_local bool ir_disas_delay_state;
+
+/** Host address of the cycle limit checked on the back edges of
+ * recompiled loops, NULL if backward branches are not followed. */
+static uint64_t const *ir_cycles_limit;
+/** Set when the disassembled block starts with an idle loop candidate. */
+static thread_local bool ir_disas_idle_loop;
 
 static inline void ir_mips_incr_cycles(void) {
     ir_disas_cycles++;
@@ -273,21 +445,102 @@ static inline void ir_mips_commit_cycles(ir_instr_cont_t *c) {
 
 static inline void ir_mips_commit_state(ir_instr_cont_t *c, uint64_t address) {
     if (ir_disas_delay_slot) {
-        // The value of the elay slot always defaults to 0.
-        // The recompiled code execution stops after any branching
-        // instruction so the value never needs to be rewritten to 0.
+        // The value of the delay slot always defaults to 0.
+        // It is rewritten to 0 only when the recompiled code follows
+        // the branch, see \ref disas_branch_edge.
         ir_append_write_i8(c, REG_DELAY_SLOT, ir_make_const_i8(1));
         ir_append_write_i64(c, REG_PC_NEXT, ir_disas_branch_target);
+        ir_disas_delay_state = true;
     }
     ir_append_write_i64(c, REG_PC, ir_make_const_i64(address));
     ir_mips_commit_cycles(c);
 }
 
+/** Instruction classes of the interpreter fallback counters, with the
+ * valid bit 32 set; zero for unused slots. */
+static uint64_t ir_fallback_keys[IR_MIPS_FALLBACK_MAX];
+/** Interpreter fallback counters, incremented by the recompiled code. */
+static uint64_t ir_fallback_counts[IR_MIPS_FALLBACK_MAX];
+
+/** Return the mask of the instruction fields used to classify
+ * the instruction \p instr for the fallback counters. */
+static uint32_t ir_mips_fallback_mask(uint32_t instr) {
+    switch (instr >> 26) {
+    case 0x00: return UINT32_C(0xfc00003f);     // SPECIAL: funct
+    case 0x01: return UINT32_C(0xfc1f0000);     // REGIMM: rt
+    case 0x10:                                  // COP0: rs, rd or funct
+        return (instr & (UINT32_C(1) << 25)) ?
+            UINT32_C(0xfe00003f) : UINT32_C(0xffe0f800);
+    case 0x11:                                  // COP1: fmt, funct
+        return (instr & (UINT32_C(1) << 25)) ?
+            UINT32_C(0xffe0003f) : UINT32_C(0xffe00000);
+    default:   return UINT32_C(0xfc000000);
+    }
+}
+
+/**
+ * Return the fallback counter for the class of the instruction \p instr,
+ * allocating a new slot on first use. Slots are never released, as the
+ * recompiled code holds the address of the counter.
+ * @return the counter address, or NULL if the table is full.
+ */
+static uint64_t *ir_mips_fallback_counter(uint32_t instr) {
+    uint64_t key = (UINT64_C(1) << 32) | (instr & ir_mips_fallback_mask(instr));
+    unsigned slot = (unsigned)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 56);
+
+    for (unsigned nr = 0; nr < IR_MIPS_FALLBACK_MAX; nr++) {
+        uint64_t *entry = &ir_fallback_keys[(slot + nr) % IR_MIPS_FALLBACK_MAX];
+        uint64_t cur = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+        // Claim the free slot; on failure cur is updated with the key
+        // of the concurrent claim.
+        if (cur == 0 && __atomic_compare_exchange_n(entry, &cur, key, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            cur = key;
+        }
+        if (cur == key) {
+            return &ir_fallback_counts[entry - ir_fallback_keys];
+        }
+    }
+    return NULL;
+}
+
+size_t ir_mips_get_fallback_stats(ir_mips_fallback_stats_t *stats,
+                                  size_t max) {
+    size_t len = 0;
+    for (unsigned nr = 0; nr < IR_MIPS_FALLBACK_MAX; nr++) {
+        uint64_t key = __atomic_load_n(&ir_fallback_keys[nr], __ATOMIC_ACQUIRE);
+        uint64_t count = __atomic_load_n(&ir_fallback_counts[nr],
+                                         __ATOMIC_RELAXED);
+        if (key == 0 || count == 0) {
+            continue;
+        }
+        // Insertion sort by decreasing count, dropping the smallest
+        // counters once the output is full.
+        size_t pos = len < max ? len++ : max;
+        for (; pos > 0 && stats[pos - 1].count < count; pos--) {
+            if (pos < max) {
+                stats[pos] = stats[pos - 1];
+            }
+        }
+        if (pos < max) {
+            stats[pos] = (ir_mips_fallback_stats_t){ (uint32_t)key, count };
+        }
+    }
+    return len;
+}
+
 static inline void ir_mips_append_interpreter(ir_instr_cont_t *c,
                                               uint64_t address,
                                               uint32_t instr,
                                               bool raise) {
     ir_mips_commit_state(c, address);
+    uint64_t *counter = ir_mips_fallback_counter(instr);
+    if (counter != NULL) {
+        ir_value_t ptr = ir_make_const_ptr(counter);
+        ir_value_t count = ir_append_load(c, ir_make_i64(), ptr);
+        ir_append_store(c, ir_make_i64(), ptr,
+            ir_append_binop(c, IR_ADD, count, ir_make_const_i64(1)));
+    }
     if (raise) {
         ir_value_t exn = ir_append_call(c, ir_make_iN(1),
             (ir_func_t)interpret_exception,
@@ -299,28 +552,32 @@ static inline void ir_mips_append_interpreter(ir_instr_cont_t *c,
     }
 }
 
+/** Disassembly entry point. The cycle count and COP1 guard state are
+ * restored when the entry point is popped from the queue. */
 typedef struct ir_disas_entrypoint {
     uint64_t address;
     ir_instr_cont_t cont;
+    unsigned cycles;
+    bool cop1_guard_generated;
 } ir_disas_entrypoint_t;
 
 /** Store the information relevant to the current disassembly task. */
-static struct {
+static thread_local struct {
     uint64_t start;
     uint64_t end;
     unsigned char *ptr;
+    uint64_t read_end;  /**< End address of the instructions read. */
 } ir_disas_region;
 
 /** Queue containing current disassembly entry points. */
-static struct {
+static thread_local struct {
     ir_disas_entrypoint_t queue[RECOMPILER_BLOCK_MAX];
     unsigned length;
 } ir_disas_queue;
 
-/** Map address offsets to disassembled instructions. */
-static struct {
-    ir_instr_t     *map[RECOMPILER_INSTR_MAX];
-    unsigned        base;
+/** Map address offsets to the blocks disassembled from branch targets. */
+static thread_local struct {
+    ir_block_t     *map[RECOMPILER_INSTR_MAX];
 } ir_disas_map;
 
 static ir_instr_t *disas_instr(ir_instr_cont_t *c, uint64_t address,
@@ -330,31 +587,37 @@ static void append_delay_instr(ir_instr_cont_t *c, uint64_t address,
 
 static void disas_push (uint64_t address, ir_instr_cont_t c) {
     ir_disas_queue.queue[ir_disas_queue.length++] =
-        (ir_disas_entrypoint_t){ .address = address, .cont = c };
+        (ir_disas_entrypoint_t){ .address = address, .cont = c,
+            .cycles = ir_disas_cycles,
+            .cop1_guard_generated = ir_cop1_guard_generated };
 }
 
 static void disas_pop  (uint64_t *address, ir_instr_cont_t *c) {
     ir_disas_queue.length--;
     *address = ir_disas_queue.queue[ir_disas_queue.length].address;
     *c = ir_disas_queue.queue[ir_disas_queue.length].cont;
+    ir_disas_cycles = ir_disas_queue.queue[ir_disas_queue.length].cycles;
+    ir_cop1_guard_generated =
+        ir_disas_queue.queue[ir_disas_queue.length].cop1_guard_generated;
 }
 
-static void disas_map  (uint64_t address, ir_instr_t *instr) {
+static void disas_map  (uint64_t address, ir_block_t *block) {
     unsigned offset = (address - ir_disas_region.start) / 4;
-    ir_disas_map.map[offset] = instr;
+    ir_disas_map.map[offset] = block;
 }
 
+/** Join the block disassembled from \p address, if any, unless \p cont
+ * is the start of this block. The pending cycles are committed
+ * before jumping to the block. */
 static bool disas_fetch(uint64_t address, ir_instr_cont_t cont) {
-#if 0
     unsigned offset = (address - ir_disas_region.start) / 4;
-    if (ir_disas_map.map[offset]) {
-        *cont = ir_disas_map.map[offset];
-        return true;
-    } else {
+    ir_block_t *block = ir_disas_map.map[offset];
+    if (block == NULL || cont.next == &block->entry) {
         return false;
     }
-#endif
-    return false;
+    ir_mips_commit_cycles(&cont);
+    ir_append_jmp(&cont, block);
+    return true;
 }
 
 static bool disas_check_address(uint64_t address) {
@@ -362,6 +625,109 @@ static bool disas_check_address(uint64_t address) {
            (address + 4) <= ir_disas_region.end;
 }
 
+/**
+ * Check the resources left to disassemble one more instruction.
+ * The margins cover the largest instruction expansion: a branch and two
+ * copies of its delay instruction with the memory fast path, followed
+ * by the transitions to the branch targets.
+ */
+static bool disas_check_budget(recompiler_backend_t const *backend) {
+    return backend->cur_block + 16 <= backend->nr_blocks &&
+           backend->cur_instr + 160 <= backend->nr_instrs &&
+           backend->cur_param + 16 <= backend->nr_params;
+}
+
+/**
+ * Return the block disassembled from the branch target \p target,
+ * allocating and queuing a new block if the target was not yet reached.
+ * @return the target block, or NULL if the target cannot be followed:
+ *  branch following is disabled, the target is outside the disassembly
+ *  region, or the resources are exhausted.
+ */
+static ir_block_t *disas_target_block(recompiler_backend_t *backend,
+                                      uint64_t target) {
+#if RECOMPILER_DISAS_BRANCH_ENABLE
+    if (!disas_check_address(target) || (target & 3) != 0) {
+        return NULL;
+    }
+
+    unsigned offset = (target - ir_disas_region.start) / 4;
+    if (ir_disas_map.map[offset] != NULL) {
+        return ir_disas_map.map[offset];
+    }
+    if (!disas_check_budget(backend) ||
+        ir_disas_queue.length + 2 > RECOMPILER_BLOCK_MAX) {
+        return NULL;
+    }
+
+    ir_block_t *block = ir_alloc_block(backend);
+    disas_map(target, block);
+    ir_disas_queue.queue[ir_disas_queue.length++] =
+        (ir_disas_entrypoint_t){ .address = target,
+            .cont = { backend, block, &block->entry },
+            .cycles = 0, .cop1_guard_generated = false };
+    return block;
+#else
+    (void)backend;
+    (void)target;
+    return NULL;
+#endif /* RECOMPILER_DISAS_BRANCH_ENABLE */
+}
+
+/**
+ * Generate the transition to the target of a branch instruction,
+ * after the delay instruction, if any, was disassembled.
+ * Targets inside the disassembly region are followed: the continuation
+ * jumps to the block disassembled from the target address. Backward
+ * branches check the cycle budget before jumping, and exit the recompiled
+ * code when it is exhausted. Other targets generate a side exit
+ * to the interpreter, as well as the back edge of an idle loop, which
+ * is fast-forwarded by the interpreter.
+ * @param address       Address of the branch instruction.
+ * @param target        Address of the branch target.
+ */
+static void disas_branch_edge(ir_instr_cont_t *c, uint64_t address,
+                              uint64_t target) {
+    bool backward = target <= address;
+    bool delay_state = ir_disas_delay_state;
+    ir_block_t *block = NULL;
+
+    ir_disas_delay_state = false;
+    if ((!backward || ir_cycles_limit != NULL) &&
+        !(ir_disas_idle_loop && target == ir_disas_region.start)) {
+        block = disas_target_block(c->backend, target);
+    }
+    if (block == NULL) {
+        ir_append_write_i64(c, REG_PC, ir_make_const_i64(target));
+        ir_mips_commit_cycles(c);
+        ir_append_exit(c);
+        return;
+    }
+
+    // The delay instruction exited the delay slot,
+    // restore the default state.
+    ir_mips_commit_cycles(c);
+    if (delay_state) {
+        ir_append_write_i8(c, REG_DELAY_SLOT, ir_make_const_i8(0));
+        ir_append_store_i32(c,
+            ir_make_const_ptr(&R4300::state.cpu.nextAction),
+            ir_make_const_i32(R4300::State::Continue));
+    }
+
+    if (backward) {
+        ir_instr_cont_t loop, exit;
+        ir_value_t cycles = ir_append_read_i64(c, REG_CYCLES);
+        ir_value_t limit = ir_append_load_i64(c,
+            ir_make_const_ptr(ir_cycles_limit));
+        ir_append_br(c, ir_append_icmp(c, IR_UGE, cycles, limit),
+            &loop, &exit);
+        ir_append_write_i64(&exit, REG_PC, ir_make_const_i64(target));
+        ir_append_exit(&exit);
+        *c = loop;
+    }
+    ir_append_jmp(c, block);
+}
+
 /** Check whether the delay instruction address is inside the
  * disassembly region. Generates IR bytecode to exit the recompiled code
  * before the branch instruction if the address is invalid. */
@@ -424,45 +790,15 @@ static void generate_cop1_guard(ir_instr_cont_t *c, uint64_t address) {
 
 static uint32_t disas_read_instr(uint64_t address) {
     unsigned char *ptr = ir_disas_region.ptr + (address - ir_disas_region.start);
+    if (address + 4 > ir_disas_region.read_end) {
+        ir_disas_region.read_end = address + 4;
+    }
     return ((uint32_t)ptr[0] << 24) |
            ((uint32_t)ptr[1] << 16) |
            ((uint32_t)ptr[2] << 8)  |
            ((uint32_t)ptr[3] << 0);
 }
 
-#if 0
-/** Generates the IR bytecode for a branch instruction.
- * The generated graph has the following shape :
- *
- *  cond = .. --> [delay] --> br cond --{true}--> target
- *                              |
- *                              `-----{false}--> next
- */
-static void disas_branch(ir_instr_cont_t *c, ir_value_t cond, uint64_t address,
-                         uint32_t instr) {
-
-    ir_instr_cont_t br_false, br_true;
-    uint64_t imm = mips_get_imm_u64(instr);
-    uint64_t target = address + 4 + (imm << 2);
-
-    ir_disas_branch_target = ir_make_const_i64(target);
-
-    append_delay_instr(c, address + 4, disas_read_instr(address + 4));
-    ir_mips_commit_cycles(c);
-    ir_append_br(c, cond, &br_false, &br_true);
-
-#if RECOMPILER_DISAS_BRANCH_ENABLE
-    disas_push(target, br_true);
-    disas_push(address + 8, br_false);
-#else
-    ir_append_write_i64(&br_false, REG_PC, ir_make_const_i64(address + 8));
-    ir_append_exit(&br_false);
-
-    ir_append_write_i64(&br_true, REG_PC, ir_make_const_i64(target));
-    ir_append_exit(&br_true);
-#endif /* DISAS_BRANCH_ENABLE */
-}
-#else
 /** Generates the IR bytecode for a branch instruction.
  * The generated graph has the following shape :
  *
@@ -486,19 +822,14 @@ static void disas_branch(ir_instr_cont_t *c, ir_value_t cond, uint64_t address,
     ir_cop1_guard_generated = cop1_guard_generated;
     ir_disas_branch_target = ir_make_const_i64(address + 8);
     append_delay_instr(&br_false, address + 4, delay_instr);
-    ir_append_write_i64(&br_false, REG_PC, ir_make_const_i64(address + 8));
-    ir_mips_commit_cycles(&br_false);
-    ir_append_exit(&br_false);
+    disas_branch_edge(&br_false, address, address + 8);
 
     ir_disas_cycles = cycles;
     ir_cop1_guard_generated = cop1_guard_generated;
     ir_disas_branch_target = ir_make_const_i64(target);
     append_delay_instr(&br_true, address + 4, delay_instr);
-    ir_append_write_i64(&br_true, REG_PC, ir_make_const_i64(target));
-    ir_mips_commit_cycles(&br_true);
-    ir_append_exit(&br_true);
+    disas_branch_edge(&br_true, address, target);
 }
-#endif
 
 /** Generates the IR bytecode for a branch _likely_ instruction.
  * The generated graph has the following shape :
@@ -517,19 +848,10 @@ static void disas_branch_likely(ir_instr_cont_t *c, ir_value_t cond,
 
     ir_mips_commit_cycles(c);
     ir_append_br(c, cond, &br_false, &br_true);
-    append_delay_instr(&br_true, address + 4, disas_read_instr(address + 4));
-
-#if RECOMPILER_DISAS_BRANCH_ENABLE
-    disas_push(target, br_true);
-    disas_push(address + 8, br_false);
-#else
-    ir_append_write_i64(&br_false, REG_PC, ir_make_const_i64(address + 8));
-    ir_append_exit(&br_false);
+    disas_branch_edge(&br_false, address, address + 8);
 
-    ir_append_write_i64(&br_true, REG_PC, ir_make_const_i64(target));
-    ir_mips_commit_cycles(&br_true);
-    ir_append_exit(&br_true);
-#endif /* DISAS_BRANCH_ENABLE */
+    append_delay_instr(&br_true, address + 4, disas_read_instr(address + 4));
+    disas_branch_edge(&br_true, address, target);
 }
 
 /* Reserved opcodes */
@@ -1262,10 +1584,21 @@ static void disas_CACHE(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     disas_push(address + 4, *c);
 }
 
-/** Specific helper to read the current count value. */
-extern "C" uint32_t eval_MFC0_Count(void) {
-    return R4300::state.cp0reg.count +
-        (R4300::state.cycles - R4300::state.cp0reg.lastCounterUpdate) / 2;
+/**
+ * Generate the read of the current count value: the count register is only
+ * updated on writes and counter events, and increments every other cycle.
+ */
+static ir_value_t ir_mips_append_read_count(ir_instr_cont_t *c) {
+    static_assert(sizeof(R4300::state.cp0reg.lastCounterUpdate) == 8,
+                  "unexpected size for lastCounterUpdate");
+    ir_mips_commit_cycles(c);
+    ir_value_t last_update = ir_append_load(c, ir_make_i64(),
+        ir_make_const_ptr(&R4300::state.cp0reg.lastCounterUpdate));
+    ir_value_t diff = ir_append_binop(c, IR_SUB,
+        ir_append_read_i64(c, REG_CYCLES), last_update);
+    diff = ir_append_binop(c, IR_SRL, diff, ir_make_const_i8(1));
+    return ir_append_binop(c, IR_ADD,
+        ir_append_read_i32(c, REG_COUNT), ir_append_trunc_i32(c, diff));
 }
 
 static void disas_MFC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -1292,11 +1625,7 @@ static void disas_MFC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
         vd = ir_append_trunc_i32(c,
              ir_append_read_i64(c, REG_BADVADDR));
         break;
-    case Count:
-        ir_mips_commit_cycles(c);
-        vd = ir_append_call(c, ir_make_iN(32),
-            (ir_func_t)eval_MFC0_Count, 0);
-        break;
+    case Count:     vd = ir_mips_append_read_count(c); break;
     case EntryHi:
         vd = ir_append_trunc_i32(c,
              ir_append_read_i64(c, REG_ENTRYHI));
@@ -1349,10 +1678,7 @@ static void disas_DMFC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     case ErrorEPC:  vd = ir_append_read_i64(c, REG_ERROREPC); break;
     /* 32-bit registers */
     case Count:
-        ir_mips_commit_cycles(c);
-        vd = ir_append_zext_i64(c,
-             ir_append_call(c, ir_make_iN(32),
-                (ir_func_t)eval_MFC0_Count, 0));
+        vd = ir_append_zext_i64(c, ir_mips_append_read_count(c));
         break;
     default:
         vd = ir_make_const_i64(0);
@@ -1363,138 +1689,114 @@ static void disas_DMFC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     disas_push(address + 4, *c);
 }
 
-#if 0
-static void disas_MTC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
-    u32 rt = Mips::getRt(instr);
-    u32 rd = Mips::getRd(instr);
-    u32 val = state.reg.gpr[rt];
+/** Specific helper to write the count register. */
+extern "C" void eval_MTC0_Count(uint32_t val) {
+    R4300::state.cp0reg.count = val;
+    R4300::state.cp0reg.lastCounterUpdate = R4300::state.cycles;
+    R4300::scheduleCounterEvent();
+}
 
-    debugger::info(Debugger::COP0, "{} <- {:08x}", Cop0RegisterNames[rd], val);
+/** Specific helper to write the compare register. */
+extern "C" void eval_MTC0_Compare(uint32_t val) {
+    R4300::state.cp0reg.compare = val;
+    R4300::state.cp0reg.cause &= ~CAUSE_IP7;
+    R4300::scheduleCounterEvent();
+}
 
-    switch (rd) {
-        case Index:     state.cp0reg.index = val & UINT32_C(0x3f); break;
-        case Random:
-            state.cp0reg.random = val;
-            core::halt("MTC0 random");
-            break;
-        case EntryLo0:  state.cp0reg.entrylo0 = sign_extend<u64, u32>(val); break;
-        case EntryLo1:  state.cp0reg.entrylo1 = sign_extend<u64, u32>(val); break;
-        case Context:
-            state.cp0reg.context = sign_extend<u64, u32>(val);
-            break;
-        case PageMask:  state.cp0reg.pagemask = val & UINT32_C(0x01ffe000); break;
-        case Wired:
-            state.cp0reg.wired = val & UINT32_C(0x3f);
-            if (state.cp0reg.wired >= tlbEntryCount)
-                core::halt("COP0::wired invalid value");
-            state.cp0reg.random = tlbEntryCount - 1;
-            break;
-        case BadVAddr:  state.cp0reg.badvaddr = sign_extend<u64, u32>(val); break;
-        case Count:
-            state.cp0reg.count = val;
-            state.cp0reg.lastCounterUpdate = state.cycles;
-            scheduleCounterEvent();
-            break;
-        case EntryHi:   state.cp0reg.entryhi = sign_extend<u64, u32>(val); break;
-        case Compare:
-            state.cp0reg.compare = val;
-            state.cp0reg.cause &= ~CAUSE_IP7;
-            scheduleCounterEvent();
-            break;
-        case SR:
-            if ((val & STATUS_FR) != (state.cp0reg.sr & STATUS_FR)) {
-                state.cp1reg.setFprAliases((val & STATUS_FR) != 0);
-            }
-            if (val & STATUS_RE) {
-                core::halt("COP0::sr RE bit set");
-            }
-            // TODO check all config bits
-            state.cp0reg.sr = val;
-            checkInterrupt();
-            break;
-        case Cause:
-            state.cp0reg.cause =
-                (state.cp0reg.cause & ~CAUSE_IP_MASK) |
-                (val                &  CAUSE_IP_MASK);
-            // Interrupts bit 0 and 1 can be used to raise
-            // software interrupts.
-            // TODO mask unimplemented bits (only NMI, IRQ, SWI0, SWI1
-            // are actually writable).
-            checkInterrupt();
-            break;
-        case EPC:       state.cp0reg.epc = sign_extend<u64, u32>(val); break;
-        case PrId:
-            state.cp0reg.prid = val;
-            core::halt("MTC0 prid");
-            break;
-        case Config:
-            state.cp0reg.config = val;
-            core::halt("MTC0 config");
-            break;
-        case LLAddr:
-            state.cp0reg.lladdr = val;
-            core::halt("MTC0 lladdr");
-            break;
-        case WatchLo:
-            state.cp0reg.watchlo = val;
-            core::halt("MTC0 watchlo");
-            break;
-        case WatchHi:
-            state.cp0reg.watchhi = val;
-            core::halt("MTC0 watchhi");
-            break;
-        case XContext:
-            state.cp0reg.xcontext = sign_extend<u64, u32>(val);
-            core::halt("MTC0 xcontext");
-            break;
-        case PErr:
-            state.cp0reg.perr = val;
-            core::halt("MTC0 perr");
-            break;
-        case CacheErr:
-            state.cp0reg.cacheerr = val;
-            core::halt("MTC0 cacheerr");
-            break;
-        case TagLo:     state.cp0reg.taglo = val; break;
-        case TagHi:     state.cp0reg.taghi = val; break;
-        case ErrorEPC:  state.cp0reg.errorepc = sign_extend<u64, u32>(val); break;
-        default:
-            std::string reason = "MTC0 ";
-            core::halt(reason + Cop0RegisterNames[rd]);
-            break;
+/** Specific helper to write the status register. Has the same exception
+ * return as \ref interpret_exception, as the write can unmask
+ * a pending interrupt. */
+extern "C" bool eval_MTC0_SR(uint32_t val) {
+    R4300::state.cpu.nextAction = R4300::state.cpu.delaySlot ?
+        R4300::State::Jump : R4300::State::Continue;
+    uint64_t next_pc = R4300::state.cpu.nextPc;
+    if ((val & STATUS_FR) != (R4300::state.cp0reg.sr & STATUS_FR)) {
+        R4300::state.cp1reg.setFprAliases((val & STATUS_FR) != 0);
+    }
+    if (val & STATUS_RE) {
+        core::halt("COP0::sr RE bit set");
     }
+    R4300::state.cp0reg.sr = val;
+    R4300::checkInterrupt();
+    return R4300::state.cpu.nextAction != R4300::State::Jump ||
+           R4300::state.cpu.nextPc == next_pc;
 }
 
-static void disas_DMTC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
-    u32 rt = Mips::getRt(instr);
-    u32 rd = Mips::getRd(instr);
-    u64 val = state.reg.gpr[rt];
-
-    debugger::info(Debugger::COP0, "{} <- {:08x}", Cop0RegisterNames[rd], val);
-
-    switch (rd) {
-        case EntryLo0:  state.cp0reg.entrylo0 = val; break;
-        case EntryLo1:  state.cp0reg.entrylo1 = val; break;
-        case Context:
-            state.cp0reg.context = val;
-            core::halt("DMTC0 context");
-            break;
-        case BadVAddr:  state.cp0reg.badvaddr = val; break;
-        case EntryHi:   state.cp0reg.entryhi = val; break;
-        case EPC:       state.cp0reg.epc = val; break;
-        case XContext:
-            state.cp0reg.xcontext = val;
-            core::halt("DMTC0 xcontext");
-            break;
-        case ErrorEPC:  state.cp0reg.errorepc = val; break;
-        default:
-            std::string reason = "DMTC0 ";
-            core::halt(reason + Cop0RegisterNames[rd] + " (undefined)");
-            break;
+static void disas_MTC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
+    using namespace n64::assembly::cpu;
+    ir_value_t vt, exn;
+    vt = ir_append_trunc_i32(c, ir_mips_append_read(c, mips_get_rt(instr)));
+
+    switch (mips_get_rd(instr)) {
+    case Index:
+        ir_append_write_i32(c, REG_INDEX,
+            ir_append_binop(c, IR_AND, vt, ir_make_const_i32(0x3f)));
+        break;
+    case EntryLo0:
+        ir_append_write_i64(c, REG_ENTRYLO0, ir_append_sext_i64(c, vt));
+        break;
+    case EntryLo1:
+        ir_append_write_i64(c, REG_ENTRYLO1, ir_append_sext_i64(c, vt));
+        break;
+    case Context:
+        ir_append_write_i64(c, REG_CONTEXT, ir_append_sext_i64(c, vt));
+        break;
+    case PageMask:
+        ir_append_write_i32(c, REG_PAGEMASK,
+            ir_append_binop(c, IR_AND, vt, ir_make_const_i32(0x01ffe000)));
+        break;
+    case BadVAddr:
+        ir_append_write_i64(c, REG_BADVADDR, ir_append_sext_i64(c, vt));
+        break;
+    case Count:
+        ir_mips_commit_cycles(c);
+        ir_append_call(c, ir_make_iN(0), (ir_func_t)eval_MTC0_Count, 1, vt);
+        break;
+    case EntryHi:
+        ir_append_write_i64(c, REG_ENTRYHI, ir_append_sext_i64(c, vt));
+        break;
+    case Compare:
+        ir_mips_commit_cycles(c);
+        ir_append_call(c, ir_make_iN(0), (ir_func_t)eval_MTC0_Compare, 1, vt);
+        break;
+    case SR:
+        ir_cop1_guard_generated = false;
+        ir_mips_commit_state(c, address);
+        exn = ir_append_call(c, ir_make_iN(1), (ir_func_t)eval_MTC0_SR, 1, vt);
+        ir_append_assert(c, exn);
+        break;
+    case EPC:
+        ir_append_write_i64(c, REG_EPC, ir_append_sext_i64(c, vt));
+        break;
+    case TagLo:     ir_append_write_i32(c, REG_TAGLO, vt); break;
+    case TagHi:     ir_append_write_i32(c, REG_TAGHI, vt); break;
+    case ErrorEPC:
+        ir_append_write_i64(c, REG_ERROREPC, ir_append_sext_i64(c, vt));
+        break;
+    default:
+        ir_mips_append_interpreter(c, address, instr, true);
+        break;
     }
+    disas_push(address + 4, *c);
 }
 
-#endif
+static void disas_DMTC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
+    using namespace n64::assembly::cpu;
+    ir_value_t vt = ir_mips_append_read(c, mips_get_rt(instr));
+
+    switch (mips_get_rd(instr)) {
+    case EntryLo0:  ir_append_write_i64(c, REG_ENTRYLO0, vt); break;
+    case EntryLo1:  ir_append_write_i64(c, REG_ENTRYLO1, vt); break;
+    case BadVAddr:  ir_append_write_i64(c, REG_BADVADDR, vt); break;
+    case EntryHi:   ir_append_write_i64(c, REG_ENTRYHI, vt); break;
+    case EPC:       ir_append_write_i64(c, REG_EPC, vt); break;
+    case ErrorEPC:  ir_append_write_i64(c, REG_ERROREPC, vt); break;
+    default:
+        ir_mips_append_interpreter(c, address, instr, true);
+        break;
+    }
+    disas_push(address + 4, *c);
+}
 
 static void disas_CFC0(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     (void)instr;
@@ -1589,8 +1891,8 @@ static void disas_COP0(ir_instr_cont_t *c, uint64_t address, uint32_t instr)
     case 0:  disas_MFC0(c, address, instr); break;
     case 1:  disas_DMFC0(c, address, instr); break;
     // case 2:    eval_CFC0(instr); break;
-    // case 4:    eval_MTC0(instr); break;
-    // case 5 :   eval_DMTC0(instr); break;
+    case 4:  disas_MTC0(c, address, instr); break;
+    case 5:  disas_DMTC0(c, address, instr); break;
     // case 6:    eval_CTC0(instr); break;
     case 0x10u:
         switch (instr & 0x3fu) {
@@ -1681,13 +1983,83 @@ static void disas_BC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     }
 }
 
+/**
+ * Generate the host address of the floating point register \p fpr,
+ * for word or double word access. The address is read from the register
+ * aliases, which depend on the FR bit of the status register,
+ * see \ref R4300::cp1reg::setFprAliases.
+ */
+static ir_value_t ir_mips_append_fpr_ptr(ir_instr_cont_t *c, unsigned fpr,
+                                         bool dword) {
+    void *alias = dword ? (void *)&R4300::state.cp1reg.fpr_d[fpr]
+                        : (void *)&R4300::state.cp1reg.fpr_s[fpr];
+    return ir_append_load(c, ir_make_iptr(),
+        ir_make_const_ptr(alias));
+}
+
+static void disas_MFC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
+    ir_value_t fs = ir_mips_append_fpr_ptr(c, mips_get_rd(instr), false);
+    ir_value_t vt = ir_append_load(c, ir_make_i32(), fs);
+    ir_mips_append_write(c, mips_get_rt(instr), ir_append_sext_i64(c, vt));
+    disas_push(address + 4, *c);
+}
+
+static void disas_DMFC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
+    ir_value_t fs = ir_mips_append_fpr_ptr(c, mips_get_rd(instr), true);
+    ir_value_t vt = ir_append_load(c, ir_make_i64(), fs);
+    ir_mips_append_write(c, mips_get_rt(instr), vt);
+    disas_push(address + 4, *c);
+}
+
+static void disas_MTC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
+    ir_value_t vt = ir_mips_append_read(c, mips_get_rt(instr));
+    ir_value_t fs = ir_mips_append_fpr_ptr(c, mips_get_rd(instr), false);
+    ir_append_store(c, ir_make_i32(), fs, ir_append_trunc_i32(c, vt));
+    disas_push(address + 4, *c);
+}
+
+static void disas_DMTC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
+    ir_value_t vt = ir_mips_append_read(c, mips_get_rt(instr));
+    ir_value_t fs = ir_mips_append_fpr_ptr(c, mips_get_rd(instr), true);
+    ir_append_store(c, ir_make_i64(), fs, vt);
+    disas_push(address + 4, *c);
+}
+
+/**
+ * Generate the arithmetic, conversion and comparison instructions of the
+ * S, D, W, L formats. The IR has no floating point operations: the
+ * instructions call the interpreter handler decoded at recompilation time.
+ * The handlers only access the floating point registers and the FCR31
+ * condition bit, and cannot raise exceptions: the state is not committed.
+ */
+static void disas_COP1_fmt(ir_instr_cont_t *c, uint64_t address,
+                           uint32_t instr) {
+    interpreter::cpu::eval_callback_t callback =
+        interpreter::cpu::decode_COP1(instr);
+    if (callback == interpreter::cpu::eval_Reserved) {
+        ir_mips_append_interpreter(c, address, instr, true);
+    } else {
+        ir_append_call(c, ir_make_iN(0), (ir_func_t)callback,
+            1, ir_make_const_i32(instr));
+    }
+    disas_push(address + 4, *c);
+}
+
 static void disas_COP1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     generate_cop1_guard(c, address);
     unsigned fmt = mips_get_rs(instr);
     switch (fmt) {
+    case 0: disas_MFC1(c, address, instr); break;
+    case 1: disas_DMFC1(c, address, instr); break;
     case 2: disas_CFC1(c, address, instr); break;
+    case 4: disas_MTC1(c, address, instr); break;
+    case 5: disas_DMTC1(c, address, instr); break;
     case 6: disas_CTC1(c, address, instr); break;
     case 8: disas_BC1(c, address, instr); break;
+    case 0x10:
+    case 0x11:
+    case 0x14:
+    case 0x15: disas_COP1_fmt(c, address, instr); break;
     default:
         ir_mips_append_interpreter(c, address, instr, true);
         disas_push(address + 4, *c);
@@ -1727,9 +2099,7 @@ static void disas_J(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     target = (address & 0xfffffffff0000000llu) | (target << 2);
     ir_disas_branch_target = ir_make_const_i64(target);
     append_delay_instr(c, address + 4, delay_instr);
-    ir_mips_append_write(c, REG_PC, ir_make_const_i64(target));
-    ir_mips_commit_cycles(c);
-    ir_append_exit(c);
+    disas_branch_edge(c, address, target);
 }
 
 static void disas_JAL(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -1739,9 +2109,7 @@ static void disas_JAL(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     ir_disas_branch_target = ir_make_const_i64(target);
     ir_mips_append_write(c, REG_RA, ir_make_const_i64(address + 8));
     append_delay_instr(c, address + 4, delay_instr);
-    ir_mips_append_write(c, REG_PC, ir_make_const_i64(target));
-    ir_mips_commit_cycles(c);
-    ir_append_exit(c);
+    disas_branch_edge(c, address, target);
 }
 
 static void disas_LB(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -1781,23 +2149,15 @@ static void disas_LD(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
 
 static void disas_LDC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     generate_cop1_guard(c, address);
-    ir_mips_append_interpreter(c, address, instr, true);
+    ir_value_t vs, imm, vt;
+    vs = ir_mips_append_read(c, mips_get_rs(instr));
+    imm = ir_make_const_i64(mips_get_imm_u64(instr));
+    vs = ir_append_binop(c, IR_ADD, vs, imm);
+    ir_mips_commit_state(c, address);
+    vt = ir_mips_append_load_i64(c, vs);
+    ir_append_store(c, ir_make_i64(),
+        ir_mips_append_fpr_ptr(c, mips_get_rt(instr), true), vt);
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr, val;
-
-    // checkCop1Usable();
-    // checkAddressAlignment(vAddr, 8, false, true);
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, false),
-    //     vAddr, false, true, 0);
-    // checkR4300::Exception(
-    //     state.bus->load(8, pAddr, &val) ? None : BusError,
-    //     vAddr, false, true, 0);
-
-    // state.cp1reg.fpr_d[rt]->l = val;
 }
 
 static void disas_LDC2(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -1933,24 +2293,15 @@ static void disas_LW(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
 
 static void disas_LWC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     generate_cop1_guard(c, address);
-    ir_mips_append_interpreter(c, address, instr, true);
+    ir_value_t vs, imm, vt;
+    vs = ir_mips_append_read(c, mips_get_rs(instr));
+    imm = ir_make_const_i64(mips_get_imm_u64(instr));
+    vs = ir_append_binop(c, IR_ADD, vs, imm);
+    ir_mips_commit_state(c, address);
+    vt = ir_mips_append_load_i32(c, vs);
+    ir_append_store(c, ir_make_i32(),
+        ir_mips_append_fpr_ptr(c, mips_get_rt(instr), false), vt);
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-    // uint32_t val;
-
-    // checkCop1Usable();
-    // checkAddressAlignment(vAddr, 4, false, true);
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, false),
-    //     vAddr, false, true, 0);
-    // checkR4300::Exception(
-    //     loadw(pAddr, &val),
-    //     vAddr, false, true, 0);
-
-    // state.cp1reg.fpr_s[rt]->w = val;
 }
 
 static void disas_LWC2(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -1967,71 +2318,62 @@ static void disas_LWC3(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     // core::halt("LWC3");
 }
 
+/**
+ * Generate the address computation of the unaligned word accesses
+ * LWL, LWR, SWL, SWR. The instructions are lowered to an access of the
+ * aligned word containing the effective address.
+ * @param aligned       Receives the aligned word address.
+ * @param shift         Receives the big endian bit offset of the
+ *                      effective address in the aligned word.
+ */
+static void ir_mips_append_unaligned_addr(ir_instr_cont_t *c, uint32_t instr,
+                                          ir_value_t *aligned,
+                                          ir_value_t *shift) {
+    ir_value_t vs, imm;
+    vs = ir_mips_append_read(c, mips_get_rs(instr));
+    imm = ir_make_const_i64(mips_get_imm_u64(instr));
+    vs = ir_append_binop(c, IR_ADD, vs, imm);
+    *aligned = ir_append_binop(c, IR_AND, vs, ir_make_const_i64(~UINT64_C(3)));
+    *shift = ir_append_binop(c, IR_SLL,
+        ir_append_trunc_i8(c,
+            ir_append_binop(c, IR_AND, vs, ir_make_const_i64(3))),
+        ir_make_const_i8(3));
+}
+
 static void disas_LWL(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
-    ir_mips_append_interpreter(c, address, instr, true);
+    // The bytes from the effective address to the end of the aligned word
+    // are merged into the most significant bytes of rt.
+    // Only BigEndianMem & !ReverseEndian are supported.
+    ir_value_t vs, shift, word, mask, vt;
+    ir_mips_append_unaligned_addr(c, instr, &vs, &shift);
+    ir_mips_commit_state(c, address);
+    word = ir_mips_append_load_i32(c, vs);
+    word = ir_append_binop(c, IR_SLL, word, shift);
+    mask = ir_append_binop(c, IR_SUB,
+        ir_append_binop(c, IR_SLL, ir_make_const_i32(1), shift),
+        ir_make_const_i32(1));
+    vt = ir_append_trunc_i32(c, ir_mips_append_read(c, mips_get_rt(instr)));
+    vt = ir_append_binop(c, IR_OR, word, ir_append_binop(c, IR_AND, vt, mask));
+    ir_mips_append_write(c, mips_get_rt(instr), ir_append_sext_i64(c, vt));
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-
-    // // @todo only BigEndianMem & !ReverseEndian for now
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-
-    // // Not calling checkAddressAlignment:
-    // // this instruction specifically ignores the alignment
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, true),
-    //     vAddr, false, false, 0);
-
-    // size_t count = 4 - (pAddr % 4);
-    // unsigned int shift = 24;
-    // uint64_t mask = (1llu << (32 - 8 * count)) - 1u;
-    // uint64_t val = 0;
-
-    // for (size_t nr = 0; nr < count; nr++, shift -= 8) {
-    //     uint64_t byte = 0;
-    //     if (!state.bus->load(1, pAddr + nr, &byte)) {
-    //         takeR4300::Exception(BusError, vAddr, false, false, 0);
-    //         return;
-    //     }
-    //     val |= (byte << shift);
-    // }
-
-    // val = val | (state.reg.gpr[rt] & mask);
-    // state.reg.gpr[rt] = sign_extend<uint64_t, uint32_t>(val);
 }
 
 static void disas_LWR(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
-    ir_mips_append_interpreter(c, address, instr, true);
+    // The bytes from the start of the aligned word to the effective address
+    // are merged into the least significant bytes of rt.
+    // Only BigEndianMem & !ReverseEndian are supported.
+    ir_value_t vs, shift, word, mask, vt;
+    ir_mips_append_unaligned_addr(c, instr, &vs, &shift);
+    shift = ir_append_binop(c, IR_SUB, ir_make_const_i8(24), shift);
+    ir_mips_commit_state(c, address);
+    word = ir_mips_append_load_i32(c, vs);
+    word = ir_append_binop(c, IR_SRL, word, shift);
+    mask = ir_append_unop(c, IR_NOT,
+        ir_append_binop(c, IR_SRL, ir_make_const_i32(UINT32_MAX), shift));
+    vt = ir_append_trunc_i32(c, ir_mips_append_read(c, mips_get_rt(instr)));
+    vt = ir_append_binop(c, IR_OR, word, ir_append_binop(c, IR_AND, vt, mask));
+    ir_mips_append_write(c, mips_get_rt(instr), ir_append_sext_i64(c, vt));
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-
-    // // @todo only BigEndianMem & !ReverseEndian for now
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-
-    // // Not calling checkAddressAlignment:
-    // // this instruction specifically ignores the alignment
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, true),
-    //     vAddr, false, false, 0);
-
-    // size_t count = 1 + (pAddr % 4);
-    // unsigned int shift = 0;
-    // uint64_t mask = (1llu << (32 - 8 * count)) - 1u;
-    // mask <<= 8 * count;
-    // uint64_t val = 0;
-
-    // for (size_t nr = 0; nr < count; nr++, shift += 8) {
-    //     uint64_t byte = 0;
-    //     if (!state.bus->load(1, pAddr - nr, &byte)) {
-    //         takeR4300::Exception(BusError, vAddr, false, false);
-    //         return;
-    //     }
-    //     val |= (byte << shift);
-    // }
-
-    // val = val | (state.reg.gpr[rt] & mask);
-    // state.reg.gpr[rt] = sign_extend<uint64_t, uint32_t>(val);
 }
 
 static void disas_LWU(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -2094,21 +2436,15 @@ static void disas_SD(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
 
 static void disas_SDC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     generate_cop1_guard(c, address);
-    ir_mips_append_interpreter(c, address, instr, true);
+    ir_value_t vs, imm, vt;
+    vs = ir_mips_append_read(c, mips_get_rs(instr));
+    imm = ir_make_const_i64(mips_get_imm_u64(instr));
+    vs = ir_append_binop(c, IR_ADD, vs, imm);
+    vt = ir_append_load(c, ir_make_i64(),
+        ir_mips_append_fpr_ptr(c, mips_get_rt(instr), true));
+    ir_mips_commit_state(c, address);
+    ir_mips_append_store_i64(c, vs, vt);
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-
-    // checkCop1Usable();
-    // checkAddressAlignment(vAddr, 8, false, false);
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, false),
-    //     vAddr, false, false, 0);
-    // checkR4300::Exception(
-    //     state.bus->store(8, pAddr, state.cp1reg.fpr_d[rt]->l) ? None : BusError,
-    //     vAddr, false, false, 0);
 }
 
 static void disas_SDC2(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -2218,21 +2554,15 @@ static void disas_SW(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
 
 static void disas_SWC1(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
     generate_cop1_guard(c, address);
-    ir_mips_append_interpreter(c, address, instr, true);
+    ir_value_t vs, imm, vt;
+    vs = ir_mips_append_read(c, mips_get_rs(instr));
+    imm = ir_make_const_i64(mips_get_imm_u64(instr));
+    vs = ir_append_binop(c, IR_ADD, vs, imm);
+    vt = ir_append_load(c, ir_make_i32(),
+        ir_mips_append_fpr_ptr(c, mips_get_rt(instr), false));
+    ir_mips_commit_state(c, address);
+    ir_mips_append_store_i32(c, vs, vt);
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-
-    // checkCop1Usable();
-    // checkAddressAlignment(vAddr, 4, false, false);
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, false),
-    //     vAddr, false, false, 0);
-    // checkR4300::Exception(
-    //     state.bus->store(4, pAddr, state.cp1reg.fpr_s[rt]->w) ? None : BusError,
-    //     vAddr, false, false, 0);
 }
 
 static void disas_SWC2(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -2250,57 +2580,40 @@ static void disas_SWC3(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
 }
 
 static void disas_SWL(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
-    ir_mips_append_interpreter(c, address, instr, true);
+    // The most significant bytes of rt are stored from the effective address
+    // to the end of the aligned word, which is read, merged and written back.
+    // Only BigEndianMem & !ReverseEndian are supported.
+    ir_value_t vs, shift, word, mask, vt;
+    ir_mips_append_unaligned_addr(c, instr, &vs, &shift);
+    vt = ir_append_trunc_i32(c, ir_mips_append_read(c, mips_get_rt(instr)));
+    vt = ir_append_binop(c, IR_SRL, vt, shift);
+    mask = ir_append_unop(c, IR_NOT,
+        ir_append_binop(c, IR_SRL, ir_make_const_i32(UINT32_MAX), shift));
+    ir_mips_commit_state(c, address);
+    word = ir_mips_append_load_i32(c, vs);
+    word = ir_append_binop(c, IR_OR, vt, ir_append_binop(c, IR_AND, word, mask));
+    ir_mips_append_store_i32(c, vs, word);
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-    // // core::halt("SWL instruction");
-    // // @todo only BigEndianMem & !ReverseEndian for now
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-
-    // // Not calling checkAddressAlignment:
-    // // this instruction specifically ignores the alignment
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, false),
-    //     vAddr, false, false, 0);
-
-    // size_t count = 4 - (pAddr % 4);
-    // uint32_t val = state.reg.gpr[rt];
-    // unsigned int shift = 24;
-    // for (size_t nr = 0; nr < count; nr++, shift -= 8) {
-    //     uint64_t byte = (val >> shift) & 0xfflu;
-    //     if (!state.bus->store(1, pAddr + nr, byte)) {
-    //         takeR4300::Exception(BusError, vAddr, false, false, 0);
-    //         return;
-    //     }
-    // }
 }
 
 static void disas_SWR(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
-    ir_mips_append_interpreter(c, address, instr, true);
+    // The least significant bytes of rt are stored from the start of the
+    // aligned word to the effective address, the aligned word is read,
+    // merged and written back.
+    // Only BigEndianMem & !ReverseEndian are supported.
+    ir_value_t vs, shift, word, mask, vt;
+    ir_mips_append_unaligned_addr(c, instr, &vs, &shift);
+    shift = ir_append_binop(c, IR_SUB, ir_make_const_i8(24), shift);
+    vt = ir_append_trunc_i32(c, ir_mips_append_read(c, mips_get_rt(instr)));
+    vt = ir_append_binop(c, IR_SLL, vt, shift);
+    mask = ir_append_binop(c, IR_SUB,
+        ir_append_binop(c, IR_SLL, ir_make_const_i32(1), shift),
+        ir_make_const_i32(1));
+    ir_mips_commit_state(c, address);
+    word = ir_mips_append_load_i32(c, vs);
+    word = ir_append_binop(c, IR_OR, vt, ir_append_binop(c, IR_AND, word, mask));
+    ir_mips_append_store_i32(c, vs, word);
     disas_push(address + 4, *c);
-    // IType(instr, sign_extend);
-    // // core::halt("SWR instruction");
-    // // @todo only BigEndianMem & !ReverseEndian for now
-    // uint64_t vAddr = state.reg.gpr[rs] + imm;
-    // uint64_t pAddr;
-
-    // // Not calling checkAddressAlignment:
-    // // this instruction specifically ignores the alignment
-    // checkR4300::Exception(
-    //     translate_address(vAddr, &pAddr, false),
-    //     vAddr, false, false, 0);
-
-    // size_t count = 1 + (pAddr % 4);
-    // uint32_t val = state.reg.gpr[rt];
-    // unsigned int shift = 0;
-    // for (size_t nr = 0; nr < count; nr++, shift += 8) {
-    //     uint64_t byte = (val >> shift) & 0xfflu;
-    //     if (!state.bus->store(1, pAddr - nr, byte)) {
-    //         takeR4300::Exception(BusError, vAddr, false, false);
-    //         return;
-    //     }
-    // }
 }
 
 static void disas_XORI(ir_instr_cont_t *c, uint64_t address, uint32_t instr) {
@@ -2375,6 +2688,9 @@ static ir_instr_t *disas_instr(ir_instr_cont_t *c, uint64_t address,
     ir_instr_t *entry = NULL;
     ir_instr_cont_t entryc = { c->backend, c->block, &entry };
     ir_disas_delay_slot = delay_slot;
+    if (!delay_slot) {
+        ir_disas_delay_state = false;
+    }
     CPU_callbacks[(instr >> 26) & 0x3fu](&entryc, address, instr);
     if (entry == NULL) {
         /* The instruction is void, edit the last queue entry
@@ -2383,6 +2699,7 @@ static ir_instr_t *disas_instr(ir_instr_cont_t *c, uint64_t address,
         ir_disas_queue.queue[ir_disas_queue.length - 1].cont = *c;
     } else {
         *c->next = entry;
+        c->block = entryc.block;
         c->next = entryc.next;
     }
     return entry;
@@ -2444,6 +2761,18 @@ recompiler_backend_t *ir_mips_recompiler_backend(void) {
                                     RECOMPILER_PARAM_MAX);
 }
 
+void ir_mips_set_cycles_limit(uint64_t const *cycles_limit) {
+    ir_cycles_limit = cycles_limit;
+}
+
+size_t ir_mips_disassembled_len(void) {
+    return ir_disas_region.read_end - ir_disas_region.start;
+}
+
+ir_global_t ir_mips_pc_global(void) {
+    return REG_PC;
+}
+
 ir_graph_t *ir_mips_disassemble(recompiler_backend_t *backend,
                                 uint64_t address, unsigned char *ptr, size_t len) {
     /* Catch recompiler allocation errors. */
@@ -2463,32 +2792,60 @@ ir_graph_t *ir_mips_disassemble(recompiler_backend_t *backend,
     ir_disas_region.start = address;
     ir_disas_region.end   = address + len;
     ir_disas_region.ptr   = ptr;
+    ir_disas_region.read_end = address;
+
+    /* The memory fast path bypasses the address translation, and is only
+     * valid in kernel mode. Code executing from KSEG0 or KSEG1 necessarily
+     * runs in kernel mode. */
+    ir_disas_fast_path = ir_fast_path_base != NULL &&
+        address >= UINT64_C(0xffffffff80000000) &&
+        address <  UINT64_C(0xffffffffc0000000);
 
     ir_block_t *block      = ir_alloc_block(backend);
     ir_instr_cont_t cont = { backend, block, &block->entry };
 
     ir_disas_cycles = 0;
     ir_cop1_guard_generated = false;
+    ir_disas_delay_state = false;
+    memset(ir_disas_map.map, 0, sizeof(ir_disas_map.map));
+
+    /* Check for an idle loop at the block start, whose back edge is not
+     * followed. The loop is disassembled as the first block, reading
+     * the instructions here does not extend the disassembled length. */
+    uint32_t instrs[IDLE_LOOP_INSTR_MAX];
+    unsigned nr_instrs = 0;
+    for (; nr_instrs < IDLE_LOOP_INSTR_MAX &&
+           4 * (nr_instrs + 1) <= len; nr_instrs++) {
+        unsigned char *instr_ptr = ptr + 4 * nr_instrs;
+        instrs[nr_instrs] = ((uint32_t)instr_ptr[0] << 24) |
+                            ((uint32_t)instr_ptr[1] << 16) |
+                            ((uint32_t)instr_ptr[2] << 8)  |
+                            ((uint32_t)instr_ptr[3] << 0);
+    }
+    ir_disas_idle_loop =
+        interpreter::cpu::idle_loop_length(address, instrs, nr_instrs) != 0;
+    disas_map(address, block);
 
     disas_push(address, cont);
     while (ir_disas_queue.length) {
         disas_pop(&address, &cont);
-        if (!disas_check_address(address)) {
-            /* The address is outside the specified region,
-             * emit a emulation exit to return to the interpreter. */
+        if (!disas_check_address(address) ||
+            !disas_check_budget(backend)) {
+            /* The address is outside the specified region, or the
+             * graph is full, emit a emulation exit to return
+             * to the interpreter. */
             ir_append_write_i64(&cont, REG_PC, ir_make_const_i64(address));
             ir_mips_commit_cycles(&cont);
             ir_append_exit(&cont);
         }
         else if (!disas_fetch(address, cont)) {
-            /* The continuation is automatically filled if the instruction
-             * was already disassembled. Otherwise read the instruction word
-             * and procude the IR. NB: delay instructions, which are
-             * disassembled directly in the branch handlers, are purposefully
-             * not added to the map as the control flow would be incorrect. */
+            /* The continuation jumps to the block disassembled from
+             * the same address, if any. Otherwise read the instruction word
+             * and procude the IR. NB: only branch targets are added to the
+             * map; delay instructions, which are disassembled directly in
+             * the branch handlers, never start a block. */
             uint32_t instr = disas_read_instr(address);
-            ir_instr_t *entry = disas_instr(&cont, address, instr, false);
-            disas_map(address, entry);
+            (void)disas_instr(&cont, address, instr, false);
         }
     }
 
@@ -0,0 +1,56 @@
+
+#ifndef _RECOMPILER_TARGET_RSP_H_INCLUDED_
+#define _RECOMPILER_TARGET_RSP_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <recompiler/backend.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/** Maximum number of instructions disassembled per RSP block. */
+#define IR_RSP_BLOCK_INSTR_MAX  128
+
+/**
+ * @brief Return the backend for the RSP recompiler.
+ * @param cycles    Host address of the RSP cycle counter, incremented
+ *                  by the recompiled code with the number of executed
+ *                  instructions.
+ */
+recompiler_backend_t *ir_rsp_recompiler_backend(uint64_t *cycles);
+
+/**
+ * @brief Disassemble a block of RSP instructions, producing IR bytecode.
+ *
+ * Disassembles the block starting from the IMEM address \p address,
+ * reading the instructions from \p imem. The block must be entered with
+ * the pending action State::Jump to \p address, and exits with the same
+ * pending action to the next instruction address.
+ *
+ * The disassembly stops after the delay instruction of the first branch
+ * or jump, after instructions accessing the RSP coprocessor 0 or halting
+ * the RSP, at the end of IMEM, or after \ref IR_RSP_BLOCK_INSTR_MAX
+ * instructions. The instructions accessing the coprocessor 0 or halting
+ * the RSP are always the first of their block, so that the RSP thread
+ * can stop before them. The scalar instructions are translated to IR;
+ * vector instructions call the interpreter handlers, decoded at
+ * disassembly time.
+ *
+ * @param address   IMEM address of the first instruction, word aligned.
+ * @param imem      Host pointer to the IMEM contents, in guest byte order.
+ * @param len       Receives the length in bytes of the disassembled block.
+ * @return the instruction graph, or NULL if the block could not be
+ *  disassembled.
+ */
+ir_graph_t *ir_rsp_disassemble(recompiler_backend_t *backend,
+                               uint32_t address, unsigned char const *imem,
+                               size_t *len);
+
+#ifdef __cplusplus
+}; /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* _RECOMPILER_TARGET_RSP_H_INCLUDED_ */
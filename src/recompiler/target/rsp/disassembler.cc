@@ -0,0 +1,855 @@
+
+#include <interpreter.h>
+#include <assembly/registers.h>
+#include <r4300/state.h>
+
+#include <recompiler/config.h>
+#include <recompiler/ir.h>
+#include <recompiler/backend.h>
+#include <recompiler/target/rsp.h>
+
+enum {
+    /* General purpose registers. */
+    REG_ZERO,
+    /* Special registers. */
+    REG_PC = 32,
+    /* State globals. */
+    REG_PC_NEXT,
+    REG_CYCLES,
+    REG_MAX,
+};
+
+static inline uint32_t rsp_get_rs(uint32_t instr) {
+    return (instr >> 21) & 0x1fu;
+}
+
+static inline uint32_t rsp_get_rt(uint32_t instr) {
+    return (instr >> 16) & 0x1fu;
+}
+
+static inline uint32_t rsp_get_rd(uint32_t instr) {
+    return (instr >> 11) & 0x1fu;
+}
+
+static inline uint32_t rsp_get_shamnt(uint32_t instr) {
+    return (instr >> 6) & 0x1fu;
+}
+
+static inline uint16_t rsp_get_imm_u16(uint32_t instr) {
+    return instr & 0xffffu;
+}
+
+static inline uint64_t rsp_get_imm_u64(uint32_t instr) {
+    return (uint64_t)(int64_t)(int16_t)(instr & 0xffffu);
+}
+
+static inline uint32_t rsp_get_target(uint32_t instr) {
+    return instr & 0x3ffffffu;
+}
+
+/** Size of the IMEM and DMEM memories. */
+#define RSP_MEM_SIZE    UINT32_C(0x1000)
+
+/** Number of instructions executed so far in the current block. */
+static thread_local unsigned ir_disas_cycles;
+/** Pointer to the IMEM contents being disassembled. */
+static thread_local unsigned char const *ir_disas_imem;
+
+static inline ir_value_t ir_rsp_append_read(ir_instr_cont_t *c,
+                                            ir_global_t global) {
+    return global ? ir_append_read_i64(c, global)
+                     : ir_make_const_i64(0);
+}
+
+static inline void ir_rsp_append_write(ir_instr_cont_t *c,
+                                       ir_global_t global,
+                                       ir_value_t value) {
+    if (global) ir_append_write_i64(c, global, value);
+}
+
+/** Sign extend the lower 32 bits of \p value, the register format of the
+ * 32bit results. */
+static inline ir_value_t ir_rsp_append_sext_i32(ir_instr_cont_t *c,
+                                                ir_value_t value) {
+    if (value.type.width > 32) {
+        value = ir_append_trunc_i32(c, value);
+    }
+    return ir_append_sext_i64(c, value);
+}
+
+/**
+ * Commit the state shared by all exits of the block: the program counter
+ * is set to the address of the last executed instruction \p address,
+ * and the cycle counter incremented with the number of executed
+ * instructions.
+ */
+static void ir_rsp_commit_state(ir_instr_cont_t *c, uint32_t address) {
+    ir_append_write_i64(c, REG_PC, ir_make_const_i64(address));
+    if (ir_disas_cycles) {
+        ir_value_t v = ir_append_read_i64(c, REG_CYCLES);
+        ir_append_write_i64(c, REG_CYCLES,
+            ir_append_binop(c, IR_ADD, v, ir_make_const_i64(ir_disas_cycles)));
+    }
+}
+
+/**
+ * Generate a block exit, continuing with the instruction at \p next_pc.
+ * The pending action remains State::Jump.
+ */
+static void ir_rsp_append_exit(ir_instr_cont_t *c, ir_value_t next_pc) {
+    ir_append_write_i64(c, REG_PC_NEXT, next_pc);
+    ir_append_exit(c);
+}
+
+/**
+ * Generate a call to the interpreter handler \p handler. The handlers
+ * access the machine state directly, the registers cached by the generated
+ * code are committed before the call.
+ */
+static inline void ir_rsp_append_handler(ir_instr_cont_t *c,
+                                         interpreter::cpu::eval_callback_t handler,
+                                         uint32_t instr) {
+    ir_append_call(c, ir_make_iN(0), (ir_func_t)handler,
+        1, ir_make_const_i32(instr));
+}
+
+/**
+ * Check the resources left to disassemble one more instruction.
+ * The margins cover the largest instruction expansion: a branch and its
+ * delay instruction with the aligned access test, followed by the two
+ * exits.
+ */
+static bool disas_check_budget(recompiler_backend_t const *backend) {
+    return backend->cur_block + 8 <= backend->nr_blocks &&
+           backend->cur_instr + 64 <= backend->nr_instrs &&
+           backend->cur_param + 8 <= backend->nr_params;
+}
+
+static uint32_t disas_read_instr(uint32_t address) {
+    unsigned char const *ptr = ir_disas_imem + address;
+    return ((uint32_t)ptr[0] << 24) |
+           ((uint32_t)ptr[1] << 16) |
+           ((uint32_t)ptr[2] << 8)  |
+           ((uint32_t)ptr[3] << 0);
+}
+
+/**
+ * Check whether an instruction can be disassembled in a branch delay slot.
+ * Branches, and instructions ending the block are excluded.
+ */
+static bool disas_delay_instr_allowed(uint32_t instr) {
+    switch ((instr >> 26) & 0x3fu) {
+    case 0x00: /* SPECIAL */
+        switch (instr & 0x3fu) {
+        case 0x08: /* JR */
+        case 0x09: /* JALR */
+        case 0x0d: /* BREAK */
+            return false;
+        default:
+            return true;
+        }
+    case 0x01: /* REGIMM */
+    case 0x02: /* J */
+    case 0x03: /* JAL */
+    case 0x04: /* BEQ */
+    case 0x05: /* BNE */
+    case 0x06: /* BLEZ */
+    case 0x07: /* BGTZ */
+    case 0x10: /* COP0 */
+        return false;
+    default:
+        return true;
+    }
+}
+
+/**
+ * Generate a DMEM load. Aligned accesses are performed inline, other
+ * accesses call the interpreter handler, which emulates the wrapping
+ * of unaligned words at the end of DMEM.
+ * The continuation \p c is updated to point to the join block.
+ */
+static void ir_rsp_append_load(ir_instr_cont_t *c, uint32_t instr,
+                               unsigned width, bool sign_extend,
+                               interpreter::cpu::eval_callback_t handler) {
+    ir_value_t vs, addr, offset, ptr, value;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    addr = ir_append_binop(c, IR_ADD, vs,
+        ir_make_const_i64(rsp_get_imm_u64(instr)));
+    offset = ir_append_binop(c, IR_AND, addr,
+        ir_make_const_i64(RSP_MEM_SIZE - 1));
+
+    ir_instr_cont_t fast_path, slow_path;
+    ir_block_t *join = NULL;
+    if (width > 8) {
+        ir_value_t cond = ir_append_icmp(c, IR_NE,
+            ir_append_binop(c, IR_AND, addr,
+                ir_make_const_i64(width / 8 - 1)),
+            ir_make_const_i64(0));
+        ir_append_br(c, cond, &fast_path, &slow_path);
+        join = ir_alloc_block(c->backend);
+        ir_rsp_append_handler(&slow_path, handler, instr);
+        ir_append_jmp(&slow_path, join);
+    } else {
+        fast_path = *c;
+    }
+
+    ptr = ir_append_binop(&fast_path, IR_ADD,
+        ir_make_const_ptr(R4300::state.dmem),
+        offset);
+    value = ir_append_load(&fast_path, ir_make_iN(width), ptr);
+    if (width > 8) {
+        value = ir_append_unop(&fast_path, IR_BSWAP, value);
+    }
+    value = sign_extend ? ir_append_sext_i64(&fast_path, value)
+                        : ir_append_zext_i64(&fast_path, value);
+    ir_rsp_append_write(&fast_path, rsp_get_rt(instr), value);
+
+    if (join != NULL) {
+        ir_append_jmp(&fast_path, join);
+        *c = (ir_instr_cont_t){ c->backend, join, &join->entry };
+    } else {
+        *c = fast_path;
+    }
+}
+
+/**
+ * Generate a DMEM store. Aligned accesses are performed inline, other
+ * accesses call the interpreter handler.
+ * The continuation \p c is updated to point to the join block.
+ */
+static void ir_rsp_append_store(ir_instr_cont_t *c, uint32_t instr,
+                                unsigned width,
+                                interpreter::cpu::eval_callback_t handler) {
+    ir_value_t vs, vt, addr, offset, ptr;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    addr = ir_append_binop(c, IR_ADD, vs,
+        ir_make_const_i64(rsp_get_imm_u64(instr)));
+    offset = ir_append_binop(c, IR_AND, addr,
+        ir_make_const_i64(RSP_MEM_SIZE - 1));
+
+    ir_instr_cont_t fast_path, slow_path;
+    ir_block_t *join = NULL;
+    if (width > 8) {
+        ir_value_t cond = ir_append_icmp(c, IR_NE,
+            ir_append_binop(c, IR_AND, addr,
+                ir_make_const_i64(width / 8 - 1)),
+            ir_make_const_i64(0));
+        ir_append_br(c, cond, &fast_path, &slow_path);
+        join = ir_alloc_block(c->backend);
+        ir_rsp_append_handler(&slow_path, handler, instr);
+        ir_append_jmp(&slow_path, join);
+    } else {
+        fast_path = *c;
+    }
+
+    ptr = ir_append_binop(&fast_path, IR_ADD,
+        ir_make_const_ptr(R4300::state.dmem),
+        offset);
+    vt = ir_append_trunc(&fast_path, ir_make_iN(width), vt);
+    if (width > 8) {
+        vt = ir_append_unop(&fast_path, IR_BSWAP, vt);
+    }
+    ir_append_store(&fast_path, ir_make_iN(width), ptr, vt);
+
+    if (join != NULL) {
+        ir_append_jmp(&fast_path, join);
+        *c = (ir_instr_cont_t){ c->backend, join, &join->entry };
+    } else {
+        *c = fast_path;
+    }
+}
+
+static bool disas_instr(ir_instr_cont_t *c, uint32_t address, uint32_t instr);
+
+/**
+ * Generate a branch or jump instruction, followed by its delay
+ * instruction, and the block exits to the target \p target when \p cond
+ * is true, to the instruction following the delay slot otherwise.
+ * The link register \p link, if not zero, is written before the delay
+ * instruction. Branches whose delay instruction is outside IMEM or cannot
+ * be disassembled in a delay slot end the block before the branch.
+ * @param cond      Branch condition of type `i1`, or constant for jumps.
+ * @return false, the branch always ends the block.
+ */
+static bool disas_branch(ir_instr_cont_t *c, uint32_t address,
+                         ir_value_t cond, ir_value_t target,
+                         ir_global_t link) {
+    ir_rsp_append_write(c, link, ir_make_const_i64(address + 8));
+    (void)disas_instr(c, address + 4, disas_read_instr(address + 4));
+    ir_rsp_commit_state(c, address + 4);
+
+    if (cond.kind == IR_CONST) {
+        ir_rsp_append_exit(c, cond.const_.int_ ?
+            target : ir_make_const_i64(address + 8));
+        return false;
+    }
+
+    ir_instr_cont_t not_taken, taken;
+    ir_append_br(c, cond, &not_taken, &taken);
+    ir_rsp_append_exit(&not_taken, ir_make_const_i64(address + 8));
+    ir_rsp_append_exit(&taken, target);
+    return false;
+}
+
+/** Check that the delay instruction of the branch at \p address can be
+ * disassembled. Generates the exit to the branch otherwise. */
+static bool disas_guard_branch_delay(ir_instr_cont_t *c, uint32_t address) {
+    if (address + 8 <= RSP_MEM_SIZE &&
+        disas_delay_instr_allowed(disas_read_instr(address + 4))) {
+        return true;
+    } else {
+        ir_disas_cycles--;
+        ir_rsp_commit_state(c, address - 4);
+        ir_rsp_append_exit(c, ir_make_const_i64(address));
+        return false;
+    }
+}
+
+static inline ir_value_t disas_branch_target(uint32_t address,
+                                             uint32_t instr) {
+    return ir_make_const_i64(address + 4 + (rsp_get_imm_u64(instr) << 2));
+}
+
+static bool disas_Reserved(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_handler(c, interpreter::rsp::eval_Instr, instr);
+    return true;
+}
+
+/* SPECIAL opcodes */
+
+static bool disas_ADD(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_binop(c, IR_ADD, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), ir_rsp_append_sext_i32(c, vd));
+    return true;
+}
+
+static bool disas_AND(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_binop(c, IR_AND, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), vd);
+    return true;
+}
+
+static bool disas_BREAK(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_commit_state(c, address);
+    ir_append_write_i64(c, REG_PC_NEXT, ir_make_const_i64(address + 4));
+    ir_rsp_append_handler(c, interpreter::rsp::eval_BREAK, instr);
+    ir_append_exit(c);
+    return false;
+}
+
+static bool disas_JALR(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    return disas_branch(c, address, ir_make_const_iN(1, 1), vs,
+                        rsp_get_rd(instr));
+}
+
+static bool disas_JR(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    return disas_branch(c, address, ir_make_const_iN(1, 1), vs, 0);
+}
+
+static bool disas_NOR(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_unop(c, IR_NOT, ir_append_binop(c, IR_OR, vs, vt));
+    ir_rsp_append_write(c, rsp_get_rd(instr), vd);
+    return true;
+}
+
+static bool disas_OR(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_binop(c, IR_OR, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), vd);
+    return true;
+}
+
+/**
+ * Generate a 32bit shift of the register rt. The registers always hold
+ * sign extended 32bit values, the arithmetic right shift can be performed
+ * on the lower word.
+ * @param shift     Shift amount of type `i8`.
+ */
+static void disas_shift(ir_instr_cont_t *c, uint32_t instr,
+                        ir_instr_kind_t op, ir_value_t shift) {
+    ir_value_t vt, vd;
+    vt = ir_append_trunc_i32(c, ir_rsp_append_read(c, rsp_get_rt(instr)));
+    vd = ir_append_binop(c, op, vt, shift);
+    ir_rsp_append_write(c, rsp_get_rd(instr), ir_append_sext_i64(c, vd));
+}
+
+/** Return the shift amount read from the register rs. */
+static ir_value_t disas_shift_amount(ir_instr_cont_t *c, uint32_t instr) {
+    ir_value_t vs = ir_append_trunc_i8(c, ir_rsp_append_read(c, rsp_get_rs(instr)));
+    return ir_append_binop(c, IR_AND, vs, ir_make_const_i8(0x1f));
+}
+
+static bool disas_SLL(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    // The null instruction 'sll r0, r0, 0' fills most delay slots.
+    if (instr != 0) {
+        disas_shift(c, instr, IR_SLL, ir_make_const_i8(rsp_get_shamnt(instr)));
+    }
+    return true;
+}
+
+static bool disas_SLLV(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    disas_shift(c, instr, IR_SLL, disas_shift_amount(c, instr));
+    return true;
+}
+
+static bool disas_SLT(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_icmp(c, IR_SLT, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), ir_append_zext_i64(c, vd));
+    return true;
+}
+
+static bool disas_SLTU(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_icmp(c, IR_ULT, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), ir_append_zext_i64(c, vd));
+    return true;
+}
+
+static bool disas_SRA(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    disas_shift(c, instr, IR_SRA, ir_make_const_i8(rsp_get_shamnt(instr)));
+    return true;
+}
+
+static bool disas_SRAV(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    disas_shift(c, instr, IR_SRA, disas_shift_amount(c, instr));
+    return true;
+}
+
+static bool disas_SRL(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    disas_shift(c, instr, IR_SRL, ir_make_const_i8(rsp_get_shamnt(instr)));
+    return true;
+}
+
+static bool disas_SRLV(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    disas_shift(c, instr, IR_SRL, disas_shift_amount(c, instr));
+    return true;
+}
+
+static bool disas_SUB(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_binop(c, IR_SUB, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), ir_rsp_append_sext_i32(c, vd));
+    return true;
+}
+
+static bool disas_XOR(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt, vd;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    vd = ir_append_binop(c, IR_XOR, vs, vt);
+    ir_rsp_append_write(c, rsp_get_rd(instr), vd);
+    return true;
+}
+
+/* REGIMM opcodes */
+
+static bool disas_BGEZ(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    cond = ir_append_icmp(c, IR_SGE, vs, ir_make_const_i64(0));
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 0);
+}
+
+static bool disas_BGEZAL(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    cond = ir_append_icmp(c, IR_SGE, vs, ir_make_const_i64(0));
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 31);
+}
+
+static bool disas_BLTZ(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    cond = ir_append_icmp(c, IR_SLT, vs, ir_make_const_i64(0));
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 0);
+}
+
+static bool disas_BLTZAL(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    cond = ir_append_icmp(c, IR_SLT, vs, ir_make_const_i64(0));
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 31);
+}
+
+/* Other opcodes */
+
+static bool disas_ADDI(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_append_binop(c, IR_ADD, vs,
+        ir_make_const_i64(rsp_get_imm_u64(instr)));
+    ir_rsp_append_write(c, rsp_get_rt(instr), ir_rsp_append_sext_i32(c, vt));
+    return true;
+}
+
+static bool disas_ANDI(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_append_binop(c, IR_AND, vs,
+        ir_make_const_i64(rsp_get_imm_u16(instr)));
+    ir_rsp_append_write(c, rsp_get_rt(instr), vt);
+    return true;
+}
+
+static bool disas_BEQ(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, vt, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    cond = ir_append_icmp(c, IR_EQ, vs, vt);
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 0);
+}
+
+static bool disas_BGTZ(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    cond = ir_append_icmp(c, IR_SGT, vs, ir_make_const_i64(0));
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 0);
+}
+
+static bool disas_BLEZ(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    cond = ir_append_icmp(c, IR_SLE, vs, ir_make_const_i64(0));
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 0);
+}
+
+static bool disas_BNE(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    ir_value_t vs, vt, cond;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_rsp_append_read(c, rsp_get_rt(instr));
+    cond = ir_append_icmp(c, IR_NE, vs, vt);
+    return disas_branch(c, address, cond,
+                        disas_branch_target(address, instr), 0);
+}
+
+static bool disas_CACHE(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    return true;
+}
+
+static bool disas_COP0(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (rsp_get_rs(instr) == 0 /* MFC0 */) {
+        ir_rsp_append_handler(c, interpreter::rsp::eval_COP0, instr);
+        return true;
+    }
+    // The register moves can halt the RSP, start DMA transfers overwriting
+    // IMEM, or modify the state of the RDP: MTC0 ends the block.
+    // The next address is committed first, as writes to SP_PC_REG
+    // replace it.
+    ir_rsp_commit_state(c, address);
+    ir_append_write_i64(c, REG_PC_NEXT, ir_make_const_i64(address + 4));
+    ir_rsp_append_handler(c, interpreter::rsp::eval_COP0, instr);
+    ir_append_exit(c);
+    return false;
+}
+
+static bool disas_COP2(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_handler(c, interpreter::rsp::decode_COP2(instr), instr);
+    return true;
+}
+
+static bool disas_J(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    return disas_branch(c, address, ir_make_const_iN(1, 1),
+        ir_make_const_i64((uint64_t)rsp_get_target(instr) << 2), 0);
+}
+
+static bool disas_JAL(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    if (!disas_guard_branch_delay(c, address))
+        return false;
+    return disas_branch(c, address, ir_make_const_iN(1, 1),
+        ir_make_const_i64((uint64_t)rsp_get_target(instr) << 2), 31);
+}
+
+static bool disas_LB(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_load(c, instr, 8, true, interpreter::rsp::eval_LB);
+    return true;
+}
+
+static bool disas_LBU(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_load(c, instr, 8, false, interpreter::rsp::eval_LBU);
+    return true;
+}
+
+static bool disas_LH(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_load(c, instr, 16, true, interpreter::rsp::eval_LH);
+    return true;
+}
+
+static bool disas_LHU(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_load(c, instr, 16, false, interpreter::rsp::eval_LHU);
+    return true;
+}
+
+static bool disas_LUI(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_write(c, rsp_get_rt(instr),
+        ir_make_const_i64(rsp_get_imm_u64(instr) << 16));
+    return true;
+}
+
+static bool disas_LW(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_load(c, instr, 32, true, interpreter::rsp::eval_LW);
+    return true;
+}
+
+static bool disas_LWC2(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_handler(c, interpreter::rsp::eval_LWC2, instr);
+    return true;
+}
+
+static bool disas_ORI(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_append_binop(c, IR_OR, vs,
+        ir_make_const_i64(rsp_get_imm_u16(instr)));
+    ir_rsp_append_write(c, rsp_get_rt(instr), vt);
+    return true;
+}
+
+static bool disas_SB(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_store(c, instr, 8, interpreter::rsp::eval_SB);
+    return true;
+}
+
+static bool disas_SH(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_store(c, instr, 16, interpreter::rsp::eval_SH);
+    return true;
+}
+
+static bool disas_SLTI(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_append_icmp(c, IR_SLT, vs,
+        ir_make_const_i64(rsp_get_imm_u64(instr)));
+    ir_rsp_append_write(c, rsp_get_rt(instr), ir_append_zext_i64(c, vt));
+    return true;
+}
+
+static bool disas_SLTIU(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_append_icmp(c, IR_ULT, vs,
+        ir_make_const_i64(rsp_get_imm_u64(instr)));
+    ir_rsp_append_write(c, rsp_get_rt(instr), ir_append_zext_i64(c, vt));
+    return true;
+}
+
+static bool disas_SW(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_store(c, instr, 32, interpreter::rsp::eval_SW);
+    return true;
+}
+
+static bool disas_SWC2(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_rsp_append_handler(c, interpreter::rsp::eval_SWC2, instr);
+    return true;
+}
+
+static bool disas_XORI(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_value_t vs, vt;
+    vs = ir_rsp_append_read(c, rsp_get_rs(instr));
+    vt = ir_append_binop(c, IR_XOR, vs,
+        ir_make_const_i64(rsp_get_imm_u16(instr)));
+    ir_rsp_append_write(c, rsp_get_rt(instr), vt);
+    return true;
+}
+
+static bool (*SPECIAL_callbacks[64])(ir_instr_cont_t *, uint32_t, uint32_t) = {
+    disas_SLL,       disas_Reserved,  disas_SRL,       disas_SRA,
+    disas_SLLV,      disas_Reserved,  disas_SRLV,      disas_SRAV,
+    disas_JR,        disas_JALR,      disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_BREAK,     disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_ADD,       disas_ADD,       disas_SUB,       disas_SUB,
+    disas_AND,       disas_OR,        disas_XOR,       disas_NOR,
+    disas_Reserved,  disas_Reserved,  disas_SLT,       disas_SLTU,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+};
+
+static bool disas_SPECIAL(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    return SPECIAL_callbacks[instr & 0x3fu](c, address, instr);
+}
+
+static bool (*REGIMM_callbacks[32])(ir_instr_cont_t *, uint32_t, uint32_t) = {
+    disas_BLTZ,      disas_BGEZ,      disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_BLTZAL,    disas_BGEZAL,    disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+};
+
+static bool disas_REGIMM(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    return REGIMM_callbacks[rsp_get_rt(instr)](c, address, instr);
+}
+
+static bool (*CPU_callbacks[64])(ir_instr_cont_t *, uint32_t, uint32_t) = {
+    disas_SPECIAL,   disas_REGIMM,    disas_J,         disas_JAL,
+    disas_BEQ,       disas_BNE,       disas_BLEZ,      disas_BGTZ,
+    disas_ADDI,      disas_ADDI,      disas_SLTI,      disas_SLTIU,
+    disas_ANDI,      disas_ORI,       disas_XORI,      disas_LUI,
+    disas_COP0,      disas_Reserved,  disas_COP2,      disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_LB,        disas_LH,        disas_Reserved,  disas_LW,
+    disas_LBU,       disas_LHU,       disas_Reserved,  disas_Reserved,
+    disas_SB,        disas_SH,        disas_Reserved,  disas_SW,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_CACHE,
+    disas_Reserved,  disas_Reserved,  disas_LWC2,      disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_SWC2,      disas_Reserved,
+    disas_Reserved,  disas_Reserved,  disas_Reserved,  disas_Reserved,
+};
+
+/**
+ * Check whether the instruction \p instr accesses the coprocessor 0
+ * or halts the RSP.
+ */
+static bool disas_sync_instr(uint32_t instr) {
+    switch ((instr >> 26) & 0x3fu) {
+    case 0x00: /* SPECIAL */
+        return (instr & 0x3fu) == 0x0d; /* BREAK */
+    case 0x10: /* COP0 */
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Disassemble the instruction \p instr at the address \p address.
+ * @return true if the disassembly continues with the next instruction.
+ */
+static bool disas_instr(ir_instr_cont_t *c, uint32_t address, uint32_t instr) {
+    ir_disas_cycles++;
+    return CPU_callbacks[(instr >> 26) & 0x3fu](c, address, instr);
+}
+
+recompiler_backend_t *ir_rsp_recompiler_backend(uint64_t *cycles) {
+    ir_global_definition_t global_definitions[REG_MAX];
+    global_definitions[REG_PC] = { ir_make_i64(), "pc", &R4300::state.rspreg.pc };
+    global_definitions[REG_PC_NEXT] = { ir_make_i64(), "next_pc", &R4300::state.rsp.nextPc };
+    global_definitions[REG_CYCLES] = { ir_make_i64(), "cycles", cycles };
+
+    for (unsigned i = 0; i < 32; i++) {
+        global_definitions[i] = {
+            ir_make_i64(), n64::assembly::cpu::RegisterNames[i],
+            &R4300::state.rspreg.gpr[i],
+        };
+    }
+
+    return alloc_recompiler_backend(global_definitions, REG_MAX,
+                                    RECOMPILER_BLOCK_MAX,
+                                    RECOMPILER_INSTR_MAX,
+                                    RECOMPILER_PARAM_MAX);
+}
+
+ir_graph_t *ir_rsp_disassemble(recompiler_backend_t *backend,
+                               uint32_t address, unsigned char const *imem,
+                               size_t *len) {
+    /* Catch recompiler allocation errors. */
+    if (catch_recompiler_error(backend) < 0) {
+        return NULL;
+    }
+
+    ir_disas_imem = imem;
+    ir_disas_cycles = 0;
+
+    ir_block_t *block = ir_alloc_block(backend);
+    ir_instr_cont_t cont = { backend, block, &block->entry };
+    uint32_t start = address;
+
+    for (;;) {
+        if (address + 4 > RSP_MEM_SIZE ||
+            address - start >= 4 * IR_RSP_BLOCK_INSTR_MAX ||
+            !disas_check_budget(backend)) {
+            /* The end of IMEM is reached, or the graph is full,
+             * emit an exit to the next instruction. */
+            ir_rsp_commit_state(&cont, address - 4);
+            ir_rsp_append_exit(&cont, ir_make_const_i64(address));
+            break;
+        }
+        uint32_t instr = disas_read_instr(address);
+        if (address != start && disas_sync_instr(instr)) {
+            /* Instructions observable by the CPU start their own block,
+             * the RSP thread stops before entering them. */
+            ir_rsp_commit_state(&cont, address - 4);
+            ir_rsp_append_exit(&cont, ir_make_const_i64(address));
+            break;
+        }
+        if (!disas_instr(&cont, address, instr)) {
+            break;
+        }
+        address += 4;
+    }
+
+    /* Blocks whose first instruction is a branch with an invalid
+     * delay instruction are left to the interpreter. */
+    if (ir_disas_cycles == 0) {
+        return NULL;
+    }
+
+    /* The branch instructions read their delay instruction. */
+    *len = address - start + 8;
+    if (start + *len > RSP_MEM_SIZE) {
+        *len = RSP_MEM_SIZE - start;
+    }
+    return ir_make_graph(backend);
+}
@@ -13,6 +13,106 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/**
+ * @struct ir_x86_64_link_config
+ * @brief Configuration for direct block chaining.
+ *
+ * When enabled, exits with a constant program counter are assembled as
+ * patchable jump stubs. An unlinked stub returns to the caller after saving
+ * the address of its `rel32` patch site to \ref exit_link; the caller can
+ * then redirect the stub to the entry point of the target block, which is
+ * then entered directly as a tail call. Restoring the stub is done by
+ * patching the jump back to the address immediately following the patch
+ * site.
+ *
+ * @var ir_x86_64_link_config::pc_global
+ *      Global variable holding the program counter. Exits are chainable
+ *      only if the last write to this global in the exit block is a constant.
+ * @var ir_x86_64_link_config::cycles
+ *      Pointer to the 64bit cycle counter.
+ * @var ir_x86_64_link_config::cycles_limit
+ *      Pointer to the 64bit cycle budget. Links are followed only while
+ *      the cycle counter is strictly lower than the budget.
+ * @var ir_x86_64_link_config::action
+ *      Pointer to a 32bit word which must be zero for links to be followed.
+ *      Used to detect exceptions and interrupts taken from called functions.
+ * @var ir_x86_64_link_config::exit_link
+ *      Pointer to the variable receiving the address of the patch site
+ *      when an unlinked stub is exited.
+ */
+typedef struct ir_x86_64_link_config {
+    ir_global_t         pc_global;
+    uint64_t const     *cycles;
+    uint64_t const     *cycles_limit;
+    uint32_t const     *action;
+    unsigned char     **exit_link;
+} ir_x86_64_link_config_t;
+
+/**
+ * @brief Enable or disable direct block chaining.
+ * @param config
+ *      Pointer to the link configuration, copied by the assembler.
+ *      Block chaining is disabled if NULL.
+ */
+void ir_x86_64_set_link_config(ir_x86_64_link_config_t const *config);
+
+/**
+ * @brief Suspend block chaining for the graphs assembled by the calling
+ *  thread. Used to assemble graphs from backends other than the one
+ *  the link configuration was set up for.
+ */
+void ir_x86_64_suspend_link(bool suspend);
+
+/**
+ * @brief Patch a stub generated for a chainable exit.
+ * @param rel32     Pointer to the patch site of the exit stub.
+ * @param target
+ *      Pointer to the entry point of the linked block,
+ *      or NULL to restore the stub.
+ */
+void ir_x86_64_patch_link(unsigned char *rel32, unsigned char *target);
+
+/**
+ * @struct ir_x86_64_stats
+ * @brief Register allocation and code size statistics, accumulated
+ *      over all assembled graphs.
+ *
+ * @var ir_x86_64_stats::nr_blocks
+ *      Number of assembled instruction blocks.
+ * @var ir_x86_64_stats::nr_vars
+ *      Number of allocated pseudo variables, excluding stack allocations.
+ * @var ir_x86_64_stats::nr_spills
+ *      Number of pseudo variables spilled to the stack frame.
+ * @var ir_x86_64_stats::nr_bytes
+ *      Number of bytes of generated binary code.
+ * @var ir_x86_64_stats::nr_bytes_saved
+ *      Number of bytes saved by the short jump encodings and
+ *      the peephole simplifications.
+ */
+typedef struct ir_x86_64_stats {
+    unsigned long       nr_blocks;
+    unsigned long       nr_vars;
+    unsigned long       nr_spills;
+    unsigned long       nr_bytes;
+    unsigned long       nr_bytes_saved;
+} ir_x86_64_stats_t;
+
+/**
+ * @brief Return the register allocation and code size statistics.
+ * @param stats     Pointer to the structure receiving the statistics.
+ */
+void ir_x86_64_get_stats(ir_x86_64_stats_t *stats);
+
+/**
+ * @brief Abort the execution of compiled code.
+ *
+ * Releases the stack frame of the compiled code currently executing, and
+ * returns to its caller. Must not be called: the routine is meant to be
+ * jumped to from signal handlers interrupting compiled code, by overwriting
+ * the instruction pointer of the interrupted context.
+ */
+void ir_x86_64_abort(void);
+
 /**
  * @brief Compile an IR program to x86_64 binary.
  *
@@ -18,25 +18,67 @@ typedef struct ir_var_context {
     unsigned register_;
     bool allocated;
     bool spilled;
+    bool crosses_call;
+    unsigned width;
     unsigned liveness_start;
     unsigned liveness_end;
 } ir_var_context_t;
 
+/** Patch site of a jump, encoded with a rel8 or rel32 offset. */
+typedef struct ir_jump {
+    unsigned char *rel;
+    bool rel8;
+} ir_jump_t;
+
 typedef struct ir_br_context {
     ir_block_t const *block;
-    unsigned char *rel32;
+    ir_jump_t jump;
 } ir_br_context_t;
 
 typedef struct ir_exit_context {
-    unsigned char *rel32;
+    ir_jump_t jump;
 } ir_exit_context_t;
 
-static ir_block_context_t ir_block_context[RECOMPILER_BLOCK_MAX];
-static ir_var_context_t   ir_var_context[RECOMPILER_VAR_MAX];
-static ir_br_context_t    ir_br_queue[RECOMPILER_BLOCK_MAX];
-static unsigned           ir_br_queue_len;
-static ir_exit_context_t  ir_exit_queue[RECOMPILER_INSTR_MAX]; // TODO BLOCK
-static unsigned           ir_exit_queue_len;
+typedef struct ir_exit_target {
+    bool known;
+    uint64_t address;
+} ir_exit_target_t;
+
+/* The assembler context is private to each recompiler thread;
+ * the link configuration and statistics are shared. */
+static _Thread_local ir_block_context_t ir_block_context[RECOMPILER_BLOCK_MAX];
+static _Thread_local ir_var_context_t   ir_var_context[RECOMPILER_VAR_MAX];
+static _Thread_local ir_br_context_t    ir_br_queue[2 * RECOMPILER_BLOCK_MAX];
+static _Thread_local unsigned           ir_br_queue_len;
+static _Thread_local ir_exit_context_t  ir_exit_queue[RECOMPILER_INSTR_MAX]; // TODO BLOCK
+static _Thread_local unsigned           ir_exit_queue_len;
+static _Thread_local ir_exit_target_t   ir_exit_target;
+static ir_x86_64_link_config_t          ir_link_config;
+static bool                             ir_link_enabled;
+static _Thread_local bool               ir_link_suspended;
+static ir_x86_64_stats_t                ir_stats;
+
+/* Jumps to blocks and to the exit label, in generation order: each
+ * instruction generates at most two exit jumps, each block two branches.
+ * The patch sites are recorded by the first assembly pass, the jumps
+ * found within the rel8 range are shortened by the second pass. */
+#define IR_JUMP_MAX (2 * RECOMPILER_INSTR_MAX + 2 * RECOMPILER_BLOCK_MAX)
+static _Thread_local unsigned char     *ir_jump_site[IR_JUMP_MAX];
+static _Thread_local bool               ir_jump_rel8[IR_JUMP_MAX];
+static _Thread_local unsigned           ir_jump_count;
+/* Enable the peephole simplifications of the second assembly pass. */
+static _Thread_local bool               ir_peephole;
+
+/* Number of call instructions preceding each instruction index. */
+static _Thread_local unsigned           ir_call_count[RECOMPILER_INSTR_MAX + 1];
+/* Pseudo variable currently assigned to each register, or -1. */
+static _Thread_local int                ir_register_owner[16];
+
+/* Pool of registers available for pseudo variable allocation.
+ * R8-R11 are caller saved, R12-R15 are callee saved and pushed
+ * by the function prologue. */
+#define CALLER_SAVED_REGISTERS  0x0f00u
+#define CALLEE_SAVED_REGISTERS  0xf000u
 
 static inline unsigned round_up_to_power2(unsigned v) {
     v--;
@@ -93,6 +135,30 @@ static x86_64_operand_t op_value(ir_value_t const *value) {
     }
 }
 
+/**
+ * Return true if the memory access with the input value as address can be
+ * generated with the address register as base, without copying the address
+ * to a temporary register first. The registers encoded as 4 (RSP, R12)
+ * require an additional SIB byte, not supported here.
+ */
+static bool can_fold_address(ir_value_t const *address) {
+    return address->kind == IR_VAR &&
+        !ir_var_context[address->var].allocated &&
+        !ir_var_context[address->var].spilled &&
+        (ir_var_context[address->var].register_ & 7) != 4;
+}
+
+/**
+ * Return the memory operand accessing the address held in the register
+ * allocated to \p address. The registers encoded as 5 (RBP, R13) require
+ * an explicit displacement.
+ */
+static x86_64_operand_t op_address(unsigned size, ir_value_t const *address) {
+    unsigned reg = ir_var_context[address->var].register_;
+    return (reg & 7) == 5 ?
+        op_mem_indirect_disp(size, reg, 0) : op_mem_indirect(size, reg);
+}
+
 /**
  * Generate the code to move the input value to the selected location.
  * If \p value is an allocated variable, the pointer to the allocated location
@@ -130,11 +196,122 @@ static void emit_mov_val_src(code_buffer_t *emitter,
 }
 
 
+/**
+ * Generate a jump to a target not yet known. The jump is encoded with
+ * the rel8 offset if the target was found within range by the first
+ * assembly pass, with the rel32 offset otherwise.
+ * @param emit_rel32    Emitter for the rel32 encoding of the jump.
+ * @param emit_rel8     Emitter for the rel8 encoding of the jump.
+ */
+static ir_jump_t emit_jump(code_buffer_t *emitter,
+    unsigned char *(*emit_rel32)(code_buffer_t *emitter, int32_t rel32),
+    unsigned char *(*emit_rel8)(code_buffer_t *emitter, int8_t rel8)) {
+    unsigned nr = ir_jump_count++;
+    ir_jump_t jump;
+
+    jump.rel8 = nr < IR_JUMP_MAX && ir_jump_rel8[nr];
+    jump.rel = jump.rel8 ? emit_rel8(emitter, 0) : emit_rel32(emitter, 0);
+    if (nr < IR_JUMP_MAX) {
+        ir_jump_site[nr] = jump.rel;
+    }
+    return jump;
+}
+
+static void patch_jump(code_buffer_t *emitter, ir_jump_t jump,
+                       unsigned char *target) {
+    if (jump.rel8) {
+        patch_jmp_rel8(emitter, jump.rel, target);
+    } else {
+        patch_jmp_rel32(emitter, jump.rel, target);
+    }
+}
+
+static void queue_exit(code_buffer_t *emitter, ir_jump_t jump) {
+    if (ir_exit_queue_len >= RECOMPILER_INSTR_MAX) {
+        fail_code_buffer(emitter);
+    }
+    ir_exit_queue[ir_exit_queue_len].jump = jump;
+    ir_exit_queue_len++;
+}
+
+/**
+ * Generate the code to restore the stack pointer and callee saved registers,
+ * i.e. revert the effects of the function prelude generated
+ * by \ref ir_x86_64_assemble.
+ */
+static void emit_leave_frame(code_buffer_t *emitter) {
+    emit_mov_r64_r64(emitter, RSP, RBP);
+    emit_pop_r64(emitter, R15);
+    emit_pop_r64(emitter, R14);
+    emit_pop_r64(emitter, R13);
+    emit_pop_r64(emitter, R12);
+    emit_pop_r64(emitter, RBP);
+}
+
+/**
+ * Return a memory operand for the host variable \p ptr. The operand is
+ * relative to the globals base pointer (R15) if the offset can be represented
+ * as a 32bit displacement, otherwise the address is first loaded to
+ * \p scratch_reg.
+ */
+static x86_64_mem_t mem_host_ptr(recompiler_backend_t const *backend,
+                                 code_buffer_t *emitter,
+                                 void const *ptr, unsigned scratch_reg) {
+    int64_t ptr_offset =
+        (intptr_t)ptr - (intptr_t)backend->globals_base_ptr;
+    if (is_int32(ptr_offset)) {
+        return mem_indirect_disp(R15, ptr_offset);
+    } else {
+        emit_mov_r64_imm64(emitter, scratch_reg, (intptr_t)ptr);
+        return mem_indirect(scratch_reg);
+    }
+}
+
+/**
+ * Generate a chainable exit. The stub checks the cycle budget and pending
+ * actions, and returns through the common exit label if either check fails.
+ * Otherwise the stack frame is released, and the stub jumps to the
+ * linked block, or returns to the caller if the stub is not yet linked.
+ * In the latter case the address of the patch site is saved to
+ * \ref ir_x86_64_link_config::exit_link to let the caller link the stub.
+ */
+static void assemble_link_exit(recompiler_backend_t const *backend,
+                               code_buffer_t *emitter) {
+    x86_64_mem_t mem;
+    unsigned char *rel32;
+
+    mem = mem_host_ptr(backend, emitter, ir_link_config.cycles, RAX);
+    emit_mov_r64_m64(emitter, RAX, mem);
+    mem = mem_host_ptr(backend, emitter, ir_link_config.cycles_limit, RCX);
+    emit_cmp_r64_m64(emitter, RAX, mem);
+    queue_exit(emitter, emit_jump(emitter, emit_jae_rel32, emit_jae_rel8));
+
+    mem = mem_host_ptr(backend, emitter, ir_link_config.action, RCX);
+    emit_cmp_m32_imm8(emitter, mem, 0);
+    queue_exit(emitter, emit_jump(emitter, emit_jne_rel32, emit_jne_rel8));
+
+    // The stack frame is released before the patchable jump: the linked
+    // block is entered as a tail call and returns directly to the caller.
+    emit_leave_frame(emitter);
+    rel32 = emit_jmp_rel32(emitter, 0);
+    patch_jmp_rel32(emitter, rel32, code_buffer_ptr(emitter));
+
+    // Unlinked exit. R15 was restored at this point and cannot be used
+    // to index the exit link variable.
+    emit_mov_r64_imm64(emitter, RAX, (intptr_t)rel32);
+    emit_mov_r64_imm64(emitter, RCX, (intptr_t)ir_link_config.exit_link);
+    emit_mov_m64_r64(emitter, mem_indirect(RCX), RAX);
+    emit_ret(emitter);
+}
+
 static void assemble_exit(recompiler_backend_t const *backend,
                           code_buffer_t *emitter,
                           ir_instr_t const *instr) {
-    ir_exit_queue[ir_exit_queue_len].rel32 = emit_jmp_rel32(emitter, 0);
-    ir_exit_queue_len++;
+    if (ir_link_enabled && !ir_link_suspended && ir_exit_target.known) {
+        assemble_link_exit(backend, emitter);
+    } else {
+        queue_exit(emitter, emit_jump(emitter, emit_jmp_rel32, emit_jmp_rel8));
+    }
 }
 
 static void assemble_assert(recompiler_backend_t const *backend,
@@ -146,8 +323,7 @@ static void assemble_assert(recompiler_backend_t const *backend,
     x86_64_operand_t src1 = op_imm(8, 1);
 
     emit_test_src0_src1(emitter, &src0, &src1);
-    ir_exit_queue[ir_exit_queue_len].rel32 = emit_je_rel32(emitter, 0);
-    ir_exit_queue_len++;
+    queue_exit(emitter, emit_jump(emitter, emit_je_rel32, emit_je_rel8));
 }
 
 static void assemble_br(recompiler_backend_t const *backend,
@@ -155,17 +331,28 @@ static void assemble_br(recompiler_backend_t const *backend,
                         ir_instr_t const *instr) {
     x86_64_operand_t src0 = op_value(&instr->br.cond);
     x86_64_operand_t src1 = op_imm(8, 1);
-    unsigned char *rel32;
+    ir_jump_t jump;
+
+    // Unconditional branch: the target is assembled directly after the
+    // current block if not already generated, otherwise a jump
+    // is inserted.
+    if (instr->br.cond.kind == IR_CONST) {
+        ir_br_queue[ir_br_queue_len].jump.rel = NULL;
+        ir_br_queue[ir_br_queue_len].block =
+            instr->br.target[instr->br.cond.const_.int_ != 0];
+        ir_br_queue_len++;
+        return;
+    }
 
     emit_test_src0_src1(emitter, &src0, &src1);
-    rel32 = emit_jne_rel32(emitter, 0);
-    ir_br_queue[ir_br_queue_len].rel32 = rel32;
+    jump = emit_jump(emitter, emit_jne_rel32, emit_jne_rel8);
+    ir_br_queue[ir_br_queue_len].jump = jump;
     ir_br_queue[ir_br_queue_len].block = instr->br.target[1];
     ir_br_queue_len++;
     // The false branch is assembled directly after the current block
     // (the branch instruction is final). No additional branch
     // instruction required.
-    ir_br_queue[ir_br_queue_len].rel32 = NULL;
+    ir_br_queue[ir_br_queue_len].jump.rel = NULL;
     ir_br_queue[ir_br_queue_len].block = instr->br.target[0];
     ir_br_queue_len++;
 }
@@ -178,30 +365,34 @@ static void assemble_call(recompiler_backend_t const *backend,
     // the System V ABI is quite simple in this case: all types are rounded
     // up to 64bits, the first 6 parameters are passed by register, the others
     // on the stack.
-    // For this implementation, we are not concerned with caller saved
-    // registers, as register allocation is not present.
+    // Pseudo variables live across the call are allocated to callee saved
+    // registers, the caller saved registers need not be preserved.
 
     unsigned frame_size = 0;
     static const unsigned register_parameters[6] = {
         RDI, RSI, RDX, RCX, R8, R9,
     };
 
-    // Save R8, R9 if necessary: these registers are used for pseudo
-    // variable storage.
-    if (instr->call.nr_params >= 5) {
-        emit_push_r64(emitter, R8);
-        emit_push_r64(emitter, R9);
-    }
-
-    // TODO potential issue if the a parameter is saved to R8: its value
-    // might be overwritten...
-    for (unsigned nr = 5; nr < instr->call.nr_params; nr++) {
-        if (instr->call.params[nr].kind == IR_VAR &&
-            !ir_var_context[instr->call.params[nr].var].spilled &&
-            ir_var_context[instr->call.params[nr].var].register_ == R8) {
-            printf("assemble_call: cannot assemble function call");
+    // Check that no parameter is read from a register already overwritten
+    // with a previous parameter. R8, R9 can hold pseudo variables whose
+    // liveness interval ends with the call, and RAX the result of a
+    // preceding call.
+    unsigned clobbered_register_bitmap = 0;
+    for (unsigned nr = 0; nr < instr->call.nr_params; nr++) {
+        ir_value_t *param = instr->call.params + nr;
+        if (param->kind == IR_VAR &&
+            !ir_var_context[param->var].spilled &&
+            (clobbered_register_bitmap &
+                (1u << ir_var_context[param->var].register_)) != 0) {
+            printf("assemble_call: cannot assemble function call\n");
             fail_code_buffer(emitter);
         }
+        if (nr < 6) {
+            clobbered_register_bitmap |= 1u << register_parameters[nr];
+        }
+        if (nr < 3 && round_up_to_power2(param->type.width) == 8) {
+            clobbered_register_bitmap |= 1u << RAX;
+        }
     }
 
     // Load first six parameters to registers.
@@ -250,12 +441,6 @@ static void assemble_call(recompiler_backend_t const *backend,
         emit_pop_r64(emitter, RBX);
     }
 
-    // Restore R8, R9 if they were saved.
-    if (instr->call.nr_params >= 5) {
-        emit_pop_r64(emitter, R9);
-        emit_pop_r64(emitter, R8);
-    }
-
     // Save the function return value.
     if (instr->type.width > 0) {
         unsigned size = round_up_to_power2(instr->type.width);
@@ -285,6 +470,16 @@ static void assemble_not(recompiler_backend_t const *backend,
     emit_not_dst_src0(emitter, &dst, &src0);
 }
 
+static void assemble_bswap(recompiler_backend_t const *backend,
+                           code_buffer_t *emitter,
+                           ir_instr_t const *instr) {
+
+    x86_64_operand_t dst = op_var(instr->res, instr->type);
+    x86_64_operand_t src0 = op_value(&instr->unop.value);
+
+    emit_bswap_dst_src0(emitter, &dst, &src0);
+}
+
 static void assemble_add(recompiler_backend_t const *backend,
                          code_buffer_t *emitter,
                          ir_instr_t const *instr) {
@@ -519,6 +714,9 @@ static void assemble_load(recompiler_backend_t const *backend,
         x86_64_operand_t src = op_mem_indirect_disp(size, RBP,
             ir_var_context[instr->load.address.var].stack_offset);
         emit_mov_val_src(emitter, instr->res, instr->type, &src);
+    } else if (ir_peephole && can_fold_address(&instr->load.address)) {
+        x86_64_operand_t src = op_address(size, &instr->load.address);
+        emit_mov_val_src(emitter, instr->res, instr->type, &src);
     } else {
         x86_64_operand_t src = op_value(&instr->load.address);
         x86_64_operand_t tmp = op_reg(src.size, RAX);
@@ -540,10 +738,19 @@ static void assemble_store(recompiler_backend_t const *backend,
         x86_64_operand_t dst = op_mem_indirect_disp(size, RBP,
             ir_var_context[instr->store.address.var].stack_offset);
         emit_mov_dst_val(emitter, &dst, &instr->store.value);
+    } else if (ir_peephole && can_fold_address(&instr->store.address) &&
+               ir_var_context[instr->store.address.var].register_ != RAX) {
+        // RAX is used as temporary register when the stored value
+        // is not in a register, the address must be held in a different
+        // register.
+        x86_64_operand_t dst = op_address(size, &instr->store.address);
+        emit_mov_dst_val(emitter, &dst, &instr->store.value);
     } else {
+        // The address is loaded to RCX, RAX is used as temporary
+        // register when the stored value is not in a register.
         x86_64_operand_t dst = op_value(&instr->store.address);
-        x86_64_operand_t tmp = op_reg(instr->type.width, RAX);
-        x86_64_operand_t tmp_deref = op_mem_indirect(size, RAX);
+        x86_64_operand_t tmp = op_reg(dst.size, RCX);
+        x86_64_operand_t tmp_deref = op_mem_indirect(size, RCX);
         emit_mov_op0_op1(emitter, &tmp, &dst);
         emit_mov_dst_val(emitter, &tmp_deref, &instr->store.value);
     }
@@ -595,6 +802,14 @@ static void assemble_write(recompiler_backend_t const *backend,
     int64_t ptr_offset = (intptr_t)ptr - (intptr_t)base_ptr;
     x86_64_operand_t dst;
 
+    // Track constant writes to the program counter to identify
+    // chainable exits.
+    if (ir_link_enabled && !ir_link_suspended &&
+        global == ir_link_config.pc_global) {
+        ir_exit_target.known = instr->write.value.kind == IR_CONST;
+        ir_exit_target.address = instr->write.value.const_.int_;
+    }
+
     // If the offset from the globals base pointer can be represented in
     // the x86_64 mov instruction, then a single mov instruction is used.
     // Other the assembler defaults to using an additional move to load
@@ -650,8 +865,15 @@ static void assemble_zext(recompiler_backend_t const *backend,
     x86_64_operand_t tmp0 = op_reg(from_size, RAX);
     x86_64_operand_t tmp1 = op_reg(to_size, RAX);
 
-    emit_xor_r64_r64(emitter, RAX, RAX);
-    emit_mov_dst_val(emitter, &tmp0, &instr->cvt.value);
+    // 32bit moves clear the upper half of the destination register,
+    // the explicit move is generated even if the value is held in RAX.
+    if (ir_peephole && from_size == 32) {
+        x86_64_operand_t src = op_value(&instr->cvt.value);
+        emit_mov_op0_op1(emitter, &tmp0, &src);
+    } else {
+        emit_xor_r64_r64(emitter, RAX, RAX);
+        emit_mov_dst_val(emitter, &tmp0, &instr->cvt.value);
+    }
     emit_mov_val_src(emitter, instr->res, instr->type, &tmp1);
 }
 
@@ -664,6 +886,7 @@ static const void (*assemble_callbacks[])(recompiler_backend_t const *backend,
     [IR_CALL]   = assemble_call,
     [IR_ALLOC]  = assemble_alloc,
     [IR_NOT]    = assemble_not,
+    [IR_BSWAP]  = assemble_bswap,
     [IR_ADD]    = assemble_add,
     [IR_SUB]    = assemble_sub,
     [IR_MUL]    = assemble_mul,
@@ -687,7 +910,7 @@ static const void (*assemble_callbacks[])(recompiler_backend_t const *backend,
     [IR_ZEXT]   = assemble_zext,
 };
 
-_Static_assert(IR_ZEXT == 26,
+_Static_assert(IR_ZEXT == 27,
     "IR instruction set changed, code may need to be updated");
 
 static void assemble_instr(recompiler_backend_t const *backend,
@@ -700,6 +923,7 @@ static void assemble_block(recompiler_backend_t const *backend,
                            code_buffer_t *emitter,
                            ir_block_t const *block) {
     ir_instr_t const *instr = block->entry;
+    ir_exit_target.known = false;
     for (; instr != NULL; instr = instr->next) {
         assemble_instr(backend, emitter, instr);
     }
@@ -717,9 +941,13 @@ static void set_liveness_end(void *index, ir_value_t const *value) {
  * are in SSA form) and ends with the last occurence.
  * The blocks must have been generated following the domination graph:
  * each block precedes all blocks inheriting its scope.
+ * Also marks the variables whose interval strictly contains a function
+ * call, or passed as late call parameters: these cannot be stored in
+ * caller saved registers.
  */
 static void compute_liveness(ir_graph_t const *graph) {
     unsigned index = 0;
+    ir_call_count[0] = 0;
     for (unsigned label = 0; label < graph->nr_blocks; label++) {
         ir_block_t const *block = graph->blocks + label;
         ir_instr_t const *instr = block->entry;
@@ -728,6 +956,34 @@ static void compute_liveness(ir_graph_t const *graph) {
             ir_iter_values(instr, set_liveness_end, &index);
             if (!ir_is_void_instr(instr)) {
                 ir_var_context[instr->res].liveness_start = index;
+                ir_var_context[instr->res].liveness_end = index;
+            }
+            ir_call_count[index + 1] =
+                ir_call_count[index] + (instr->kind == IR_CALL);
+        }
+    }
+
+    index = 0;
+    for (unsigned label = 0; label < graph->nr_blocks; label++) {
+        ir_block_t const *block = graph->blocks + label;
+        ir_instr_t const *instr = block->entry;
+
+        for (; instr != NULL; instr = instr->next, index++) {
+            if (!ir_is_void_instr(instr)) {
+                ir_var_context_t *ctx = ir_var_context + instr->res;
+                ctx->crosses_call =
+                    ir_call_count[ctx->liveness_end] >
+                    ir_call_count[ctx->liveness_start + 1];
+            }
+            // Parameters loaded after R8 has been assigned cannot be
+            // stored in caller saved registers either.
+            if (instr->kind == IR_CALL) {
+                for (unsigned nr = 5; nr < instr->call.nr_params; nr++) {
+                    if (instr->call.params[nr].kind == IR_VAR) {
+                        ir_var_t var = instr->call.params[nr].var;
+                        ir_var_context[var].crosses_call = true;
+                    }
+                }
             }
         }
     }
@@ -761,6 +1017,7 @@ static void release_register(void *params_, ir_value_t const *value) {
         return;
     }
 
+    ir_register_owner[ctx->register_] = -1;
     params->register_bitmap |= 1u << ctx->register_;
     if (params->preferred_register < 0) {
         params->preferred_register = ctx->register_;
@@ -785,19 +1042,58 @@ static int release_registers(ir_instr_t const *instr, unsigned index,
 }
 
 /**
- * Alloc a register from the unused bitmap.
- * \p register_bitmap must not be zero.
- * If \p preferred_register is strictly positive,
+ * Alloc a register from the unused bitmap, restricted to the registers
+ * in \p allowed_bitmap. Caller saved registers are picked first.
+ * If \p preferred_register is positive and allowed,
  * it will be directly allocated.
+ * Returns -1 if no allowed register is free.
  */
-static unsigned alloc_register(unsigned *register_bitmap,
-                               int preferred_register) {
-    unsigned r = preferred_register < 0 ?
-        __builtin_ctz(*register_bitmap) : preferred_register;
+static int alloc_register(unsigned *register_bitmap,
+                          unsigned allowed_bitmap,
+                          int preferred_register) {
+    unsigned candidates = *register_bitmap & allowed_bitmap;
+    unsigned r;
+
+    if (candidates == 0) {
+        return -1;
+    }
+    if (preferred_register >= 0 &&
+        (candidates & (1u << preferred_register)) != 0) {
+        r = preferred_register;
+    } else if ((candidates & CALLER_SAVED_REGISTERS) != 0) {
+        r = __builtin_ctz(candidates & CALLER_SAVED_REGISTERS);
+    } else {
+        r = __builtin_ctz(candidates);
+    }
     *register_bitmap &= ~(1u << r);
     return r;
 }
 
+/**
+ * Select the variable to spill when no allowed register is free, following
+ * the linear scan heuristic: the variable whose liveness interval
+ * ends last is spilled. Returns the register of the variable to spill, or
+ * -1 if the new interval ends after all active intervals, in which
+ * case the new variable is spilled instead.
+ */
+static int select_spill_register(unsigned allowed_bitmap,
+                                 unsigned liveness_end) {
+    int spill_register = -1;
+    unsigned spill_end = liveness_end;
+
+    for (unsigned r = 0; r < 16; r++) {
+        int var = ir_register_owner[r];
+        if ((allowed_bitmap & (1u << r)) == 0 || var < 0) {
+            continue;
+        }
+        if (ir_var_context[var].liveness_end > spill_end) {
+            spill_register = r;
+            spill_end = ir_var_context[var].liveness_end;
+        }
+    }
+    return spill_register;
+}
+
 /**
  * Heuristic for determining if the variable can safely to assigned to
  * the RAX register. The instruction \p instr must not be void and must not
@@ -825,8 +1121,28 @@ static bool should_use_rax(ir_instr_t const *instr) {
 }
 
 /**
- * Allocate the stack frame for storing all intermediate variables.
- * The allocation spills all variables, and ignores lifetime.
+ * Allocate a stack slot for a pseudo variable of the given width (in bits).
+ * Returns the new stack frame size.
+ */
+static unsigned alloc_stack_slot(ir_var_t var, unsigned width,
+                                 unsigned stack_offset, bool alloc) {
+    // Align the offset to the type size.
+    width = round_up_to_power2(width) / 8;
+    stack_offset = (stack_offset + width - 1) & ~(width - 1);
+    stack_offset = stack_offset + width;
+    ir_var_context[var].spilled = true;
+    ir_var_context[var].stack_offset = -stack_offset;
+    ir_var_context[var].allocated = alloc;
+    return stack_offset;
+}
+
+/**
+ * Allocate registers and stack slots for all intermediate variables.
+ * The allocation uses the linear scan algorithm over the liveness intervals
+ * computed by \ref compute_liveness. When no register is available, the
+ * variable with the furthest interval end is spilled to the stack frame.
+ * Variables live across function calls are only allocated to callee saved
+ * registers.
  * Returns the required stack frame size.
  */
 static unsigned alloc_vars(ir_graph_t const *graph,
@@ -834,15 +1150,26 @@ static unsigned alloc_vars(ir_graph_t const *graph,
                            unsigned *used_register_bitmap_ptr) {
     /* Current stack frame offset.  */
     unsigned stack_offset = 0;
+    /* Bitmap of allocatable registers. */
+    unsigned register_pool =
+        (CALLER_SAVED_REGISTERS | CALLEE_SAVED_REGISTERS) &
+        ~banned_register_bitmap;
     /* Bitmap of unused registers. */
-    unsigned register_bitmap = 0xff00 & ~banned_register_bitmap;
+    unsigned register_bitmap = register_pool;
     unsigned used_register_bitmap = 0x0;
     /* Instruction index. */
     unsigned index = 0;
+    /* Number of spilled variables. */
+    unsigned nr_spills = 0;
+    unsigned nr_vars = 0;
 
     /* Determine the liveness of each variable first. */
     compute_liveness(graph);
 
+    for (unsigned r = 0; r < 16; r++) {
+        ir_register_owner[r] = -1;
+    }
+
     /* Iterate through instructions to allocate variables.  */
     for (unsigned label = 0; label < graph->nr_blocks; label++) {
         ir_block_t const *block = graph->blocks + label;
@@ -858,34 +1185,62 @@ static unsigned alloc_vars(ir_graph_t const *graph,
 
             // Allocated variables are phantom, only the requested memory
             // is allocated, not the variable slot.
-            bool alloc = instr->kind == IR_ALLOC;
+            if (instr->kind == IR_ALLOC) {
+                stack_offset = alloc_stack_slot(instr->res,
+                    instr->alloc.type.width, stack_offset, true);
+                continue;
+            }
 
-            if (!alloc && should_use_rax(instr)) {
+            ir_var_context_t *ctx = ir_var_context + instr->res;
+            unsigned allowed_bitmap = register_pool;
+            if (ctx->crosses_call) {
+                allowed_bitmap &= CALLEE_SAVED_REGISTERS;
+            }
+
+            nr_vars++;
+            ctx->allocated = false;
+            ctx->width = instr->type.width;
+
+            if (should_use_rax(instr)) {
                 // Follow heuristic for using the RAX register in priority.
-                ir_var_context[instr->res].spilled = false;
-                ir_var_context[instr->res].register_ = RAX;
-                ir_var_context[instr->res].allocated = false;
-            } else if (!alloc && register_bitmap != 0) {
+                ctx->spilled = false;
+                ctx->register_ = RAX;
+                continue;
+            }
+
+            reg = alloc_register(&register_bitmap, allowed_bitmap, reg);
+            if (reg < 0) {
+                // Steal the register of the active variable living
+                // the longest, if it outlives the current variable.
+                reg = select_spill_register(allowed_bitmap, ctx->liveness_end);
+                if (reg >= 0) {
+                    ir_var_t spill_var = ir_register_owner[reg];
+                    stack_offset = alloc_stack_slot(spill_var,
+                        ir_var_context[spill_var].width, stack_offset, false);
+                    nr_spills++;
+                }
+            }
+            if (reg < 0) {
+                // Spill the variable.
+                stack_offset = alloc_stack_slot(instr->res,
+                    instr->type.width, stack_offset, false);
+                nr_spills++;
+            } else {
                 // Allocate a register.
-                reg = alloc_register(&register_bitmap, reg);
-                ir_var_context[instr->res].spilled = false;
-                ir_var_context[instr->res].register_ = reg;
-                ir_var_context[instr->res].allocated = false;
+                ctx->spilled = false;
+                ctx->register_ = reg;
+                ir_register_owner[reg] = instr->res;
                 used_register_bitmap |= (1u << reg);
-            } else {
-                // Spill the variable.
-                // Align the offset to the return type size.
-                unsigned width = alloc ? instr->alloc.type.width : instr->type.width;
-                width = round_up_to_power2(width) / 8;
-                stack_offset = (stack_offset + width - 1) & ~(width - 1);
-                stack_offset = stack_offset + width;
-                ir_var_context[instr->res].spilled = true;
-                ir_var_context[instr->res].stack_offset = -stack_offset;
-                ir_var_context[instr->res].allocated = alloc;
             }
         }
     }
 
+    // Update allocation statistics.
+    // The statistics are shared between the recompiler threads.
+    __atomic_fetch_add(&ir_stats.nr_blocks, graph->nr_blocks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ir_stats.nr_vars, nr_vars, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ir_stats.nr_spills, nr_spills, __ATOMIC_RELAXED);
+
     // Return used registers.
     if (used_register_bitmap_ptr) {
         *used_register_bitmap_ptr = used_register_bitmap;
@@ -895,29 +1250,74 @@ static unsigned alloc_vars(ir_graph_t const *graph,
     return (stack_offset + 15) & ~15u;
 }
 
-code_entry_t ir_x86_64_assemble(recompiler_backend_t const *backend,
-                                code_buffer_t *emitter,
-                                ir_graph_t const *graph,
-                                size_t *binary_len) {
-
-    // Reset the emitter. Sets a catch point for exception generated by the
-    // emit_* helpers. An negative return signifies a generation failure.
-    if (catch_code_buffer_error(emitter) < 0) {
-        return NULL;
+void ir_x86_64_set_link_config(ir_x86_64_link_config_t const *config) {
+    ir_link_enabled = config != NULL;
+    if (config != NULL) {
+        ir_link_config = *config;
     }
+}
+
+void ir_x86_64_suspend_link(bool suspend) {
+    ir_link_suspended = suspend;
+}
+
+void ir_x86_64_patch_link(unsigned char *rel32, unsigned char *target) {
+    // Unlinked stubs jump to the instruction immediately following the
+    // patch site. The code buffers are allocated as a single contiguous
+    // memory range, all links are reachable with 32bit offsets.
+    uint32_t rel = target == NULL ? 0 :
+        (uint32_t)(int32_t)(target - rel32 - 4);
+    rel32[0] = rel;
+    rel32[1] = rel >> 8;
+    rel32[2] = rel >> 16;
+    rel32[3] = rel >> 24;
+}
+
+void ir_x86_64_get_stats(ir_x86_64_stats_t *stats) {
+    stats->nr_blocks = __atomic_load_n(&ir_stats.nr_blocks, __ATOMIC_RELAXED);
+    stats->nr_vars = __atomic_load_n(&ir_stats.nr_vars, __ATOMIC_RELAXED);
+    stats->nr_spills = __atomic_load_n(&ir_stats.nr_spills, __ATOMIC_RELAXED);
+    stats->nr_bytes = __atomic_load_n(&ir_stats.nr_bytes, __ATOMIC_RELAXED);
+    stats->nr_bytes_saved =
+        __atomic_load_n(&ir_stats.nr_bytes_saved, __ATOMIC_RELAXED);
+}
+
+/* Same sequence as generated by \ref emit_leave_frame, the frame pointer RBP
+ * is never allocated and always points to the frame of the executing code. */
+__asm__(
+    "    .text\n"
+    "    .globl ir_x86_64_abort\n"
+    "    .type ir_x86_64_abort, @function\n"
+    "ir_x86_64_abort:\n"
+    "    mov %rbp, %rsp\n"
+    "    pop %r15\n"
+    "    pop %r14\n"
+    "    pop %r13\n"
+    "    pop %r12\n"
+    "    pop %rbp\n"
+    "    ret\n"
+    "    .size ir_x86_64_abort, .-ir_x86_64_abort\n");
+
+/**
+ * Generate the binary code of the graph at the current location of the
+ * code buffer: function prelude, instruction blocks, and common exit label.
+ * The pseudo variables must have been allocated with \ref alloc_vars.
+ */
+static void assemble_graph(recompiler_backend_t const *backend,
+                           code_buffer_t *emitter,
+                           ir_graph_t const *graph,
+                           unsigned stack_size) {
 
     // Clear the assembler context.
     ir_br_queue_len = 0;
     ir_exit_queue_len = 0;
+    ir_jump_count = 0;
     for (unsigned nr = 0; nr < RECOMPILER_BLOCK_MAX; nr++) {
         ir_block_context[nr].start = NULL;
     }
 
     // Generate the standard function prelude to enter into compiled code.
     // Register R15 is reserved to index global variables.
-    void *entry = code_buffer_ptr(emitter);
-    unsigned used_register_bitmap = 0;
-    unsigned stack_size = alloc_vars(graph, 1u << R15, &used_register_bitmap);
     emit_push_r64(emitter, RBP);
     emit_push_r64(emitter, R12);
     emit_push_r64(emitter, R13);
@@ -934,7 +1334,7 @@ code_entry_t ir_x86_64_assemble(recompiler_backend_t const *backend,
     emit_mov_r64_imm64(emitter, R15, (intptr_t)backend->globals_base_ptr);
 
     // Start the assembly with the first block.
-    ir_br_queue[0].rel32 = NULL;
+    ir_br_queue[0].jump.rel = NULL;
     ir_br_queue[0].block = &graph->blocks[0];
     ir_br_queue_len = 1;
 
@@ -946,33 +1346,83 @@ code_entry_t ir_x86_64_assemble(recompiler_backend_t const *backend,
             start = code_buffer_ptr(emitter);
             ir_block_context[context.block->label].start = start;
             assemble_block(backend, emitter, context.block);
+        } else if (context.jump.rel == NULL) {
+            // The fallthrough block was already assembled,
+            // jump to its start. The offset is known, the short
+            // encoding is selected directly.
+            ptrdiff_t rel8 = start - (code_buffer_ptr(emitter) + 2);
+            context.jump.rel8 = ir_peephole && rel8 >= INT8_MIN;
+            context.jump.rel = context.jump.rel8 ?
+                emit_jmp_rel8(emitter, 0) : emit_jmp_rel32(emitter, 0);
         }
-        patch_jmp_rel32(emitter, context.rel32, start);
+        patch_jump(emitter, context.jump, start);
     }
 
     // Mark the current location as exit label.
     unsigned char *exit_label = code_buffer_ptr(emitter);
 
-    // Restore the stack pointer.
-    // Only necessary if variables were spilled on the stack.
-    emit_mov_r64_r64(emitter, RSP, RBP);
-
-    // Restore callee saves.
-    emit_pop_r64(emitter, R15);
-    emit_pop_r64(emitter, R14);
-    emit_pop_r64(emitter, R13);
-    emit_pop_r64(emitter, R12);
-    emit_pop_r64(emitter, RBP);
+    // Restore the stack pointer and callee saves.
+    emit_leave_frame(emitter);
     emit_ret(emitter);
 
     // Patch all exit instructions to jump to the exit label.
     for (unsigned nr = 0; nr < ir_exit_queue_len; nr++) {
-        patch_jmp_rel32(emitter, ir_exit_queue[nr].rel32, exit_label);
+        patch_jump(emitter, ir_exit_queue[nr].jump, exit_label);
     }
+}
+
+code_entry_t ir_x86_64_assemble(recompiler_backend_t const *backend,
+                                code_buffer_t *emitter,
+                                ir_graph_t const *graph,
+                                size_t *binary_len) {
+
+    // Reset the emitter. Sets a catch point for exception generated by the
+    // emit_* helpers. An negative return signifies a generation failure.
+    if (catch_code_buffer_error(emitter) < 0) {
+        set_emitter_peephole(true);
+        return NULL;
+    }
+
+    void *entry = code_buffer_ptr(emitter);
+    size_t entry_length = emitter->length;
+    unsigned used_register_bitmap = 0;
+    unsigned stack_size = alloc_vars(graph, 1u << R15, &used_register_bitmap);
+
+    // The graph is assembled twice. The first pass generates the plain
+    // encoding with rel32 jumps, and records the jump offsets.
+    // The offsets can only decrease in the second pass, which shortens
+    // the jumps found within the rel8 range and applies the peephole
+    // simplifications.
+    ir_peephole = false;
+    set_emitter_peephole(false);
+    memset(ir_jump_rel8, 0, sizeof(ir_jump_rel8));
+    assemble_graph(backend, emitter, graph, stack_size);
+    size_t plain_length = emitter->length - entry_length;
+
+    unsigned nr_jumps = ir_jump_count < IR_JUMP_MAX ?
+        ir_jump_count : IR_JUMP_MAX;
+    for (unsigned nr = 0; nr < nr_jumps; nr++) {
+        unsigned char *rel32 = ir_jump_site[nr];
+        int32_t rel = (int32_t)((uint32_t)rel32[0] |
+            ((uint32_t)rel32[1] << 8) |
+            ((uint32_t)rel32[2] << 16) |
+            ((uint32_t)rel32[3] << 24));
+        ir_jump_rel8[nr] = rel >= INT8_MIN && rel <= INT8_MAX;
+    }
+
+    ir_peephole = true;
+    set_emitter_peephole(true);
+    emitter->length = entry_length;
+    assemble_graph(backend, emitter, graph, stack_size);
+    size_t length = emitter->length - entry_length;
+
+    // Update code size statistics.
+    __atomic_fetch_add(&ir_stats.nr_bytes, length, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ir_stats.nr_bytes_saved, plain_length - length,
+                       __ATOMIC_RELAXED);
 
     // Return the length of the generated binary code.
-    if (binary_len) *binary_len =
-        (size_t)(code_buffer_ptr(emitter) - (unsigned char *)entry);
+    if (binary_len) *binary_len = length;
 
     // Return the address of the graph entry.
     return entry;
@@ -2,6 +2,13 @@
 #include <stdbool.h>
 #include "emitter.h"
 
+/* Peephole simplifications are enabled per recompiler thread. */
+static _Thread_local bool emitter_peephole = true;
+
+void set_emitter_peephole(bool enabled) {
+    emitter_peephole = enabled;
+}
+
 static inline bool is_int8(int64_t v) {
     return v >= INT8_MIN && v <= INT8_MAX;
 }
@@ -229,6 +236,15 @@ void emit_instruction_1_Kv_Iv(code_buffer_t *emitter, unsigned size,
     else                 emit_i64_le(emitter, imm);
 }
 
+static
+unsigned char *emit_instruction_1_Jb(code_buffer_t *emitter,
+                                     uint8_t opcode, int8_t rel) {
+    emit_u8(emitter, opcode);
+    unsigned char *ptr = emitter->ptr + emitter->length;
+    emit_i8(emitter, rel);
+    return ptr;
+}
+
 static
 unsigned char *emit_instruction_1_Jz(code_buffer_t *emitter, unsigned size,
                                      uint8_t opcode, int64_t rel) {
@@ -242,6 +258,15 @@ unsigned char *emit_instruction_1_Jz(code_buffer_t *emitter, unsigned size,
     return ptr;
 }
 
+static
+void emit_instruction_2_Kv(code_buffer_t *emitter, unsigned size,
+                           uint8_t opcode, unsigned reg) {
+    x86_64_mem_t m = mem_direct(reg);
+    emit_rex_reg_modrm(emitter, size == 64, 0, &m);
+    emit_u8(emitter, 0x0f);
+    emit_u8(emitter, opcode | (reg & 7));
+}
+
 static
 void emit_instruction_2_Eb_Gb(code_buffer_t *emitter, uint8_t opcode,
                               x86_64_mem_t *modrm, unsigned reg) {
@@ -318,6 +343,20 @@ void patch_jmp_rel32(code_buffer_t *emitter,
     rel32[3] = _rel32 >> 24;
 }
 
+void patch_jmp_rel8(code_buffer_t *emitter,
+    unsigned char *rel8, unsigned char *target) {
+
+    if (rel8 == NULL) {
+        return;
+    }
+
+    ptrdiff_t rel = target - rel8 - 1;
+    if (!is_int8(rel)) {
+        fail_code_buffer(emitter);
+    }
+    rel8[0] = (uint8_t)(int8_t)rel;
+}
+
 void emit_add_al_imm8(code_buffer_t *emitter, int8_t imm8) {
     emit_instruction_1_AL_Ib(emitter, 0x04, imm8);
 }
@@ -709,6 +748,26 @@ unsigned char *emit_jne_rel32(code_buffer_t *emitter, int32_t rel32) {
     return emit_instruction_2_Jz(emitter, 32, 0x85, rel32);
 }
 
+unsigned char *emit_jae_rel32(code_buffer_t *emitter, int32_t rel32) {
+    return emit_instruction_2_Jz(emitter, 32, 0x83, rel32);
+}
+
+unsigned char *emit_jmp_rel8(code_buffer_t *emitter, int8_t rel8) {
+    return emit_instruction_1_Jb(emitter, 0xeb, rel8);
+}
+
+unsigned char *emit_je_rel8(code_buffer_t *emitter, int8_t rel8) {
+    return emit_instruction_1_Jb(emitter, 0x74, rel8);
+}
+
+unsigned char *emit_jne_rel8(code_buffer_t *emitter, int8_t rel8) {
+    return emit_instruction_1_Jb(emitter, 0x75, rel8);
+}
+
+unsigned char *emit_jae_rel8(code_buffer_t *emitter, int8_t rel8) {
+    return emit_instruction_1_Jb(emitter, 0x73, rel8);
+}
+
 void emit_mov_r8_imm8(code_buffer_t *emitter, unsigned r8, int8_t imm8) {
     emit_instruction_1_Kb_Ib(emitter, 0xb0, r8, imm8);
 }
@@ -822,6 +881,19 @@ void emit_push_r64(code_buffer_t *emitter, unsigned r64) {
     emit_instruction_1_Kv(emitter, 64, 0x50, r64);
 }
 
+void emit_bswap_r32(code_buffer_t *emitter, unsigned r32) {
+    emit_instruction_2_Kv(emitter, 32, 0xc8, r32);
+}
+
+void emit_bswap_r64(code_buffer_t *emitter, unsigned r64) {
+    emit_instruction_2_Kv(emitter, 64, 0xc8, r64);
+}
+
+void emit_rol_r16_imm8(code_buffer_t *emitter, unsigned r16, uint8_t imm8) {
+    x86_64_mem_t m16 = mem_direct(r16);
+    emit_instruction_1_Ev_Ib(emitter, 16, 0xc1, 0x00, &m16, imm8);
+}
+
 void emit_ret(code_buffer_t *emitter) {
     // Near return.
     emit_u8(emitter, 0xc3);
@@ -1569,6 +1641,11 @@ void emit_mov_op0_op1(code_buffer_t *emitter,
         break;
 
     case REGISTER_REGISTER:
+        // Moving a register to itself is a no-op, except for 32bit
+        // moves which clear the upper half of the register.
+        if (emitter_peephole && op0->reg == op1->reg && size != 32) {
+            break;
+        }
         m = mem_direct(op0->reg);
         if (size == 8) {
             emit_instruction_1_Eb_Gb(emitter,
@@ -1890,6 +1967,10 @@ void emit_cmp_src0_src1(code_buffer_t *emitter,
         x86_64_operand_t tmp = op_reg(src0->size, RAX); // XXX
         emit_mov_op0_op1(emitter, &tmp, src0);
         emit_cmp_op0_op1(emitter, &tmp, src1);
+    } else if (emitter_peephole && src0->kind == REGISTER &&
+               src1->kind == IMMEDIATE && src1->imm == 0) {
+        // test r, r sets the flags as cmp r, 0 with a shorter encoding.
+        emit_test_op0_op1(emitter, src0, src0);
     } else {
         emit_cmp_op0_op1(emitter, src0, src1);
     }
@@ -1941,7 +2022,7 @@ static void emit_unop_dst_src0(code_buffer_t *emitter, uint8_t opcode_ext,
         break;
     case MODE_1:
         emit_mov_op0_op1(emitter, dst, src0);
-        emit_unop_op0(emitter, opcode_ext, src0);
+        emit_unop_op0(emitter, opcode_ext, dst);
         break;
     case MODE_2:
         emit_mov_op0_op1(emitter, &tmp, src0);
@@ -1967,6 +2048,26 @@ void emit_neg_dst_src0(code_buffer_t *emitter, x86_64_operand_t *dst,
     emit_unop_dst_src0(emitter, 0x03, dst, src0);
 }
 
+void emit_bswap_dst_src0(code_buffer_t *emitter, x86_64_operand_t *dst,
+                         x86_64_operand_t *src0) {
+    if (dst->size != src0->size || dst->kind == IMMEDIATE) {
+        fail_code_buffer(emitter);
+        return;
+    }
+
+    // The byte swap is always performed in the temporary register,
+    // the 16bit swap is implemented as a rotation.
+    x86_64_operand_t tmp = op_reg(src0->size, RAX);
+    emit_mov_op0_op1(emitter, &tmp, src0);
+    switch (src0->size) {
+    case 16: emit_rol_r16_imm8(emitter, RAX, 8); break;
+    case 32: emit_bswap_r32(emitter, RAX); break;
+    case 64: emit_bswap_r64(emitter, RAX); break;
+    default: fail_code_buffer(emitter); return;
+    }
+    emit_mov_op0_op1(emitter, dst, &tmp);
+}
+
 /**
  * Convert a shift instruction with separate destination operand into
  * a simple instruction operating on the left operand. Namely insert
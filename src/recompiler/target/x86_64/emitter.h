@@ -3,6 +3,7 @@
 #define _RECOMPILER_TARGET_X86_64_EMITTER_H_INCLUDED_
 
 #include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -79,10 +80,19 @@ static inline x86_64_mem_t mem_indirect_scaled_disp(
         .rm = 4, .base = base, .index = index, .scale = scale };
 }
 
+/** Enable or disable the peephole simplifications of the generic emitters
+ * for the current thread: redundant register moves are dropped, and
+ * comparisons with zero are replaced by test instructions. */
+void set_emitter_peephole(bool enabled);
+
 /** Patch a previously generated jump relative offset to point to the correct
  * address. The call fails if the target cannot be reached. */
 void patch_jmp_rel32(code_buffer_t *emitter, unsigned char *rel32,
                      unsigned char *target);
+/** Patch a previously generated jump 8bit relative offset. The call fails
+ * if the target is out of the rel8 range. */
+void patch_jmp_rel8(code_buffer_t *emitter, unsigned char *rel8,
+                    unsigned char *target);
 
 void emit_add_al_imm8(code_buffer_t *emitter, int8_t imm8);
 void emit_add_eax_imm32(code_buffer_t *emitter, int32_t imm32);
@@ -176,6 +186,11 @@ void emit_imul_rN_rN(code_buffer_t *emitter, unsigned width, unsigned drN, unsig
 unsigned char *emit_jmp_rel32(code_buffer_t *emitter, int32_t rel32);
 unsigned char *emit_je_rel32(code_buffer_t *emitter, int32_t rel32);
 unsigned char *emit_jne_rel32(code_buffer_t *emitter, int32_t rel32);
+unsigned char *emit_jae_rel32(code_buffer_t *emitter, int32_t rel32);
+unsigned char *emit_jmp_rel8(code_buffer_t *emitter, int8_t rel8);
+unsigned char *emit_je_rel8(code_buffer_t *emitter, int8_t rel8);
+unsigned char *emit_jne_rel8(code_buffer_t *emitter, int8_t rel8);
+unsigned char *emit_jae_rel8(code_buffer_t *emitter, int8_t rel8);
 
 void emit_lea_r64_m(code_buffer_t *emitter, unsigned r64, x86_64_mem_t m);
 
@@ -195,6 +210,10 @@ void emit_mov_r64_r64(code_buffer_t *emitter, unsigned dr64, unsigned sr64);
 void emit_mov_rN_mN(code_buffer_t *emitter, unsigned width, unsigned rN, x86_64_mem_t mN);
 void emit_mov_mN_rN(code_buffer_t *emitter, unsigned width, x86_64_mem_t mN, unsigned rN);
 
+void emit_bswap_r32(code_buffer_t *emitter, unsigned r32);
+void emit_bswap_r64(code_buffer_t *emitter, unsigned r64);
+void emit_rol_r16_imm8(code_buffer_t *emitter, unsigned r16, uint8_t imm8);
+
 void emit_not_r8(code_buffer_t *emitter, unsigned r8);
 void emit_not_r16(code_buffer_t *emitter, unsigned r16);
 void emit_not_r32(code_buffer_t *emitter, unsigned r32);
@@ -508,6 +527,13 @@ void emit_not_dst_src0(code_buffer_t *emitter, x86_64_operand_t *dst,
 void emit_neg_dst_src0(code_buffer_t *emitter, x86_64_operand_t *dst,
                        x86_64_operand_t *src0);
 
+/**
+ * Byte swap, the operands dst, src0 must have the same operand size
+ * (16, 32 or 64). The swap is performed in the temporary register RAX.
+ */
+void emit_bswap_dst_src0(code_buffer_t *emitter, x86_64_operand_t *dst,
+                         x86_64_operand_t *src0);
+
 /**
  * Shift instruction group, generalized implementation.
  * The operands dst, op0 must have the same operand size.
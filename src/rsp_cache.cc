@@ -0,0 +1,233 @@
+
+#include <atomic>
+#include <cstring>
+
+#include <fmt/color.h>
+#include <fmt/format.h>
+
+#include <lib/crc32.h>
+#include <recompiler/ir.h>
+#include <recompiler/backend.h>
+#include <recompiler/code_buffer.h>
+#include <recompiler/passes.h>
+#include <recompiler/target/rsp.h>
+#include <recompiler/target/x86_64.h>
+#include <r4300/hw.h>
+#include <r4300/rsp.h>
+#include <r4300/state.h>
+
+#include "rsp_cache.h"
+
+using namespace R4300;
+
+namespace rsp_cache {
+
+/** Number of microcode images whose recompiled blocks are retained. */
+#define RSP_CACHE_IMAGE_MAX     16
+/** Size of the code buffer shared by all images. */
+#define RSP_CACHE_BUFFER_SIZE   (4 * 1024 * 1024)
+/** Number of instruction words in IMEM. */
+#define RSP_CACHE_MAP_SIZE      (sizeof(state.imem) / 4)
+
+unsigned long recompiled_cycles;
+unsigned long recompiled_blocks;
+unsigned long clears;
+
+/**
+ * @brief Recompiled blocks of a microcode image.
+ * @var image::crc
+ *      CRC32 of the IMEM contents.
+ * @var image::last_use
+ *      Value of \ref use_counter when the image was last selected,
+ *      for least recently used replacement.
+ * @var image::map
+ *      Entry points of the blocks recompiled from each IMEM word address,
+ *      NULL if not yet recompiled, or \ref block_failed if the block
+ *      could not be recompiled.
+ */
+struct image {
+    bool valid;
+    uint32_t crc;
+    unsigned long last_use;
+    code_entry_t map[RSP_CACHE_MAP_SIZE];
+};
+
+static struct image images[RSP_CACHE_IMAGE_MAX];
+static struct image *current_image;
+static unsigned long use_counter;
+static std::atomic_bool imem_modified{true};
+static bool rsp_halted = true;
+static bool disabled;
+
+static recompiler_backend_t *backend;
+static code_buffer_t *buffer;
+
+/** Cycle counter incremented by the recompiled code, and target of the
+ * current run. */
+static uint64_t cycles;
+static uint64_t cycles_limit;
+
+/** Placeholder entry for blocks that cannot be recompiled. */
+static void block_failed(void) {
+}
+
+/** Allocate the recompiler backend and code buffer on first use.
+ * The recompiler is disabled if the allocations fail. */
+static bool alloc_recompiler(void) {
+    if (backend != NULL) {
+        return true;
+    }
+    if (disabled) {
+        return false;
+    }
+    backend = ir_rsp_recompiler_backend(&cycles);
+    buffer = alloc_code_buffer(RSP_CACHE_BUFFER_SIZE);
+    if (backend == NULL || buffer == NULL) {
+        fmt::print(fmt::fg(fmt::color::tomato),
+            "failed to allocate the RSP recompiler, "
+            "falling back to the interpreter\n");
+        free_recompiler_backend(backend);
+        free_code_buffer(buffer);
+        backend = NULL;
+        buffer = NULL;
+        disabled = true;
+        return false;
+    }
+    return true;
+}
+
+/** Identify the microcode image loaded in IMEM. The least recently used
+ * image is replaced if the contents are not known. */
+static void select_image(void) {
+    uint32_t crc = calculate_crc32(state.imem, sizeof(state.imem));
+    struct image *lru = &images[0];
+    use_counter++;
+    for (struct image &image : images) {
+        if (image.valid && image.crc == crc) {
+            image.last_use = use_counter;
+            current_image = &image;
+            return;
+        }
+        if (!image.valid ||
+            (lru->valid && image.last_use < lru->last_use)) {
+            lru = &image;
+        }
+    }
+    lru->valid = true;
+    lru->crc = crc;
+    lru->last_use = use_counter;
+    memset(lru->map, 0, sizeof(lru->map));
+    current_image = lru;
+}
+
+/** Drop the recompiled blocks of all images, to reclaim the code buffer. */
+static void clear_images(void) {
+    for (struct image &image : images) {
+        memset(image.map, 0, sizeof(image.map));
+    }
+    clear_code_buffer(buffer);
+    clears++;
+}
+
+/** Recompile the block starting at the IMEM address \p address. */
+static code_entry_t compile(uint32_t address) {
+    size_t len;
+    size_t binary_len;
+    clear_recompiler_backend(backend);
+    ir_graph_t *graph = ir_rsp_disassemble(backend, address, state.imem, &len);
+    if (graph == NULL) {
+        return block_failed;
+    }
+    ir_optimize(backend, graph);
+
+    // The chaining of exits is configured for the MIPS blocks.
+    ir_x86_64_suspend_link(true);
+    code_entry_t binary = ir_x86_64_assemble(backend, buffer, graph,
+                                             &binary_len);
+    if (binary == NULL) {
+        clear_images();
+        binary = ir_x86_64_assemble(backend, buffer, graph, &binary_len);
+    }
+    ir_x86_64_suspend_link(false);
+
+    recompiled_blocks++;
+    return binary != NULL ? binary : block_failed;
+}
+
+/**
+ * Run the RSP for \p nr_cycles cycles, or until the RSP is halted.
+ * When \p sync is true, the execution also stops before the instructions
+ * observable by the CPU, and the cycles left are dropped.
+ * @return true if the execution stopped before an instruction observable
+ *  by the CPU.
+ */
+static bool run(unsigned long nr_cycles, bool sync) {
+    if (state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) {
+        // The RSP cannot leave the halted state by itself; return early
+        // instead of stepping through the cycles skipped by idle loops.
+        rsp_halted = true;
+        return false;
+    }
+    if (rsp_halted) {
+        // IMEM may have been written while the RSP was halted,
+        // and the cycles owed by the previous run are dropped.
+        rsp_halted = false;
+        imem_modified.store(true, std::memory_order_relaxed);
+        cycles_limit = cycles;
+    }
+
+    cycles_limit += nr_cycles;
+    bool enabled = alloc_recompiler();
+    while (cycles < cycles_limit &&
+           !(state.hwreg.SP_STATUS_REG & SP_STATUS_HALT)) {
+        // Continuing to the next instruction is equivalent to jumping to
+        // it, which lets the recompiled blocks start from any instruction.
+        if (state.rsp.nextAction == State::Action::Continue) {
+            state.rsp.nextAction = State::Action::Jump;
+            state.rsp.nextPc = state.rspreg.pc + 4;
+        }
+        // The recompiled blocks start with the observable instructions,
+        // checking the block entries is sufficient.
+        if (sync && R4300::RSP::at_sync_point()) {
+            cycles_limit = cycles;
+            return true;
+        }
+
+        uint64_t pc = state.rsp.nextPc;
+        if (enabled &&
+            state.rsp.nextAction == State::Action::Jump &&
+            pc < sizeof(state.imem) && (pc & 0x3u) == 0) {
+            if (imem_modified.exchange(false, std::memory_order_relaxed)) {
+                select_image();
+            }
+            code_entry_t *entry = &current_image->map[pc / 4];
+            if (*entry == NULL) {
+                *entry = compile(pc);
+            }
+            if (*entry != block_failed) {
+                uint64_t start = cycles;
+                (*entry)();
+                recompiled_cycles += cycles - start;
+                continue;
+            }
+        }
+
+        R4300::RSP::step();
+        cycles++;
+    }
+    return false;
+}
+
+void exec(unsigned long nr_cycles) {
+    (void)run(nr_cycles, false);
+}
+
+bool exec_until_sync(unsigned long nr_cycles) {
+    return run(nr_cycles, true);
+}
+
+void invalidate(void) {
+    imem_modified.store(true, std::memory_order_relaxed);
+}
+
+}; /* namespace rsp_cache */
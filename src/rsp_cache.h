@@ -0,0 +1,59 @@
+
+#ifndef _RSP_CACHE_H_INCLUDED_
+#define _RSP_CACHE_H_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Recompiler cache for the RSP.
+ *
+ * The RSP executes microcode loaded to IMEM by DMA, and the same few
+ * microcode images are swapped in and out repeatedly. The recompiled
+ * blocks are thus keyed by the CRC32 of the full IMEM contents: each
+ * distinct image owns a map from IMEM word addresses to recompiled
+ * blocks, and switching back to a known image reuses its blocks.
+ * The blocks are recompiled on first entry, on the thread running
+ * the RSP.
+ *
+ * The IMEM contents are hashed again after any write to IMEM, and when
+ * the RSP is restarted after being halted, which covers the IMEM writes
+ * made by the CPU without invalidation while the RSP is halted.
+ */
+namespace rsp_cache {
+
+/** Number of RSP cycles executed through recompiled code. */
+extern unsigned long recompiled_cycles;
+/** Number of RSP blocks recompiled. */
+extern unsigned long recompiled_blocks;
+/** Number of times the code buffer was cleared for lack of space. */
+extern unsigned long clears;
+
+/**
+ * @brief Run the RSP for \p cycles cycles.
+ *  Executes the recompiled blocks, and falls back to the interpreter for
+ *  the instructions that cannot be recompiled. The cycles overshot by
+ *  the last block are deducted from the next run.
+ *  Called from the interpreter thread only, in lockstep mode.
+ */
+void exec(unsigned long cycles);
+
+/**
+ * @brief Run the RSP for \p cycles cycles, stopping before the next
+ *  instruction accessing the coprocessor 0 or halting the RSP.
+ *  Called from the RSP thread only, the stopping instruction is left
+ *  to the interpreter thread.
+ * @return true if the execution stopped before such an instruction.
+ */
+bool exec_until_sync(unsigned long cycles);
+
+/**
+ * @brief Mark the IMEM contents as modified.
+ *  The current microcode image is identified again before the next
+ *  block is entered.
+ */
+void invalidate(void);
+
+}; /* namespace rsp_cache */
+
+#endif /* _RSP_CACHE_H_INCLUDED_ */
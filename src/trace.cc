@@ -32,7 +32,7 @@ void DebugBus::copy_trace(std::vector<Memory::BusTransaction> &trace) {
 }
 
 bool DebugBus::load(unsigned bytes, uint64_t addr, uint64_t *val) {
-    bool res = root.load(bytes, addr, val);
+    bool res = Memory::Bus::load(bytes, addr, val);
     if (enable_trace) {
         trace.push_back(
             Memory::BusTransaction(true, res, bytes, addr, res ? *val : 0));
@@ -41,7 +41,7 @@ bool DebugBus::load(unsigned bytes, uint64_t addr, uint64_t *val) {
 }
 
 bool DebugBus::store(unsigned bytes, uint64_t addr, uint64_t val) {
-    bool res = root.store(bytes, addr, val);
+    bool res = Memory::Bus::store(bytes, addr, val);
     if (enable_trace) {
         trace.push_back(
             Memory::BusTransaction(false, res, bytes, addr, val));
@@ -146,7 +146,7 @@ RecordBus::~RecordBus() {
 bool RecordBus::load(unsigned bytes, u64 address, u64 *value) {
     uint64_t pc = R4300::state.reg.pc;
     uint64_t cycles = R4300::state.cycles;
-    bool res = root.load(bytes, address, value);
+    bool res = Memory::Bus::load(bytes, address, value);
 
     unsigned char buf[35];
     buf[0] = 0;
@@ -170,7 +170,7 @@ bool RecordBus::load(unsigned bytes, u64 address, u64 *value) {
 bool RecordBus::store(unsigned bytes, u64 address, u64 value) {
     uint64_t pc = R4300::state.reg.pc;
     uint64_t cycles = R4300::state.cycles;
-    bool res = root.store(bytes, address, value);
+    bool res = Memory::Bus::store(bytes, address, value);
 
     unsigned char buf[35];
     buf[0] = 1;
@@ -205,7 +205,7 @@ ReplayBus::~ReplayBus() {
 bool ReplayBus::load(unsigned bytes, u64 address, u64 *value) {
     uint64_t pc = R4300::state.reg.pc;
     uint64_t cycles = R4300::state.cycles;
-    bool res = root.load(bytes, address, value);
+    bool res = Memory::Bus::load(bytes, address, value);
 
     unsigned char buf[35];
     is->read((char *)buf, sizeof(buf));
@@ -259,7 +259,7 @@ bool ReplayBus::load(unsigned bytes, u64 address, u64 *value) {
 bool ReplayBus::store(unsigned bytes, u64 address, u64 value) {
     uint64_t pc = R4300::state.reg.pc;
     uint64_t cycles = R4300::state.cycles;
-    bool res = root.store(bytes, address, value);
+    bool res = Memory::Bus::store(bytes, address, value);
 
     unsigned char buf[35];
     is->read((char *)buf, sizeof(buf));
@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fmt/format.h>
+#include <fmt/color.h>
+
+#include <debugger.h>
+#include <memory.h>
+
+/* Define stubs for core functions. */
+namespace core {
+
+void halt(std::string reason) {
+    (void)reason;
+}
+
+void invalidate_recompiler_cache(uint64_t start_phys_address,
+                                 uint64_t end_phys_address) {
+    (void)start_phys_address;
+    (void)end_phys_address;
+}
+
+}; /* namespace core */
+
+static u8 dram[0x400000];
+static u8 rom[0x1000000];
+static u64 io_register;
+
+static bool read_IO(unsigned bytes, u64 addr, u64 *value) {
+    (void)bytes; (void)addr;
+    *value = io_register;
+    return true;
+}
+
+static bool write_IO(unsigned bytes, u64 addr, u64 value) {
+    (void)bytes; (void)addr;
+    io_register = value;
+    return true;
+}
+
+/**
+ * Memory access generator. The physical addresses are drawn from a
+ * pseudo random sequence, with a distribution approaching the access
+ * patterns of the CPU: mostly DRAM, some ROM and IO register accesses.
+ */
+struct access_pattern {
+    u64 addresses[0x10000];
+
+    access_pattern() {
+        u32 seed = 0x12345678;
+        for (size_t nr = 0; nr < 0x10000; nr++) {
+            seed = seed * 1103515245 + 12345;
+            u32 offset = (seed >> 8) & 0x3ffffc;
+            switch (seed & 0xf) {
+            case 0:  addresses[nr] = 0x04300000 + (offset & 0xc); break;
+            case 1:  addresses[nr] = 0x04400000 + (offset & 0x3c); break;
+            case 2:
+            case 3:  addresses[nr] = 0x10000000 + offset; break;
+            default: addresses[nr] = offset; break;
+            }
+        }
+    }
+};
+
+static access_pattern pattern;
+
+/**
+ * Run \p nr_accesses alternating loads and stores with the selected
+ * dispatch method.
+ * @return the number of bus accesses per second.
+ */
+template<typename Load, typename Store>
+static double run_benchmark(unsigned long nr_accesses, Load load, Store store) {
+    auto start = std::chrono::steady_clock::now();
+    u64 sum = 0;
+    for (unsigned long nr = 0; nr < nr_accesses; nr++) {
+        u64 addr = pattern.addresses[nr & 0xffff];
+        u64 value;
+        if (nr & 1) {
+            load(4, addr, &value);
+            sum += value;
+        } else if (addr < 0x10000000) {
+            store(4, addr, sum);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    io_register += sum;
+    return nr_accesses / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+    unsigned long nr_accesses = argc > 1 ? strtoul(argv[1], NULL, 0) : 50000000;
+    Memory::Bus bus(32);
+
+    // Replicate the layout of the N64 physical address space.
+    bus.root.insertRam(  0x00000000llu, 0x400000,  dram);
+    bus.root.insertIOmem(0x03f00000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04040000llu, 0x80000,   read_IO, write_IO);
+    bus.root.insertIOmem(0x04100000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04200000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04300000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04400000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04500000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04600000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04700000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x04800000llu, 0x100000,  read_IO, write_IO);
+    bus.root.insertIOmem(0x05000000llu, 0x1000000, read_IO, write_IO);
+    bus.root.insertIOmem(0x06000000llu, 0x2000000, read_IO, write_IO);
+    bus.root.insertIOmem(0x08000000llu, 0x8000000, read_IO, write_IO);
+    bus.root.insertRom(  0x10000000llu, 0x1000000, rom);
+    bus.updatePageTable();
+
+    double region_rate = run_benchmark(nr_accesses,
+        [&](unsigned bytes, u64 addr, u64 *value) {
+            return bus.root.load(bytes, addr, value); },
+        [&](unsigned bytes, u64 addr, u64 value) {
+            return bus.root.store(bytes, addr, value); });
+    double page_rate = run_benchmark(nr_accesses,
+        [&](unsigned bytes, u64 addr, u64 *value) {
+            return bus.load(bytes, addr, value); },
+        [&](unsigned bytes, u64 addr, u64 value) {
+            return bus.store(bytes, addr, value); });
+
+    fmt::print("region tree dispatch: {:>8.2f} M accesses/s\n",
+        region_rate / 1e6);
+    fmt::print("page table dispatch:  {:>8.2f} M accesses/s\n",
+        page_rate / 1e6);
+    fmt::print(fmt::fg(fmt::color::green), "speedup: {:.2f}x\n",
+        page_rate / region_rate);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <fmt/format.h>
+#include <fmt/color.h>
+
+#include <recompiler/cache.h>
+#include <recompiler/code_buffer.h>
+
+/** Size of the DRAM range covered by the caches. */
+#define DRAM_SIZE       UINT64_C(0x400000)
+/** Number of recompiled blocks. */
+#define BLOCK_COUNT     8192
+/** Length of the sequence of block entries. */
+#define TRACE_LEN       0x10000
+
+/**
+ * Block entry generator. The block start addresses are drawn from
+ * a pseudo random sequence; the entries follow the pattern of the
+ * interpreter dispatch loop, mostly returning to a small set of hot
+ * blocks.
+ */
+struct entry_pattern {
+    uint64_t blocks[BLOCK_COUNT];
+    uint64_t addresses[TRACE_LEN];
+
+    entry_pattern() {
+        uint32_t seed = 0x12345678;
+        for (size_t nr = 0; nr < BLOCK_COUNT; nr++) {
+            seed = seed * 1103515245 + 12345;
+            blocks[nr] = (seed >> 8) & (DRAM_SIZE - 4);
+        }
+        for (size_t nr = 0; nr < TRACE_LEN; nr++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned block = (seed >> 8) % BLOCK_COUNT;
+            // Nine entries out of ten go to the hottest tenth of the blocks.
+            if (((seed >> 4) % 10) != 0) {
+                block %= BLOCK_COUNT / 10;
+            }
+            addresses[nr] = blocks[block];
+        }
+    }
+};
+
+static entry_pattern pattern;
+
+/**
+ * Direct mapped cache, with the layout of the recompiler cache of the
+ * core: one entry per DRAM word, holding the offset of the binary in the
+ * code buffer of the page, and the valid bit.
+ */
+struct direct_map {
+    unsigned page_shift;
+    code_buffer_t *buffers;
+    std::unique_ptr<std::atomic_uint32_t[]> map;
+
+    direct_map(size_t page_size, size_t buffer_size) {
+        page_shift = __builtin_ctz(page_size);
+        buffers = alloc_code_buffer_array(DRAM_SIZE >> page_shift, buffer_size);
+        map.reset(new std::atomic_uint32_t[DRAM_SIZE >> 2]());
+    }
+    ~direct_map() {
+        free_code_buffer_array(buffers);
+    }
+
+    void update(uint64_t address, uint32_t offset) {
+        map[address >> 2] = (offset << 2) | 0x1;
+    }
+
+    code_entry_t query(uint64_t address) {
+        uint32_t entry = map[address >> 2];
+        if ((entry & 0x1) == 0) {
+            return NULL;
+        }
+        return (code_entry_t)(buffers[address >> page_shift].ptr +
+            (entry >> 2));
+    }
+};
+
+/**
+ * Run \p nr_queries cache queries with the selected query method.
+ * @return the number of queries per second.
+ */
+template<typename Query>
+static double run_benchmark(unsigned long nr_queries, Query query) {
+    auto start = std::chrono::steady_clock::now();
+    uintptr_t sum = 0;
+    for (unsigned long nr = 0; nr < nr_queries; nr++) {
+        sum += (uintptr_t)query(pattern.addresses[nr & (TRACE_LEN - 1)]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    if (sum == 0) {
+        fmt::print(fmt::fg(fmt::color::tomato), "no cache hits\n");
+    }
+    return nr_queries / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+    unsigned long nr_queries = argc > 1 ? strtoul(argv[1], NULL, 0) : 50000000;
+    size_t buffer_size = 0x40000;
+
+    for (size_t page_size = 0x1000; page_size <= 0x10000; page_size <<= 2) {
+        size_t page_count = DRAM_SIZE / page_size;
+        size_t hash_map_size = page_size / 32;
+
+        // Populate both caches with the same recompiled blocks.
+        // The binaries are not executed, only the entry points are
+        // recorded.
+        direct_map direct(page_size, buffer_size);
+        recompiler_cache_t *hash = alloc_recompiler_cache(
+            page_size, page_count, buffer_size, hash_map_size);
+        if (hash == NULL) {
+            fmt::print(fmt::fg(fmt::color::tomato),
+                "failed to allocate the hash mapped cache\n");
+            return 1;
+        }
+        for (size_t nr = 0; nr < BLOCK_COUNT; nr++) {
+            uint64_t address = pattern.blocks[nr];
+            uint32_t offset = (address & (page_size - 1)) * 4;
+            code_buffer_t *emitter;
+            (void)query_recompiler_cache(hash, address, &emitter, NULL);
+            (void)update_recompiler_cache(hash, address,
+                (code_entry_t)(direct.buffers[address / page_size].ptr + offset),
+                16);
+            direct.update(address, offset);
+        }
+
+        double direct_rate = run_benchmark(nr_queries,
+            [&](uint64_t address) {
+                return direct.query(address); });
+        double hash_rate = run_benchmark(nr_queries,
+            [&](uint64_t address) {
+                code_buffer_t *emitter;
+                return query_recompiler_cache(hash, address, &emitter, NULL); });
+
+        float map_usage, buffer_usage;
+        get_recompiler_cache_stats(hash, &map_usage, &buffer_usage);
+        free_recompiler_cache(hash);
+
+        fmt::print("page size {:#x}:\n", page_size);
+        fmt::print("  direct map: {:>8.2f} M queries/s\n", direct_rate / 1e6);
+        fmt::print("  hash map:   {:>8.2f} M queries/s, {:.1f}% map usage\n",
+            hash_rate / 1e6, map_usage * 100);
+        fmt::print(fmt::fg(fmt::color::green), "  speedup: {:.2f}x\n",
+            direct_rate / hash_rate);
+    }
+    return 0;
+}
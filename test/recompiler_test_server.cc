@@ -1108,6 +1108,13 @@ void resume(void) {
     }
 }
 
+/* The RSP always runs in lockstep with the CPU. */
+void lock_rsp(void) {
+}
+
+void unlock_rsp(void) {
+}
+
 }; /* namespace core */
 
 
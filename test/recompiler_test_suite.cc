@@ -15,8 +15,11 @@
 #include <recompiler/backend.h>
 #include <recompiler/passes.h>
 #include <recompiler/code_buffer.h>
+#include <recompiler/serialize.h>
 #include <recompiler/target/x86_64.h>
 #include <recompiler/target/mips.h>
+#include <assembly/disassembler.h>
+#include <interpreter/interpreter.h>
 #include <debugger.h>
 
 namespace Memory {
@@ -120,6 +123,10 @@ public:
 
 }; /* Memory */
 
+/** Bounds of the executable image, defined by the linker. */
+extern "C" char __executable_start[];
+extern "C" char _end[];
+
 /* Define stubs for used, but unrequired machine features. */
 namespace R4300 {
 using namespace R4300;
@@ -292,6 +299,7 @@ struct test_case {
     uint64_t end_address;
     uint64_t start_cycles;
     uint64_t end_cycles;
+    uint64_t cycles_limit;
     std::vector<Memory::BusTransaction> trace;
     unsigned char *input;
     unsigned char *output;
@@ -492,6 +500,7 @@ static int parse_test_case(toml::node const *test_node,
     auto end_address_node = (*test_table)["end_address"];
     auto start_cycles_node = (*test_table)["start_cycles"];
     auto end_cycles_node = (*test_table)["end_cycles"];
+    auto cycles_limit_node = (*test_table)["cycles_limit"];
     auto trace_node = (*test_table)["trace"];
     toml::array const *trace_array;
 
@@ -507,6 +516,10 @@ static int parse_test_case(toml::node const *test_node,
         debugger::error(Debugger::CPU, "cannot identify test integer node 'end_cycles'");
         return -1;
     }
+    if (cycles_limit_node && !cycles_limit_node.is_integer()) {
+        debugger::error(Debugger::CPU, "invalid test integer node 'cycles_limit'");
+        return -1;
+    }
     if (!trace_node || !trace_node.is_array()) {
         debugger::error(Debugger::CPU, "cannot identify test array node 'trace'");
         return -1;
@@ -515,6 +528,8 @@ static int parse_test_case(toml::node const *test_node,
     test.end_address = strtoull((**end_address_node.as_string()).c_str(), NULL, 0);
     test.start_cycles =  start_cycles_node.as_integer()->get();
     test.end_cycles =  end_cycles_node.as_integer()->get();
+    test.cycles_limit = cycles_limit_node ?
+        cycles_limit_node.as_integer()->get() : UINT64_MAX;
 
     trace_array = trace_node.as_array();
     for (unsigned i = 0; i < trace_array->size(); i++) {
@@ -527,12 +542,30 @@ static int parse_test_case(toml::node const *test_node,
     return 0;
 }
 
+/** Cycle limit checked by the back edges of the recompiled loops,
+ * loaded from the 'cycles_limit' value of the current test case. */
+static uint64_t test_cycles_limit;
+
+/** Return true iff any test case of \p test_array sets a cycle limit.
+ * The backward branches are followed only for these test suites, to leave
+ * the graphs of the other test suites unchanged. */
+static bool has_cycles_limit(toml::array const *test_array) {
+    for (unsigned nr = 0; nr < test_array->size(); nr++) {
+        toml::table const *test_table = test_array->get(nr)->as_table();
+        if ((*test_table)["cycles_limit"])
+            return true;
+    }
+    return false;
+}
+
 int run_test_suite(recompiler_backend_t *backend,
                    code_buffer_t *emitter,
                    std::string const &test_dir,
                    std::string const &test_suite_name,
                    struct test_statistics *stats,
                    bool interpret,
+                   bool optimize_full,
+                   bool serialize,
                    bool verbose) {
     std::string test_filename   =
         test_dir + "/" + test_suite_name + ".toml";
@@ -596,8 +629,11 @@ int run_test_suite(recompiler_backend_t *backend,
     header.asm_code = **asm_code_node.as_string();
 
     clear_recompiler_backend(backend);
+    ir_mips_set_cycles_limit(has_cycles_limit(test_array) ?
+                             &test_cycles_limit : NULL);
     header.graph = ir_mips_disassemble(backend, header.start_address,
                                        header.bin_code, header.bin_code_len);
+    ir_mips_set_cycles_limit(NULL);
 
     /* Disassembly can fail due to resource limitations. */
     if (header.graph == NULL) {
@@ -615,7 +651,31 @@ int run_test_suite(recompiler_backend_t *backend,
     }
 
     /* Optimize the generated graph. */
-    ir_optimize(backend, header.graph);
+    if (optimize_full) {
+        ir_optimize_full(backend, header.graph);
+    } else {
+        ir_optimize(backend, header.graph);
+    }
+
+    /* Reload the optimized graph as the persistent code cache does.
+     * The host pointers are relocated against the executable image. */
+    if (serialize) {
+        static unsigned char buffer[0x40000];
+        ir_reloc_region_t region = {
+            (uintptr_t)__executable_start,
+            (uintptr_t)(_end - __executable_start) };
+        size_t len = ir_serialize_graph(header.graph, &region, 1,
+                                        buffer, sizeof(buffer));
+        clear_recompiler_backend(backend);
+        header.graph = len == 0 ? NULL :
+            ir_deserialize_graph(backend, &region, 1, buffer, len);
+        if (header.graph == NULL) {
+            debugger::error(Debugger::CPU,
+                "failed to serialize intermediate code");
+            print_backend_error_log(backend);
+            goto test_preparation_failure;
+        }
+    }
 
     if (verbose) {
         print_input_info(header);
@@ -700,6 +760,7 @@ int run_test_suite(recompiler_backend_t *backend,
         }
 
         R4300::state.cycles = test.start_cycles;
+        test_cycles_limit = test.cycles_limit;
         R4300::state.cp1reg.setFprAliases(R4300::state.cp0reg.FR());
         reg.pc = test.end_address;
         bus->reset(test.trace);
@@ -758,6 +819,80 @@ test_preparation_failure:
     return -1;
 }
 
+/**
+ * Check the idle loop detection against loops polling DRAM and device
+ * registers. DRAM is assumed to be only modified by scheduled events
+ * while the RSP is halted; the RDP registers are not stable.
+ * The loops are located at 0xffffffff80000400, and evaluated at the
+ * cycle count 1000, with the next event scheduled at 5000 and the next
+ * VI line starting at 1050.
+ */
+static void run_idle_loop_checks(struct test_statistics *stats) {
+    u64 const address = UINT64_C(0xffffffff80000400);
+    static struct {
+        char const *name;
+        u32 instrs[3];
+        u64 a0;
+        bool rsp_halted;
+        unsigned length;
+        ulong until;
+    } const checks[] = {
+        /* lw t0, 0(a0); beq t0, zero, loop; nop */
+        { "poll dram", { 0x8c880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffff80001000), true, 3, 5000 },
+        { "poll dram, rsp running", { 0x8c880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffff80001000), false, 3, 0 },
+        { "poll dmem", { 0x8c880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffffa4000100), true, 3, 5000 },
+        { "poll mi_intr", { 0x8c880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffffa4300008), true, 3, 5000 },
+        { "poll vi_current", { 0x8c880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffffa4400010), true, 3, 1050 },
+        { "poll dpc_status", { 0x8c880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffffa410000c), true, 3, 0 },
+        { "poll unaligned", { 0x8c880002, 0x1100fffe, 0 },
+          UINT64_C(0xffffffff80001000), true, 3, 0 },
+        /* sw t0, 0(a0); beq t0, zero, loop; nop */
+        { "store", { 0xac880000, 0x1100fffe, 0 },
+          UINT64_C(0xffffffff80001000), true, 0, 0 },
+        /* addiu t0, t0, 1; beq t0, zero, loop; nop */
+        { "counter", { 0x25080001, 0x1100fffe, 0 },
+          UINT64_C(0xffffffff80001000), true, 0, 0 },
+        /* lw t0, 0(a0); beq t0, zero, loop+4; nop */
+        { "branch target", { 0x8c880000, 0x1100ffff, 0 },
+          UINT64_C(0xffffffff80001000), true, 0, 0 },
+    };
+
+    for (auto const &check : checks) {
+        R4300::state.reg.gpr[4] = check.a0;
+        R4300::state.cycles = 1000;
+        R4300::state.cpu.nextEvent = 5000;
+        R4300::state.hwreg.vi_LastCycleCount = 950;
+        R4300::state.hwreg.vi_CyclesPerLine = 100;
+        R4300::state.hwreg.SP_STATUS_REG =
+            check.rsp_halted ? SP_STATUS_HALT : 0;
+
+        ulong until = 0;
+        unsigned length =
+            interpreter::cpu::idle_loop_length(address, check.instrs, 3);
+        bool idle =
+            interpreter::cpu::idle_loop_until(address, check.instrs, 3, &until);
+
+        fmt::print("+ [idle loop] {} -- ", check.name);
+        if (length != check.length || idle != (check.until != 0) ||
+            (idle && until != check.until)) {
+            fmt::print(fmt::fg(fmt::color::tomato), "FAILED\n");
+            fmt::print(fmt::emphasis::italic,
+                "length {}, until {} (expected {}, {})\n",
+                length, idle ? until : 0, check.length, check.until);
+            stats->total_failed++;
+        } else {
+            fmt::print(fmt::fg(fmt::color::chartreuse), "PASS\n");
+            stats->total_pass++;
+        }
+    }
+}
+
 std::vector<std::string> list_test_suites(std::string &dir) {
     DIR* dirp = opendir(dir.c_str());
     std::vector<std::string> test_suites;
@@ -785,6 +920,9 @@ int main(int argc, char **argv) {
         ("I,input",     "Select test input directory",
              cxxopts::value<std::string>())
         ("i,interpret", "Run the IR interpreter")
+        ("O,optimize-full", "Run the full optimization pipeline")
+        ("s,serialize", "Reload the optimized code through the code cache serialization")
+        ("l,idle-loops", "Run the idle loop detection checks")
         ("v,verbose",   "Enable verbose logs")
         ("test",        "Test files",
             cxxopts::value<std::vector<std::string>>())
@@ -795,9 +933,12 @@ int main(int argc, char **argv) {
     auto result = options.parse(argc, argv);
     std::string input_dir = "test/recompiler";
     bool interpret = result.count("interpret") > 0;
+    bool optimize_full = result.count("optimize-full") > 0;
+    bool serialize = result.count("serialize") > 0;
+    bool idle_loops = result.count("idle-loops") > 0;
     bool verbose = result.count("verbose") > 0;
     bool all = result.count("all") > 0;
-    bool random = !all && result.count("test") == 0;
+    bool random = !all && !idle_loops && result.count("test") == 0;
 
     if (result.count("help")) {
         std::cout << options.help() << std::endl;
@@ -813,18 +954,22 @@ int main(int argc, char **argv) {
     recompiler_backend_t *backend = ir_mips_recompiler_backend();
     code_buffer_t *emitter = alloc_code_buffer(0x4000);
 
+    if (idle_loops) {
+        run_idle_loop_checks(&test_stats);
+    }
+
     if (random) {
         unsigned selected = std::rand() % test_suites.size();
         run_test_suite(backend, emitter,
             input_dir, test_suites[selected], &test_stats,
-            interpret, verbose);
+            interpret, optimize_full, serialize, verbose);
     }
 
     if (all) {
         for (unsigned nr = 0; nr < test_suites.size(); nr++) {
             run_test_suite(backend, emitter,
                 input_dir, test_suites[nr], &test_stats,
-                interpret, verbose);
+                interpret, optimize_full, serialize, verbose);
         }
     }
 
@@ -834,7 +979,7 @@ int main(int argc, char **argv) {
         for (std::string const &test: tests) {
             run_test_suite(backend, emitter,
                 input_dir, test, &test_stats,
-                interpret, verbose);
+                interpret, optimize_full, serialize, verbose);
         }
     }
 
@@ -850,5 +995,30 @@ int main(int argc, char **argv) {
         test_stats.total_halted,
         test_stats.total_failed,
         test_stats.total_skipped);
+
+    ir_x86_64_stats_t x86_64_stats;
+    ir_x86_64_get_stats(&x86_64_stats);
+    fmt::print("  {} bytes of binary code, {} bytes saved\n",
+        x86_64_stats.nr_bytes, x86_64_stats.nr_bytes_saved);
+
+    ir_mips_fallback_stats_t fallback_stats[8];
+    size_t nr_fallbacks = ir_mips_get_fallback_stats(fallback_stats, 8);
+    for (size_t nr = 0; nr < nr_fallbacks; nr++) {
+        fmt::print("  {:<24} {:>8} interpreter fallbacks\n",
+            n64::assembly::cpu::disassemble(0, fallback_stats[nr].instr),
+            fallback_stats[nr].count);
+    }
+
+    if (optimize_full) {
+        ir_optimize_stats_t optimize_stats;
+        ir_optimize_get_stats(&optimize_stats);
+        for (unsigned nr = 0; nr < IR_OPTIMIZE_PASS_COUNT; nr++) {
+            fmt::print("  {:<6} {:>6} runs, {:>8} -> {:>8} instructions\n",
+                ir_optimize_pass_name((ir_optimize_pass_t)nr),
+                optimize_stats.nr_runs[nr],
+                optimize_stats.nr_instrs_before[nr],
+                optimize_stats.nr_instrs_after[nr]);
+        }
+    }
     return total_tests != test_stats.total_pass;
 }
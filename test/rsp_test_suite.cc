@@ -1,13 +1,23 @@
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <random>
+#include <vector>
 #include <toml++/toml.h>
 #include <fmt/format.h>
 #include <fmt/color.h>
 
+#include <r4300/hle.h>
+#include <r4300/hw.h>
+#include <r4300/rdp.h>
 #include <r4300/state.h>
 #include <debugger.h>
 #include <core.h>
+#include <interpreter/interpreter.h>
+#include <rsp_cache.h>
 
 using namespace std::string_view_literals;
 
@@ -42,6 +52,12 @@ void invalidate_recompiler_cache(uint64_t start_phys_address,
     (void)end_phys_address;
 }
 
+void lock_rsp(void) {
+}
+
+void unlock_rsp(void) {
+}
+
 }; /* namespace core */
 
 /* Define stubs for used, but unrequired machine features. */
@@ -81,6 +97,86 @@ void write_DPC_END_REG(u32 value) {
 
 }; /* namespace R4300 */
 
+/**
+ * RDP command interface recording the commands of the graphics tasks:
+ * the commands loaded through the DPC registers by the task microcode,
+ * and the commands generated by the high level emulation.
+ * The commands are consumed as soon as the DPC end register is written.
+ */
+class CaptureInterface : public R4300::rdp::DPCommandInterface {
+public:
+    CaptureInterface() : status(0), start(0), current(0), start_valid(false) {}
+    virtual ~CaptureInterface() {}
+
+    virtual void write_DPC_STATUS_REG(uint32_t value) {
+        if (value & DPC_STATUS_CLR_XBUS_DMEM_DMA) {
+            status &= ~DPC_STATUS_XBUS_DMEM_DMA;
+        }
+        if (value & DPC_STATUS_SET_XBUS_DMEM_DMA) {
+            status |= DPC_STATUS_XBUS_DMEM_DMA;
+        }
+    }
+
+    virtual void write_DPC_START_REG(uint32_t value) {
+        start = value & UINT32_C(0xfffff8);
+        start_valid = true;
+    }
+
+    virtual void write_DPC_END_REG(uint32_t value) {
+        u32 end = value & UINT32_C(0xfffff8);
+        if (start_valid) {
+            current = start;
+            start_valid = false;
+        }
+        for (; current < end; current += 8) {
+            u8 const *ptr = (status & DPC_STATUS_XBUS_DMEM_DMA) ?
+                &R4300::state.dmem[current & 0xff8] :
+                &R4300::state.dram[current % sizeof(R4300::state.dram)];
+            u64 command = 0;
+            for (unsigned i = 0; i < 8; i++) {
+                command = (command << 8) | ptr[i];
+            }
+            commands.push_back(command);
+        }
+    }
+
+    virtual uint32_t read_DPC_STATUS_REG() {
+        return status;
+    }
+
+    virtual uint32_t read_DPC_CURRENT_REG() {
+        return current;
+    }
+
+    virtual void exec_commands(u64 const *commands, size_t len) {
+        this->commands.insert(this->commands.end(), commands, commands + len);
+    }
+
+    void reset(void) {
+        commands.clear();
+        status = 0;
+        start = current = 0;
+        start_valid = false;
+    }
+
+    std::vector<u64> commands;
+
+private:
+    u32 status;
+    u32 start;
+    u32 current;
+    bool start_valid;
+};
+
+static CaptureInterface capture_interface;
+
+namespace R4300 {
+namespace rdp {
+
+DPCommandInterface *interface = &capture_interface;
+
+}; /* namespace rdp */
+}; /* namespace R4300 */
 
 int load_file(std::string filename, u8 *buffer, unsigned *size, bool exact) {
     FILE *fd = fopen(filename.c_str(), "r");
@@ -206,6 +302,9 @@ static void print_array_diff(uint8_t const *left_buffer,
     fmt::print("{} |{}\n", left, right);
 }
 
+/** Run the tests with the RSP recompiler instead of the interpreter. */
+static bool use_recompiler;
+
 struct test_statistics {
     unsigned total_pass;
     unsigned total_halted;
@@ -324,7 +423,11 @@ int run_test_suite(char const *test_suite_name, struct test_statistics *stats) {
 
         while ((R4300::state.hwreg.SP_STATUS_REG & SP_STATUS_BROKE) == 0 &&
                !core::halted()) {
-            R4300::RSP::step();
+            if (use_recompiler) {
+                rsp_cache::exec(1);
+            } else {
+                R4300::RSP::step();
+            }
         }
 
         if (core::halted()) {
@@ -408,7 +511,674 @@ char const *rsp_test_suites[] = {
     "vsucb",
 };
 
-int main(void) {
+/** Vector instructions with SIMD implementations, and their funct field. */
+static struct {
+    char const *name;
+    u32 funct;
+} simd_instrs[] = {
+    { "vmulf", 0x00 }, { "vmulu", 0x01 }, { "vmudl", 0x04 },
+    { "vmudm", 0x05 }, { "vmudn", 0x06 }, { "vmudh", 0x07 },
+    { "vmacf", 0x08 }, { "vmacu", 0x09 }, { "vmadl", 0x0c },
+    { "vmadm", 0x0d }, { "vmadn", 0x0e }, { "vmadh", 0x0f },
+    { "vadd",  0x10 }, { "vsub",  0x11 }, { "vabs",  0x13 },
+    { "vaddc", 0x14 }, { "vsubc", 0x15 }, { "vsar",  0x1d },
+    { "vlt",   0x20 }, { "veq",   0x21 }, { "vne",   0x22 },
+    { "vge",   0x23 }, { "vcl",   0x24 }, { "vch",   0x25 },
+    { "vcr",   0x26 }, { "vmrg",  0x27 }, { "vand",  0x28 },
+    { "vnand", 0x29 }, { "vor",   0x2a }, { "vnor",  0x2b },
+    { "vxor",  0x2c }, { "vnxor", 0x2d },
+};
+
+static char const *simd_level_names[] = {
+    "scalar", "sse2", "sse41", "avx2",
+};
+
+/** Generate a random vector element, biased towards the boundary values. */
+static u16 random_element(std::mt19937 &gen) {
+    static u16 const boundaries[] = {
+        0x0000, 0x0001, 0x7ffe, 0x7fff, 0x8000, 0x8001, 0xfffe, 0xffff,
+    };
+    u32 r = gen();
+    return (r & 0x3) == 0 ? boundaries[(r >> 2) & 0x7] : (u16)(r >> 16);
+}
+
+/** Fill the vector registers, accumulator and flags with random values. */
+static void randomize_vector_state(std::mt19937 &gen) {
+    for (unsigned nr = 0; nr < 32; nr++) {
+        for (unsigned i = 0; i < 8; i++) {
+            R4300::state.rspreg.vr[nr].h[i] = random_element(gen);
+        }
+    }
+    for (unsigned i = 0; i < 8; i++) {
+        R4300::state.rspreg.vacc.hi.h[i] = random_element(gen);
+        R4300::state.rspreg.vacc.md.h[i] = random_element(gen);
+        R4300::state.rspreg.vacc.lo.h[i] = random_element(gen);
+    }
+    R4300::state.rspreg.vco = gen();
+    R4300::state.rspreg.vcc = gen();
+    R4300::state.rspreg.vce = gen();
+}
+
+/** Compare the vector registers, accumulator and flags of two states. */
+static bool equal_vector_state(R4300::rspreg const &left,
+                               R4300::rspreg const &right) {
+    return memcmp(left.vr, right.vr, sizeof(left.vr)) == 0 &&
+        memcmp(&left.vacc, &right.vacc, sizeof(left.vacc)) == 0 &&
+        left.vco == right.vco &&
+        left.vcc == right.vcc &&
+        left.vce == right.vce;
+}
+
+/**
+ * Check the SIMD implementations of the vector instructions against the
+ * scalar implementations, for each instruction set supported by the host
+ * cpu. Each instruction is executed with random operands, element
+ * specifiers and register state.
+ */
+static void run_simd_comparison(struct test_statistics *stats) {
+    using namespace interpreter::rsp;
+    unsigned const nr_iterations = 2000;
+    simd_level const max_level = detect_simd_level();
+    simd_level const saved_level = get_simd_level();
+    R4300::rspreg const saved_state = R4300::state.rspreg;
+
+    for (simd_level level = simd_level::sse2; level <= max_level;
+         level = (simd_level)((int)level + 1)) {
+        for (auto const &instr_desc : simd_instrs) {
+            fmt::print("{:>6}:{:<6} ... ",
+                instr_desc.name, simd_level_names[(int)level]);
+            if (get_simd_callback(level, instr_desc.funct) == NULL) {
+                fmt::print(fmt::fg(fmt::color::gray), "SKIPPED\n");
+                stats->total_skipped++;
+                continue;
+            }
+
+            std::mt19937 gen(instr_desc.funct);
+            bool failed = false;
+            for (unsigned nr = 0; !failed && nr < nr_iterations; nr++) {
+                u32 instr = UINT32_C(0x4a000000) | (gen() & UINT32_C(0x1ffffc0)) |
+                            instr_desc.funct;
+                randomize_vector_state(gen);
+                R4300::rspreg const input = R4300::state.rspreg;
+
+                set_simd_level(simd_level::scalar);
+                decode_COP2(instr)(instr);
+                R4300::rspreg const expected = R4300::state.rspreg;
+
+                R4300::state.rspreg = input;
+                set_simd_level(level);
+                decode_COP2(instr)(instr);
+
+                if (!equal_vector_state(expected, R4300::state.rspreg)) {
+                    fmt::print(fmt::fg(fmt::color::tomato),
+                        "FAILED ({:08x})\n", instr);
+                    failed = true;
+                }
+            }
+            if (failed) {
+                stats->total_failed++;
+            } else {
+                fmt::print(fmt::fg(fmt::color::chartreuse), "PASS\n");
+                stats->total_pass++;
+            }
+        }
+    }
+
+    set_simd_level(saved_level);
+    R4300::state.rspreg = saved_state;
+}
+
+/** Load a task captured with the option --capture-tasks. */
+static bool load_task(std::string const &filename, u32 *pc) {
+    FILE *fd = fopen(filename.c_str(), "r");
+    if (fd == NULL) {
+        return false;
+    }
+    bool loaded =
+        fread(R4300::state.dram, 1, sizeof(R4300::state.dram), fd) ==
+            sizeof(R4300::state.dram) &&
+        fread(R4300::state.dmem, 1, sizeof(R4300::state.dmem), fd) ==
+            sizeof(R4300::state.dmem) &&
+        fread(R4300::state.imem, 1, sizeof(R4300::state.imem), fd) ==
+            sizeof(R4300::state.imem) &&
+        fread(pc, 1, sizeof(*pc), fd) == sizeof(*pc);
+    fclose(fd);
+    return loaded;
+}
+
+/**
+ * Low level emulation of a task: run the task microcode from \p pc until
+ * it halts. The break interrupt is left disabled.
+ * @return true if the microcode halted.
+ */
+static bool run_task_microcode(u32 pc) {
+    unsigned const max_steps = 1u << 26;
+    R4300::state.rspreg = (R4300::rspreg){};
+    R4300::state.rspreg.pc = pc;
+    R4300::state.rsp.nextAction = R4300::State::Action::Jump;
+    R4300::state.rsp.nextPc = pc;
+    R4300::state.hwreg.SP_STATUS_REG = 0;
+    core::resume();
+    for (unsigned nr = 0; nr < max_steps &&
+         (R4300::state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) == 0 &&
+         !core::halted(); nr++) {
+        if (use_recompiler) {
+            rsp_cache::exec(1);
+        } else {
+            R4300::RSP::step();
+        }
+    }
+    return (R4300::state.hwreg.SP_STATUS_REG & SP_STATUS_HALT) != 0;
+}
+
+/**
+ * Compare the high level emulation of captured audio tasks against the
+ * execution of the task microcode. The DRAM ranges written with audio
+ * samples by the high level emulation must be identical.
+ */
+static void run_audio_comparison(std::vector<std::string> const &filenames,
+                                 struct test_statistics *stats) {
+    std::vector<u8> expected(sizeof(R4300::state.dram));
+
+    for (std::string const &filename : filenames) {
+        u32 pc;
+        fmt::print("{} ... ", filename);
+        if (!load_task(filename, &pc)) {
+            fmt::print(fmt::fg(fmt::color::gray), "SKIPPED (cannot load)\n");
+            stats->total_skipped++;
+            continue;
+        }
+
+        if (!run_task_microcode(pc)) {
+            fmt::print(fmt::fg(fmt::color::orange), "HALTED\n");
+            stats->total_halted++;
+            continue;
+        }
+        memcpy(expected.data(), R4300::state.dram, expected.size());
+
+        /* High level emulation. */
+        load_task(filename, &pc);
+        u32 data = R4300::hle::load_task_word(OSTASK_UCODE_DATA) &
+            (sizeof(R4300::state.dram) - 1);
+        u32 data_size = std::min<u32>(
+            R4300::hle::load_task_word(OSTASK_UCODE_DATA_SIZE),
+            sizeof(R4300::state.dram) - data);
+        std::vector<R4300::hle::dram_range> outputs;
+        u32 lut_offset;
+        if (!R4300::hle::identify_audio_ucode(R4300::state.dram + data,
+                data_size, &lut_offset) ||
+            !R4300::hle::exec_audio_task(lut_offset, &outputs)) {
+            fmt::print(fmt::fg(fmt::color::gray), "SKIPPED (unsupported)\n");
+            stats->total_skipped++;
+            continue;
+        }
+
+        bool failed = false;
+        for (R4300::hle::dram_range const &range : outputs) {
+            u32 length = std::min<u32>(range.length,
+                sizeof(R4300::state.dram) - range.address);
+            if (memcmp(expected.data() + range.address,
+                       R4300::state.dram + range.address, length) != 0) {
+                if (!failed) {
+                    fmt::print(fmt::fg(fmt::color::tomato), "FAILED\n");
+                }
+                fmt::print("output {:08x}+{:x}, expected | HLE:\n",
+                    range.address, length);
+                print_array_diff(expected.data() + range.address,
+                    R4300::state.dram + range.address, length);
+                failed = true;
+            }
+        }
+        if (failed) {
+            stats->total_failed++;
+        } else {
+            fmt::print(fmt::fg(fmt::color::chartreuse), "PASS\n");
+            stats->total_pass++;
+        }
+    }
+}
+
+/** Size of the coverage grid used to compare the triangles of the
+ * graphics tasks, in pixels. */
+#define COVERAGE_SIZE       1024
+
+/** Relative difference of triangle coverage accepted between the high
+ * and low level emulations of a graphics task. */
+#define COVERAGE_TOLERANCE  0.02
+
+/** Return the length in double words of the RDP command \p command. */
+static unsigned rdp_command_length(u64 command) {
+    unsigned op = (command >> 56) & 0x3f;
+    if (op >= 0x08 && op <= 0x0f) {
+        return 4 + ((op & 0x4) ? 8 : 0) + ((op & 0x2) ? 8 : 0) +
+                   ((op & 0x1) ? 2 : 0);
+    }
+    return (op == 0x24 || op == 0x25) ? 2 : 1;
+}
+
+/** Check whether the RDP command \p command is a triangle command. */
+static bool is_triangle_command(u64 command) {
+    unsigned op = (command >> 56) & 0x3f;
+    return op >= 0x08 && op <= 0x0f;
+}
+
+/** Decode an s11.2 triangle Y coordinate. */
+static double triangle_y(u64 value) {
+    return (i16)((value & 0x3fff) << 2) / 16.;
+}
+
+/** Decode an s15.16 triangle edge coefficient. */
+static double triangle_edge(u64 value) {
+    return (i32)value / 65536.;
+}
+
+/**
+ * Add \p weight to the coverage of the pixels whose center is inside
+ * the triangle \p triangle, following the edge walking of the RDP: the
+ * major edge H and the first minor edge M start at the scanline
+ * containing YH, the second minor edge L starts at YM.
+ * @return the number of covered pixels.
+ */
+static u64 rasterize_triangle(u64 const *triangle, std::vector<i32> &coverage,
+                               i32 weight) {
+    double yl = triangle_y(triangle[0] >> 32);
+    double ym = triangle_y(triangle[0] >> 16);
+    double yh = triangle_y(triangle[0]);
+    double xl = triangle_edge(triangle[1] >> 32);
+    double dxldy = triangle_edge(triangle[1]);
+    double xh = triangle_edge(triangle[2] >> 32);
+    double dxhdy = triangle_edge(triangle[2]);
+    double xm = triangle_edge(triangle[3] >> 32);
+    double dxmdy = triangle_edge(triangle[3]);
+    double ytop = std::floor(yh);
+    u64 pixels = 0;
+
+    int ystart = std::max(0, (int)ytop);
+    int yend = std::min(COVERAGE_SIZE, (int)std::ceil(yl));
+    for (int y = ystart; y < yend; y++) {
+        double ys = y + 0.5;
+        if (ys < yh || ys >= yl) {
+            continue;
+        }
+        double xa = xh + dxhdy * (ys - ytop);
+        double xb = ys < ym ? xm + dxmdy * (ys - ytop) :
+                              xl + dxldy * (ys - ym);
+        int xstart = std::max(0., std::ceil(std::min(xa, xb) - 0.5));
+        int xend = std::min((double)COVERAGE_SIZE,
+                            std::ceil(std::max(xa, xb) - 0.5));
+        for (int x = xstart; x < xend; x++) {
+            coverage[y * COVERAGE_SIZE + x] += weight;
+            pixels++;
+        }
+    }
+    return pixels;
+}
+
+/**
+ * Compare the RDP command streams \p expected and \p actual.
+ * The commands other than triangles must be identical and in the same
+ * order. The triangles may be clipped and rounded differently, and are
+ * compared by their pixel coverage.
+ * @return true if the streams match.
+ */
+static bool compare_rdp_commands(std::vector<u64> const &expected,
+                                 std::vector<u64> const &actual) {
+    std::vector<i32> coverage(COVERAGE_SIZE * COVERAGE_SIZE, 0);
+    size_t expected_pos = 0, actual_pos = 0;
+    u64 expected_pixels = 0;
+
+    for (;;) {
+        while (expected_pos + 4 <= expected.size() &&
+               is_triangle_command(expected[expected_pos])) {
+            expected_pixels +=
+                rasterize_triangle(&expected[expected_pos], coverage, 1);
+            expected_pos += rdp_command_length(expected[expected_pos]);
+        }
+        while (actual_pos + 4 <= actual.size() &&
+               is_triangle_command(actual[actual_pos])) {
+            rasterize_triangle(&actual[actual_pos], coverage, -1);
+            actual_pos += rdp_command_length(actual[actual_pos]);
+        }
+        if (expected_pos >= expected.size() || actual_pos >= actual.size()) {
+            break;
+        }
+        unsigned length = rdp_command_length(expected[expected_pos]);
+        if (expected_pos + length > expected.size() ||
+            actual_pos + length > actual.size() ||
+            !std::equal(&expected[expected_pos],
+                        &expected[expected_pos] + length,
+                        &actual[actual_pos])) {
+            fmt::print(fmt::fg(fmt::color::tomato), "FAILED\n");
+            fmt::print("command #{}, expected | HLE: {:016x} | {:016x}\n",
+                expected_pos, expected[expected_pos], actual[actual_pos]);
+            return false;
+        }
+        expected_pos += length;
+        actual_pos += length;
+    }
+
+    if (expected_pos < expected.size() || actual_pos < actual.size()) {
+        fmt::print(fmt::fg(fmt::color::tomato), "FAILED\n");
+        fmt::print("command count, expected | HLE: {} | {}\n",
+            expected.size(), actual.size());
+        return false;
+    }
+
+    u64 mismatched_pixels = 0;
+    for (i32 value : coverage) {
+        mismatched_pixels += std::abs(value);
+    }
+    if (mismatched_pixels > COVERAGE_TOLERANCE * expected_pixels) {
+        fmt::print(fmt::fg(fmt::color::tomato), "FAILED\n");
+        fmt::print("triangle coverage: {} of {} pixels mismatched\n",
+            mismatched_pixels, expected_pixels);
+        return false;
+    }
+    return true;
+}
+
+/** Store a big endian word to DRAM, for building display lists. */
+static void store_dram_u32(u32 address, u32 value) {
+    u8 *ptr = &R4300::state.dram[address];
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+}
+
+/** Store a big endian half word to DRAM, for building display lists. */
+static void store_dram_u16(u32 address, u16 value) {
+    R4300::state.dram[address] = value >> 8;
+    R4300::state.dram[address + 1] = value;
+}
+
+/** Append the display list command \p w0, \p w1 at \p *dl. */
+static void store_gfx_command(u32 *dl, u32 w0, u32 w1) {
+    store_dram_u32(*dl, w0);
+    store_dram_u32(*dl + 4, w1);
+    *dl += 8;
+}
+
+/** Run the high level emulation of the F3DEX display list at \p dl. */
+static R4300::hle::gfx_status exec_gfx_display_list(u32 dl) {
+    u8 *ptr = &R4300::state.dmem[OSTASK_ADDRESS + OSTASK_DATA_PTR];
+    ptr[0] = dl >> 24;
+    ptr[1] = dl >> 16;
+    ptr[2] = dl >> 8;
+    ptr[3] = dl;
+    capture_interface.reset();
+    return R4300::hle::exec_gfx_task(R4300::hle::GFX_UCODE_F3DEX);
+}
+
+static void print_check_result(bool pass, struct test_statistics *stats) {
+    if (pass) {
+        fmt::print(fmt::fg(fmt::color::chartreuse), "PASS\n");
+        stats->total_pass++;
+    } else {
+        fmt::print(fmt::fg(fmt::color::tomato), "FAILED\n");
+        stats->total_failed++;
+    }
+}
+
+/**
+ * Check the identification of the graphics microcodes from the
+ * identification string of their data segment.
+ */
+static void check_identify_gfx_ucode(struct test_statistics *stats) {
+    static struct {
+        char const *name;
+        char const *signature;
+        bool supported;
+        R4300::hle::gfx_ucode ucode;
+    } const signatures[] = {
+        { "Fast3D 2.0D",
+          "RSP SW Version: 2.0D, 04-01-96",
+          true, R4300::hle::GFX_UCODE_F3D },
+        { "F3DEX 1.23",
+          "RSP Gfx ucode F3DEX       fifo 1.23 Yoshitaka Yasumoto 1998 Nintendo.",
+          true, R4300::hle::GFX_UCODE_F3DEX },
+        { "F3DLX 1.21",
+          "RSP Gfx ucode F3DLX.Rej   fifo 1.21 Yoshitaka Yasumoto 1996 Nintendo.",
+          true, R4300::hle::GFX_UCODE_F3DEX },
+        { "F3DEX 2.08",
+          "RSP Gfx ucode F3DEX       fifo 2.08 Yoshitaka Yasumoto 1999 Nintendo.",
+          false, R4300::hle::GFX_UCODE_F3DEX },
+        { "S2DEX 1.05",
+          "RSP Gfx ucode S2DEX  fifo 1.05  Yoshitaka Yasumoto 1998 Nintendo.",
+          false, R4300::hle::GFX_UCODE_F3DEX },
+    };
+
+    for (auto const &signature : signatures) {
+        /* The signature is preceded by unrelated microcode data. */
+        std::vector<u8> data(0x100, 0xa5);
+        data.insert(data.end(), signature.signature,
+            signature.signature + strlen(signature.signature));
+        data.resize(data.size() + 0x40, 0);
+
+        R4300::hle::gfx_ucode ucode;
+        bool supported = R4300::hle::identify_gfx_ucode(
+            data.data(), data.size(), &ucode);
+        fmt::print("identify_gfx_ucode {} ... ", signature.name);
+        print_check_result(supported == signature.supported &&
+            (!supported || ucode == signature.ucode), stats);
+    }
+}
+
+/**
+ * Check the triangle commands generated for a display list with a visible,
+ * a culled and a clipped triangle. The projection matrix scales the
+ * vertex coordinates by 1/64, and the default viewport maps the clip
+ * coordinates [-1,1] to the screen coordinates [0,320]x[240,0]:
+ * the vertices (-32,-32), (32,-32), (32,32) are projected exactly
+ * to (80,180), (240,180), (240,60).
+ */
+static void check_gfx_triangles(struct test_statistics *stats) {
+    u32 const mtx = 0x1000, vtx = 0x2000;
+    u32 dl = 0x3000;
+
+    memset(R4300::state.dram, 0, 0x4000);
+    for (unsigned i = 0; i < 4; i++) {
+        u32 value = i == 3 ? 0x10000 : 0x400;
+        store_dram_u16(mtx + 10 * i, value >> 16);
+        store_dram_u16(mtx + 32 + 10 * i, value);
+    }
+    static i16 const coords[4][2] = {
+        { -32, -32 }, { 32, -32 }, { 32, 32 }, { 192, 32 },
+    };
+    for (unsigned i = 0; i < 4; i++) {
+        store_dram_u16(vtx + 16 * i, coords[i][0]);
+        store_dram_u16(vtx + 16 * i + 2, coords[i][1]);
+        store_dram_u32(vtx + 16 * i + 12, 0xffffffff);
+    }
+
+    u32 const start = dl;
+    store_gfx_command(&dl, 0x01030000, mtx);        /* G_MTX projection load */
+    store_gfx_command(&dl, 0xb7000000, 0x00002204); /* G_SETGEOMETRYMODE */
+    store_gfx_command(&dl, 0x04000000 | (4 << 10) | 64, vtx); /* G_VTX */
+    store_gfx_command(&dl, 0xbf000000, 0x00000204); /* G_TRI1 visible */
+    store_gfx_command(&dl, 0xbf000000, 0x00000402); /* G_TRI1 back face */
+    store_gfx_command(&dl, 0xbf000000, 0x00000206); /* G_TRI1 clipped */
+    store_gfx_command(&dl, 0xe9000000, 0);          /* G_RDPFULLSYNC */
+    store_gfx_command(&dl, 0xb8000000, 0);          /* G_ENDDL */
+
+    fmt::print("exec_gfx_task triangle edges ... ");
+    if (exec_gfx_display_list(start) != R4300::hle::GFX_TASK_COMPLETE) {
+        print_check_result(false, stats);
+        return;
+    }
+
+    std::vector<u64> const &commands = capture_interface.commands;
+    unsigned nr_triangles = 0;
+    size_t pos = 0;
+    for (; pos < commands.size() && is_triangle_command(commands[pos]);
+         pos += rdp_command_length(commands[pos])) {
+        nr_triangles++;
+    }
+    bool pass =
+        nr_triangles == 3 &&
+        pos + 1 == commands.size() &&
+        commands[pos] == UINT64_C(0xe900000000000000);
+    if (pass) {
+        /* Shaded triangle, left major edge. */
+        u64 const *tri = &commands[0];
+        double const eps = 1. / 256.;
+        pass = ((tri[0] >> 56) & 0x3f) == 0x0c &&
+            ((tri[0] >> 55) & 1) == 0 &&
+            triangle_y(tri[0] >> 32) == 180. &&
+            triangle_y(tri[0] >> 16) == 180. &&
+            triangle_y(tri[0]) == 60. &&
+            std::abs(triangle_edge(tri[1] >> 32) - 80.) < eps &&
+            std::abs(triangle_edge(tri[1])) < eps &&
+            std::abs(triangle_edge(tri[2] >> 32) - 240.) < eps &&
+            std::abs(triangle_edge(tri[2])) < eps &&
+            std::abs(triangle_edge(tri[3] >> 32) - 240.) < eps &&
+            std::abs(triangle_edge(tri[3]) + 4. / 3.) < eps;
+    }
+    print_check_result(pass, stats);
+}
+
+/**
+ * Check that a display list switching microcode, in a called display list
+ * behind a conditional branch, is left to the task microcode.
+ */
+static void check_gfx_ucode_switch(struct test_statistics *stats) {
+    u32 dl = 0x5000;
+    store_gfx_command(&dl, 0xb4000000, 0x06005100); /* G_RDPHALF_1 */
+    store_gfx_command(&dl, 0xb0000000, 0);          /* G_BRANCH_Z */
+    store_gfx_command(&dl, 0xb8000000, 0);          /* G_ENDDL */
+    dl = 0x5100;
+    store_gfx_command(&dl, 0xaf000000, 0);          /* G_LOAD_UCODE */
+    store_gfx_command(&dl, 0xb8000000, 0);          /* G_ENDDL */
+    dl = 0x4000;
+    store_gfx_command(&dl, 0xbc000406, 0);          /* G_MW_SEGMENT 6 */
+    store_gfx_command(&dl, 0x06000000, 0x06005000); /* G_DL */
+    store_gfx_command(&dl, 0xe9000000, 0);          /* G_RDPFULLSYNC */
+    store_gfx_command(&dl, 0xb8000000, 0);          /* G_ENDDL */
+
+    fmt::print("exec_gfx_task microcode switch ... ");
+    print_check_result(
+        exec_gfx_display_list(0x4000) == R4300::hle::GFX_TASK_SWITCHED &&
+        capture_interface.commands.empty(), stats);
+}
+
+/**
+ * Compare the high level emulation of captured graphics tasks against the
+ * execution of the task microcode. The RDP commands sent by both must
+ * match, as checked by \ref compare_rdp_commands.
+ */
+static void run_gfx_comparison(std::vector<std::string> const &filenames,
+                               struct test_statistics *stats) {
+    check_identify_gfx_ucode(stats);
+    check_gfx_triangles(stats);
+    check_gfx_ucode_switch(stats);
+
+    for (std::string const &filename : filenames) {
+        u32 pc;
+        fmt::print("{} ... ", filename);
+        if (!load_task(filename, &pc)) {
+            fmt::print(fmt::fg(fmt::color::gray), "SKIPPED (cannot load)\n");
+            stats->total_skipped++;
+            continue;
+        }
+
+        /* Low level emulation. */
+        capture_interface.reset();
+        if (!run_task_microcode(pc)) {
+            fmt::print(fmt::fg(fmt::color::orange), "HALTED\n");
+            stats->total_halted++;
+            continue;
+        }
+        std::vector<u64> expected = capture_interface.commands;
+
+        /* High level emulation. */
+        load_task(filename, &pc);
+        capture_interface.reset();
+        u32 data = R4300::hle::load_task_word(OSTASK_UCODE_DATA) &
+            (sizeof(R4300::state.dram) - 1);
+        u32 data_size = std::min<u32>(
+            R4300::hle::load_task_word(OSTASK_UCODE_DATA_SIZE),
+            sizeof(R4300::state.dram) - data);
+        R4300::hle::gfx_ucode ucode;
+        if (!R4300::hle::identify_gfx_ucode(R4300::state.dram + data,
+                data_size, &ucode) ||
+            R4300::hle::exec_gfx_task(ucode) !=
+                R4300::hle::GFX_TASK_COMPLETE) {
+            fmt::print(fmt::fg(fmt::color::gray), "SKIPPED (unsupported)\n");
+            stats->total_skipped++;
+            continue;
+        }
+
+        if (compare_rdp_commands(expected, capture_interface.commands)) {
+            fmt::print(fmt::fg(fmt::color::chartreuse), "PASS\n");
+            stats->total_pass++;
+        } else {
+            stats->total_failed++;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool compare_simd = false;
+    bool compare_audio = false;
+    bool compare_gfx = false;
+    std::vector<std::string> tasks;
+    for (int nr = 1; nr < argc; nr++) {
+        std::string arg = argv[nr];
+        if (arg == "-r" || arg == "--recompiler") {
+            use_recompiler = true;
+        } else if (arg == "-c" || arg == "--compare-simd") {
+            compare_simd = true;
+        } else if (arg == "-a" || arg == "--compare-audio") {
+            compare_audio = true;
+            tasks.assign(argv + nr + 1, argv + argc);
+            break;
+        } else if (arg == "-g" || arg == "--compare-gfx") {
+            compare_gfx = true;
+            tasks.assign(argv + nr + 1, argv + argc);
+            break;
+        } else {
+            fmt::print(stderr,
+                "usage: {} [-r|--recompiler] [-c|--compare-simd] "
+                "[-a|--compare-audio TASK...] [-g|--compare-gfx [TASK...]]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+
+    if (compare_audio || compare_gfx) {
+        struct test_statistics test_stats = {};
+        if (compare_audio) {
+            run_audio_comparison(tasks, &test_stats);
+        } else {
+            run_gfx_comparison(tasks, &test_stats);
+        }
+        fmt::print(fmt::emphasis::bold,
+            "{} tests run; PASS:{} HALTED:{} FAILED:{} SKIPPED:{}\n",
+            test_stats.total_pass +
+            test_stats.total_halted +
+            test_stats.total_failed +
+            test_stats.total_skipped,
+            test_stats.total_pass,
+            test_stats.total_halted,
+            test_stats.total_failed,
+            test_stats.total_skipped);
+        return test_stats.total_failed != 0;
+    }
+
+    if (compare_simd) {
+        struct test_statistics test_stats = {};
+        run_simd_comparison(&test_stats);
+        fmt::print(fmt::emphasis::bold,
+            "{} tests run; PASS:{} FAILED:{} SKIPPED:{}\n",
+            test_stats.total_pass +
+            test_stats.total_failed +
+            test_stats.total_skipped,
+            test_stats.total_pass,
+            test_stats.total_failed,
+            test_stats.total_skipped);
+        return test_stats.total_failed != 0;
+    }
+
     struct test_statistics test_stats = {};
     unsigned nr_test_suites =
         sizeof(rsp_test_suites) / sizeof(rsp_test_suites[0]);